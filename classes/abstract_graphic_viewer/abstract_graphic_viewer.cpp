@@ -3,6 +3,13 @@
 //
 
 #include "abstract_graphic_viewer.h"
+#include <QStyleOptionGraphicsItem>
+#include <QAbstractGraphicsShapeItem>
+
+// keys of the per item data used by the LOD policy
+static constexpr int LOD_POLICY_KEY = 0x4c4f4400;
+static constexpr int LOD_STATE_KEY = 0x4c4f4401;   // true while hidden or simplified by the policy
+static constexpr int LOD_PEN_KEY = 0x4c4f4402;     // original pen of simplified items
 AbstractGraphicViewer::AbstractGraphicViewer(QWidget *parent, QRectF dim_, bool draw_axis)
 {
     QVBoxLayout *vlayout = new QVBoxLayout(parent);
@@ -20,6 +27,15 @@ AbstractGraphicViewer::AbstractGraphicViewer(QWidget *parent, QRectF dim_, bool
     this->setMouseTracking(true);
     this->fitInView(scene.sceneRect(), Qt::KeepAspectRatio);
     this->viewport()->setMouseTracking(true);
+    connect(&frame_timer, &QTimer::timeout, this, [this]()
+        {
+            if (frame_dirty)
+            {
+                frame_dirty = false;
+                this->viewport()->update();
+            }
+        });
+    connect(&scene, &QGraphicsScene::changed, this, [this](){ frame_dirty = true; });
 
     // axis
     if(draw_axis)
@@ -76,11 +92,18 @@ void AbstractGraphicViewer::wheelEvent(QWheelEvent *event)
     this->scale(factor, factor);
     auto delta = this->mapToScene(view_pos.toPoint()) - this->mapToScene(this->viewport()->rect().center());
     this->centerOn(scene_pos - delta);
+    frame_dirty = true;
+    update_lod();
 }
 void AbstractGraphicViewer::resizeEvent(QResizeEvent *e)
 {
     QGraphicsView::resizeEvent(e);
 }
+void AbstractGraphicViewer::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    frame_dirty = true;
+}
 void AbstractGraphicViewer::mouseMoveEvent(QMouseEvent *event)
 {
     if (_pan)
@@ -125,4 +148,97 @@ void AbstractGraphicViewer::mouseReleaseEvent(QMouseEvent *event)
         event->accept();
     }
     QGraphicsView::mouseReleaseEvent(event);
-}
\ No newline at end of file
+}
+////////////////////////////////////////////////////////////////////////////////////////////
+void AbstractGraphicViewer::set_lod_policy(QGraphicsItem *item, LOD policy)
+{
+    if (item == nullptr) return;
+    // undo the current policy before replacing it
+    if (item->data(LOD_STATE_KEY).toBool())
+    {
+        item->setData(LOD_POLICY_KEY, QVariant());
+        apply_lod(item, 0);
+    }
+    if (policy == LOD::None)
+        item->setData(LOD_POLICY_KEY, QVariant());
+    else
+    {
+        item->setData(LOD_POLICY_KEY, static_cast<int>(policy));
+        apply_lod(item, QStyleOptionGraphicsItem::levelOfDetailFromTransform(transform()));
+    }
+}
+void AbstractGraphicViewer::set_lod_threshold(float pixels)
+{
+    lod_min_pixels = pixels;
+    lod_scale = 0;
+    update_lod();
+}
+void AbstractGraphicViewer::update_lod()
+{
+    const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(transform());
+    if (scale == lod_scale) return;
+    lod_scale = scale;
+    for (auto item : scene.items())
+        if (item->data(LOD_POLICY_KEY).isValid())
+            apply_lod(item, scale);
+}
+void AbstractGraphicViewer::apply_lod(QGraphicsItem *item, qreal scale)
+{
+    const auto policy = static_cast<LOD>(item->data(LOD_POLICY_KEY).toInt());
+    const bool reduced = item->data(LOD_STATE_KEY).toBool();
+    const auto rect = item->sceneBoundingRect();
+    const qreal pixels = std::max(rect.width(), rect.height()) * scale;
+    // a little hysteresis so that items whose bounding rect shrinks when simplified do not flicker
+    const bool small = policy != LOD::None and pixels < (reduced ? 1.25 * lod_min_pixels : lod_min_pixels);
+    if (small == reduced) return;
+
+    auto shape = dynamic_cast<QAbstractGraphicsShapeItem*>(item);
+    auto line = qgraphicsitem_cast<QGraphicsLineItem*>(item);
+    if (small)
+    {
+        if (policy == LOD::Hide)
+            item->hide();
+        else if (shape != nullptr or line != nullptr)
+        {
+            QPen pen = shape != nullptr ? shape->pen() : line->pen();
+            item->setData(LOD_PEN_KEY, pen);
+            pen.setWidth(0);
+            pen.setCosmetic(true);
+            if (shape != nullptr) shape->setPen(pen); else line->setPen(pen);
+        }
+        else
+            return;   // nothing to simplify
+    }
+    else if (item->data(LOD_PEN_KEY).isValid())
+    {
+        const QPen pen = item->data(LOD_PEN_KEY).value<QPen>();
+        if (shape != nullptr) shape->setPen(pen); else if (line != nullptr) line->setPen(pen);
+        item->setData(LOD_PEN_KEY, QVariant());
+    }
+    else
+        item->show();
+    item->setData(LOD_STATE_KEY, small);
+}
+void AbstractGraphicViewer::set_item_index_method(QGraphicsScene::ItemIndexMethod method, int bsp_depth)
+{
+    scene.setItemIndexMethod(method);
+    if (method == QGraphicsScene::BspTreeIndex)
+        scene.setBspTreeDepth(bsp_depth);
+}
+void AbstractGraphicViewer::set_batched_updates(bool enable, int fps)
+{
+    if (enable)
+    {
+        if (not frame_timer.isActive())
+            unbatched_update_mode = viewportUpdateMode();
+        this->setViewportUpdateMode(QGraphicsView::NoViewportUpdate);
+        frame_timer.start(1000 / std::max(fps, 1));
+        frame_dirty = true;
+    }
+    else if (frame_timer.isActive())
+    {
+        frame_timer.stop();
+        this->setViewportUpdateMode(unbatched_update_mode);
+        this->viewport()->update();
+    }
+}
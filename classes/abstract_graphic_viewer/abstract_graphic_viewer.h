@@ -15,6 +15,7 @@
 #include <QApplication>
 #include <QVBoxLayout>
 #include <QGraphicsPolygonItem>
+#include <QTimer>
 #include <iostream>
 
 
@@ -38,6 +39,23 @@ class AbstractGraphicViewer : public QGraphicsView
         QGraphicsPolygonItem* robot_poly();
         QGraphicsEllipseItem* laser_in_robot();
 
+        // Level of detail: items with a policy are hidden, or drawn with a 1 pixel cosmetic pen, while
+        // their on-screen size is below the threshold. Re-evaluated on zoom, not on every frame.
+        enum class LOD { None, Hide, Simplify };
+        void set_lod_policy(QGraphicsItem *item, LOD policy);
+        void set_lod_threshold(float pixels);
+        float lod_threshold() const { return lod_min_pixels; }
+        void update_lod();
+
+        // NoIndex (default) suits scenes where most items move every frame; BspTreeIndex speeds up
+        // picking and culling of big static maps. depth 0 lets Qt choose it.
+        void set_item_index_method(QGraphicsScene::ItemIndexMethod method, int bsp_depth = 0);
+
+        // Batched updates: item changes (e.g. laser polygons set at sensor rate) only mark the view
+        // dirty and the viewport is repainted once per frame at the given rate.
+        void set_batched_updates(bool enable, int fps = 30);
+        bool batched_updates() const { return frame_timer.isActive(); }
+
 signals:
       void new_mouse_coordinates(QPointF);
       void right_click(QPointF);
@@ -45,6 +63,13 @@ signals:
     protected:
         bool _pan = false;
         int _panStartX, _panStartY;
+        float lod_min_pixels = 3.f;
+        qreal lod_scale = 0;
+        QTimer frame_timer;
+        bool frame_dirty = false;
+        QGraphicsView::ViewportUpdateMode unbatched_update_mode = QGraphicsView::BoundingRectViewportUpdate;
+        void apply_lod(QGraphicsItem *item, qreal scale);
+        virtual void scrollContentsBy(int dx, int dy);
         virtual void wheelEvent(QWheelEvent *event);
         virtual void resizeEvent(QResizeEvent *e);
         virtual void mouseMoveEvent(QMouseEvent *event);
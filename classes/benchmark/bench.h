@@ -0,0 +1,113 @@
+//
+// Minimal benchmark harness of robocomp_core_bench.
+//
+// A suite is a function that receives the Runner and calls run() for each scenario. run() times the callable
+// repeatedly (after one warm up call) until it has at least min_samples samples and min_time seconds, and
+// record() stores samples measured by the scenario itself, such as per task latencies. Scenarios are named
+// "suite/name" plus a list of numeric parameters, so results of different runs can be matched and compared.
+//
+//      static void my_suite(bench::Runner &r)
+//      {
+//          std::vector<float> v(1 << 20);
+//          r.run("my", "fill", {{"n", v.size()}}, v.size(), [&]{ std::fill(v.begin(), v.end(), 1.f); });
+//      }
+//      ROBOCOMP_BENCH_SUITE(my, my_suite);
+//
+// The inputs must be deterministic: fixed seeds and sizes, so that two runs measure the same work.
+//
+#ifndef ROBOCOMP_BENCH_H
+#define ROBOCOMP_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+using Params = std::vector<std::pair<std::string, double>>;
+
+struct Result
+{
+    std::string suite, name;
+    Params params;
+    double items = 1;                       // work units per sample, for the throughput
+    std::vector<double> samples_ns;
+    double mean = 0, median = 0, p90 = 0, p99 = 0, min = 0, max = 0, stddev = 0;
+
+    void compute();
+    double items_per_second() const { return median > 0 ? items * 1e9 / median : 0; }
+};
+
+class Runner
+{
+public:
+    struct Options
+    {
+        double min_time = 0.2;              // seconds per scenario
+        std::size_t min_samples = 5;
+        std::size_t max_samples = 10000;
+        std::string filter;                 // substring of "suite/name", empty runs everything
+        bool quick = false;                 // smaller problem sizes, for smoke tests
+    };
+
+    explicit Runner(const Options &options) : options(options) {}
+
+    bool quick() const { return options.quick; }
+    bool enabled(const std::string &suite, const std::string &name) const
+    {
+        return options.filter.empty() || (suite + "/" + name).find(options.filter) != std::string::npos;
+    }
+
+    template <typename Function>
+    void run(const std::string &suite, const std::string &name, Params params, double items, Function &&fn)
+    {
+        if (!enabled(suite, name))
+            return;
+        using clock = std::chrono::steady_clock;
+        fn();
+        std::vector<double> samples;
+        const auto start = clock::now();
+        while (samples.size() < options.max_samples &&
+               (samples.size() < options.min_samples || std::chrono::duration<double>(clock::now() - start).count() < options.min_time))
+        {
+            const auto t0 = clock::now();
+            fn();
+            samples.push_back(std::chrono::duration<double, std::nano>(clock::now() - t0).count());
+        }
+        record(suite, name, std::move(params), std::move(samples), items);
+    }
+
+    void record(const std::string &suite, const std::string &name, Params params, std::vector<double> samples_ns, double items = 1);
+
+    const std::vector<Result> &results() const { return all; }
+    void write_text(std::ostream &os) const;
+    void write_csv(std::ostream &os) const;
+    void write_json(std::ostream &os) const;
+
+private:
+    Options options;
+    std::vector<Result> all;
+};
+
+using Suite = std::function<void(Runner &)>;
+std::vector<std::pair<std::string, Suite>> &suites();
+inline int add_suite(const std::string &name, Suite suite)
+{
+    suites().emplace_back(name, std::move(suite));
+    return 0;
+}
+
+// Keeps the compiler from discarding a computed value
+template <typename T>
+inline void keep(T &&value) { asm volatile("" : : "g"(&value) : "memory"); }
+}
+
+#define ROBOCOMP_BENCH_SUITE(name, fn) static const int robocomp_bench_suite_##name = bench::add_suite(#name, fn)
+
+#endif // ROBOCOMP_BENCH_H
@@ -0,0 +1,71 @@
+//
+// BufferSync: N producers over two synchronized queues and M consumers reading matched pairs.
+//
+#include "bench.h"
+
+#include <atomic>
+#include <thread>
+#include <doublebuffer_sync/doublebuffer_sync.h>
+
+using Payload = std::vector<float>;
+using Buffer = BufferSync<InOut<Payload, Payload>, InOut<Payload, Payload>>;
+
+static void buffersync_suite(bench::Runner &r)
+{
+    const std::size_t puts = r.quick() ? 500 : 5000;          // per producer
+    const std::size_t payload = 1024;
+    for (bool reuse : {false, true})
+        for (std::size_t producers : {2, 4})
+            for (std::size_t consumers : {1, 4})
+            {
+                const std::string name = std::string("put_read/") + (reuse ? "reuse" : "alloc");
+                r.run("buffersync", name, {{"producers", double(producers)}, {"consumers", double(consumers)}, {"payload", double(payload)}},
+                      double(puts * producers), [&] {
+                    Buffer buffer(16, reuse, 2);
+                    std::atomic_bool done{false};
+                    std::atomic<std::size_t> timestamp{1};
+                    std::vector<std::thread> threads;
+                    for (std::size_t c = 0; c < consumers; c++)
+                        threads.emplace_back([&] {
+                            while (!done.load(std::memory_order_acquire))
+                            {
+                                // the pair nearest to the newest timestamp, within 8 ticks
+                                auto [a, b] = buffer.read_shared(timestamp.load(std::memory_order_relaxed), 8);
+                                bench::keep(a);
+                                bench::keep(b);
+                                std::this_thread::yield();
+                            }
+                        });
+                    std::vector<std::thread> writers;
+                    for (std::size_t p = 0; p < producers; p++)
+                        writers.emplace_back([&, p] {
+                            for (std::size_t i = 0; i < puts; i++)
+                            {
+                                const std::size_t t = timestamp.fetch_add(1, std::memory_order_relaxed);
+                                if (p % 2 == 0)
+                                    buffer.put<0>(Payload(payload, float(t)), t);
+                                else
+                                    buffer.put<1>(Payload(payload, float(t)), t);
+                                if (i % 64 == 63)
+                                    std::this_thread::yield();
+                            }
+                        });
+                    for (auto &t : writers)
+                        t.join();
+                    // the puts are inserted in order, so the conversions are done when the sentinels show up
+                    buffer.put<0>(Payload(1, -1.f), std::numeric_limits<size_t>::max() - 1);
+                    buffer.put<1>(Payload(1, -1.f), std::numeric_limits<size_t>::max() - 1);
+                    for (;;)
+                    {
+                        auto [a, b] = buffer.read_last_shared();
+                        if (a && b && a->size() == 1 && b->size() == 1)
+                            break;
+                        std::this_thread::yield();
+                    }
+                    done.store(true, std::memory_order_release);
+                    for (auto &t : threads)
+                        t.join();
+                });
+            }
+}
+ROBOCOMP_BENCH_SUITE(buffersync, buffersync_suite);
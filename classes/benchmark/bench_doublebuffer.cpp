@@ -0,0 +1,83 @@
+//
+// DoubleBuffer: one producer (the middleware stub) and M consumers, in the swap and triple buffer modes.
+//
+#include "bench.h"
+
+#include <atomic>
+#include <thread>
+#include <doublebuffer/DoubleBuffer.h>
+
+using Payload = std::vector<float>;
+
+using Clock = std::chrono::steady_clock;
+
+// microseconds since 'base', small enough to be exact in the float payload
+static float since_us(Clock::time_point base)
+{
+    return std::chrono::duration<float, std::micro>(Clock::now() - base).count();
+}
+
+// The producer puts 'messages' payloads while the consumers poll try_get(). The first element of every payload is
+// its put time (since the start of the sample), so each fresh read yields a put-to-read latency.
+template <class Mode>
+static void producer_consumers(bench::Runner &r, const std::string &name, std::size_t consumers, std::size_t messages, std::size_t payload)
+{
+    if (!r.enabled("doublebuffer", name))
+        return;
+    std::vector<double> latencies;
+    std::mutex latencies_mutex;
+    r.run("doublebuffer", name, {{"producers", 1}, {"consumers", double(consumers)}, {"payload", double(payload)}}, messages, [&] {
+        DoubleBuffer<Payload, Payload, Mode> buffer;
+        const auto base = Clock::now();
+        std::atomic_bool done{false};
+        std::vector<std::thread> readers;
+        for (std::size_t c = 0; c < consumers; c++)
+            readers.emplace_back([&] {
+                std::vector<double> local;
+                while (!done.load(std::memory_order_acquire))
+                {
+                    if (auto v = buffer.try_get(); v.has_value() && !v->empty())
+                    {
+                        if (v->front() < 0)
+                            done.store(true, std::memory_order_release);
+                        else
+                            local.push_back((since_us(base) - v->front()) * 1e3);
+                    }
+                    else
+                        std::this_thread::yield();
+                }
+                std::lock_guard lock(latencies_mutex);
+                latencies.insert(latencies.end(), local.begin(), local.end());
+            });
+        for (std::size_t i = 0; i < messages; i++)
+        {
+            Payload p(payload, 1.f);
+            p.front() = since_us(base);
+            buffer.put(std::move(p));
+            if (i % 64 == 63)
+                std::this_thread::yield();
+        }
+        // the puts are converted on the buffer's worker and puts closer than write_freq are dropped, so the
+        // sentinel is repeated until a consumer reads it
+        while (!done.load(std::memory_order_acquire))
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            buffer.put(Payload(1, -1.f));
+        }
+        for (auto &t : readers)
+            t.join();
+    });
+    r.record("doublebuffer", name + "/latency", {{"consumers", double(consumers)}, {"payload", double(payload)}}, std::move(latencies));
+}
+
+static void doublebuffer_suite(bench::Runner &r)
+{
+    const std::size_t messages = r.quick() ? 500 : 5000;
+    for (std::size_t payload : {16, 4096})
+    {
+        for (std::size_t consumers : {1, 2, 4})
+            producer_consumers<SwapBuffers>(r, "swap", consumers, messages, payload);
+        producer_consumers<TripleBuffer>(r, "triple", 1, messages, payload);
+    }
+}
+ROBOCOMP_BENCH_SUITE(doublebuffer, doublebuffer_suite);
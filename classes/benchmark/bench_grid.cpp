@@ -0,0 +1,71 @@
+//
+// Grid: update_map, computePath and update_costs on synthetic maps of growing size, Dense storage and Image render.
+//
+#include "bench.h"
+
+#include <QApplication>
+#include <QGraphicsScene>
+#include <grid2d/grid.h>
+
+// a square room with four pillars, seen from the center by a 360 degrees scan
+static std::vector<Eigen::Vector2f> synthetic_scan(float half_side, const Eigen::Vector2f &robot, std::size_t rays)
+{
+    std::vector<Eigen::Vector2f> points;
+    points.reserve(rays);
+    for (std::size_t i = 0; i < rays; i++)
+    {
+        const float a = 2.f * float(M_PI) * i / rays;
+        const Eigen::Vector2f d(std::cos(a), std::sin(a));
+        float range = half_side / std::max(std::abs(d.x()), std::abs(d.y()));
+        for (float px : {-half_side / 2, half_side / 2})
+            for (float pz : {-half_side / 2, half_side / 2})
+            {
+                // ray against a pillar of radius half_side / 20
+                const Eigen::Vector2f c(px, pz);
+                const float t = d.dot(c - robot), r = half_side / 20;
+                const float miss2 = (robot + t * d - c).squaredNorm();
+                if (t > 0 && miss2 < r * r)
+                    range = std::min(range, t - std::sqrt(r * r - miss2));
+            }
+        points.emplace_back(robot + range * d);
+    }
+    return points;
+}
+
+static void grid_suite(bench::Runner &r)
+{
+    int argc = 1;
+    char name[] = "robocomp_core_bench";
+    char *argv[] = {name, nullptr};
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    static QApplication app(argc, argv);
+
+    const int tile = 100;
+    const std::vector<int> sides = r.quick() ? std::vector<int>{5000, 10000} : std::vector<int>{5000, 10000, 20000, 40000};
+    for (int side : sides)
+    {
+        QGraphicsScene scene;
+        Grid grid;
+        const float half = side / 2.f;
+        grid.initialize(QRectF(-half, -half, side, side), tile, &scene, false, "", QPointF(0, 0), 0.f,
+                        Grid::Storage::Dense, Grid::Render::Image);
+        const Eigen::Vector2f robot(0, 0);
+        const auto scan = synthetic_scan(half - tile, robot, 720);
+        const bench::Params params{{"side_mm", double(side)}, {"tile_mm", double(tile)}, {"cells", double(grid.size())}, {"rays", double(scan.size())}};
+
+        r.run("grid", "update_map", params, scan.size(), [&] { grid.update_map(scan, robot, float(side)); });
+        if (std::thread::hardware_concurrency() > 1)
+        {
+            auto threaded = params;
+            threaded.emplace_back("threads", double(std::thread::hardware_concurrency()));
+            grid.set_update_threads(std::thread::hardware_concurrency());
+            r.run("grid", "update_map", threaded, scan.size(), [&] { grid.update_map(scan, robot, float(side)); });
+            grid.set_update_threads(0);
+        }
+        r.run("grid", "update_costs", params, grid.size(), [&] { grid.update_costs(true); });
+        // corner to corner, around the pillars
+        const QPointF from(-half + 2 * tile, -half + 2 * tile), to(half - 2 * tile, half - 2 * tile);
+        r.run("grid", "computePath", params, 1, [&] { bench::keep(grid.computePath(from, to)); });
+    }
+}
+ROBOCOMP_BENCH_SUITE(grid, grid_suite);
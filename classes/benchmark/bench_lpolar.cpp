@@ -0,0 +1,35 @@
+//
+// LPolar: forward, averaged, batched and inverse log-polar conversions of a synthetic camera frame.
+//
+#include "bench.h"
+
+#include <logpolar/lpolar.h>
+
+static void lpolar_suite(bench::Runner &r)
+{
+    const int ecc = 64, ang = 128, w = 480, h = 480;
+    for (int channels : {1, 3})
+    {
+        LPolar lp(ecc, ang, w, h);
+        const int stride = w * channels;
+        std::vector<unsigned char> image(std::size_t(stride) * h), polar(std::size_t(ecc) * ang * channels), back(std::size_t(w) * h * channels);
+        for (std::size_t i = 0; i < image.size(); i++)
+            image[i] = static_cast<unsigned char>((i * 2654435761u) >> 24);
+        const bench::Params params{{"ecc", double(ecc)}, {"ang", double(ang)}, {"w", double(w)}, {"h", double(h)}, {"channels", double(channels)}};
+        r.run("lpolar", "convert", params, 1, [&] { lp.convert(image.data(), polar.data(), stride, channels); bench::keep(polar); });
+        r.run("lpolar", "convertPromedio", params, 1, [&] { lp.convertPromedio(image.data(), polar.data(), stride, channels); bench::keep(polar); });
+        r.run("lpolar", "inverseBilinear", params, 1, [&] { lp.inverseBilinear(polar.data(), back.data(), w, h, channels); bench::keep(back); });
+        r.run("lpolar", "convertInverse", params, 1, [&] { lp.convertInverse(image.data(), back.data(), stride, channels, w, h); bench::keep(back); });
+
+        const std::size_t frames = 8;
+        std::vector<std::vector<unsigned char>> outputs(frames, polar);
+        std::vector<const unsigned char *> in(frames, image.data());
+        std::vector<unsigned char *> out;
+        for (auto &o : outputs)
+            out.push_back(o.data());
+        auto batch = params;
+        batch.emplace_back("frames", double(frames));
+        r.run("lpolar", "convertBatch", batch, frames, [&] { lp.convertBatch(in, out, stride, channels); bench::keep(outputs); });
+    }
+}
+ROBOCOMP_BENCH_SUITE(lpolar, lpolar_suite);
@@ -0,0 +1,35 @@
+//
+// RCParticleFilterSoA: step time against the particle count, with a unicycle motion model and a range likelihood.
+//
+#include "bench.h"
+
+#include <particleFiltering/particleFilterSoA.h>
+
+static void particlefilter_suite(bench::Runner &r)
+{
+    const std::vector<uint32_t> counts = r.quick() ? std::vector<uint32_t>{1000, 10000} : std::vector<uint32_t>{1000, 10000, 100000};
+    for (uint32_t n : counts)
+    {
+        RCParticleFilterSoA<3> pf(n, -1, 42);
+        pf.initialize([](auto &s, uint32_t) { s.setRandom(); s.topRows(2) *= 5000.f; s.row(2) *= float(M_PI); });
+        const float advance = 20.f, rotation = 0.01f, sigma2 = 2.f * 300.f * 300.f;
+        const Eigen::Vector2f beacon(1000.f, -500.f);
+        const float measured = 2500.f;
+        auto motion = [&](auto &s, uint32_t)
+        {
+            s.row(0).array() += s.row(2).array().cos() * advance;
+            s.row(1).array() += s.row(2).array().sin() * advance;
+            s.row(2).array() += rotation;
+        };
+        auto likelihood = [&](const auto &s, auto &&l, uint32_t)
+        {
+            const auto range = ((s.row(0).array() - beacon.x()).square() + (s.row(1).array() - beacon.y()).square()).sqrt();
+            l = (-(range - measured).square() / sigma2).exp().transpose().template cast<double>();
+        };
+        r.run("particlefilter", "soa/step", {{"particles", double(n)}}, n, [&] { pf.step(motion, likelihood); });
+        r.run("particlefilter", "soa/predict", {{"particles", double(n)}}, n, [&] { pf.predict(motion); });
+        r.run("particlefilter", "soa/update", {{"particles", double(n)}}, n, [&] { pf.update(likelihood); });
+        bench::keep(pf.getBest());
+    }
+}
+ROBOCOMP_BENCH_SUITE(particlefilter, particlefilter_suite);
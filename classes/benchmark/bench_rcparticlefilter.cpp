@@ -0,0 +1,54 @@
+//
+// RCParticleFilter (array of particle objects): step time against the particle count, to compare with the SoA filter.
+//
+#include "bench.h"
+
+#include <particleFiltering/particleFilter.h>
+
+namespace
+{
+struct Beacon { float x, z, range; };
+struct Odometry { float advance, rotation; };
+
+class BeaconParticle : public RCParticleFilter_Particle<Beacon, Odometry, RCParticleFilter_Config>
+{
+public:
+    void initialize(const Beacon &, const Odometry &, const RCParticleFilter_Config *) override
+    {
+        auto &g = RCRandom::local();
+        x = (RCRandom::uniformf(g) * 2.f - 1.f) * 5000.f;
+        z = (RCRandom::uniformf(g) * 2.f - 1.f) * 5000.f;
+        angle = (RCRandom::uniformf(g) * 2.f - 1.f) * float(M_PI);
+        weight = 1.;
+    }
+    void adapt(const Odometry &, const Odometry &odometry, const bool) override
+    {
+        x += std::cos(angle) * odometry.advance;
+        z += std::sin(angle) * odometry.advance;
+        angle += odometry.rotation;
+    }
+    void computeWeight(const Beacon &b) override
+    {
+        const float range = std::hypot(x - b.x, z - b.z);
+        weight = std::exp(-(range - b.range) * (range - b.range) / (2.f * 300.f * 300.f));
+    }
+private:
+    float x = 0, z = 0, angle = 0;
+};
+}
+
+static void rcparticlefilter_suite(bench::Runner &r)
+{
+    const std::vector<uint32_t> counts = r.quick() ? std::vector<uint32_t>{1000, 10000} : std::vector<uint32_t>{1000, 10000, 100000};
+    const Beacon beacon{1000.f, -500.f, 2500.f};
+    const Odometry odometry{20.f, 0.01f};
+    for (uint32_t n : counts)
+    {
+        RCRandom::seed(42);
+        RCParticleFilter_Config config;
+        config.particles = n;
+        RCParticleFilter<Beacon, Odometry, BeaconParticle> pf(&config, beacon, odometry);
+        r.run("particlefilter", "aos/step", {{"particles", double(n)}}, n, [&] { pf.step(beacon, odometry); });
+    }
+}
+ROBOCOMP_BENCH_SUITE(rcparticlefilter, rcparticlefilter_suite);
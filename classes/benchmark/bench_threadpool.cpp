@@ -0,0 +1,65 @@
+//
+// ThreadPool: task throughput, round trip latency and parallel_for, for both scheduling modes.
+//
+#include "bench.h"
+
+#include <atomic>
+#include <thread>
+#include <threadpool/threadpool.h>
+
+static void threadpool_suite(bench::Runner &r)
+{
+    const uint32_t hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> counts{1};
+    if (hw > 1)
+        counts.push_back(hw);
+    const std::size_t tasks = r.quick() ? 2000 : 20000;
+    const std::size_t roundtrips = r.quick() ? 200 : 2000;
+    std::vector<float> data(r.quick() ? 1 << 16 : 1 << 20, 1.f);
+
+    for (auto scheduling : {ThreadPool::Scheduling::SharedQueue, ThreadPool::Scheduling::WorkStealing})
+    {
+        const std::string mode = scheduling == ThreadPool::Scheduling::SharedQueue ? "shared" : "stealing";
+        for (uint32_t threads : counts)
+        {
+            ThreadPool pool(threads, scheduling);
+            const bench::Params params{{"threads", threads}, {"tasks", double(tasks)}};
+
+            // tasks queued one by one from an external thread, counted by the tasks themselves
+            r.run("threadpool", "spawn_task/" + mode, params, tasks, [&] {
+                std::atomic<std::size_t> done{0};
+                for (std::size_t i = 0; i < tasks; i++)
+                    pool.spawn_task([&done] { done.fetch_add(1, std::memory_order_release); });
+                while (done.load(std::memory_order_acquire) < tasks)
+                    std::this_thread::yield();
+            });
+
+            r.run("threadpool", "spawn_bulk/" + mode, params, tasks, [&] {
+                pool.spawn_bulk(tasks, [](std::size_t i) { bench::keep(i); }).get();
+            });
+
+            // submit to result of a waitable task, with the pool idle
+            if (r.enabled("threadpool", "roundtrip/" + mode))
+            {
+                std::vector<double> latencies;
+                latencies.reserve(roundtrips);
+                for (std::size_t i = 0; i < roundtrips; i++)
+                {
+                    const auto t0 = std::chrono::steady_clock::now();
+                    pool.spawn_task_waitable([] { return 1; }).get();
+                    latencies.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count());
+                }
+                r.record("threadpool", "roundtrip/" + mode, {{"threads", threads}}, std::move(latencies));
+            }
+
+            r.run("threadpool", "parallel_for/" + mode, {{"threads", threads}, {"n", double(data.size())}}, data.size(), [&] {
+                pool.parallel_for(0, data.size(), 4096, [&](std::size_t b, std::size_t e) {
+                    for (std::size_t i = b; i < e; i++)
+                        data[i] = data[i] * 0.999f + 0.001f;
+                });
+            });
+        }
+    }
+    bench::keep(data);
+}
+ROBOCOMP_BENCH_SUITE(threadpool, threadpool_suite);
@@ -0,0 +1,191 @@
+//
+// robocomp_core_bench: microbenchmarks of the hot paths of the core classes.
+//
+//      robocomp_core_bench [--filter=<suite/name substring>] [--format=text|csv|json] [--out=<file>]
+//                          [--min-time=<seconds>] [--quick] [--list]
+//
+#include "bench.h"
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace bench
+{
+std::vector<std::pair<std::string, Suite>> &suites()
+{
+    static std::vector<std::pair<std::string, Suite>> registered;
+    return registered;
+}
+
+void Result::compute()
+{
+    if (samples_ns.empty())
+        return;
+    std::vector<double> s = samples_ns;
+    std::sort(s.begin(), s.end());
+    auto at = [&](double q) { return s[std::min(s.size() - 1, std::size_t(q * (s.size() - 1) + 0.5))]; };
+    min = s.front();
+    max = s.back();
+    median = at(0.5);
+    p90 = at(0.9);
+    p99 = at(0.99);
+    double sum = 0, sq = 0;
+    for (double v : s)
+        sum += v;
+    mean = sum / s.size();
+    for (double v : s)
+        sq += (v - mean) * (v - mean);
+    stddev = s.size() > 1 ? std::sqrt(sq / (s.size() - 1)) : 0;
+}
+
+void Runner::record(const std::string &suite, const std::string &name, Params params, std::vector<double> samples_ns, double items)
+{
+    if (!enabled(suite, name) || samples_ns.empty())
+        return;
+    Result r{suite, name, std::move(params), items, std::move(samples_ns)};
+    r.compute();
+    std::cerr << std::left << std::setw(48) << (suite + "/" + name);
+    for (const auto &[k, v] : r.params)
+        std::cerr << ' ' << k << '=' << v;
+    std::cerr << "  median " << std::fixed << std::setprecision(1) << r.median / 1e3 << " us" << std::defaultfloat << std::setprecision(6) << std::endl;
+    all.push_back(std::move(r));
+}
+
+static std::string params_string(const Params &params)
+{
+    std::ostringstream os;
+    for (std::size_t i = 0; i < params.size(); i++)
+        os << (i ? ";" : "") << params[i].first << '=' << params[i].second;
+    return os.str();
+}
+
+static std::string quoted(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + '"';
+}
+
+void Runner::write_text(std::ostream &os) const
+{
+    os << std::left << std::setw(44) << "benchmark" << std::setw(34) << "params" << std::right
+       << std::setw(14) << "median(ns)" << std::setw(14) << "p99(ns)" << std::setw(16) << "items/s" << std::setw(9) << "samples" << '\n';
+    for (const auto &r : all)
+        os << std::left << std::setw(44) << (r.suite + "/" + r.name) << std::setw(34) << params_string(r.params) << std::right
+           << std::fixed << std::setprecision(0) << std::setw(14) << r.median << std::setw(14) << r.p99
+           << std::setw(16) << r.items_per_second() << std::setw(9) << r.samples_ns.size() << std::defaultfloat << '\n';
+}
+
+void Runner::write_csv(std::ostream &os) const
+{
+    os << "suite,name,params,samples,items,mean_ns,median_ns,p90_ns,p99_ns,min_ns,max_ns,stddev_ns,items_per_second\n";
+    os << std::setprecision(10);
+    for (const auto &r : all)
+        os << r.suite << ',' << r.name << ',' << params_string(r.params) << ',' << r.samples_ns.size() << ',' << r.items << ','
+           << r.mean << ',' << r.median << ',' << r.p90 << ',' << r.p99 << ',' << r.min << ',' << r.max << ',' << r.stddev << ','
+           << r.items_per_second() << '\n';
+}
+
+void Runner::write_json(std::ostream &os) const
+{
+    const std::time_t now = std::time(nullptr);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    os << std::setprecision(10);
+    os << "{\n  \"context\": {\"date\": " << quoted(date) << ", \"hardware_threads\": " << std::thread::hardware_concurrency()
+       << ", \"compiler\": " << quoted(__VERSION__) << ", \"quick\": " << (options.quick ? "true" : "false")
+#ifdef NDEBUG
+       << ", \"build\": \"release\""
+#else
+       << ", \"build\": \"debug\""
+#endif
+       << "},\n  \"results\": [";
+    for (std::size_t i = 0; i < all.size(); i++)
+    {
+        const auto &r = all[i];
+        os << (i ? ",\n" : "\n") << "    {\"suite\": " << quoted(r.suite) << ", \"name\": " << quoted(r.name) << ", \"params\": {";
+        for (std::size_t k = 0; k < r.params.size(); k++)
+            os << (k ? ", " : "") << quoted(r.params[k].first) << ": " << r.params[k].second;
+        os << "}, \"samples\": " << r.samples_ns.size() << ", \"items\": " << r.items << ", \"mean_ns\": " << r.mean
+           << ", \"median_ns\": " << r.median << ", \"p90_ns\": " << r.p90 << ", \"p99_ns\": " << r.p99 << ", \"min_ns\": " << r.min
+           << ", \"max_ns\": " << r.max << ", \"stddev_ns\": " << r.stddev << ", \"items_per_second\": " << r.items_per_second() << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+}
+
+int main(int argc, char *argv[])
+{
+    bench::Runner::Options options;
+    std::string format = "text", out;
+    bool list = false;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        auto value = [&](const char *key) -> const char * {
+            const std::size_t n = std::strlen(key);
+            return arg.compare(0, n, key) == 0 ? argv[i] + n : nullptr;
+        };
+        if (const char *v = value("--filter="))
+            options.filter = v;
+        else if (const char *v = value("--format="))
+            format = v;
+        else if (const char *v = value("--out="))
+            out = v;
+        else if (const char *v = value("--min-time="))
+            options.min_time = std::atof(v);
+        else if (arg == "--quick")
+            options.quick = true;
+        else if (arg == "--list")
+            list = true;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--filter=<suite/name>] [--format=text|csv|json] [--out=<file>] [--min-time=<s>] [--quick] [--list]" << std::endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (format != "text" && format != "csv" && format != "json")
+    {
+        std::cerr << "unknown format " << format << std::endl;
+        return 1;
+    }
+    if (list)
+    {
+        for (const auto &[name, suite] : bench::suites())
+            std::cout << name << std::endl;
+        return 0;
+    }
+
+    bench::Runner runner(options);
+    for (const auto &[name, suite] : bench::suites())
+        suite(runner);
+
+    std::ofstream file;
+    if (!out.empty())
+    {
+        file.open(out);
+        if (!file)
+        {
+            std::cerr << "can not write " << out << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &os = out.empty() ? std::cout : file;
+    if (format == "json")
+        runner.write_json(os);
+    else if (format == "csv")
+        runner.write_csv(os);
+    else
+        runner.write_text(os);
+    return 0;
+}
@@ -0,0 +1,49 @@
+//
+// BiasedSelector alias mode: the ids of no weight are never drawn, and the table follows resize().
+//
+#include <iostream>
+#include <vector>
+#include <biasedRandomSelector.h>
+
+static int fail(const char *what)
+{
+    std::cerr << "test_biased_selector: " << what << std::endl;
+    return 1;
+}
+
+int main()
+{
+    constexpr uint32_t n = 7;
+    BiasedSelector selector(n);
+    // weights that do not split evenly, so that the construction leaves rounding leftovers
+    for (uint32_t id = 0; id < n; id++)
+        selector.setWeight(id, id % 2 ? 0. : 1. / 3. + id * 0.1);
+    selector.buildAlias();
+
+    std::vector<long> count(n + 3, 0);
+    for (int i = 0; i < 200000; i++)
+        count[selector.getAlias()]++;
+    for (uint32_t id = 1; id < n; id += 2)
+        if (count[id] != 0)
+            return fail("an id of no weight was drawn");
+
+    // zeroing a weight without rebuilding the table
+    selector.setWeight(0, 0.);
+    std::fill(count.begin(), count.end(), 0);
+    for (int i = 0; i < 200000; i++)
+        count[selector.getAlias()]++;
+    if (count[0] != 0)
+        return fail("an id set to no weight was drawn");
+
+    // the new candidates of resize() reach the table
+    selector.resize(n + 3);
+    selector.setWeight(n + 2, 1.);
+    std::fill(count.begin(), count.end(), 0);
+    for (int i = 0; i < 200000; i++)
+        count[selector.getAlias()]++;
+    if (count[n + 2] == 0 or count[n] != 0 or count[n + 1] != 0)
+        return fail("resize() left the table out of date");
+
+    std::cout << "test_biased_selector: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,109 @@
+//
+// GRAFCETMachine on a compiled table: entry and exit actions, guarded transitions tried in declaration order, events
+// posted from another thread and dispatched by tick(), a full queue, and state()/isActive() read by an observer thread.
+//
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <grafcetStep/GRAFCETTable.h>
+
+namespace
+{
+enum class S { Idle, Run, Fault, Count };
+enum class E { Start, Stop, Error, Count };
+
+struct Ctx
+{
+    bool faultsAllowed = false;
+    int entries[3] = {};
+    int exits[3] = {};
+    long cycles = 0;
+};
+
+constexpr GRAFCETTransition<S, E, Ctx> transitions[] = {
+    {S::Idle, E::Start, S::Run, nullptr},
+    {S::Run, E::Stop, S::Idle, nullptr},
+    {S::Run, E::Error, S::Fault, [](const Ctx &c) { return c.faultsAllowed; }},
+    {S::Run, E::Error, S::Idle, nullptr},
+    {S::Fault, E::Stop, S::Idle, nullptr},
+};
+constexpr auto table = makeGRAFCETTable(transitions);
+static_assert(table.first[0][0] == 0 and table.first[1][2] == 2 and table.next[2] == 3 and table.next[3] == -1);
+
+const GRAFCETActions<Ctx> actions[] = {
+    {"Idle", nullptr, [](Ctx &c) { c.entries[0]++; }, [](Ctx &c) { c.exits[0]++; }},
+    {"Run", [](Ctx &c) { c.cycles++; }, [](Ctx &c) { c.entries[1]++; }, [](Ctx &c) { c.exits[1]++; }},
+    {"Fault", nullptr, [](Ctx &c) { c.entries[2]++; }, [](Ctx &c) { c.exits[2]++; }},
+};
+
+int failures = 0;
+void check(bool ok, const char *what)
+{
+    if (not ok)
+    {
+        std::cerr << "test_grafcet_table: " << what << std::endl;
+        failures++;
+    }
+}
+}
+
+int main()
+{
+    Ctx ctx;
+    GRAFCETMachine machine(table, actions, ctx);
+    check(not machine.dispatch(E::Start), "dispatch before start");
+    check(std::string(machine.stateName()) == "None", "name before start");
+
+    machine.start(S::Idle);
+    check(machine.isActive() and machine.state() == S::Idle and ctx.entries[0] == 1, "start");
+    check(not machine.dispatch(E::Stop), "event without transition");
+    check(machine.dispatch(E::Start) and machine.state() == S::Run, "Idle -> Run");
+    check(ctx.exits[0] == 1 and ctx.entries[1] == 1, "P0 and P1 of a transition");
+    // the guard of the first Error transition does not hold: the next one of the chain is taken
+    check(machine.dispatch(E::Error) and machine.state() == S::Idle, "guarded chain");
+    machine.dispatch(E::Start);
+    ctx.faultsAllowed = true;
+    check(machine.dispatch(E::Error) and machine.state() == S::Fault, "guard holds");
+    check(machine.transitionCount() == 4, "transition count");
+    machine.dispatch(E::Stop);
+    machine.dispatch(E::Start);
+    machine.tick();
+    check(ctx.cycles == 1, "N of the active step");
+
+    // a full queue refuses the events, tick() dispatches them in order
+    machine.dispatch(E::Stop);
+    int posted = 0;
+    while (machine.post(posted % 2 == 0 ? E::Start : E::Stop))
+        posted++;
+    check(posted == 64, "queue capacity");
+    machine.tick();
+    check(machine.state() == S::Idle and machine.transitionCount() == 7 + 64, "events dispatched by tick");
+
+    // events from another thread, observed from a third one while the owner ticks
+    constexpr int rounds = 20000;
+    std::atomic<bool> done{false};
+    std::thread observer([&]() {
+        while (not done.load())
+            if (machine.isActive() and machine.state() == S::Count)
+                check(false, "observed state");
+    });
+    std::thread producer([&]() {
+        for (int i = 0; i < rounds; i++)
+            while (not machine.post(i % 2 == 0 ? E::Start : E::Stop))
+                std::this_thread::yield();
+    });
+    const uint64_t before = machine.transitionCount();
+    while (machine.transitionCount() - before < uint64_t(rounds))
+        machine.tick();
+    producer.join();
+    machine.stop();
+    done = true;
+    observer.join();
+    check(not machine.isActive() and std::string(machine.stateName()) == "None", "stop");
+    check(ctx.entries[0] + ctx.entries[1] + ctx.entries[2] == ctx.exits[0] + ctx.exits[1] + ctx.exits[2], "entries and exits");
+
+    if (failures == 0)
+        std::cout << "test_grafcet_table: ok" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
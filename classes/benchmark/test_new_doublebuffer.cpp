@@ -0,0 +1,104 @@
+//
+// new_doublebuffer with LockFreeSlots: several writers and one reader on a buffer of one slot. A late writer can leave
+// an older element in the slot after 'published' moved on; the reads must still return instead of spinning.
+// The views held by a reader keep their data while the writers reuse the other nodes, and after the buffer is gone.
+//
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <new_doublebuffer/doublebuffer.h>
+
+int main()
+{
+    using Buffer = DoubleBuffer<std::tuple<int>, std::tuple<int>, LockFreeSlots>;
+    static_assert(Buffer::always_lock_free, "LockFreeSlots needs lock-free atomics");
+    static_assert(not DoubleBuffer<std::tuple<int>, std::tuple<int>>::always_lock_free);
+    if (not Buffer::is_lock_free())
+    {
+        std::cerr << "test_new_doublebuffer: the slots are not lock free" << std::endl;
+        return 1;
+    }
+    Buffer buffer(1, 4);
+    auto identity = [](std::tuple<int> &&i) { return std::tuple<int>{std::get<0>(i)}; };
+
+    constexpr int writers = 4, puts = 20000;
+    std::atomic<bool> writing{true};
+    std::atomic<long> reads{0};
+    auto reader = std::async(std::launch::async, [&]() {
+        auto last = std::chrono::steady_clock::time_point::min();
+        while (writing.load())
+        {
+            buffer.get();
+            buffer.get_new(last);
+            reads++;
+        }
+        // no put will come any more: every read has to return on what is stored
+        for (int i = 0; i < 1000; i++)
+        {
+            buffer.get();
+            buffer.get_shared();
+            buffer.get_new_shared(last);
+        }
+    });
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; w++)
+        threads.emplace_back([&, w]() {
+            for (int i = 0; i < puts; i++)
+                buffer.put(std::tuple<int>{w * puts + i}, identity);
+        });
+    for (auto &t : threads)
+        t.join();
+    while (buffer.put_stats().transformed < buffer.put_stats().accepted)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    writing = false;
+
+    if (reader.wait_for(std::chrono::seconds(10)) != std::future_status::ready)
+    {
+        std::cerr << "test_new_doublebuffer: the reader did not return" << std::endl;
+        std::_Exit(1);
+    }
+
+    // views held across puts, on a buffer that does not outlive them
+    std::vector<std::pair<int, Buffer::data_view>> held;
+    {
+        Buffer small(2, 1);
+        for (int i = 0; i < 200; i++)
+        {
+            small.put(std::tuple<int>{i}, identity);
+            while (small.put_stats().transformed < uint64_t(i + 1))
+                std::this_thread::yield();
+            if (i % 20 == 0)
+            {
+                auto v = small.get_shared();
+                held.emplace_back(std::get<0>(*v), std::move(v));
+            }
+        }
+    }
+    for (const auto &[value, view] : held)
+        if (std::get<0>(*view) != value)
+        {
+            std::cerr << "test_new_doublebuffer: a held view changed" << std::endl;
+            return 1;
+        }
+
+    // a transformation throwing something else than a std::exception loses its input, not the worker
+    {
+        Buffer failing(1, 1);
+        failing.put(std::tuple<int>{1}, [](std::tuple<int> &&) -> std::tuple<int> { throw 42; });
+        failing.put(std::tuple<int>{2}, identity);
+        while (failing.put_stats().transformed < 2)
+            std::this_thread::yield();
+        if (std::get<0>(failing.get()) != 2)
+        {
+            std::cerr << "test_new_doublebuffer: the worker did not survive a failed transformation" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "test_new_doublebuffer: " << reads.load() << " reads, ok" << std::endl;
+    return 0;
+}
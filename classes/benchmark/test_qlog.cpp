@@ -0,0 +1,54 @@
+//
+// qLog asynchronous mode: producers that keep logging while setAsync(false) runs. Every message must be printed once,
+// either queued and drained or written synchronously once the mode is off.
+//
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <qlog/qlog.h>
+
+int main()
+{
+    const char *path = "test_qlog.out";
+    if (freopen(path, "w", stdout) == nullptr)
+        return 1;
+    constexpr int rounds = 100, producers = 3;
+    std::atomic<long> sent{0};
+    for (int round = 0; round < rounds; round++)
+    {
+        qLog *log = new qLog();
+        log->setAsync(true, 1);
+        std::atomic<bool> go{true};
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; p++)
+            threads.emplace_back([&]() {
+                // the synchronous mode is not thread safe, stop as soon as it is back
+                while (go and log->isAsync())
+                {
+                    log->send(__FILE__, __LINE__, __func__, std::string("message"), "Info");
+                    sent++;
+                }
+            });
+        std::this_thread::sleep_for(std::chrono::microseconds(200 + 50 * round));
+        log->setAsync(false);
+        go = false;
+        for (auto &t : threads)
+            t.join();
+        // queued with no logging thread, written by the destructor
+        log->setAsync(true, 1000);
+        log->send(__FILE__, __LINE__, __func__, std::string("last"), "Info");
+        sent++;
+        delete log;
+    }
+    fflush(stdout);
+
+    FILE *f = fopen(path, "r");
+    long lines = 0;
+    for (int c; f != nullptr and (c = fgetc(f)) != EOF;)
+        lines += c == '\n';
+    if (f != nullptr)
+        fclose(f);
+    fprintf(stderr, "test_qlog: %ld messages, %ld lines\n", sent.load(), lines);
+    return lines == sent.load() ? 0 : 1;
+}
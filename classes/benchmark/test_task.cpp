@@ -0,0 +1,163 @@
+//
+// rc::Task coroutines on ThreadPool: co_await chains that hop to the workers, exceptions rethrown along co_await, then()
+// and the joins, and tasks dropped without being awaited, whose coroutines still run to the end and free their frames.
+//
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <threadpool/task.h>
+
+namespace
+{
+int failures = 0;
+void check(bool ok, const char *what)
+{
+    if (not ok)
+    {
+        std::cerr << "test_task: " << what << std::endl;
+        failures++;
+    }
+}
+
+// counts the frames alive: a local of every coroutine below
+std::atomic<int> frames{0};
+struct Frame
+{
+    Frame() { frames++; }
+    ~Frame() { frames--; }
+};
+
+rc::Task<int> leaf(ThreadPool &tp, int v)
+{
+    Frame f;
+    co_await tp.schedule();
+    co_return v + 1;
+}
+
+rc::Task<int> middle(ThreadPool &tp, int v)
+{
+    Frame f;
+    int a = co_await leaf(tp, v);
+    int b = co_await leaf(tp, a);
+    co_return a + b;
+}
+
+rc::Task<long> root(ThreadPool &tp, int n)
+{
+    Frame f;
+    long sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += co_await middle(tp, i);
+    co_return sum;
+}
+
+rc::Task<int> failing(ThreadPool &tp)
+{
+    Frame f;
+    co_await tp.schedule();
+    throw std::runtime_error("leaf failed");
+    co_return 0;
+}
+
+rc::Task<std::string> catching(ThreadPool &tp)
+{
+    Frame f;
+    try
+    {
+        co_await failing(tp);
+    }
+    catch (const std::runtime_error &e)
+    {
+        co_return std::string("caught ") + e.what();
+    }
+    co_return "not thrown";
+}
+
+rc::Task<int> forwarding(ThreadPool &tp)
+{
+    Frame f;
+    co_return co_await failing(tp) + 1;     // the exception goes through this frame to the caller
+}
+
+rc::Task<void> detached(ThreadPool &tp, std::atomic<int> &finished)
+{
+    Frame f;
+    co_await tp.schedule();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    finished++;
+}
+
+bool wait_for(const std::atomic<int> &value, int expected)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (value.load() != expected)
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+}
+
+int main()
+{
+    ThreadPool tp(ThreadPool::Config{.num_threads = 3});
+
+    // chaining: middle(i) = (i + 1) + (i + 2)
+    constexpr int n = 200;
+    check(rc::sync_wait(root(tp, n)) == long(n) * (n - 1) + 3L * n, "co_await chain");
+
+    // exceptions
+    check(rc::sync_wait(catching(tp)) == "caught leaf failed", "exception caught by the awaiting coroutine");
+    try
+    {
+        rc::sync_wait(forwarding(tp));
+        check(false, "exception not propagated through the chain");
+    }
+    catch (const std::runtime_error &e)
+    {
+        check(std::string(e.what()) == "leaf failed", "propagated exception");
+    }
+    std::atomic<bool> called{false};
+    auto chained = failing(tp).then([&called](int v) { called = true; return v; });
+    try
+    {
+        chained.get();
+        check(false, "exception not propagated through then()");
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+    check(not called.load(), "then() called with a failed input");
+    try
+    {
+        std::vector<rc::Task<int>> tasks;
+        tasks.push_back(leaf(tp, 1));
+        tasks.push_back(failing(tp));
+        rc::when_all(std::move(tasks)).get();
+        check(false, "exception not propagated through when_all");
+    }
+    catch (const std::runtime_error &)
+    {
+    }
+
+    // tasks destroyed without being awaited: the coroutines run to the end and release their frames
+    std::atomic<int> finished{0};
+    constexpr int dropped = 100;
+    for (int i = 0; i < dropped; i++)
+    {
+        auto t = detached(tp, finished);
+    }
+    (void)failing(tp);                          // its exception is dropped with the state
+    check(wait_for(finished, dropped), "dropped tasks did not finish");
+    check(wait_for(frames, 0), "coroutine frames left alive");
+
+    if (failures == 0)
+        std::cout << "test_task: ok" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
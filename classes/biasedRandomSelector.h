@@ -13,6 +13,8 @@
 
 #include <QObject>
 
+#include <random/rng.h>
+
 #define BIASED_MULT 1000000.
 
 struct BiasedCandidate
@@ -51,6 +53,7 @@ public:
 	{
 		candidates = other.candidates;
 		totalWeight = other.totalWeight;
+		alias = other.alias;
 	}
 
 	double getTotalWeight() { return totalWeight; }
@@ -67,6 +70,7 @@ public:
 				candidates[i].weight = 0.;
 			}
 		}
+		alias = Alias();           // the next getAlias() builds the table for the new candidates
 	}
 	uint32_t getFirst()
 	{
@@ -82,7 +86,7 @@ public:
 		{
 			throw std::string("BiasedSelector::Error: No possible choice.");
 		}
-		const long double result = fmodl(qrand()/RAND_MAX, totalWeight);
+		const long double result = RCRandom::uniform(RCRandom::local()) * totalWeight;
 		for (size_t i=0; i<candidates.size(); i++)
 		{
 			if (candidates[i].accum >= result)
@@ -112,6 +116,8 @@ public:
 				totalWeight -= candidates[i].weight;
 				candidates[i].weight = BIASED_MULT * p;
 				totalWeight += candidates[i].weight;
+				if (not alias.prob.empty())
+					setAliasWeight(id, p);
 				if (perform_sort)
 					sort();
 			}
@@ -138,8 +144,113 @@ public:
 		}
 	}
 
+	// Alias method (Walker, Vose). buildAlias() makes the table from the current weights in O(N), then getAlias()
+	// draws in O(1) without sorting. setAliasWeight() changes a single weight in O(1): the table keeps the weights
+	// it was built with as an envelope and the draws are accepted with probability weight / envelope. A weight that
+	// grows over its envelope, or a total weight that falls under half the envelope, rebuilds the table on the next
+	// draw. setWeight() keeps the table up to date once it has been built. The table is indexed by id: it holds
+	// max(id) + 1 entries and the ids of no candidate weigh 0. Ids of no weight are never drawn.
+	void buildAlias()
+	{
+		uint32_t n = 0;
+		for (const auto &c : candidates)
+			n = std::max(n, c.id + 1);
+		alias.weight.assign(n, 0.);
+		for (const auto &c : candidates)
+			alias.weight[c.id] = c.weight;
+		rebuildAlias();
+	}
+	uint32_t getAlias()
+	{
+		if (alias.prob.empty())
+			buildAlias();
+		if (alias.dirty or alias.total < 0.5 * alias.envelopeTotal)
+			rebuildAlias();
+		if (alias.total <= 0.000000000000000000000000001)
+		{
+			throw std::string("BiasedSelector::Error: No possible choice.");
+		}
+		auto &g = RCRandom::local();
+		const size_t n = alias.prob.size();
+		while (true)
+		{
+			const double u = RCRandom::uniform(g) * n;
+			const size_t column = std::min(size_t(u), n - 1);
+			const uint32_t id = (u - column < alias.prob[column]) ? column : alias.index[column];
+			if (alias.envelope[id] <= 0.)  // rounding leftovers can keep a column of no weight
+				continue;
+			if (alias.weight[id] >= alias.envelope[id] or RCRandom::uniform(g) * alias.envelope[id] < alias.weight[id])
+				return id;
+		}
+	}
+	void setAliasWeight(uint32_t id, double p)
+	{
+		if (p<0.)
+			throw std::string("Me does not allows negatif veilius");
+		if (alias.prob.empty() or id >= alias.weight.size())
+			buildAlias();
+		if (id >= alias.weight.size())
+			throw std::string("BiasedSelector::Error: No candidate with this id.");
+		const double w = BIASED_MULT * p;
+		alias.total += w - alias.weight[id];
+		alias.weight[id] = w;
+		if (w > alias.envelope[id])
+			alias.dirty = true;
+	}
+
 	std::vector<BiasedCandidate> candidates;
 	double totalWeight;
+
+private:
+	struct Alias
+	{
+		std::vector<double> prob;          // probability of keeping the column, the rest goes to index
+		std::vector<uint32_t> index;
+		std::vector<double> weight;        // current weights by id
+		std::vector<double> envelope;      // weights the table was built with
+		double total = 0., envelopeTotal = 0.;
+		bool dirty = false;
+	};
+	Alias alias;
+
+	void rebuildAlias()
+	{
+		const size_t n = alias.weight.size();
+		alias.envelope = alias.weight;
+		alias.prob.assign(n, 0.);
+		alias.index.assign(n, 0);
+		alias.total = 0.;
+		for (auto w : alias.weight)
+			alias.total += w;
+		alias.envelopeTotal = alias.total;
+		alias.dirty = false;
+		if (n == 0 or alias.total <= 0.)
+			return;
+		std::vector<double> scaled(n);
+		std::vector<uint32_t> small, large;
+		for (size_t i = 0; i < n; ++i)
+		{
+			scaled[i] = alias.weight[i] * n / alias.total;
+			(scaled[i] < 1. ? small : large).push_back(i);
+		}
+		while (not small.empty() and not large.empty())
+		{
+			const uint32_t s = small.back(), l = large.back();
+			small.pop_back();
+			alias.prob[s] = scaled[s];
+			alias.index[s] = l;
+			scaled[l] -= 1. - scaled[s];
+			if (scaled[l] < 1.)
+			{
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		for (auto i : large)
+			alias.prob[i] = 1.;
+		for (auto i : small)       // rounding leftovers
+			alias.prob[i] = 1.;
+	}
 };
 
 #endif
@@ -25,7 +25,7 @@ CanBus::CanBus(QString device, int baudRate)
 */
 CanBus::~CanBus()
 {
-	
+	stopRx();
 }
 /// PRIVATE METHODS
 int CanBus::setBaudRate(int baudRate)
@@ -72,6 +72,21 @@ int CanBus::writeWaitReadMessage(VSCAN_MSG* msg)
 //	printf("------------------------------------\n");
 //	printf("Write messages\n");
 //	printMessageData(*msg);
+	if (rxRunning())
+	{
+		uint32_t key;
+		if (not requestKey(*msg, key))
+			return send(msg, 1) == 0 ? 1 : -1;
+		CanResponse r = request(*msg).get();
+		if (not r.ok)
+		{
+			printf("writeWaitReadMessage() ERROR: No se pudo leer la respuesta al comando enviado\n");
+			printMessageData(*msg);
+			return -1;
+		}
+		*msg = r.msg;
+		return 1;
+	}
 
     int status = VSCAN_Write(devHandler,msg,1,&written);
 	VSCAN_Flush(devHandler);
@@ -122,6 +137,26 @@ int CanBus::multiWriteWaitReadMessage(VSCAN_MSG* msgs, int msg_count)
 	VSCAN_MSG sended_msgs[msg_count] , readed_msgs[msg_count];
 	memcpy(sended_msgs, msgs, sizeof(VSCAN_MSG)*msg_count);
 		
+	if (rxRunning())
+	{
+		// every response goes to the position of its request
+		std::vector<std::future<CanResponse>> responses = request(msgs, msg_count);
+		int result = 1;
+		for (int i=0; i<msg_count; i++)
+		{
+			CanResponse r = responses[i].get();
+			if (r.ok)
+				msgs[i] = r.msg;
+			else
+			{
+				printf("multiWriteWaitReadMessage() ERROR: No se pudo leer la respuesta al comando enviado\n");
+				printMessageData(sended_msgs[i]);
+				result = -1;
+			}
+		}
+		return result;
+	}
+
 	QVector<VSCAN_MSG> cmds_tocheck;
 	for(int x=0;x<msg_count;x++)
 		cmds_tocheck.push_back(msgs[x] );
@@ -290,3 +325,195 @@ int CanBus::readIntegerResponse(VSCAN_MSG msg)
 	return result;
 }
 
+
+/// ASYNCHRONOUS TRANSACTIONS
+
+bool CanBus::requestKey(const VSCAN_MSG &request, uint32_t &key)
+{
+	const uint32_t function = request.Id & 0x780, node = request.Id & 0x7F;
+	if (function == 0x600 and request.Size >= 3)            // SDO: answered on 0x580 with the same object index
+		key = ((0x580 | node) << 16) | (request.Data[2] << 8) | request.Data[1];
+	else if (function == 0x300 and request.Size >= 1)       // Faulhaber command: answered on 0x280 with the command
+		key = ((0x280 | node) << 16) | request.Data[0];
+	else
+		return false;
+	return true;
+}
+
+bool CanBus::responseKey(const VSCAN_MSG &response, uint32_t &key)
+{
+	const uint32_t function = response.Id & 0x780, node = response.Id & 0x7F;
+	if (function == 0x580 and response.Size >= 3)
+		key = ((0x580 | node) << 16) | (response.Data[2] << 8) | response.Data[1];
+	else if (function == 0x280 and response.Size >= 1)
+		key = ((0x280 | node) << 16) | response.Data[0];
+	else
+		return false;
+	return true;
+}
+
+/**
+* \brief Starts the reception thread. The bus is read every pollMicroseconds while it is idle, and again at once
+* after every message.
+*/
+bool CanBus::startRx(int pollMicroseconds)
+{
+	if (rxRunning())
+		return true;
+	rxPoll = pollMicroseconds;
+	rxStop = false;
+	rxThread = std::thread(&CanBus::rxLoop, this);
+	return true;
+}
+
+/**
+* \brief Stops the reception thread. The requests still waiting are answered with ok = false.
+*/
+void CanBus::stopRx()
+{
+	if (not rxRunning())
+		return;
+	rxStop = true;
+	rxThread.join();
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	for (auto &p : pending)
+		p.second.promise.set_value(CanResponse{false, VSCAN_MSG()});
+	pending.clear();
+	expired.clear();
+}
+
+void CanBus::setRxCallback(std::function<void(const VSCAN_MSG &)> callback)
+{
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	rxCallback = callback;
+}
+
+int CanBus::writeMessages(const VSCAN_MSG *msgs, int count)
+{
+	DWORD written;
+	std::lock_guard<std::mutex> lock(deviceMutex);
+	int status = VSCAN_Write(devHandler, const_cast<VSCAN_MSG *>(msgs), count, &written);
+	VSCAN_Flush(devHandler);
+	return status;
+}
+
+int CanBus::send(const VSCAN_MSG *msgs, int count)
+{
+	return writeMessages(msgs, count);
+}
+
+std::future<CanResponse> CanBus::request(const VSCAN_MSG &msg, int timeoutMs)
+{
+	return std::move(request(&msg, 1, timeoutMs)[0]);
+}
+
+/**
+* \brief Writes all the messages at once and returns a future per message. The requests are registered before
+* writing, so a fast response can not be missed. Messages with no response are completed when written.
+*/
+std::vector<std::future<CanResponse>> CanBus::request(const VSCAN_MSG *msgs, int count, int timeoutMs)
+{
+	std::vector<std::future<CanResponse>> futures(count);
+	std::vector<uint64_t> ids(count, 0);
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		for (int i=0; i<count; i++)
+		{
+			uint32_t key;
+			if (requestKey(msgs[i], key))
+			{
+				auto it = pending.emplace(key, Pending());
+				it->second.deadline = std::chrono::steady_clock::time_point::max();   // not before it is written
+				it->second.id = ids[i] = ++lastRequest;
+				futures[i] = it->second.promise.get_future();
+			}
+		}
+	}
+	const bool written = writeMessages(msgs, count) == 0;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	for (int i=0; i<count; i++)
+	{
+		uint32_t key;
+		if (ids[i] == 0)
+		{
+			std::promise<CanResponse> done;
+			futures[i] = done.get_future();
+			done.set_value(CanResponse{written, msgs[i]});
+			continue;
+		}
+		requestKey(msgs[i], key);
+		auto range = pending.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it)
+			if (it->second.id == ids[i])    // still waiting
+			{
+				if (written)
+				{
+					it->second.deadline = deadline;
+					it->second.timeout = std::chrono::milliseconds(timeoutMs);
+				}
+				else
+				{
+					it->second.promise.set_value(CanResponse{false, msgs[i]});
+					pending.erase(it);
+				}
+				break;
+			}
+	}
+	if (not written)
+		printf("CanBus::request() ERROR: El comando no se escribio correctamente\n");
+	return futures;
+}
+
+void CanBus::rxLoop()
+{
+	VSCAN_MSG received[64];
+	while (not rxStop)
+	{
+		DWORD read = 0;
+		int status;
+		{
+			std::lock_guard<std::mutex> lock(deviceMutex);
+			status = VSCAN_Read(devHandler, received, 64, &read);
+		}
+		if (status != 0)
+			read = 0;
+		{
+			const auto now = std::chrono::steady_clock::now();
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			for (DWORD i=0; i<read; i++)
+			{
+				uint32_t key;
+				const bool response = responseKey(received[i], key);
+				if (auto late = response ? expired.lower_bound(key) : expired.end(); late != expired.end() and late->first == key)
+				{
+					expired.erase(late);    // answers a request that timed out, the oldest one
+					continue;
+				}
+				auto it = response ? pending.lower_bound(key) : pending.end();   // the oldest request
+				if (it != pending.end() and it->first == key)
+				{
+					it->second.promise.set_value(CanResponse{true, received[i]});
+					pending.erase(it);
+				}
+				else if (rxCallback)
+					rxCallback(received[i]);
+			}
+			for (auto it = pending.begin(); it != pending.end(); )
+			{
+				if (it->second.deadline < now)
+				{
+					it->second.promise.set_value(CanResponse{false, VSCAN_MSG()});
+					expired.emplace(it->first, now + it->second.timeout);
+					it = pending.erase(it);
+				}
+				else
+					++it;
+			}
+			for (auto it = expired.begin(); it != expired.end(); )
+				it = it->second < now ? expired.erase(it) : std::next(it);
+		}
+		if (read == 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(rxPoll));
+	}
+}
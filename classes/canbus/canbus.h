@@ -26,6 +26,15 @@
 #include <limits.h>
 #include <QtCore>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <qlog/qlog.h>
 
 //DEVICE MODES
@@ -37,6 +46,12 @@
 
 #define MAX_READ_RETRIES 20
 
+// Result of an asynchronous transaction: ok is false if no response arrived before the timeout
+struct CanResponse
+{
+	bool ok;
+	VSCAN_MSG msg;
+};
 
 class CanBus
 {
@@ -56,13 +71,49 @@ class CanBus
 	int readIntegerResponse(VSCAN_MSG msg);
 	
 	int checkMessage(VSCAN_MSG* send, VSCAN_MSG* received);
+
+	// Asynchronous transactions. A reception thread reads the bus and completes the outstanding request that each
+	// message answers: SDO requests (0x600 + node) by the node and object index of the 0x580 response, Faulhaber
+	// commands (0x300 + node) by the node and command byte of the 0x280 response. Any number of requests can be in
+	// flight; those waiting for the same response are answered in order. While the thread runs,
+	// writeWaitReadMessage() and multiWriteWaitReadMessage() go through it.
+	// A request that times out still expects its response for one more timeout: the first response with its key in
+	// that window is dropped, so that it does not answer the next request for the same node and index.
+	bool startRx(int pollMicroseconds = 100);
+	void stopRx();
+	inline bool rxRunning() const { return rxThread.joinable(); }
+	std::future<CanResponse> request(const VSCAN_MSG &msg, int timeoutMs = 40);
+	std::vector<std::future<CanResponse>> request(const VSCAN_MSG *msgs, int count, int timeoutMs = 40);
+	// Messages that expect no response (NMT, SYNC, PDOs...), written and flushed at once
+	int send(const VSCAN_MSG *msgs, int count);
+	// Called from the reception thread with the messages that answer no request. It must not make requests.
+	void setRxCallback(std::function<void(const VSCAN_MSG &)> callback);
 	
 //   private:
 	int devHandler;
-	
 
-	
-	
+  private:
+	// transaction key of the response to 'request', false if it has none; and of a received message
+	static bool requestKey(const VSCAN_MSG &request, uint32_t &key);
+	static bool responseKey(const VSCAN_MSG &response, uint32_t &key);
+	void rxLoop();
+	int writeMessages(const VSCAN_MSG *msgs, int count);
+
+	struct Pending
+	{
+		std::promise<CanResponse> promise;
+		std::chrono::steady_clock::time_point deadline;
+		std::chrono::milliseconds timeout;
+		uint64_t id;
+	};
+	std::mutex deviceMutex, pendingMutex;
+	std::multimap<uint32_t, Pending> pending;
+	std::multimap<uint32_t, std::chrono::steady_clock::time_point> expired;    // late responses to drop, until then
+	uint64_t lastRequest = 0;
+	std::function<void(const VSCAN_MSG &)> rxCallback;
+	std::thread rxThread;
+	std::atomic_bool rxStop{false};
+	int rxPoll = 100;
 };
 
 
@@ -7,13 +7,15 @@ FaulHaberApi::FaulHaberApi(QString device, int baudRate) : CanBus(device, baudRa
 {
 	printf("FaulHaberApi: %s %d\n", device.toStdString().c_str(), baudRate);
 	//qDebug()<<"binario"<<QString::number(16,2);
+	for (int i=0; i<128; i++)
+		cyclicSlot[i] = -1;
 }
 /**
 * \brief Default destructor
 */
 FaulHaberApi::~FaulHaberApi()
 {
-	
+	stopCyclic();
 }
 
 void FaulHaberApi::Init_Node(int id)
@@ -77,6 +79,11 @@ int FaulHaberApi::getPosition(int id)
 	}
 }
 
+std::future<CanResponse> FaulHaberApi::getPositionAsync(int id)
+{
+	return request(buildMessageData(0x300,id,8,0x40,0x0000,0x00,0x00000000));
+}
+
 int FaulHaberApi::getPositionExternalEncoder(int id)
 {
 
@@ -110,6 +117,18 @@ void FaulHaberApi::setInternalEncoderValue(int id, int value)
 
 int FaulHaberApi::syncGetPosition(int node_count,int* nodeIds,int* positions)
 {
+	if (cyclicRunning())
+	{
+		const FaulHaberCyclicState state = cyclicState();
+		for (int count=0;count<node_count;count++)
+		{
+			const int slot = nodeIds[count] >= 0 and nodeIds[count] < 128 ? cyclicSlot[nodeIds[count]] : -1;
+			if (slot < 0 or state.cycle[slot] == 0)
+				return -1;
+			positions[count] = state.positions[slot];
+		}
+		return 1;
+	}
 
 	for(int count=0;count<node_count;count++)
 	{
@@ -147,6 +166,12 @@ void FaulHaberApi::setPosition(int id, int position)
 
 int FaulHaberApi::syncSetPosition(int node_count,int* nodeIds,int* positions)
 {
+	if (cyclicRunning() and not cyclicVelocity)
+	{
+		for(int count=0;count<node_count;count++)
+			setCyclicTarget(nodeIds[count], positions[count]);
+		return 2;
+	}
 	for(int count=0;count<node_count;count++)
 	{
 		qDebug()<<"sync"<<nodeIds[count]<<positions[count];
@@ -203,6 +228,12 @@ int FaulHaberApi::setVelocity(int id, int vel)
 }
 int FaulHaberApi::syncSetVelocity(int node_count,int* nodeIds,int* velocities)
 {
+	if (cyclicRunning() and cyclicVelocity)
+	{
+		for(int count=0;count<node_count;count++)
+			setCyclicTarget(nodeIds[count], velocities[count]);
+		return 1;
+	}
 	for(int count=0;count<node_count;count++)
 	{
 		msgs[count] = buildMessageData(WriteObjectId,nodeIds[count],8,0x23,0x6084,0x00,velocities[count]);//set position
@@ -307,3 +338,188 @@ void FaulHaberApi::resetBus()
 	sleep(5);
 }
 
+
+/// CYCLIC MODE
+
+int FaulHaberApi::writeObject(int id, uint16_t index, uint8_t subindex, uint8_t bytes, uint32_t value)
+{
+	const uint8_t command = bytes == 1 ? 0x2F : bytes == 2 ? 0x2B : 0x23;
+	VSCAN_MSG m = buildMessageData(WriteObjectId,id,8,command,index,subindex,value);
+	return writeWaitReadMessage(&m) == 1 ? 0 : -1;
+}
+
+/**
+* \brief Maps the PDOs of the nodes, sets the cyclic synchronous mode and starts the SYNC thread
+*/
+bool FaulHaberApi::startCyclic(int node_count, int* nodeIds, bool velocityMode, int periodUs)
+{
+	if (cyclicRunning() or node_count < 1 or node_count > MAX_MOTORS)
+		return false;
+	cyclicVelocity = velocityMode;
+	cyclicPeriod = periodUs;
+	cyclicCount = node_count;
+	for (int i=0; i<128; i++)
+		cyclicSlot[i] = -1;
+	cyclicOwnsRx = not rxRunning();
+	startRx();
+
+	int errors = 0, configured = 0;
+	for (int i=0; i<node_count; i++, configured++)
+	{
+		const int id = nodeIds[i];
+		cyclicNodes[i] = id;
+		cyclicSlot[id & 0x7F] = i;
+		targets[i] = 0;
+		statePositions[i] = 0;
+		stateVelocities[i] = 0;
+		stateCycle[i] = 0;
+
+		VSCAN_MSG nmt = buildRawMessageData(CanOpenId,2,0x80,id,0,0,0,0,0,0);  // pre-operational
+		send(&nmt, 1);
+		// TPDO3: actual position (0x6064) and velocity (0x606C), sent on every SYNC
+		errors += writeObject(id, 0x1802, 1, 4, 0x80000000 | (CyclicTxPdoId + id));
+		errors += writeObject(id, 0x1A02, 0, 1, 0);
+		errors += writeObject(id, 0x1A02, 1, 4, 0x60640020);
+		errors += writeObject(id, 0x1A02, 2, 4, 0x606C0020);
+		errors += writeObject(id, 0x1A02, 0, 1, 2);
+		errors += writeObject(id, 0x1802, 2, 1, 1);
+		errors += writeObject(id, 0x1802, 1, 4, CyclicTxPdoId + id);
+		// RPDO3: target position (0x607A) or velocity (0x60FF), applied on SYNC
+		errors += writeObject(id, 0x1402, 1, 4, 0x80000000 | (CyclicRxPdoId + id));
+		errors += writeObject(id, 0x1602, 0, 1, 0);
+		errors += writeObject(id, 0x1602, 1, 4, velocityMode ? 0x60FF0020 : 0x607A0020);
+		errors += writeObject(id, 0x1602, 0, 1, 1);
+		errors += writeObject(id, 0x1402, 2, 1, 1);
+		errors += writeObject(id, 0x1402, 1, 4, CyclicRxPdoId + id);
+		// communication cycle period and cyclic synchronous position (8) or velocity (9) mode
+		errors += writeObject(id, 0x1006, 0, 4, periodUs);
+		errors += writeObject(id, 0x6060, 0, 1, velocityMode ? 9 : 8);
+		if (not velocityMode)
+		{
+			// the first targets hold the current positions
+			const int position = getPosition(id);
+			if (position != -1)
+				targets[i] = position;
+		}
+		nmt = buildRawMessageData(CanOpenId,2,0x01,id,0,0,0,0,0,0);            // operational
+		send(&nmt, 1);
+	}
+	if (errors != 0)
+	{
+		printf("FaulHaberApi::startCyclic() ERROR: %d objects could not be written\n", -errors);
+		cyclicTeardown(configured);
+		return false;
+	}
+	setRxCallback([this](const VSCAN_MSG &pdo) { cyclicReceived(pdo); });
+	cyclicStop = false;
+	cyclicThread = std::thread(&FaulHaberApi::cyclicLoop, this);
+	return true;
+}
+
+void FaulHaberApi::stopCyclic()
+{
+	if (not cyclicRunning())
+		return;
+	cyclicTeardown(cyclicCount);
+}
+
+/**
+* \brief Undoes startCyclic() for the first 'configured' nodes: stops the SYNC thread, disables their PDO3 and stops
+* the reception thread if startCyclic() started it. The mode of operation is left as it is.
+*/
+void FaulHaberApi::cyclicTeardown(int configured)
+{
+	if (cyclicThread.joinable())
+	{
+		cyclicStop = true;
+		cyclicThread.join();
+	}
+	setRxCallback(std::function<void(const VSCAN_MSG &)>());
+	for (int i=0; i<configured; i++)
+	{
+		const int id = cyclicNodes[i];
+		writeObject(id, 0x1802, 1, 4, 0x80000000 | (CyclicTxPdoId + id));
+		writeObject(id, 0x1402, 1, 4, 0x80000000 | (CyclicRxPdoId + id));
+	}
+	for (int i=0; i<128; i++)
+		cyclicSlot[i] = -1;
+	cyclicCount = 0;
+	if (cyclicOwnsRx)
+		stopRx();
+	cyclicOwnsRx = false;
+}
+
+void FaulHaberApi::setCyclicTarget(int id, int target)
+{
+	if (not cyclicRunning())
+		return;
+	const int slot = id >= 0 and id < 128 ? cyclicSlot[id] : -1;
+	if (slot >= 0)
+		targets[slot].store(target, std::memory_order_relaxed);
+}
+
+/**
+* \brief Copy of the last TPDO values, free of locks: the copy is repeated if the RX thread wrote meanwhile
+*/
+FaulHaberCyclicState FaulHaberApi::cyclicState() const
+{
+	FaulHaberCyclicState state;
+	state.node_count = cyclicCount;
+	uint64_t before, after;
+	do
+	{
+		before = stateSequence.load(std::memory_order_acquire);
+		for (int i=0; i<cyclicCount; i++)
+		{
+			state.nodeIds[i] = cyclicNodes[i];
+			state.positions[i] = statePositions[i].load(std::memory_order_relaxed);
+			state.velocities[i] = stateVelocities[i].load(std::memory_order_relaxed);
+			state.cycle[i] = stateCycle[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = stateSequence.load(std::memory_order_relaxed);
+	} while (before != after or (before & 1));
+	return state;
+}
+
+// RX thread: a TPDO3 of a cyclic node
+void FaulHaberApi::cyclicReceived(const VSCAN_MSG &pdo)
+{
+	if ((pdo.Id & 0x780) != CyclicTxPdoId or pdo.Size < 8)
+		return;
+	const int slot = cyclicSlot[pdo.Id & 0x7F];
+	if (slot < 0)
+		return;
+	const int32_t position = pdo.Data[0] | (pdo.Data[1] << 8) | (pdo.Data[2] << 16) | (uint32_t(pdo.Data[3]) << 24);
+	const int32_t velocity = pdo.Data[4] | (pdo.Data[5] << 8) | (pdo.Data[6] << 16) | (uint32_t(pdo.Data[7]) << 24);
+	const uint64_t sequence = stateSequence.load(std::memory_order_relaxed);
+	stateSequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	statePositions[slot].store(position, std::memory_order_relaxed);
+	stateVelocities[slot].store(velocity, std::memory_order_relaxed);
+	stateCycle[slot].store(syncCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	stateSequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Every period: the RPDOs with the targets and the SYNC, in one write
+void FaulHaberApi::cyclicLoop()
+{
+	VSCAN_MSG frames[MAX_MOTORS + 1];
+	auto next = std::chrono::steady_clock::now();
+	while (not cyclicStop)
+	{
+		for (int i=0; i<cyclicCount; i++)
+		{
+			const uint32_t target = targets[i].load(std::memory_order_relaxed);
+			frames[i] = buildRawMessageData(CyclicRxPdoId + cyclicNodes[i], 4, target & 0xFF, (target >> 8) & 0xFF, (target >> 16) & 0xFF, target >> 24, 0, 0, 0, 0);
+		}
+		frames[cyclicCount] = buildRawMessageData(SyncId, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		syncCount.fetch_add(1, std::memory_order_relaxed);
+		send(frames, cyclicCount + 1);
+		next += std::chrono::microseconds(cyclicPeriod);
+		const auto now = std::chrono::steady_clock::now();
+		if (next < now)
+			next = now;     // overrun: do not try to catch up
+		std::this_thread::sleep_until(next);
+	}
+}
@@ -31,6 +31,21 @@
 
 #define MAX_MOTORS 8
 
+// CANopen cyclic mode
+#define SyncId 0x080
+#define CyclicTxPdoId 0x380      // TPDO3: actual position and velocity
+#define CyclicRxPdoId 0x400      // RPDO3: target position or velocity
+
+// Last values received in cyclic mode. cycle[i] is the SYNC cycle of the last TPDO of nodeIds[i] (0: none yet).
+struct FaulHaberCyclicState
+{
+	int node_count;
+	int nodeIds[MAX_MOTORS];
+	int positions[MAX_MOTORS];
+	int velocities[MAX_MOTORS];
+	uint64_t cycle[MAX_MOTORS];
+};
+
 class FaulHaberApi : public CanBus
 {
   public:
@@ -41,6 +56,8 @@ class FaulHaberApi : public CanBus
 	//Position
 	int getPosition(int id);
 	int getPositionExternalEncoder(int id);
+	// Needs startRx(): the position is readIntegerResponse() of the response
+	std::future<CanResponse> getPositionAsync(int id);
 	int syncGetPosition(int node_count,int* nodeIds,int* positions);//probar
 	void setPosition(int id, int position);
 	int syncSetPosition(int node_count,int* nodeIds,int* positions);//probar
@@ -81,9 +98,39 @@ class FaulHaberApi : public CanBus
 	//Faulhaber Specific command
 	VSCAN_MSG buildFaulhaberCommand(uint8_t nodeId,uint8_t CommandSpecifier, uint32_t obj_data);
 
+	// Cyclic mode (CiA 402 cyclic synchronous position or velocity). Through SDO, TPDO3 of every node is mapped to the
+	// actual position and velocity and RPDO3 to the target, both synchronous; then a thread sends the targets and a
+	// SYNC every periodUs. The TPDOs are stored in a snapshot that readers copy without locks. While it runs
+	// syncGetPosition() reads the snapshot and syncSetPosition() / syncSetVelocity() only change the targets.
+	bool startCyclic(int node_count, int* nodeIds, bool velocityMode = false, int periodUs = 1000);
+	void stopCyclic();
+	inline bool cyclicRunning() const { return cyclicThread.joinable(); }
+	FaulHaberCyclicState cyclicState() const;
+	void setCyclicTarget(int id, int target);
+
   private:
 	VSCAN_MSG msg,msgs[MAX_MOTORS];
 
+	int writeObject(int id, uint16_t index, uint8_t subindex, uint8_t bytes, uint32_t value);
+	void cyclicLoop();
+	void cyclicReceived(const VSCAN_MSG &pdo);
+	void cyclicTeardown(int configured);
+
+	std::thread cyclicThread;
+	std::atomic_bool cyclicStop{false};
+	int cyclicPeriod = 1000;
+	bool cyclicVelocity = false;
+	int cyclicCount = 0;
+	bool cyclicOwnsRx = false;                    // the reception thread was started by startCyclic()
+	int cyclicNodes[MAX_MOTORS];
+	int cyclicSlot[128];                          // node id -> position in cyclicNodes, -1 if not cyclic
+	std::atomic<int32_t> targets[MAX_MOTORS];
+	std::atomic<uint64_t> syncCount{0};
+	// seqlock: odd while the RX thread writes
+	std::atomic<uint64_t> stateSequence{0};
+	std::atomic<int32_t> statePositions[MAX_MOTORS], stateVelocities[MAX_MOTORS];
+	std::atomic<uint64_t> stateCycle[MAX_MOTORS];
+
 	
 	
 };
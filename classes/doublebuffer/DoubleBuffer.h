@@ -10,6 +10,10 @@
 //      decl: DoubleBuffer<RoboCompLaser::TLaserData, RoboCompLaser::TLaserData> laser_buffer;
 //      use:  laser_buffer.put(std::move(laserData), [](auto &&I, auto &T){ for(auto &&i , I){ T.append(i/2);}});
 //      decl: auto rgb_buffer = new DoubleBuffer<std::vector<std::uint8_t>, cv:::Mat>(std::chrono::milliseconds(100));
+// Example of a wait-free triple buffer for one producer and one consumer (the latest value wins). The published buffer is
+// exchanged with an atomic index, so try_get() and is_empty() ("no new data") never lock:
+//      decl: DoubleBuffer<RoboCompLaser::TLaserData, RoboCompLaser::TLaserData, TripleBuffer> laser_buffer;
+//      use:  if (auto ldata = laser_buffer.try_get(); ldata.has_value()) ...
 
 
 #ifndef DOUBLEBUFFER_H
@@ -25,6 +29,9 @@
 #include <future>
 #include "threadpool/threadpool.h"
 #include <optional>
+#include <array>
+#include <cstdint>
+#include <variant>
 
 using namespace std::chrono_literals;
 
@@ -41,7 +48,39 @@ struct is_iterable<T, std::void_t<decltype(std::declval<T>().begin()), decltype(
 {
 };
 
-template <class I, class O>
+// Modes of DoubleBuffer: SwapBuffers swaps a read and a write buffer under a shared_mutex (any number of readers),
+// TripleBuffer is wait-free for one producer and one consumer.
+struct SwapBuffers {};
+struct TripleBuffer {};
+
+// Wait-free single-producer single-consumer triple buffer. The producer writes in its own slot and publishes it by
+// exchanging it with the middle one; the consumer takes the middle slot only if it holds data that was not read yet.
+template <class T>
+class triple_buffer
+{
+    public:
+        T &write_slot() { return slots[back]; }
+        void publish() { back = middle.exchange(back | fresh_bit) & index_mask; }
+
+        // true if there is a published slot that the consumer has not taken yet
+        bool fresh() const { return middle.load() & fresh_bit; }
+        bool acquire()
+        {
+            if (!fresh())
+                return false;
+            front = middle.exchange(front) & index_mask;
+            return true;
+        }
+        const T &read_slot() const { return slots[front]; }
+
+    private:
+        static constexpr std::uint8_t fresh_bit = 4, index_mask = 3;
+        std::array<T, 3> slots;
+        std::uint8_t back = 0, front = 1;
+        std::atomic<std::uint8_t> middle{2};
+};
+
+template <class I, class O, class Mode = SwapBuffers>
 class DoubleBuffer
 {
     private:
@@ -55,8 +94,32 @@ class DoubleBuffer
         O &readBuffer;// = bufferA;
         O &writeBuffer;// = bufferB;
         std::atomic_bool empty;// = true;
+
+        // TripleBuffer mode only
+        static constexpr bool triple_mode = std::is_same_v<Mode, TripleBuffer>;
+        std::conditional_t<triple_mode, triple_buffer<O>, std::monostate> triple;
+        std::atomic_int waiters{0};
+        bool has_read = false;
+
+        // observer of the puts (see set_tap)
+        std::function<void(const I &)> tap;
+
+        // declared last so that its threads are joined before the buffers are destroyed
         ThreadPool worker;
 
+        // TripleBuffer mode: blocks until there is new data (or any data, if 'any' and something was read before)
+        bool wait_triple(std::chrono::milliseconds t, bool any)
+        {
+            if (triple.acquire() or (any and has_read))
+                return has_read = true;
+            std::unique_lock lock(bufferMutex);
+            waiters++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool ok = cv.wait_until(lock, std::chrono::steady_clock::now() + t, [this]() { return triple.fresh(); });
+            waiters--;
+            return ok and (has_read = triple.acquire());
+        }
+
     public:
         DoubleBuffer() : write_freq(0us), readBuffer(bufferA), writeBuffer(bufferB), empty(true), worker(1) {};
         explicit DoubleBuffer(std::chrono::milliseconds t) : write_freq(std::chrono::duration_cast<std::chrono::microseconds>(t)),
@@ -64,6 +127,7 @@ class DoubleBuffer
                                                              worker(1) {};
 
         ~DoubleBuffer() {};
+        using input_type = I;
         void set_write_freq(const std::chrono::milliseconds &freq)
         {
             write_freq = std::chrono::duration_cast<std::chrono::microseconds>(freq);
@@ -71,6 +135,12 @@ class DoubleBuffer
 
         // Waits for the buffer to be filled before retrieving its content
         O get(std::chrono::milliseconds t = 200ms ) {
+            if constexpr (triple_mode)
+            {
+                if (!wait_triple(t, false))
+                    throw std::runtime_error("Timeout");
+                return triple.read_slot();
+            }
             std::shared_lock lock(bufferMutex);
 
             //cambiar esto cuando se implemente atomic wait/notify
@@ -86,6 +156,12 @@ class DoubleBuffer
        // Retrieves the buffer's content without setting it empty or checking that it is filled up
        O get_idemp(std::chrono::milliseconds t = 200ms )
        {
+           if constexpr (triple_mode)
+           {
+               if (!wait_triple(t, true))
+                   throw std::runtime_error("Timeout");
+               return triple.read_slot();
+           }
             std::shared_lock lock(bufferMutex);
            if (!cv.wait_until(bufferMutex,
                               std::chrono::steady_clock::now() + t ,
@@ -97,6 +173,13 @@ class DoubleBuffer
 
        std::optional<O> try_get()
        {
+           if constexpr (triple_mode)
+           {
+               if (!triple.acquire())
+                   return {};
+               has_read = true;
+               return triple.read_slot();
+           }
            if (empty.load()){
                return {};
            }
@@ -106,9 +189,11 @@ class DoubleBuffer
            return readBuffer;
        }
 
-       // checks if the buffer is filled up
+       // checks if the buffer is filled up (in TripleBuffer mode, if there is no new data)
        bool is_empty() const
        {
+           if constexpr (triple_mode)
+               return !triple.fresh();
            return empty.load();
        }
 
@@ -138,8 +223,17 @@ class DoubleBuffer
             };
         }*/
 
+        // Called by put() in the producer's thread with every value, before the write_freq check (StreamRecorder uses it
+        // to log the stream, see streamlog.h). Set it before the producer starts.
+        void set_tap(std::function<void(const I &)> t)
+        {
+            tap = std::move(t);
+        }
+
         bool put(I &&d, std::function<void(I &&, O &)> t = empty_fn)
         {
+            if (tap)
+                tap(d);
             auto now = std::chrono::steady_clock::now();
             if (std::chrono::duration_cast<std::chrono::microseconds>(now - last_write)  > write_freq) {
 
@@ -148,6 +242,20 @@ class DoubleBuffer
                     O temp;
                     if (this->ItoO(std::move(d), temp, t))
                     {
+                        if constexpr (triple_mode)
+                        {
+                            // the worker is the only producer
+                            triple.write_slot() = std::move(temp);
+                            triple.publish();
+                            // wait-free unless a reader sleeps: it counts itself before checking for a fresh slot
+                            std::atomic_thread_fence(std::memory_order_seq_cst);
+                            if (waiters.load() > 0)
+                            {
+                                { std::unique_lock lock(this->bufferMutex); }
+                                cv.notify_all();
+                            }
+                            return;
+                        }
                         std::unique_lock lock(this->bufferMutex);
                         this->writeBuffer = std::move(temp);
                         std::swap(writeBuffer, readBuffer);
@@ -36,6 +36,29 @@
 // and allows passing a max_time_diff to consider two values part of the same
 // time group.
 //
+// Each read has a '_shared' version that returns std::shared_ptr<const O> views instead of copies (nullptr where the
+// optional would be empty). Several consumers can share the same stored value and it is kept alive until the last
+// view is released, even after the queue has dropped it.
+//
+//           auto [laser, str] = buffer.read_last_shared();  Same as read_last() without copying the values.
+//
+// Instead of polling read(timestamp, max_diff), a callback can be registered to be called on the pool each time a
+// new set of samples, one per queue, falls within max_diff. Every sample is delivered at most once:
+//
+//          buffer.on_sync(20ms, [](const auto &views){ auto &[laser, str] = views; ... });
+//
+// Each queue is a fixed-capacity ring of 'size' slots. With 'reuse' enabled the payload objects are preallocated
+// and recycled in place: a put writes into the oldest slot (when no reader holds a view of it) instead of building a
+// new object, so vector capacity and image buffers are kept between puts and a full queue does no heap traffic.
+// Default conversions of iterable types use 'assign' on the recycled object; for other types (cv::Mat, ...) pass a
+// converter that writes into the existing object.
+//
+//      decl:
+//          BufferSync<InOut<RoboCompLidar3D::TData, RoboCompLidar3D::TData>> lidar_buffer(5, true);
+//      use:
+//          lidar_buffer.put<0>(std::move(data), timestamp, [](auto &&I, auto &T){ T.points.assign(I.points.begin(), I.points.end()); });
+//          cam_buffer.put<0>(std::move(frame), timestamp, [](auto &&I, auto &T){ I.copyTo(T); });
+//
 // Example of Buffer creation with user-defined converter (lambda) from input  to output types:
 //
 //      decl:
@@ -47,14 +70,15 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <deque>
 #include <ranges>
 #include <shared_mutex>
 #include <type_traits>
@@ -119,6 +143,50 @@ concept printable = requires(T t) {
  */
 constexpr auto empty_fn = [](auto &&I, auto &T) {};
 
+/**
+ * 'sync_ring' is the fixed-capacity circular queue used by BufferSync for each data source.
+ * Index 0 is the oldest element. Slots are never destroyed by pop_front, they keep their value until they are
+ * overwritten, so the owner can recycle them through 'next_slot'. It does not allocate after construction.
+ */
+template <typename T>
+class sync_ring
+{
+    public:
+        explicit sync_ring(size_t capacity = 1) : slots(std::max<size_t>(capacity, 1)) {}
+
+        size_t size() const { return count; }
+        size_t capacity() const { return slots.size(); }
+        bool empty() const { return count == 0; }
+        T &operator[](size_t i) { return slots[(head + i) % slots.size()]; }
+        const T &operator[](size_t i) const { return slots[(head + i) % slots.size()]; }
+        T &front() { return (*this)[0]; }
+        const T &front() const { return (*this)[0]; }
+        T &back() { return (*this)[count - 1]; }
+        const T &back() const { return (*this)[count - 1]; }
+
+        // slot that the next push_back will write (the oldest element when the ring is full)
+        T &next_slot() { return slots[(head + count) % slots.size()]; }
+
+        void pop_front()
+        {
+            head = (head + 1) % slots.size();
+            --count;
+        }
+
+        void push_back(T &&v)
+        {
+            if (count == slots.size())
+                pop_front();
+            next_slot() = std::move(v);
+            ++count;
+        }
+
+    private:
+        std::vector<T> slots;
+        size_t head = 0;
+        size_t count = 0;
+};
+
 // Auxiliary templated struct to hold individual input/output buffer declarations
 template <typename _I, typename _O>
 struct InOut
@@ -139,8 +207,8 @@ struct InOut
 template <class... DBs> class BufferSync
 {
     private:
-        template <typename T> using pair_t_time = std::pair<T, size_t>;
-        template <typename T> using deque_db_t = std::deque<pair_t_time<T>>;
+        template <typename T> using pair_t_time = std::pair<std::shared_ptr<T>, size_t>;
+        template <typename T> using deque_db_t = sync_ring<pair_t_time<T>>;
 
         /**
         * 'DBs_size' is a static constexpr (constant expression) of type size_t. It is initialized with the number of types in the template parameter pack 'DBs'.
@@ -151,18 +219,25 @@ template <class... DBs> class BufferSync
         static constexpr size_t DBs_size = sizeof...(DBs);
 
         /**
-        * '_out' is a tuple of deques, where each deque is of (output)  type 'deque_db_t<typename DBs::O>'.
+        * '_out' is a tuple of queues, where each queue is of (output)  type 'deque_db_t<typename DBs::O>'.
         * 'DBs' is a parameter pack representing the types of data that can be stored in the buffer.
         * Each type in 'DBs' is expected to be an instance of the 'InOut' template struct, which represents a pair of input and output types.
-        * 'deque_db_t<typename DBs::O>' is a deque that stores pairs, where each pair consists of an output type and a timestamp.
+        * 'deque_db_t<typename DBs::O>' is a ring (see 'sync_ring') that stores pairs, where each pair consists of an output type and a timestamp.
         * This tuple '_out' is used to store the output data for each type in 'DBs'. Each output data is associated with a timestamp.
-        * The data is stored in a deque to allow efficient insertion and removal of elements at both ends.
+        * The ring has a fixed capacity of 'queue_size' elements, so inserting at the back and dropping the front never allocates.
         */
         std::tuple<deque_db_t<typename DBs::O>...> _out;
-        std::array<size_t, DBs_size> last_write;
+        std::array<std::atomic<size_t>, DBs_size> last_write;
 
-        mutable std::shared_mutex bufferMutex;
-        std::atomic_bool empty;
+        /**
+        * Each queue has its own lock, so puts to different queues (and their conversions) run concurrently and a read
+        * only takes the locks of the queues it touches. 'tickets' and 'committed' keep the insertion order of the puts
+        * of each queue when the pool has several threads: a put waits for its turn only to insert the converted value.
+        */
+        mutable std::array<std::shared_mutex, DBs_size> streamMutex;
+        std::array<std::atomic<size_t>, DBs_size> tickets;
+        std::array<std::atomic<size_t>, DBs_size> committed;
+        std::mutex syncMutex;
         /**
         * 'worker' is an instance of the ThreadPool class.
         * ThreadPool is a class that manages a pool of worker threads.
@@ -172,12 +247,80 @@ template <class... DBs> class BufferSync
         */
         ThreadPool worker;
         size_t queue_size;
+        bool reuse;
+
+        /**
+        * State of the approximate-time synchronizer (see 'on_sync'). 'sync_emitted' holds, for each queue, the timestamp
+        * of the last sample delivered to the callback, so a sample is never part of two matched sets.
+        */
+        using views_t = std::tuple<std::shared_ptr<const typename DBs::O>...>;
+        std::function<void(const views_t &)> sync_callback;
+        size_t sync_max_diff = 0;
+        std::array<std::optional<size_t>, DBs_size> sync_emitted;
+        // true while a callback is registered, so the puts take 'syncMutex' only when there is a synchronizer
+        std::atomic<bool> sync_active{false};
+
+        // Observers of the puts of each queue (see 'set_tap'), empty when not used
+        std::tuple<std::function<void(const typename DBs::I &, size_t)>...> taps;
 
     public:
-        BufferSync() : worker(1), queue_size(10) {};
-        BufferSync(size_t size) : worker(1), queue_size(size) {};
+        template <size_t idx> using input_t = typename std::tuple_element_t<idx, std::tuple<DBs...>>::I;
+
+        BufferSync() : BufferSync(10) {};
+        /**
+        * 'size' is the capacity of each queue. If 'reuse' is true the payloads of all the slots are constructed here
+        * and recycled by 'put' instead of creating a new object for each element. 'num_workers' is the number of
+        * threads that run the conversions of the puts (and the 'on_sync' callbacks).
+        */
+        BufferSync(size_t size, bool reuse = false, uint32_t num_workers = 1)
+            : _out{deque_db_t<typename DBs::O>(size)...}, last_write{}, tickets{}, committed{}, worker(std::max(num_workers, 1u)),
+              queue_size(size), reuse(reuse)
+        {
+            if (reuse)
+                std::apply([](auto &... q)
+                {
+                    ([&q]
+                    {
+                        for (size_t i = 0; i < q.capacity(); ++i)
+                            q[i].first = std::make_shared<typename std::remove_cvref_t<decltype(*q[i].first)>>();
+                    }(), ...);
+                }, _out);
+        };
         ~BufferSync() {};
 
+        /**
+        * 'on_sync' registers a callback that is called on the pool with a tuple of views (one per queue) every time the
+        * queues hold a new set of samples whose timestamps differ at most 'max_diff'. The matching is incremental: when
+        * a sample is inserted, only the nearest samples of the other queues that were not delivered yet are checked
+        * (with a binary search), and the set fires as soon as it is complete. Samples older than a delivered set are not
+        * considered anymore. Passing an empty callback disables the synchronizer.
+        */
+        void on_sync(size_t max_diff, std::function<void(const views_t &)> callback)
+        {
+            std::lock_guard lock(syncMutex);
+            sync_max_diff = max_diff;
+            sync_callback = std::move(callback);
+            sync_emitted.fill(std::nullopt);
+            sync_active.store(static_cast<bool>(sync_callback), std::memory_order_release);
+        }
+
+        template <class Rep, class Period>
+        void on_sync(std::chrono::duration<Rep, Period> max_diff, std::function<void(const views_t &)> callback)
+        {
+            on_sync(std::chrono::duration_cast<std::chrono::milliseconds>(max_diff).count(), std::move(callback));
+        }
+
+        /**
+        * 'set_tap' registers an observer that 'put<idx>' calls in the producer's thread, before the value is moved to the
+        * pool, with the input value and its timestamp (StreamRecorder uses it to log the stream, see streamlog.h). It
+        * must be set before the producers start; an empty function removes it.
+        */
+        template <size_t idx>
+        void set_tap(std::function<void(const input_t<idx> &, size_t)> tap)
+        {
+            std::get<idx>(taps) = std::move(tap);
+        }
+
         /**
         * 'read_first' is a method that returns a tuple of optional output types for each data buffer.
         * The method uses a lambda function to generate a const index sequence equal to the size of the data buffers (DBs_size).
@@ -200,37 +343,36 @@ template <class... DBs> class BufferSync
         * 'read_first' is a template method that returns the first elements from the data buffers without removing them.
         * The template parameters 'idx...' represent the indices of the data buffers.
         * The method first creates a tuple 'ret' of optional output types for each data buffer.
-        * If the buffer is empty (checked by 'empty.load()'), the method returns 'ret' immediately.
-        * Otherwise, the method locks the buffer for shared access using a 'std::shared_lock'.
-        * Then, using a fold expression (lines 210-217) for each data buffer, the method checks if the buffer is not empty.
+        * Then, for each data buffer (see 'visit_shared', that takes the shared lock of that buffer only), the method checks if the buffer is not empty.
         * If the buffer is not empty, the first element of the buffer is assigned to the corresponding element in 'ret'.
-        * After that, the method checks if all data buffers are empty.
-        * If all data buffers are empty, the method sets 'empty' to true.
         * Finally, the method returns 'ret', which contains the first elements from the data buffers.
         * This method is used to retrieve the first elements from all data buffers at once, without removing them from the buffers.
         */
         template <size_t... idx> auto read_first()
         {
-            auto ret = subtuple<idx...>();
-            if (empty.load())
-                return ret;
+            return to_optional(read_first_shared<idx...>());
+        }
+
+        /**
+        * Same as 'read_first' but returns shared views of the stored values instead of copies.
+        */
+        auto read_first_shared() -> std::tuple<std::shared_ptr<const typename DBs::O>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+              return read_first_shared<Is...>();
+            }(seq);
+        }
 
-            std::shared_lock lock(bufferMutex);
-            (
-                [](auto &q, auto &r)
+        template <size_t... idx> auto read_first_shared()
+        {
+            auto ret = shared_subtuple<idx...>();
+            visit_shared<idx...>(ret, [](auto &q, auto &r)
                 {
                   if (!q.empty())
                     r = q.front().first;
-                }(std::get<idx>(_out), std::get<idx>(ret)), // arguments to call lambda in place
-            ...);
-
-            /**
-             * The && ... is a fold expression that applies the logical AND operator (&&) to all elements in the parameter pack.
-             * If all data buffers are empty, the expression will be true.
-            **/
-            if ((std::get<idx>(_out).empty() && ...))
-                empty.store(true);
-
+                });
             return ret;
         }
 
@@ -254,36 +396,41 @@ template <class... DBs> class BufferSync
         * This version of 'read_last' is a template function that takes a variadic template argument 'idx...'. This argument represents the indices of the data buffers.
         * The function retrieves the last elements from the data buffers at these indices.
         * The function first creates a tuple 'ret' of optional output types for each data buffer.
-        * If the buffer is empty, the function returns 'ret' immediately.
-        * Otherwise, it locks the buffer for shared access using a 'std::shared_lock'.
-        * Then, for each data buffer, it checks if the buffer is not empty and if the difference between the maximum timestamp
+        * Then, for each data buffer (holding only the shared lock of that buffer), it checks if the buffer is not empty and if the difference between the maximum timestamp
         * and the timestamp of the last element in the buffer is less than 'max_diff'.
         * If these conditions are met, the last element of the buffer is assigned to the corresponding element in 'ret'.
-        * After that, the function checks if all data buffers are empty. If they are, it sets 'empty' to true.
         * Finally, it returns 'ret', which contains the last elements from the data buffers.
         */
         template <size_t... idx>
         auto read_last(size_t max_diff = std::numeric_limits<size_t>::max())
         {
-            auto ret = subtuple<idx...>();
+            return to_optional(read_last_shared<idx...>(max_diff));
+        }
 
-            if (empty.load())
-              return ret;
+        /**
+        * Same as 'read_last' but returns shared views of the stored values instead of copies.
+        */
+        auto read_last_shared(size_t max_diff = std::numeric_limits<size_t>::max()) -> std::tuple<std::shared_ptr<const typename DBs::O>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+                {
+                  return read_last_shared<Is...>(max_diff);
+                }(seq);
+        }
 
-            std::shared_lock lock(bufferMutex);
-            size_t max = *std::max_element(last_write.begin(), last_write.end());
-            // fold expression
-            (
-                [max, max_diff](auto &q, auto &r)
+        template <size_t... idx>
+        auto read_last_shared(size_t max_diff = std::numeric_limits<size_t>::max())
+        {
+            auto ret = shared_subtuple<idx...>();
+            size_t max = 0;
+            for (auto &w : last_write)
+                max = std::max(max, w.load());
+            visit_shared<idx...>(ret, [max, max_diff](auto &q, auto &r)
                 {
                   if (!q.empty() && (max - q.back().second < max_diff))
                     r = q.back().first;
-                }(std::get<idx>(_out), std::get<idx>(ret)),
-                ...);
-
-            if ((std::get<idx>(_out).empty() && ...))
-              empty.store(true);
-
+                });
             return ret;
         }
 
@@ -308,42 +455,39 @@ template <class... DBs> class BufferSync
         * This version of 'read' is a template function that takes a variadic template argument 'idx...'. This argument represents the indices of the data buffers.
         * The function retrieves the elements from the data buffers at these indices that are closest to the provided timestamp and within the 'max_diff' limit.
         * The function first creates a tuple 'ret' of optional output types for each data buffer.
-        * If the buffer is empty (checked by 'empty.load()'), the function returns 'ret' immediately.
-        * Otherwise, it locks the buffer for shared access using a 'std::shared_lock'.
-        * Then, for each data buffer, it calculates the absolute difference between the timestamp of each element and the provided timestamp.
-        * It finds the element with the minimum difference and if this difference is less than or equal to 'max_diff', it assigns this element to the corresponding element in 'ret'.
-        * After that, the function checks if all data buffers are empty. If they are, it sets 'empty' to true.
+        * Then, for each data buffer (holding only the shared lock of that buffer), it finds the element with the timestamp closest to the provided one with a binary search (see 'nearest').
+        * If the absolute difference is less than or equal to 'max_diff', it assigns this element to the corresponding element in 'ret'.
         * Finally, it returns 'ret', which contains the elements from the data buffers that are closest to the provided timestamp and within the 'max_diff' limit.
         */
         template <size_t... idx>
         auto read(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
         {
-            auto ret = subtuple<idx...>();
-
-            if (empty.load())
-            return ret;
+            return to_optional(read_shared<idx...>(timestamp, max_diff));
+        }
 
-            std::shared_lock lock(bufferMutex);
-            size_t dropped = 0;
-            // fold expression
-            (
-                [timestamp, max_diff, &dropped](auto &q, auto &r) {
-                  std::vector<size_t> diffs;
-                  std::transform(q.begin(), q.end(), std::back_inserter(diffs),
-                                 [timestamp](auto &val) {
-                                   return std::abs(static_cast<ssize_t>(val.second) -
-                                                   static_cast<ssize_t>(timestamp));
-                                 });
-                  auto it_idx = std::min(diffs.begin(), diffs.end()) - diffs.begin();
-                  auto it = q.begin() + it_idx;
-                  if (it != q.end() && timestamp - it->second <= max_diff)
-                    r = it->first;
-                }(std::get<idx>(_out), std::get<idx>(ret)),
-                ...);
-
-            if ((std::get<idx>(_out).empty() && ...))
-              empty.store(true);
+        /**
+        * Same as 'read' but returns shared views of the stored values instead of copies.
+        */
+        auto read_shared(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
+          -> std::tuple<std::shared_ptr<const typename DBs::O>...>
+        {
+            constexpr auto seq = std::make_index_sequence<DBs_size>{};
+            return [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return read_shared<Is...>(timestamp, max_diff);
+            }(seq);
+        }
 
+        template <size_t... idx>
+        auto read_shared(size_t timestamp, size_t max_diff = std::numeric_limits<size_t>::max())
+        {
+            auto ret = shared_subtuple<idx...>();
+            visit_shared<idx...>(ret, [timestamp, max_diff](auto &q, auto &r)
+                {
+                  auto i = nearest(q, timestamp);
+                  if (i != q.size() && abs_diff(q[i].second, timestamp) <= max_diff)
+                    r = q[i].first;
+                });
             return ret;
         }
 
@@ -356,31 +500,53 @@ template <class... DBs> class BufferSync
         * - 't' is a function that transforms the input data item to the output data type. It defaults to 'empty_fn' if not provided.
         *
         * The method first spawns a new task in the worker thread pool. The task is a lambda function that does the following:
-        * - It creates a temporary variable 'temp' of output type 'typename InOut::O'.
-        * - It calls the 'ItoO' method to transform the input data item 'd' to the output data type and stores the result in 'temp'.
-        * - It locks the buffer for exclusive access using a 'std::unique_lock'.
+        * - It takes the object where the output will be written: in 'reuse' mode the slot that is going to be overwritten,
+        *   if no reader holds a view of it (see 'recycle'); otherwise a new object of output type 'typename InOut::O'.
+        * - It calls the 'ItoO' method (or 'ItoO_reuse' for a recycled object) to transform the input data item 'd' to the output data type.
+        *   If the conversion throws, the error is printed and the sample is dropped.
+        * - It waits for the previous puts to the same data buffer to be inserted (see 'commit') and locks that buffer for exclusive access.
         * - It updates the 'last_write' timestamp for the data buffer at index 'idx'.
-        * - If the size of the data buffer at index 'idx' is greater than or equal to 'queue_size', it removes the first element from the buffer.
-        * - It inserts the transformed data item 'temp' and its associated timestamp into the data buffer at index 'idx'.
-        * - It sets 'empty' to false to indicate that the buffer is not empty.
+        * - It inserts the transformed data item and its associated timestamp into the data buffer at index 'idx', dropping the oldest one if the queue is full.
+        * - If a synchronizer is registered (see 'on_sync'), it checks for a new matched set.
         *
         * Finally, the method returns true to indicate that the data item was successfully inserted into the buffer.
         */
         template <size_t idx, typename InOut = std::remove_cvref_t<decltype(std::get<idx>(std::tuple<DBs...>()))>>
         bool put(typename InOut::I &&d, size_t timestamp, std::function<void(typename InOut::I &&, typename InOut::O &)> t = empty_fn)
             {
+                if (auto &tap = std::get<idx>(taps))
+                  tap(d, timestamp);
+                auto ticket = tickets[idx].fetch_add(1);
                 worker.spawn_task
                 (
-                    [this, d = std::move(d), t = std::move(t), timestamp]() mutable
+                    [this, d = std::move(d), t = std::move(t), timestamp, ticket]() mutable
                     {
-                      typename InOut::O temp;
-                      this->ItoO(std::move(d), temp, t);
-                      std::unique_lock lock(this->bufferMutex);
-                      last_write[idx] = std::chrono::steady_clock::now().time_since_epoch().count();
-                      if (std::get<idx>(_out).size() + 1 > queue_size)
-                        std::get<idx>(_out).pop_front();
-                      std::get<idx>(_out).emplace_back(std::move(temp), timestamp);
-                      empty.store(false);
+                      std::shared_ptr<typename InOut::O> slot;
+                      try
+                      {
+                        slot = reuse ? this->recycle<idx>() : nullptr;
+                        if (slot)
+                          this->ItoO_reuse(std::move(d), *slot, t);
+                        else
+                        {
+                          slot = std::make_shared<typename InOut::O>();
+                          this->ItoO(std::move(d), *slot, t);
+                        }
+                      }
+                      // a failed conversion drops its sample only: the pool task must not throw (std::terminate)
+                      catch (const std::exception &e)
+                      {
+                        std::cerr << "[BufferSync] conversion failed, sample dropped: " << e.what() << std::endl;
+                        this->commit<idx>(ticket, nullptr, timestamp);
+                        return;
+                      }
+                      catch (...)
+                      {
+                        std::cerr << "[BufferSync] conversion failed, sample dropped: unknown exception" << std::endl;
+                        this->commit<idx>(ticket, nullptr, timestamp);
+                        return;
+                      }
+                      this->commit<idx>(ticket, std::move(slot), timestamp);
                     }
                 );
                 return true;
@@ -417,7 +583,7 @@ template <class... DBs> class BufferSync
                           if (i < std::get<idx>(_out).size())
                           {
                             auto &[f, s] = std::get<idx>(_out)[i];
-                            std::cout << std::setw(4) << idx << " | " << std::setw(14) << f << " | " << std::setw(15) << s << "\n";
+                            std::cout << std::setw(4) << idx << " | " << std::setw(14) << *f << " | " << std::setw(15) << s << "\n";
                           }
                           else
                               std::cout << std::setw(4) << idx << " | " << std::setw(14) << " empty" << " |\n";
@@ -428,8 +594,186 @@ template <class... DBs> class BufferSync
             }
         }
 
+        /**
+        * 'Neighbours' holds the elements of a queue right before (or at) and right after a timestamp, with their
+        * timestamps, so the consumer can interpolate between them. Any of the views can be empty.
+        */
+        template <typename O>
+        struct Neighbours
+        {
+            std::shared_ptr<const O> before;
+            size_t before_ts = 0;
+            std::shared_ptr<const O> after;
+            size_t after_ts = 0;
+        };
+
+        /**
+        * 'read_neighbours' returns the two elements of queue 'idx' around 'timestamp'. It uses the same binary search as 'read'.
+        */
+        template <size_t idx, typename InOut = std::remove_cvref_t<decltype(std::get<idx>(std::tuple<DBs...>()))>>
+        auto read_neighbours(size_t timestamp) -> Neighbours<typename InOut::O>
+        {
+            Neighbours<typename InOut::O> n;
+            std::shared_lock lock(streamMutex[idx]);
+            auto &q = std::get<idx>(_out);
+            auto i = lower_bound(q, timestamp);
+            if (i != q.size() && q[i].second == timestamp)
+                ++i;
+            if (i != 0)
+            {
+                n.before = q[i - 1].first;
+                n.before_ts = q[i - 1].second;
+            }
+            if (i != q.size())
+            {
+                n.after = q[i].first;
+                n.after_ts = q[i].second;
+            }
+            return n;
+        }
+
     private:
 
+        /**
+        * 'commit' inserts the converted value of the put with 'ticket' in queue 'idx' once all the previous puts to that
+        * queue are inserted, so the queue stays sorted by insertion order with any number of workers. A null 'slot'
+        * (failed conversion) only gives the turn to the next put. Then it runs the synchronizer step, if any: without a
+        * registered callback the put does not touch 'syncMutex'.
+        */
+        template <size_t idx>
+        void commit(size_t ticket, std::shared_ptr<typename std::tuple_element_t<idx, std::tuple<DBs...>>::O> slot, size_t timestamp)
+        {
+            for (auto c = committed[idx].load(); c != ticket; c = committed[idx].load())
+                committed[idx].wait(c);
+            bool inserted = slot != nullptr;
+            if (inserted)
+            {
+                std::unique_lock lock(streamMutex[idx]);
+                last_write[idx] = std::chrono::steady_clock::now().time_since_epoch().count();
+                std::get<idx>(_out).push_back({std::move(slot), timestamp});
+            }
+            committed[idx].fetch_add(1);
+            committed[idx].notify_all();
+
+            if (!inserted || !sync_active.load(std::memory_order_acquire))
+                return;
+            std::unique_lock sync_lock(syncMutex);
+            if (sync_callback)
+                if (auto matched = match<idx>(timestamp))
+                    worker.spawn_task([cb = sync_callback, views = std::move(*matched)] { cb(views); });
+        }
+
+        /**
+        * 'visit_shared' calls 'f(queue, r)' for each queue in 'idx...', with the shared lock of that queue held. 'r' is
+        * the element of 'ret' at the same position in 'idx...', so it works for any subset of the queues.
+        */
+        template <size_t... idx, typename R, typename F>
+        void visit_shared(R &ret, F &&f) const
+        {
+            [&]<std::size_t... P>(std::index_sequence<P...>)
+            {
+                ([&]
+                {
+                  std::shared_lock lock(streamMutex[idx]);
+                  f(std::get<idx>(_out), std::get<P>(ret));
+                }(), ...);
+            }(std::make_index_sequence<sizeof...(idx)>{});
+        }
+
+        /**
+        * 'recycle' takes out of queue 'idx' the payload of the slot that the next put will overwrite, so it can be
+        * filled outside the lock. If the queue is full that slot is the oldest element, which is dropped now instead of
+        * at insertion time. It returns nullptr if a reader still holds a view of the payload: that object is left to
+        * the reader and the put allocates a new one.
+        */
+        template <size_t idx>
+        auto recycle()
+        {
+            std::unique_lock lock(streamMutex[idx]);
+            auto &q = std::get<idx>(_out);
+            auto &slot = q.next_slot();
+            if (q.size() == q.capacity())
+                q.pop_front();
+            decltype(slot.first) payload;
+            if (slot.first && slot.first.use_count() == 1)
+                payload = std::move(slot.first);
+            return payload;
+        }
+
+        /**
+        * 'match' is the incremental step of the synchronizer, called with 'syncMutex' held after inserting a sample with
+        * 'timestamp' in queue 'k'. It takes the shared locks of all the queues (always in the same order, so it cannot
+        * deadlock with the puts, that hold one lock at a time) and, for every queue, the not yet delivered sample closest to 'timestamp'. If all the queues have one and their timestamps span at most 'sync_max_diff', the set is marked
+        * as delivered and returned.
+        */
+        template <size_t k>
+        std::optional<views_t> match(size_t timestamp)
+        {
+            auto locks = [this]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return std::array<std::shared_lock<std::shared_mutex>, DBs_size>{std::shared_lock(streamMutex[Is])...};
+            }(std::make_index_sequence<DBs_size>{});
+            views_t views;
+            std::array<size_t, DBs_size> stamps;
+            size_t lo = timestamp, hi = timestamp;
+            bool complete = [&]<std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return ([&]
+                {
+                    auto &q = std::get<Is>(_out);
+                    size_t from = sync_emitted[Is] ? lower_bound(q, *sync_emitted[Is] + 1) : 0;
+                    size_t i = nearest(q, timestamp, from);
+                    if (i >= q.size() || i < from)
+                        return false;
+                    lo = std::min(lo, q[i].second);
+                    hi = std::max(hi, q[i].second);
+                    std::get<Is>(views) = q[i].first;
+                    stamps[Is] = q[i].second;
+                    return true;
+                }() && ...);
+            }(std::make_index_sequence<DBs_size>{});
+
+            if (!complete || hi - lo > sync_max_diff)
+                return std::nullopt;
+            for (size_t s = 0; s < DBs_size; ++s)
+                sync_emitted[s] = stamps[s];
+            return views;
+        }
+
+        /**
+        * 'nearest' returns the index of the element of a queue (from index 'from') whose timestamp is closest to 'timestamp' (q.size() if there is none).
+        * Queues are kept in insertion order and timestamps are expected to be non-decreasing, so it is a binary search
+        * ('lower_bound') followed by a comparison with the previous element. It does not allocate.
+        */
+        template <typename Q>
+        static size_t nearest(const Q &q, size_t timestamp, size_t from = 0)
+        {
+            size_t i = lower_bound(q, timestamp, from);
+            if (i == from)
+                return i;
+            if (i == q.size() || abs_diff(q[i - 1].second, timestamp) <= abs_diff(q[i].second, timestamp))
+                return i - 1;
+            return i;
+        }
+
+        // index of the first element of 'q' (from index 'from') whose timestamp is not lower than 'timestamp' (q.size() if none)
+        template <typename Q>
+        static size_t lower_bound(const Q &q, size_t timestamp, size_t from = 0)
+        {
+            size_t lo = from, hi = q.size();
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                if (q[mid].second < timestamp)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+
+        static size_t abs_diff(size_t a, size_t b) { return a > b ? a - b : b - a; }
+
         /**
         * 'subtuple' is a template method that creates a new tuple of optional output types for each data buffer.
         * The template parameters 'Is...' represent the indices of the data buffers.
@@ -444,6 +788,28 @@ template <class... DBs> class BufferSync
             return std::make_tuple(std::get<Is>(tuple)...);
         }
 
+        /**
+        * 'shared_subtuple' is the equivalent of 'subtuple' for the '_shared' reads: a tuple of empty shared_ptr views
+        * for the data buffers at the indices 'Is...'.
+        */
+        template <std::size_t... Is> constexpr auto shared_subtuple()
+        {
+            return std::tuple<std::shared_ptr<const typename std::tuple_element_t<Is, std::tuple<DBs...>>::O>...>{};
+        }
+
+        /**
+        * 'to_optional' copies the values pointed by a tuple of shared views into a tuple of optionals.
+        * The copy is done by the reads after releasing the buffer lock.
+        */
+        template <typename... T>
+        static std::tuple<std::optional<T>...> to_optional(const std::tuple<std::shared_ptr<const T>...> &views)
+        {
+            return std::apply([](const auto &... v)
+            {
+                return std::tuple<std::optional<T>...>{(v ? std::optional<T>(*v) : std::optional<T>{})...};
+            }, views);
+        }
+
         /**
         * 'ItoO' is a template method that transforms an input data item of type 'I' to an output data item of type 'O'.
         * The method takes three parameters:
@@ -489,4 +855,22 @@ template <class... DBs> class BufferSync
                 t(std::move(iTypeData), oTypeData);
             }
         };
+
+        /**
+        * 'ItoO_reuse' is the version of 'ItoO' used with a recycled output object, that still holds the value (and the
+        * memory) of an old element. A user-defined converter is always called, so it can write into the existing
+        * buffers. Without one, iterable outputs are refilled with 'assign', which keeps their capacity, and any other
+        * type falls back to 'ItoO'.
+        */
+        template <typename I, typename O>
+        void ItoO_reuse(I &&iTypeData, O &oTypeData, const std::function<void(I &&, O &)> &t = empty_fn)
+        {
+            if (t.template target<std::remove_const_t<decltype(empty_fn)>>() == nullptr)
+                t(std::move(iTypeData), oTypeData);
+            else if constexpr (is_iterable<I>::value && is_iterable<O>::value &&
+                               requires { oTypeData.assign(std::make_move_iterator(iTypeData.begin()), std::make_move_iterator(iTypeData.end())); })
+                oTypeData.assign(std::make_move_iterator(iTypeData.begin()), std::make_move_iterator(iTypeData.end()));
+            else
+                ItoO(std::move(iTypeData), oTypeData, t);
+        }
 };
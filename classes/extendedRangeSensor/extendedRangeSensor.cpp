@@ -18,78 +18,118 @@
  */
 #include "extendedRangeSensor.h"
 
+#include <algorithm>
+
+namespace
+{
+	// Sorting networks for the median filter
+	template <int K> struct Network;
+	template <> struct Network<3> { static constexpr int pairs[][2] = {{0,1}, {1,2}, {0,1}}; };
+	template <> struct Network<5> { static constexpr int pairs[][2] = {{0,1}, {3,4}, {2,4}, {2,3}, {0,3}, {0,2}, {1,4}, {1,3}, {1,2}}; };
+	template <> struct Network<7> { static constexpr int pairs[][2] = {{1,2}, {3,4}, {5,6}, {0,2}, {3,5}, {4,6}, {0,1}, {4,5},
+	                                                                   {2,6}, {0,4}, {1,5}, {0,3}, {2,5}, {1,3}, {2,4}, {2,3}}; };
+
+	// Median of every window of K readings of 'in', comparing whole rows of a block of consecutive beams so that the
+	// min/max loops vectorize. A median at maxDist (no echo) is replaced by the largest smaller value of the window.
+	// The first and last K/2 readings are copied.
+	template <int K>
+	void medianRange(const float *in, float *out, int n, float maxDist)
+	{
+		constexpr int B = 64, H = K/2;
+		float w[K][B];
+		std::copy(in, in + std::min(H, n), out);
+		for (int first = H; first < n - H; first += B)
+		{
+			const int count = std::min(B, n - H - first);
+			for (int j=0; j<K; j++)
+				std::copy(in + first - H + j, in + first - H + j + count, w[j]);
+			for (const auto &p : Network<K>::pairs)
+			{
+				float *lo = w[p[0]], *hi = w[p[1]];
+				for (int b=0; b<count; b++)
+				{
+					const float l = std::min(lo[b], hi[b]), h = std::max(lo[b], hi[b]);
+					lo[b] = l;
+					hi[b] = h;
+				}
+			}
+			for (int b=0; b<count; b++)
+			{
+				float v = w[H][b];
+				for (int m=H-1; m>=0; m--)
+					v = v >= maxDist ? w[m][b] : v;
+				out[first+b] = v;
+			}
+		}
+		std::copy(in + std::max(n - H, H), in + n, out + std::max(n - H, H));
+	}
+
+	// rows 0..2 of a transformation matrix
+	void affine(const RTMat &m, float r[3][4])
+	{
+		for (int i=0; i<3; i++)
+			for (int j=0; j<4; j++)
+				r[i][j] = m(i, j);
+	}
+}
+
 ExtendedRangeSensor::ExtendedRangeSensor(const RoboCompLaser::TLaserData &laserData, const RoboCompDifferentialRobot::TBaseState &bState, InnerModel *innerModel_, double extensionRange_, double maxDist_, QString laserName_)
 {
 	laserName = laserName_;
 	innerModel = innerModel_;
 	extensionRange = extensionRange_;
 	maxDist = maxDist_;
+	medianWindow = 1;
+	interpolate = false;
 	printf("ExtendedRangeSensor angle:%f  dist:%f\n", extensionRange, maxDist);
 
 	LECTURAS = laserData.size();
 	TAM_DATAEXT = rint( extensionRange * laserData.size() / ((double)fabs(laserData[0].angle-laserData[laserData.size()-1].angle)));
 	pm = TAM_DATAEXT/2;
-	dataExtended.resize(TAM_DATAEXT);
 	laserDataExtCopy.resize(TAM_DATAEXT);
 
-	for (int i=0; i<dataExtended.size(); i++)
+	beams.dist.assign(TAM_DATAEXT, maxDist);
+	beams.angle.resize(TAM_DATAEXT);
+	beams.sin.resize(TAM_DATAEXT);
+	beams.cos.resize(TAM_DATAEXT);
+	beams.x.resize(TAM_DATAEXT);
+	beams.y.resize(TAM_DATAEXT);
+	beams.z.resize(TAM_DATAEXT);
+	beams.certainty.assign(TAM_DATAEXT, 1.f);
+	beams.visit.assign(TAM_DATAEXT, true);
+	for (int i=0; i<TAM_DATAEXT; i++)
 	{
-		dataExtended[i].angle = extIndToRads(i);
-		dataExtended[i].dist = maxDist;
-		setExtended(i, maxDist, true, 1);
+		beams.angle[i] = extIndToRads(i);
+		beams.sin[i] = sin(beams.angle[i]);
+		beams.cos[i] = cos(beams.angle[i]);
 	}
-	printf("Extended field of view < %f -- %f >\n", dataExtended[0].angle, dataExtended[TAM_DATAEXT-1].angle);
+	updateWorld();
+	printf("Extended field of view < %f -- %f >\n", beams.angle[0], beams.angle[TAM_DATAEXT-1]);
 }
 
 
-void ExtendedRangeSensor::medianFilter(RoboCompLaser::TLaserData *laserData)
+void ExtendedRangeSensor::setMedianWindow(int window)
 {
-	double window[5];
-	double x[laserData->size()];
+	if (window != 1 and window != 3 and window != 5 and window != 7)
+		qFatal("%s %d: median window must be 1, 3, 5 or 7\n", __FILE__, __LINE__);
+	medianWindow = window;
+}
 
-	for (int32_t i=2; i<(int)laserData->size()-2; ++i)
-	{
-		for (int j=0; j<5; ++j)
-		{
-			window[j] = laserData->at(i - 2 + j).dist;
-		}
-		int j;
-		for (j=0; j<3; ++j)
-		{
-			int min = j;
-			for (int k = j + 1; k < 5; ++k)
-				if (window[k] < window[min])
-					min = k;
-			const double temp = window[j];
-			window[j] = window[min];
-			window[min] = temp;
-		}
-		if (window[j] >= maxDist)
-		{
-			if (window[j-1] >= maxDist)
-			{
-				x[i] = window[j-2];
-			}
-			else
-			{
-				x[i] = window[j-1];
-			}
-		}
-		else
-		{
-			x[i] = window[j];
-		}
-	}
-	for (int32_t i=0; i<(int)laserData->size(); i++)
+
+void ExtendedRangeSensor::medianFilter(const RoboCompLaser::TLaserData &laserData)
+{
+	const int n = laserData.size();
+	filtered.resize(2*n);
+	float *in = filtered.data(), *out = in + n;
+	for (int i=0; i<n; i++)
+		in[i] = laserData[i].dist;
+	switch (medianWindow)
 	{
-		setExtended(angleToExtendedIndex(laserData->at(i).angle), x[i], true);
+		case 3: medianRange<3>(in, out, n, maxDist); break;
+		case 5: medianRange<5>(in, out, n, maxDist); break;
+		case 7: medianRange<7>(in, out, n, maxDist); break;
+		default: std::copy(in, in + n, out);
 	}
-
-	// Endings
-	setExtended(angleToExtendedIndex(laserData->at(dataExtended.size()-1-1).angle), laserData->at(dataExtended.size()-1-1-1).dist, true);
-	setExtended(angleToExtendedIndex(laserData->at(dataExtended.size()-1).angle), laserData->at(dataExtended.size()-1-1).dist, true);
-	setExtended(angleToExtendedIndex(laserData->at(1).angle), laserData->at(1+1).dist, true);
-	setExtended(angleToExtendedIndex(laserData->at(0).angle), laserData->at(1).dist, true);
 }
 
 /**
@@ -110,7 +150,7 @@ int ExtendedRangeSensor::laserIndToExtInd (int ind)
  */
 double ExtendedRangeSensor::extIndToRads ( int ind )
 {
-	const double rads = ((double)ind - dataExtended.size()/2) * (extensionRange / dataExtended.size() );
+	const double rads = ((double)ind - TAM_DATAEXT/2) * (extensionRange / TAM_DATAEXT );
 	return rads;
 }
 
@@ -126,109 +166,113 @@ int ExtendedRangeSensor::angleToExtendedIndex( double angle)
 
 	double ret;
 // 	angle += extensionRange/2.;
-	ret = (angle * dataExtended.size())/extensionRange;
-	ret += dataExtended.size()/2;
+	ret = (angle * TAM_DATAEXT)/extensionRange;
+	ret += TAM_DATAEXT/2;
 	return int32_t(ret);
 }
 
 
 void ExtendedRangeSensor::update(const RoboCompLaser::TLaserData &laserData)
 {
-	QVector<TExt> dataExtendedBack = dataExtended;
+	const int n = TAM_DATAEXT;
+	float m[3][4];
+	affine(innerModel->getTransformationMatrix(laserName, "root"), m);
 
-	/// a) Inicialización
-	for (int i=0; i<dataExtended.size(); i++)
-	{
-		setExtended(i, maxDist, true);
-	}
+	/// a) Inicialización. The world points of the previous scan are kept until d)
+	std::fill(beams.dist.begin(), beams.dist.end(), maxDist);
+	std::fill(beams.visit.begin(), beams.visit.end(), true);
+	std::fill(beams.certainty.begin(), beams.certainty.end(), 1.f);
 
 	/// b) Transformación a t+1
-	for (int i=0; i<dataExtendedBack.size(); i++)
+	const float *x = beams.x.data(), *y = beams.y.data(), *z = beams.z.data();
+	for (int i=0; i<n; i++)
 	{
-		QVec l = innerModel->transform(laserName, dataExtendedBack[i].world, "root");
-		double sens = l.norm2();
-		double angle = atan2(l(0), l(2));
-		printf("%g -> %g\n", dataExtendedBack[i].angle, angle);
-		int index = angleToExtendedIndex(angle);
-		if (fabs(angle) > extensionRange/2. and sens < maxDist)
-		{
-// 			printf ("%g (%g)-> %d %d\n", double(180.*angle/M_PIl), double(sens), i, index);
-// 			dataExtendedBack[i].world.print("w");
-		}
+		const float lx = m[0][0]*x[i] + m[0][1]*y[i] + m[0][2]*z[i] + m[0][3];
+		const float ly = m[1][0]*x[i] + m[1][1]*y[i] + m[1][2]*z[i] + m[1][3];
+		const float lz = m[2][0]*x[i] + m[2][1]*y[i] + m[2][2]*z[i] + m[2][3];
+		const float sens = sqrtf(lx*lx + ly*ly + lz*lz);
 		if (sens < maxDist)
 		{
-			if (index >= 0 and index < dataExtended.size())
-			{
+			const int index = angleToExtendedIndex(atan2f(lx, lz));
+			if (index >= 0 and index < n)
 				setExtended(index, sens, true);
-			}
 		}
 	}
 
 	/// c) copiamos datos leídos sobre datos extendidos
+	const float *readings = NULL;
+	if (medianWindow > 1)
+	{
+		medianFilter(laserData);
+		readings = filtered.data() + laserData.size();
+	}
 	for (unsigned int i=0; i<laserData.size(); i++)
 	{
 		const int32_t index = angleToExtendedIndex(laserData[i].angle);
-		double sens = laserData[i].dist;
+		double sens = readings ? readings[i] : laserData[i].dist;
 		if (sens > maxDist)
 			sens = maxDist;
 		setExtended(index, sens, true);
 	}
 
 	/// d) interpolación de los puntos no visitados
-// 	interpolation();
-
+	if (interpolate)
+		interpolation();
+	updateWorld();
 
 	/// Make a copy
-	for(int h=0; h<dataExtended.size(); h++)
+	for(int h=0; h<n; h++)
 	{
-		laserDataExtCopy[h].dist = dataExtended[h].dist;
-		laserDataExtCopy[h].angle = dataExtended[h].angle;
+		laserDataExtCopy[h].dist = beams.dist[h];
+		laserDataExtCopy[h].angle = beams.angle[h];
 	}
-// 	medianFilter(&laserDataExtCopy);
 }
 
 
+/// The world point is computed by updateWorld()
 void ExtendedRangeSensor::setExtended(int i, double dist, bool visit, double certainty)
 {
-	if (i<0 or i>=dataExtended.size()) qFatal("%s %d: i<0 or i>=dataExtended.size()\n", __FILE__, __LINE__);
-	dataExtended[i].dist = dist;
-	QVec v = innerModel->laserTo("root", laserName, dist, dataExtended[i].angle);
-	dataExtended[i].world = v;
-	dataExtended[i].visit = visit;
-	dataExtended[i].certainty = certainty;
+	if (i<0 or i>=TAM_DATAEXT) qFatal("%s %d: i<0 or i>=dataExtended.size()\n", __FILE__, __LINE__);
+	beams.dist[i] = dist;
+	beams.visit[i] = visit;
+	beams.certainty[i] = certainty;
 }
 
+/// World points of all the beams, laser point (dist * sin, 0, dist * cos) to "root"
+void ExtendedRangeSensor::updateWorld()
+{
+	float m[3][4];
+	affine(innerModel->getTransformationMatrix("root", laserName), m);
+	const float *d = beams.dist.data(), *s = beams.sin.data(), *c = beams.cos.data();
+	float *x = beams.x.data(), *y = beams.y.data(), *z = beams.z.data();
+	for (int i=0; i<TAM_DATAEXT; i++)
+	{
+		const float lx = d[i]*s[i], lz = d[i]*c[i];
+		x[i] = m[0][0]*lx + m[0][2]*lz + m[0][3];
+		y[i] = m[1][0]*lx + m[1][2]*lz + m[1][3];
+		z[i] = m[2][0]*lx + m[2][2]*lz + m[2][3];
+	}
+}
+
+/// In place: a beam without data takes the distance of its next neighbour with data, or else of the previous one
 void ExtendedRangeSensor::interpolation(int first, int last)
 {
+	if (first < 0) first = 0;
+	if (last < 0) last = TAM_DATAEXT-1;
 	Q_ASSERT(first<last);
-	Q_ASSERT(first > 0 and first < dataExtended.size());
-	Q_ASSERT(last  > 0 and  last < dataExtended.size());
+	Q_ASSERT(last < TAM_DATAEXT);
 
+	float *dist = beams.dist.data();
+	uint8_t *visit = beams.visit.data();
+	auto valid = [&](int j) { return visit[j] and dist[j] < maxDist; };
 	for (int i=first; i<=last; i++)
 	{
-		if (dataExtended[i].visit != true or dataExtended[i].dist > maxDist-1)
-		{
-			printf("notvistied %d\n", i);
-			for (int o = 1; o<2; o++)
-			{
-				if (i+o < dataExtended.size())
-				{
-					if (dataExtended[i+o].visit == true and dataExtended[i+o].dist < maxDist)
-					{
-						setExtended(i, dataExtended[i+o].dist, false);
-						break;
-					}
-				}
-				if (i-o > -1)
-				{
-					if (dataExtended[i-o].visit == true and dataExtended[i-o].dist < maxDist)
-					{
-						setExtended(i, dataExtended[i-o].dist, false);
-						break;
-					}
-				}
-			}
-		}
+		if (visit[i] and dist[i] <= maxDist-1)
+			continue;
+		if (i+1 < TAM_DATAEXT and valid(i+1))
+			setExtended(i, dist[i+1], false);
+		else if (i-1 > -1 and valid(i-1))
+			setExtended(i, dist[i-1], false);
 	}
 }
 
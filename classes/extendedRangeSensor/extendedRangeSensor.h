@@ -22,6 +22,10 @@
 #include <DifferentialRobot.h>
 #include <Laser.h>
 
+#include <stdint.h>
+
+#include <vector>
+
 #include <qmat/QMatAll>
 #include <innermodel/innermodel.h>
 
@@ -69,6 +73,14 @@ public:
 	double certainty;
 };
 
+/**
+ * Range sensor with a field of view wider than the laser, keeping the points that left it as the robot moves.
+ * Every update works in stages over contiguous float arrays (one per beam attribute):
+ *   a) the points of the previous scan are taken to the current laser pose with a single transformation matrix,
+ *   b) the new readings, optionally median filtered, are copied over them,
+ *   c) the beams left without data are optionally interpolated in place,
+ *   d) the world points are recomputed in one batch with the precomputed sin/cos of every beam.
+ */
 class ExtendedRangeSensor
 {
 public:
@@ -77,12 +89,17 @@ public:
 	///
 	void update(const RoboCompLaser::TLaserData &laserData);
 
+	/// Median of the 'window' closest readings of every beam (1: disabled, 3, 5 or 7)
+	void setMedianWindow(int window);
+	/// Fill the beams without data with their neighbours
+	void setInterpolation(bool enabled) { interpolate = enabled; }
+
 	///
 	RoboCompLaser::TLaserData getData() { return laserDataExtCopy; }
 	inline RoboCompLaser::TData getData(int32_t i) { return laserDataExtCopy[i]; }
-	inline double getRange(uint i) { return dataExtended[i].dist; }
-	inline QMat getWorld(uint i) { return dataExtended[i].world; }
-	inline uint size() { return dataExtended.size(); }
+	inline double getRange(uint i) { return beams.dist[i]; }
+	inline QMat getWorld(uint i) { return QVec::vec3(beams.x[i], beams.y[i], beams.z[i]); }
+	inline uint size() { return beams.dist.size(); }
 
 // 	void relax(const double quantity, InnerModel *im, const QString &platformRef, const QString &worldRef);
 
@@ -90,19 +107,31 @@ public:
 private:
 	void setExtended(int index, double dist, bool visit=false, double certainty=1.);
 	void interpolation(int first=-1, int last=-1);
+	void updateWorld();
 
 	QString laserName;
 	int LECTURAS;
 	int TAM_DATAEXT;
 	double extensionRange, maxDist;
-	QVector<TExt> dataExtended;
+	int medianWindow;
+	bool interpolate;
+
+	// Extended beams, structure of arrays
+	struct Beams
+	{
+		std::vector<float> dist, angle, sin, cos;
+		std::vector<float> x, y, z;               // world ("root") point of every beam
+		std::vector<float> certainty;
+		std::vector<uint8_t> visit;
+	} beams;
+	std::vector<float> filtered;                  // readings and median filtered readings, one after the other
 	RoboCompLaser::TLaserData laserDataExtCopy;
 
 	RoboCompDifferentialRobot::TBaseState bState;
 int32_t pm;
 	InnerModel *innerModel;
 
-	void medianFilter(RoboCompLaser::TLaserData *laserData);
+	void medianFilter(const RoboCompLaser::TLaserData &laserData);
 	int laserIndToExtInd(int ind);
 	double extIndToRads(int ind);
 	int angleToExtendedIndex(double angle);
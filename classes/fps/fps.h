@@ -8,6 +8,9 @@
 #include <sys/times.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
 
 class FPSCounter
 {
@@ -15,24 +18,24 @@ class FPSCounter
 		FPSCounter()
 		{
 			begin = std::chrono::high_resolution_clock::now();
-            FILE* file;
             struct tms timeSample;
-            char line[128];
 
             lastCPU = times(&timeSample);
             lastSysCPU = timeSample.tms_stime;
             lastUserCPU = timeSample.tms_utime;
 
-            file = fopen("/proc/cpuinfo", "r");
-            numProcessors = 0;
-            while(fgets(line, 128, file) != NULL){
-                if (strncmp(line, "processor", 9) == 0) numProcessors++;
-            }
-            fclose(file);
+            numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+            pageKB = sysconf(_SC_PAGESIZE) / 1024;
+            // kept open: get_mem_use() rereads it with pread, without fopen on every print
+            statm.fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
 		}
+        FPSCounter(const FPSCounter &) = delete;
+        FPSCounter &operator=(const FPSCounter &) = delete;
+        // the descriptor of statm goes with the counter, see StatmFile
+        FPSCounter(FPSCounter &&) = default;
+        FPSCounter &operator=(FPSCounter &&) = default;
         int print( const std::string &text, const unsigned int msPeriod = 1000)
         {
-            static int fps=0;
             auto end = std::chrono::high_resolution_clock::now();
             auto elapsed = std::chrono::duration<double>(end - begin).count() * 1000;
             if( elapsed > msPeriod)
@@ -40,10 +43,10 @@ class FPSCounter
 				last_period = elapsed/cont;
                 float cpu = get_cpu_use();
                 int mem = get_mem_use();
-                std::cout << "Period = " << last_period << "ms. Fps = " << cont/(msPeriod/1000) << " " << text
+                fps = int(cont * 1000. / elapsed + 0.5);
+                std::cout << "Period = " << last_period << "ms. Fps = " << fps << " " << text
                           << " cpu = " << cpu << "%" << " mem = " << mem << "MB" << std::endl;
                 begin = std::chrono::high_resolution_clock::now();
-                fps=cont/(msPeriod/1000);
                 cont = 0;
             }
             cont++;
@@ -103,20 +106,16 @@ class FPSCounter
         }
         int get_mem_use()
         { //Note: this value is in MB!
-            FILE* file = fopen("/proc/self/status", "r");
-            int result = -1;
+            // statm: size resident shared ... in pages
             char line[128];
-
-            while (fgets(line, 128, file) != NULL)
-            {
-                if (strncmp(line, "VmRSS:", 6) == 0)
-                {
-                    result = parseLine(line);
-                    break;
-                }
-            }
-            fclose(file);
-            return result/1000;
+            const ssize_t n = statm.fd >= 0 ? pread(statm.fd, line, sizeof(line) - 1, 0) : -1;
+            if (n <= 0)
+                return -1;
+            line[n] = '\0';
+            long size = 0, resident = 0;
+            if (sscanf(line, "%ld %ld", &size, &resident) != 2)
+                return -1;
+            return resident * pageKB / 1000;
         }
         int parseLine(char* line)
         {
@@ -133,6 +132,30 @@ class FPSCounter
 		float last_period = 0;
         clock_t lastCPU, lastSysCPU, lastUserCPU;
         int numProcessors;
+        int fps = 0;
+        long pageKB = 4;
+        // owns the descriptor of /proc/self/statm: closed on destruction, moved without closing it twice
+        struct StatmFile
+        {
+            int fd = -1;
+            StatmFile() = default;
+            StatmFile(StatmFile &&other) noexcept : fd(std::exchange(other.fd, -1)) {}
+            StatmFile &operator=(StatmFile &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    if (fd >= 0)
+                        close(fd);
+                    fd = std::exchange(other.fd, -1);
+                }
+                return *this;
+            }
+            ~StatmFile()
+            {
+                if (fd >= 0)
+                    close(fd);
+            }
+        } statm;
         int period = 1000; //default period in ms
 };
 
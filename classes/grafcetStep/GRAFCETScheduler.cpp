@@ -0,0 +1,188 @@
+/****************************************************************************
+* File name: GRAFCETScheduler.cpp
+* Description: Shared hierarchical timer wheel that runs the cyclic (N) actions of every active GRAFCETStep.
+****************************************************************************/
+
+#include "GRAFCETScheduler.h"
+#include "GRAFCETStep.h"
+
+#include <algorithm>
+
+/**
+ * @brief Builds a scheduler
+ *
+ * @param tick_ms Resolution of the wheel, periods are rounded to multiples of it.
+ * @param parent QObject parent.
+ */
+GRAFCETScheduler::GRAFCETScheduler(int tick_ms, QObject *parent) : QObject(parent), tick_ms(std::max(tick_ms, 1)), now(0)
+{
+    std::fill(occupied, occupied + LEVELS, 0);
+    timer.setSingleShot(true);
+    timer.setTimerType(Qt::PreciseTimer);
+    connect(&timer, &QTimer::timeout, this, &GRAFCETScheduler::expire);
+    clock.start();
+}
+
+/**
+ * @brief Destroy GRAFCETScheduler object
+ */
+GRAFCETScheduler::~GRAFCETScheduler()
+{
+    timer.stop();
+    for (auto &g : groups)
+        delete g.second;
+}
+
+/**
+ * @brief Scheduler used by the steps unless another one is set, created in the thread of the first call.
+ */
+GRAFCETScheduler *GRAFCETScheduler::instance()
+{
+    static GRAFCETScheduler *scheduler = new GRAFCETScheduler();
+    return scheduler;
+}
+
+/**
+ * @brief Starts running the cyclic function of a step, or moves it to a new period.
+ *
+ * @param step Step to run.
+ * @param period_ms Period of cyclic execution.
+ */
+void GRAFCETScheduler::add(GRAFCETStep *step, int period_ms)
+{
+    remove(step);
+    const uint64_t period = std::max<uint64_t>((period_ms + tick_ms / 2) / tick_ms, 1);
+    Group *&group = groups[period];
+    if (group == nullptr)
+    {
+        group = new Group();
+        group->period = period;
+        group->expiry = currentTick() + period;
+        place(group);
+        rearm();
+    }
+    group->steps.push_back(step);
+    membership[step] = group;
+}
+
+/**
+ * @brief Stops running the cyclic function of a step. Its group is dropped at its next expiry if it becomes empty.
+ *
+ * @param step Step to stop.
+ */
+void GRAFCETScheduler::remove(GRAFCETStep *step)
+{
+    auto it = membership.find(step);
+    if (it == membership.end())
+        return;
+    std::vector<GRAFCETStep *> &steps = it->second->steps;
+    steps.erase(std::find(steps.begin(), steps.end(), step));
+    membership.erase(it);
+}
+
+/**
+ * @brief Timer slot: processes the wheel up to the current time and waits for the next non empty slot.
+ */
+void GRAFCETScheduler::expire()
+{
+    advance(currentTick());
+    rearm();
+}
+
+/**
+ * @brief Inserts a group in the level whose span covers its remaining time.
+ */
+void GRAFCETScheduler::place(Group *group)
+{
+    if (group->expiry < now)
+        group->expiry = now;
+    const uint64_t delta = group->expiry - now;
+    int level = 0;
+    while (level < LEVELS - 1 and delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+        level++;
+    const int slot = (group->expiry >> (SLOT_BITS * level)) & (SLOTS - 1);
+    wheel[level][slot].push_back(group);
+    occupied[level] |= uint64_t(1) << slot;
+}
+
+/**
+ * @brief Moves the wheel forward tick by tick, cascading the upper levels and running the expired groups.
+ */
+void GRAFCETScheduler::advance(uint64_t to)
+{
+    while (now < to)
+    {
+        now++;
+        for (int level = 1; level < LEVELS; level++)
+        {
+            if (now & ((uint64_t(1) << (SLOT_BITS * level)) - 1))
+                break;
+            const int slot = (now >> (SLOT_BITS * level)) & (SLOTS - 1);
+            due.swap(wheel[level][slot]);
+            occupied[level] &= ~(uint64_t(1) << slot);
+            for (Group *group : due)
+                place(group);
+            due.clear();
+        }
+        const int slot = now & (SLOTS - 1);
+        if (wheel[0][slot].empty())
+            continue;
+        due.swap(wheel[0][slot]);
+        occupied[0] &= ~(uint64_t(1) << slot);
+        for (Group *group : due)
+            fire(group);
+        due.clear();
+    }
+}
+
+/**
+ * @brief Runs every step of an expired group and schedules its next expiry, skipping the missed ones.
+ */
+void GRAFCETScheduler::fire(Group *group)
+{
+    if (group->steps.empty())
+    {
+        groups.erase(group->period);
+        delete group;
+        return;
+    }
+    // a cyclic function may enter or exit steps, so run a copy and skip the ones that left the group
+    running = group->steps;
+    for (GRAFCETStep *step : running)
+    {
+        auto it = membership.find(step);
+        if (it != membership.end() and it->second == group)
+            step->execute();
+    }
+    group->expiry += group->period;
+    const uint64_t current = currentTick();
+    if (group->expiry <= current)
+        group->expiry += ((current - group->expiry) / group->period + 1) * group->period;
+    place(group);
+}
+
+/**
+ * @brief Arms the timer for the earliest non empty slot of any level, or stops it if the wheel is empty.
+ */
+void GRAFCETScheduler::rearm()
+{
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        if (occupied[level] == 0)
+            continue;
+        const int shift = SLOT_BITS * level;
+        const uint64_t base = now >> shift;
+        const int first = (base + 1) & (SLOTS - 1);
+        const uint64_t rotated = first == 0 ? occupied[level] : (occupied[level] >> first) | (occupied[level] << (SLOTS - first));
+        const uint64_t t = (base + 1 + __builtin_ctzll(rotated)) << shift;
+        next = std::min(next, t);
+    }
+    if (next == UINT64_MAX)
+    {
+        timer.stop();
+        return;
+    }
+    const uint64_t current = currentTick();
+    timer.start(next > current ? int((next - current) * tick_ms) : 0);
+}
@@ -0,0 +1,74 @@
+/****************************************************************************
+* File name: GRAFCETScheduler.h
+* Description: Shared hierarchical timer wheel that runs the cyclic (N) actions of every active GRAFCETStep.
+****************************************************************************/
+
+#ifndef GRAFCETSCHEDULER_H
+#define GRAFCETSCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+class GRAFCETStep;
+
+/**
+ * @class GRAFCETScheduler
+ * @brief Drives the cyclic functions of the active steps from a single timer.
+ *
+ * Active steps with the same period form a group that is one entry of a 4 level, 64 slot timer wheel
+ * and runs in one wakeup. The only QTimer is armed for the next non empty slot, so the event loop sees
+ * one timer whatever the number of steps, and none while no step with a cyclic function is active.
+ * A step entering a period that is already running joins its group and first runs at the group's next
+ * expiry, at most one period after entering.
+ */
+class GRAFCETScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit GRAFCETScheduler(int tick_ms = 1, QObject *parent = nullptr);
+    ~GRAFCETScheduler();
+    static GRAFCETScheduler *instance();
+
+    void add(GRAFCETStep *step, int period_ms);
+    void remove(GRAFCETStep *step);
+    int activeSteps() const { return membership.size(); }
+    int tick() const { return tick_ms; }
+
+private slots:
+    void expire();
+
+private:
+    struct Group
+    {
+        uint64_t period;                    // ticks
+        uint64_t expiry;                    // absolute tick of the next execution
+        std::vector<GRAFCETStep *> steps;
+    };
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+
+    std::vector<Group *> wheel[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS];              // non empty slots of each level
+    std::map<uint64_t, Group *> groups;     // by period
+    std::unordered_map<GRAFCETStep *, Group *> membership;
+    std::vector<Group *> due;               // reused while processing a slot
+    std::vector<GRAFCETStep *> running;     // reused while running a group
+    QTimer timer;
+    QElapsedTimer clock;
+    int tick_ms;
+    uint64_t now;                           // tick up to which the wheel has been processed
+
+    uint64_t currentTick() const { return clock.elapsed() / tick_ms; }
+    void place(Group *group);
+    void advance(uint64_t to);
+    void fire(Group *group);
+    void rearm();
+};
+#endif // GRAFCETSCHEDULER_H
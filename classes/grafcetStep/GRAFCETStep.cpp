@@ -7,6 +7,8 @@
 
 #include "GRAFCETStep.h"
 
+GRAFCETTraceHook GRAFCETStep::traceHook = nullptr;
+
 /**
  * @brief Builds GRAFCETStep object
  *
@@ -19,25 +21,16 @@
  * @param P0 Function to execute when exiting the step
  */
 GRAFCETStep::GRAFCETStep(QString name, int period_ms, const std::function<void()>& N, const std::function<void()>& P1, const std::function<void()>& P0){
-    #if DEBUG
-        std::cout << "Construyendo GRAFCETStep "<< name.toStdString() <<std::endl<<std::flush;
-    #endif
     this->setObjectName(name);                  // Set object name
 
     this->N = N;                                // Set function to execute cyclically
     this->P1 = P1;                              //Function to be executed at start step
     this->P0 = P0;                              //Function to be executed at end step
 
-    if (this->N != nullptr)
-    {
-        this->timer_step = new QTimer(this);       //Create cyclic timer
-        this->timer_step->setInterval(period_ms);  //Set time to cyclic timer
-        //Connecting the cyclic timer to the function 
-        connect(this->timer_step, &QTimer::timeout, this, [this](){this->N();});
-    }
-    #if DEBUG
-        std::cout << "Construido GRAFCETStep"<< this->objectName().toStdString() <<std::endl<<std::flush;
-    #endif
+    this->period_ms = period_ms;
+    this->active = false;
+    this->scheduler = GRAFCETScheduler::instance();
+    GRAFCET_TRACE_EVENT(GRAFCETTraceEvent::Constructed, this);
 }
 
 /**
@@ -48,13 +41,8 @@ GRAFCETStep::GRAFCETStep(QString name, int period_ms, const std::function<void()
 GRAFCETStep::~GRAFCETStep() 
 {
     if (this->N != nullptr)
-    {
-        this->timer_step->stop();  //Stop cyclic timer
-        delete this->timer_step;   //Delete cyclic timer
-    }
-    #if DEBUG
-        std::cout << "Dell GRAFCETStep"<< this->objectName().toStdString()<<std::endl<<std::flush;
-    #endif
+        this->scheduler->remove(this);  //Stop cyclic execution
+    GRAFCET_TRACE_EVENT(GRAFCETTraceEvent::Destroyed, this);
 }
 
 /**
@@ -66,19 +54,10 @@ GRAFCETStep::~GRAFCETStep()
  */
 void GRAFCETStep::setPeriod(int period_ms)
 {
-    if (this->N != nullptr)
-    {
-        //Set new time to cyclic timer
-        this->timer_step->setInterval(period_ms);
-        this->mtx.lock();
-        //Restart cyclic timer
-        if (this->timer_step->isActive())
-        {
-            timer_step->stop();
-            timer_step->start();
-        }
-        this->mtx.unlock();
-    }
+    this->period_ms = period_ms;
+    //Move to the group of the new period
+    if (this->N != nullptr and this->active)
+        this->scheduler->add(this, period_ms);
 }
 
 /**
@@ -91,15 +70,41 @@ void GRAFCETStep::setPeriod(int period_ms)
 int GRAFCETStep::getPeriod()
 {
     if (this->N != nullptr)
-        return this->timer_step->interval();
+        return this->period_ms;
     else
         return -1;
 }
 
+/**
+ * @brief Changes the scheduler that runs the cyclic function
+ *
+ * By default all the steps share GRAFCETScheduler::instance().
+ *
+ * @param scheduler Scheduler to use from now on.
+ */
+void GRAFCETStep::setScheduler(GRAFCETScheduler *scheduler)
+{
+    if (this->N != nullptr and this->active)
+    {
+        this->scheduler->remove(this);
+        scheduler->add(this, this->period_ms);
+    }
+    this->scheduler = scheduler;
+}
+
+/**
+ * @brief Runs the cyclic function, called by the scheduler while the step is active.
+ */
+void GRAFCETStep::execute()
+{
+    GRAFCET_TRACE_EVENT(GRAFCETTraceEvent::Executed, this);
+    this->N();
+}
+
 /**
  * @brief When the step is activated this function is executed. 
  *
- * This function launches the cyclic timer that executes the configured function, event is not used.
+ * This function adds the step to the scheduler that executes the configured function, event is not used.
  */
 void GRAFCETStep::onEntry(QEvent *event)
 {
@@ -108,30 +113,25 @@ void GRAFCETStep::onEntry(QEvent *event)
     if (this->P1 != nullptr)
         this->P1();                     //Launches the entry function
 
+    this->active = true;
     if (this->N != nullptr)
-        this->timer_step->start();     //Launches the cyclic timer
-    #if DEBUG
-        std::cout << "Entrando en GRAFCETStep "<< this->objectName().toStdString() <<std::endl<<std::flush;
-    #endif
+        this->scheduler->add(this, this->period_ms);     //Launches the cyclic execution
+    GRAFCET_TRACE_EVENT(GRAFCETTraceEvent::Entered, this);
 }
 
 /**
  * @brief When the step is deactivated this function is executed. 
  *
- * This function stops the cyclic timer that executes the configured function, event is not used.
+ * This function removes the step from the scheduler that executes the configured function, event is not used.
  */
 void GRAFCETStep::onExit(QEvent *event)
 {
     Q_UNUSED(event)
-    if (this->N != nullptr){
-        this->mtx.lock();
-        this->timer_step->stop();      //Stops the cyclic timer
-        this->mtx.unlock();
-    }
+    this->active = false;
+    if (this->N != nullptr)
+        this->scheduler->remove(this);      //Stops the cyclic execution
     if (this->P0 != nullptr)
         this->P0();                    //Launches the exit function
 
-    #if DEBUG
-        std::cout<< "Saliendo de GRAFCETStep "<< this->objectName().toStdString() <<std::endl<<std::flush;
-    #endif
+    GRAFCET_TRACE_EVENT(GRAFCETTraceEvent::Exited, this);
 }
\ No newline at end of file
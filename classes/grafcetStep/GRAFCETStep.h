@@ -7,12 +7,31 @@
 
 #ifndef GRAFCETSTEP_H
 #define GRAFCETSTEP_H
-#define DEBUG 0
 
 #include <QState>
 #include <QTimer>
 #include <iostream>
 #include <mutex>
+#include <functional>
+
+#include "GRAFCETScheduler.h"
+
+class GRAFCETStep;
+
+/**
+ * Tracing of construction, destruction, entry, exit and cyclic execution of the steps. It is compiled
+ * out unless GRAFCET_TRACE is defined to 1, and then calls GRAFCETStep::traceHook if one is set.
+ */
+#ifndef GRAFCET_TRACE
+#define GRAFCET_TRACE 0
+#endif
+enum class GRAFCETTraceEvent { Constructed, Destroyed, Entered, Exited, Executed };
+typedef void (*GRAFCETTraceHook)(GRAFCETTraceEvent event, const GRAFCETStep *step);
+#if GRAFCET_TRACE
+#define GRAFCET_TRACE_EVENT(event, step) do { if (GRAFCETStep::traceHook != nullptr) GRAFCETStep::traceHook(event, step); } while (0)
+#else
+#define GRAFCET_TRACE_EVENT(event, step) do {} while (0)
+#endif
 
 
 /**
@@ -20,6 +39,7 @@
  * @brief Class representing a state or step of the GRAFCET diagram.
  *
  * QState wrapper to execute functions, simulating a GRAFCET or SFC(Sequential Function Chart) step (according to EN61131-3).
+ * The cyclic function is run by a GRAFCETScheduler shared by all the steps instead of a timer per step.
  */
 class GRAFCETStep : public QState
 {
@@ -30,14 +50,21 @@ public:
     ~GRAFCETStep();
     void setPeriod(int period_ms);
     int getPeriod();
+    void setScheduler(GRAFCETScheduler *scheduler);
+
+    static GRAFCETTraceHook traceHook;
 
 protected:
     void onEntry(QEvent *event) ;
     void onExit(QEvent *event) ;
 
 private:
-    std::mutex mtx;
-    QTimer *timer_step;            //Cyclic timer of execution of the function
+    friend class GRAFCETScheduler;
+    void execute();
+
+    GRAFCETScheduler *scheduler;    //Runs the cyclic function while the step is active
+    int period_ms;                  //Period of cyclic execution
+    bool active;
     std::function<void()> N;        //Function to be executed cyclically
     std::function<void()> P1;       //Function to be executed at start step
     std::function<void()> P0;       //Function to be executed at end step
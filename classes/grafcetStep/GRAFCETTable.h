@@ -0,0 +1,242 @@
+/****************************************************************************
+* File name: GRAFCETTable.h
+* Description: Table driven GRAFCET execution without Qt: steps and transitions are constexpr tables
+*              compiled into a dense [step][event] lookup, dispatched without allocations or locks.
+****************************************************************************/
+
+#ifndef GRAFCETTABLE_H
+#define GRAFCETTABLE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Actions of a step, the same hooks as GRAFCETStep: N cyclically while active, P1 on entry and P0 on exit.
+ *
+ * Plain function pointers (or captureless lambdas) that receive the user context, so tables can be constexpr.
+ */
+template <typename Context>
+struct GRAFCETActions
+{
+    const char *name;
+    void (*N)(Context &);
+    void (*P1)(Context &);
+    void (*P0)(Context &);
+};
+
+/**
+ * @brief Transition from one step to another when an event arrives and the optional guard holds.
+ */
+template <typename State, typename Event, typename Context>
+struct GRAFCETTransition
+{
+    State from;
+    Event event;
+    State to;
+    bool (*guard)(const Context &);
+};
+
+/**
+ * @brief Compiled transition table. State and Event are enums whose last enumerator is Count.
+ *
+ * first[state][event] is the first transition to try, next[] chains the ones sharing the same step and
+ * event in declaration order, -1 ends the chain.
+ */
+template <typename State, typename Event, typename Context, std::size_t Transitions>
+struct GRAFCETTable
+{
+    static constexpr std::size_t States = static_cast<std::size_t>(State::Count);
+    static constexpr std::size_t Events = static_cast<std::size_t>(Event::Count);
+    static_assert(Transitions < INT16_MAX, "too many transitions");
+
+    std::array<GRAFCETTransition<State, Event, Context>, Transitions> transitions;
+    std::array<std::array<int16_t, Events>, States> first;
+    std::array<int16_t, Transitions> next;
+};
+
+/**
+ * @brief Builds the lookup of a transition list, meant to be evaluated at compile time:
+ *
+ * @code
+ * static constexpr GRAFCETTransition<S, E, Ctx> transitions[] = { {S::Idle, E::Start, S::Run, nullptr}, ... };
+ * static constexpr auto table = makeGRAFCETTable(transitions);
+ * @endcode
+ */
+template <typename State, typename Event, typename Context, std::size_t Transitions>
+constexpr GRAFCETTable<State, Event, Context, Transitions> makeGRAFCETTable(const GRAFCETTransition<State, Event, Context> (&transitions)[Transitions])
+{
+    GRAFCETTable<State, Event, Context, Transitions> table{};
+    for (std::size_t s = 0; s < table.States; s++)
+        for (std::size_t e = 0; e < table.Events; e++)
+            table.first[s][e] = -1;
+    // backwards, so that the first declared transition of a chain is tried first
+    for (std::size_t i = Transitions; i-- > 0;)
+    {
+        table.transitions[i] = transitions[i];
+        int16_t &first = table.first[static_cast<std::size_t>(transitions[i].from)][static_cast<std::size_t>(transitions[i].event)];
+        table.next[i] = first;
+        first = static_cast<int16_t>(i);
+    }
+    return table;
+}
+
+/**
+ * @class GRAFCETMachine
+ * @brief Executes a compiled GRAFCET table with one active step.
+ *
+ * dispatch() and tick() must be called from a single thread (the owner, typically a supervisor loop that is
+ * not a Qt thread). Other threads send events with post(), a bounded lock free queue drained by tick().
+ * Nothing allocates after construction.
+ */
+template <typename State, typename Event, typename Context, std::size_t Transitions, std::size_t QueueSize = 64>
+class GRAFCETMachine
+{
+public:
+    typedef GRAFCETTable<State, Event, Context, Transitions> Table;
+    static_assert((QueueSize & (QueueSize - 1)) == 0, "QueueSize must be a power of two");
+
+    GRAFCETMachine(const Table &table, const GRAFCETActions<Context> (&actions)[Table::States], Context &context)
+        : table(table), actions(actions), context(context), current(State::Count), active(false), transitionsDone(0), enqueuePos(0), dequeuePos(0)
+    {
+        for (std::size_t i = 0; i < QueueSize; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Activates the initial step, running its P1.
+     */
+    void start(State initial)
+    {
+        current.store(initial, std::memory_order_release);
+        active.store(true, std::memory_order_release);
+        enter(initial);
+    }
+
+    /**
+     * @brief Deactivates the current step, running its P0.
+     */
+    void stop()
+    {
+        if (not active)
+            return;
+        exit(current.load(std::memory_order_relaxed));
+        active.store(false, std::memory_order_release);
+    }
+
+    /**
+     * @brief Fires the first enabled transition of the current step for the event.
+     *
+     * @return true if a transition was taken.
+     */
+    bool dispatch(Event event)
+    {
+        if (not active.load(std::memory_order_relaxed))
+            return false;
+        const State state = current.load(std::memory_order_relaxed);
+        for (int i = table.first[index(state)][index(event)]; i >= 0; i = table.next[i])
+        {
+            const GRAFCETTransition<State, Event, Context> &t = table.transitions[i];
+            if (t.guard == nullptr or t.guard(context))
+            {
+                exit(state);
+                current.store(t.to, std::memory_order_release);
+                transitionsDone.fetch_add(1, std::memory_order_relaxed);
+                enter(t.to);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Queues an event from any thread, it is dispatched by the next tick().
+     *
+     * @return false if the queue is full.
+     */
+    bool post(Event event)
+    {
+        std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & (QueueSize - 1)];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.event = event;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Dispatches the posted events in order and then runs N of the active step once.
+     */
+    void tick()
+    {
+        for (;;)
+        {
+            Cell &cell = cells[dequeuePos & (QueueSize - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+                break;
+            const Event event = cell.event;
+            cell.sequence.store(dequeuePos + QueueSize, std::memory_order_release);
+            dequeuePos++;
+            dispatch(event);
+        }
+        if (active.load(std::memory_order_relaxed))
+        {
+            const GRAFCETActions<Context> &a = actions[index(current.load(std::memory_order_relaxed))];
+            if (a.N != nullptr)
+                a.N(context);
+        }
+    }
+
+    State state() const { return current.load(std::memory_order_acquire); }    // from any thread
+    const char *stateName() const    // "None" while not started or stopped
+    {
+        const State s = state();
+        return isActive() and s != State::Count ? actions[index(s)].name : "None";
+    }
+    bool isActive() const { return active.load(std::memory_order_acquire); }                      // from any thread
+    uint64_t transitionCount() const { return transitionsDone.load(std::memory_order_relaxed); }   // from any thread
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        Event event;
+    };
+
+    const Table &table;
+    const GRAFCETActions<Context> (&actions)[Table::States];
+    Context &context;
+    // written by the owner only, atomic so that the observers (state(), isActive()...) can run in other threads
+    std::atomic<State> current;
+    std::atomic<bool> active;
+    std::atomic<uint64_t> transitionsDone;
+    std::array<Cell, QueueSize> cells;
+    std::atomic<std::size_t> enqueuePos;
+    std::size_t dequeuePos;                 // only the owner thread pops
+
+    static constexpr std::size_t index(State s) { return static_cast<std::size_t>(s); }
+    static constexpr std::size_t index(Event e) { return static_cast<std::size_t>(e); }
+    void enter(State s) { if (actions[index(s)].P1 != nullptr) actions[index(s)].P1(context); }
+    void exit(State s) { if (actions[index(s)].P0 != nullptr) actions[index(s)].P0(context); }
+};
+
+template <typename State, typename Event, typename Context, std::size_t Transitions>
+GRAFCETMachine(const GRAFCETTable<State, Event, Context, Transitions> &, const GRAFCETActions<Context> (&)[static_cast<std::size_t>(State::Count)], Context &)
+    -> GRAFCETMachine<State, Event, Context, Transitions>;
+
+#endif // GRAFCETTABLE_H
@@ -0,0 +1,235 @@
+/*
+ * Layered costs of Grid, with no Qt dependency.
+ *
+ * Every source of cost writes its own dense layer of floats, one value per tile (kx * nz + kz, as the distance field
+ * of Grid): static areas, sensed obstacles, their inflation, semantic objects and affordances. 0 in a layer adds
+ * nothing. A layer only records the bounding box of the tiles written since the last composition, and compose()
+ * recomputes the master cost inside the union of those boxes alone: the largest value of the Max layers, at least
+ * 'free', plus the values of the Sum layers, kept under 'lethal' unless a layer holds a lethal value itself.
+ *
+ *      LayeredCostmap layers;
+ *      layers.reset({nx, nz, left, top, tile});
+ *      layers.fill_polygon(LayeredCostmap::Affordance, polygon, 50.f);       // rasterized once
+ *      layers.set(LayeredCostmap::Obstacle, tile, LayeredCostmap::lethal);
+ *      layers.compose([](std::int32_t tile, float cost){ ... });            // the tiles whose cost changed
+ */
+
+#ifndef COSTMAP_LAYERS_H
+#define COSTMAP_LAYERS_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <Eigen/Dense>
+
+class LayeredCostmap
+{
+public:
+    enum Layer : std::uint8_t { Static, Obstacle, Inflation, Semantic, Affordance };
+    static constexpr std::size_t num_layers = 5;
+    enum class Combine { Max, Sum };
+
+    static constexpr float free = 1.f;          // cost of a tile no layer writes
+    static constexpr float lethal = 100.f;      // an occupied tile; Sum layers alone stay under it
+
+    struct Geometry
+    {
+        long int nx = 0, nz = 0;                // tiles along x and z
+        float left = 0, top = 0;                // grid coordinates of the center of tile (0, 0)
+        int tile = 100;                         // mm
+        bool operator==(const Geometry &) const = default;
+    };
+    struct Bounds                               // tiles [x0, x1] x [z0, z1], empty if x1 < x0
+    {
+        long int x0 = std::numeric_limits<long int>::max(), z0 = std::numeric_limits<long int>::max();
+        long int x1 = -1, z1 = -1;
+        bool empty() const { return x1 < x0; }
+        void add(long int x, long int z)
+        {
+            x0 = std::min(x0, x); x1 = std::max(x1, x);
+            z0 = std::min(z0, z); z1 = std::max(z1, z);
+        }
+        void add(const Bounds &b)
+        {
+            if (b.empty())
+                return;
+            add(b.x0, b.z0);
+            add(b.x1, b.z1);
+        }
+    };
+
+    // Clears every layer. The master is unknown until the next compose(), which then reports every tile.
+    void reset(const Geometry &geometry)
+    {
+        geom = geometry;
+        const auto n = std::size_t(geom.nx * geom.nz);
+        for (auto &l : layers)
+        {
+            l.cells.assign(n, 0.f);
+            l.dirty = Bounds();
+        }
+        master.assign(n, std::numeric_limits<float>::quiet_NaN());
+        all_dirty = true;
+    }
+    const Geometry &geometry() const { return geom; }
+
+    // Obstacle and Inflation are combined with Max by default, like the costs of Grid; the others too
+    void set_combine(Layer l, Combine c)
+    {
+        layers[l].combine = c;
+        touch_all(l);
+    }
+    Combine combine(Layer l) const { return layers[l].combine; }
+    // A disabled layer keeps its values but does not count
+    void set_enabled(Layer l, bool enabled)
+    {
+        if (layers[l].enabled != enabled)
+            touch_all(l);
+        layers[l].enabled = enabled;
+    }
+    bool enabled(Layer l) const { return layers[l].enabled; }
+
+    float get(Layer l, std::int32_t tile) const { return layers[l].cells[tile]; }
+    void set(Layer l, std::int32_t tile, float v)
+    {
+        auto &c = layers[l].cells[tile];
+        if (c == v)
+            return;
+        c = v;
+        layers[l].dirty.add(tile / geom.nz, tile % geom.nz);
+    }
+    void fill(Layer l, float v)
+    {
+        auto &layer = layers[l];
+        for (long int t = 0; t < (long int)layer.cells.size(); t++)
+            set(l, (std::int32_t)t, v);
+    }
+    // Writes v in the tiles whose center is inside the polygon (even-odd rule), grid coordinates.
+    // Returns the number of tiles.
+    std::size_t fill_polygon(Layer l, const std::vector<Eigen::Vector2f> &polygon, float v)
+    {
+        if (polygon.size() < 3 or geom.nx == 0)
+            return 0;
+        float xmin = polygon[0].x(), xmax = xmin;
+        for (const auto &p : polygon)
+        {
+            xmin = std::min(xmin, p.x());
+            xmax = std::max(xmax, p.x());
+        }
+        const long int kx0 = std::max(0L, (long int)std::ceil((xmin - geom.left) / geom.tile));
+        const long int kx1 = std::min(geom.nx - 1, (long int)std::floor((xmax - geom.left) / geom.tile));
+        std::size_t count = 0;
+        std::vector<float> crossings;
+        for (long int kx = kx0; kx <= kx1; kx++)
+        {
+            // crossings of the column of tile centers x with the edges, each edge taken as [a, b)
+            const float x = geom.left + kx * geom.tile;
+            crossings.clear();
+            for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+            {
+                const auto &a = polygon[j], &b = polygon[i];
+                if ((a.x() <= x) != (b.x() <= x))
+                    crossings.push_back(a.y() + (x - a.x()) * (b.y() - a.y()) / (b.x() - a.x()));
+            }
+            std::sort(crossings.begin(), crossings.end());
+            for (std::size_t c = 0; c + 1 < crossings.size(); c += 2)
+            {
+                const long int kz0 = std::max(0L, (long int)std::ceil((crossings[c] - geom.top) / geom.tile));
+                const long int kz1 = std::min(geom.nz - 1, (long int)std::floor((crossings[c + 1] - geom.top) / geom.tile));
+                for (long int kz = kz0; kz <= kz1; kz++, count++)
+                    set(l, (std::int32_t)(kx * geom.nz + kz), v);
+            }
+        }
+        return count;
+    }
+
+    Bounds dirty(Layer l) const { return layers[l].dirty; }
+    Bounds dirty() const
+    {
+        Bounds b;
+        if (all_dirty)
+            b.add(Bounds{0, 0, geom.nx - 1, geom.nz - 1});
+        for (const auto &l : layers)
+            b.add(l.dirty);
+        return b;
+    }
+
+    // Recomputes the master cost inside the dirty bounds and calls changed(tile, cost) for every tile whose cost
+    // changed (all of them after reset). The rows are combined layer by layer. Returns the number of changed tiles.
+    template <typename F>
+    std::size_t compose(F &&changed)
+    {
+        const Bounds b = dirty();
+        for (auto &l : layers)
+            l.dirty = Bounds();
+        all_dirty = false;
+        if (b.empty())
+            return 0;
+
+        const auto width = std::size_t(b.z1 - b.z0 + 1);
+        max_row.resize(width);
+        sum_row.resize(width);
+        lethal_row.resize(width);
+        std::size_t count = 0;
+        for (long int x = b.x0; x <= b.x1; x++)
+        {
+            const std::size_t first = x * geom.nz + b.z0;
+            std::fill(max_row.begin(), max_row.end(), free);
+            std::fill(sum_row.begin(), sum_row.end(), 0.f);
+            std::fill(lethal_row.begin(), lethal_row.end(), 0.f);
+            for (const auto &l : layers)
+            {
+                if (not l.enabled)
+                    continue;
+                const float *c = l.cells.data() + first;
+                if (l.combine == Combine::Max)
+                    for (std::size_t i = 0; i < width; i++)
+                        max_row[i] = std::max(max_row[i], c[i]);
+                else
+                    for (std::size_t i = 0; i < width; i++)
+                        sum_row[i] += c[i];
+                for (std::size_t i = 0; i < width; i++)
+                    lethal_row[i] = std::max(lethal_row[i], c[i]);
+            }
+            for (std::size_t i = 0; i < width; i++)
+            {
+                const float cost = lethal_row[i] >= lethal ? lethal : std::min(max_row[i] + sum_row[i], lethal - 1.f);
+                if (master[first + i] == cost)      // false for NaN
+                    continue;
+                master[first + i] = cost;
+                changed((std::int32_t)(first + i), cost);
+                count++;
+            }
+        }
+        return count;
+    }
+    // Master cost of the last compose()
+    float cost(std::int32_t tile) const { return master[tile]; }
+    const std::vector<float> &layer(Layer l) const { return layers[l].cells; }
+
+private:
+    struct Data
+    {
+        std::vector<float> cells;
+        Bounds dirty;
+        Combine combine = Combine::Max;
+        bool enabled = true;
+    };
+    void touch_all(Layer l)
+    {
+        if (geom.nx > 0 and geom.nz > 0)
+            layers[l].dirty.add(Bounds{0, 0, geom.nx - 1, geom.nz - 1});
+    }
+
+    Geometry geom;
+    std::array<Data, num_layers> layers;
+    std::vector<float> master;
+    bool all_dirty = false;
+    std::vector<float> max_row, sum_row, lethal_row;
+};
+
+#endif // COSTMAP_LAYERS_H
@@ -1,10 +1,81 @@
 #include "grid.h"
+#include <algorithm>
 #include <cppitertools/zip.hpp>
 #include <cppitertools/range.hpp>
 #include <cppitertools/slice.hpp>
 #include <cppitertools/enumerate.hpp>
 #include <cppitertools/chunked.hpp>
 #include <cppitertools/filterfalse.hpp>
+#include <boost/crc.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+// Render::Image item: pixel (ix, iz) is the tile centered at (dim.left() + ix * TILE_SIZE, dim.top() + iz * TILE_SIZE)
+class Grid::ImageItem : public QGraphicsItem
+{
+    public:
+        ImageItem(long int nx, long int nz, const QRectF &rect_) : image(nx, nz, QImage::Format_RGB32), rect(rect_)
+        {
+            image.fill(QColor("White").rgb());
+            setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);  // to get exposedRect in paint
+        };
+        QRectF boundingRect() const override
+        { return rect; };
+        void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *) override
+        {
+            // only the exposed part of the image is drawn
+            const QRectF exposed = option->exposedRect.intersected(rect);
+            const double sx = image.width() / rect.width(), sz = image.height() / rect.height();
+            painter->drawImage(exposed, image, QRectF((exposed.left() - rect.left()) * sx, (exposed.top() - rect.top()) * sz,
+                                                      exposed.width() * sx, exposed.height() * sz));
+        };
+        inline void set(long int ix, long int iz, QRgb color)
+        {
+            auto &pixel = reinterpret_cast<QRgb *>(image.scanLine(iz))[ix];
+            if (pixel == color) return;
+            pixel = color;
+            dirty = dirty.united(QRect(ix, iz, 1, 1));
+        };
+        void flush()
+        {
+            if (dirty.isEmpty()) return;
+            const double sx = rect.width() / image.width(), sz = rect.height() / image.height();
+            update(QRectF(rect.left() + dirty.left() * sx, rect.top() + dirty.top() * sz, dirty.width() * sx, dirty.height() * sz));
+            dirty = QRect();
+        };
+        // moves the item (dx, dz) pixels keeping the pixels that remain inside, the exposed ones become 'fill'
+        void scroll(long int dx, long int dz, double tile_size, QRgb fill)
+        {
+            const long int w = image.width(), h = image.height();
+            std::vector<QRgb> row(w);
+            for (long int n = 0; n < h; ++n)
+            {
+                const long int iz = dz >= 0 ? n : h - 1 - n;      // rows are read before being overwritten
+                auto *dst = reinterpret_cast<QRgb *>(image.scanLine(iz));
+                if (iz + dz < 0 or iz + dz >= h)
+                {
+                    std::fill(dst, dst + w, fill);
+                    continue;
+                }
+                const auto *src = reinterpret_cast<const QRgb *>(image.scanLine(iz + dz));
+                for (long int ix = 0; ix < w; ++ix)
+                    row[ix] = (ix + dx < 0 or ix + dx >= w) ? fill : src[ix + dx];
+                std::copy(row.begin(), row.end(), dst);
+            }
+            prepareGeometryChange();
+            rect.translate(dx * tile_size, dz * tile_size);
+            dirty = QRect();
+            update();
+        };
+    private:
+        QImage image;
+        QRectF rect;
+        QRect dirty;
+};
 
 auto operator<<(std::ostream &os, const Grid::Key &k) -> decltype(k.save(os), os)
 {
@@ -33,9 +104,10 @@ void Grid::initialize(  QRectF dim_,
                         bool read_from_file,
                         const std::string &file_name,
                         QPointF grid_center,
-                        float grid_angle)
+                        float grid_angle,
+                        Storage storage_,
+                        Render render_)
 {
-    static QGraphicsRectItem *bounding_box = nullptr;
     dim = dim_;
     TILE_SIZE = tile_size;
     scene = scene_;
@@ -44,18 +116,44 @@ void Grid::initialize(  QRectF dim_,
     //qInfo() << "    " << "left:" << dim.left() << "right:" << dim.right() << "bottom:" << dim.bottom() << "top:" << dim.top() << "tile:" << TILE_SIZE;
     /// CHECK DIMENSIONS BEFORE PROCEED
     qInfo() << __FUNCTION__ << "Grid coordinates. Center:" << grid_center << "Angle:" << grid_angle;
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
+    for_each_cell([this](const Key &, T &value){ if(value.tile != nullptr) scene->removeItem(value.tile); });
     if(bounding_box != nullptr) scene->removeItem(bounding_box);
+    delete image_item;
+    image_item = nullptr;
     fmap.clear();
+    dense.cells.clear();
+    storage = storage_;
+    render = render_;
+    dense.nx = dense.nz = 0;
+    dense.ox = dense.oz = 0;
+    this->grid_center = grid_center;
+    this->grid_angle = grid_angle;
+    for (float i = dim.left(); i < dim.right(); i += TILE_SIZE) dense.nx++;
+    for (float j = dim.top(); j < dim.bottom(); j += TILE_SIZE) dense.nz++;
+    if (storage == Storage::Dense)
+        dense.cells.resize(dense.nx * dense.nz);
+    brushfire = Brushfire();
+    flipped_cells.clear();
+    coarse.dirty = true;
+    device_edits.clear();
+    device_upload = true;
+    device_ahead = false;
+    if (storage != Storage::Dense)
+        device.reset();
 
-//    if(read_from_file and not file_name.empty())
-//        readFromFile(file_name);
     QColor my_color = QColor("White");
     //my_color.setAlpha(40);
     std::uint32_t id=0;
     Eigen::Matrix2f matrix;
     matrix << cos(grid_angle) , -sin(grid_angle) , sin(grid_angle) , cos(grid_angle);
+    if (render == Render::Image)
+    {
+        image_item = new ImageItem(dense.nx, dense.nz, QRectF(dim.left() - TILE_SIZE/2., dim.top() - TILE_SIZE/2.,
+                                                              dense.nx * TILE_SIZE, dense.nz * TILE_SIZE));
+        image_item->setPos(grid_center);
+        image_item->setRotation(qRadiansToDegrees(grid_angle));
+        scene->addItem(image_item);
+    }
     for (float i = dim.left(); i < dim.right(); i += TILE_SIZE)
         for (float j = dim.top(); j < dim.bottom(); j += TILE_SIZE)
         {
@@ -64,16 +162,26 @@ void Grid::initialize(  QRectF dim_,
             aux.free = true;
             aux.visited = false;
             aux.cost = 1.0;
-            QGraphicsRectItem* tile = scene->addRect(-TILE_SIZE/2, -TILE_SIZE/2, TILE_SIZE, TILE_SIZE, QPen(my_color), QBrush(my_color));
-            //tile->setZValue(50);
-            Eigen::Vector2f res = matrix * Eigen::Vector2f(i, j) + Eigen::Vector2f(grid_center.x(), grid_center.y());
-            tile->setPos(res.x(), res.y());
-            tile->setRotation(qRadiansToDegrees(grid_angle));
-            aux.tile = tile;
-            insert(Key(i, j), aux);
+            aux.tile = nullptr;
+            if (render == Render::Items)
+            {
+                QGraphicsRectItem* tile = scene->addRect(-TILE_SIZE/2, -TILE_SIZE/2, TILE_SIZE, TILE_SIZE, QPen(my_color), QBrush(my_color));
+                //tile->setZValue(50);
+                Eigen::Vector2f res = matrix * Eigen::Vector2f(i, j) + Eigen::Vector2f(grid_center.x(), grid_center.y());
+                tile->setPos(res.x(), res.y());
+                tile->setRotation(qRadiansToDegrees(grid_angle));
+                aux.tile = tile;
+            }
+            if (storage == Storage::Dense)
+                dense.cells[aux.id] = aux;
+            else
+                insert(Key(i, j), aux);
             //qInfo() << __FUNCTION__ << i << j << aux.id << aux.free << aux.tile->pos();
         }
 
+    if(read_from_file and not file_name.empty())
+        readFromBinaryFile(file_name);
+
     // draw bounding box
     bounding_box = scene->addRect(dim, QPen(QColor("Grey"), 40));
     bounding_box->setPos(grid_center);
@@ -84,50 +192,72 @@ void Grid::insert(const Key &key, const T &value)
 {
     fmap.insert(std::make_pair(key, value));
 }
+inline long int Grid::cell_index(long int x, long int z) const
+{
+    long int kx = rint((x - dim.left()) / TILE_SIZE);
+    long int kz = rint((z - dim.top()) / TILE_SIZE);
+    if (kx < 0 or kx >= dense.nx or kz < 0 or kz >= dense.nz)
+        return -1;
+    return kx * dense.nz + kz;
+}
+inline Grid::T* Grid::find_tile(long int kx, long int kz)
+{
+    if (storage == Storage::Dense)
+        return (kx < 0 or kx >= dense.nx or kz < 0 or kz >= dense.nz) ? nullptr : &dense.cells[dense.physical(kx, kz)];
+    auto it = fmap.find(Key((long int)(dim.left() + kx * TILE_SIZE), (long int)(dim.top() + kz * TILE_SIZE)));
+    return it == fmap.end() ? nullptr : &it->second;
+}
+inline const Grid::T* Grid::find_tile(long int kx, long int kz) const
+{
+    return const_cast<Grid *>(this)->find_tile(kx, kz);
+}
+inline Grid::T* Grid::find_cell(long int x, long int z)
+{
+    if (storage == Storage::Dense)
+    {
+        auto i = cell_index(x, z);
+        return i < 0 ? nullptr : &dense.cells[dense.physical(i / dense.nz, i % dense.nz)];
+    }
+    auto it = fmap.find(pointToKey(x, z));
+    return it == fmap.end() ? nullptr : &it->second;
+}
+Grid::T& Grid::at(const Key &k)
+{
+    if (storage == Storage::Dense)
+    {
+        auto i = cell_index(k.x, k.z);
+        if (i < 0)
+            throw std::out_of_range("Grid::at: key out of the grid");
+        return dense.cells[dense.physical(i / dense.nz, i % dense.nz)];
+    }
+    return fmap.at(k);
+}
 inline std::tuple<bool, Grid::T&> Grid::getCell(long int x, long int z)
 {
     if (not dim.contains(QPointF(x, z)))
         return std::forward_as_tuple(false, T());
-    else
-        try
-        {
-            return std::forward_as_tuple(true, fmap.at(pointToKey(x, z)));
-        }
-        catch(const std::exception &e)
-        {
-            //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-            return std::forward_as_tuple(false, T());
-        }
+    if (T *cell = find_cell(x, z); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Grid::T&> Grid::getCell(const Key &k)
 {
     if (not dim.contains(k.toQPointF()))
         return std::forward_as_tuple(false, T());
-    else
-      try
-      {
-          return std::forward_as_tuple(true, fmap.at(pointToKey(k.x, k.z)));
-      }
-      catch(const std::exception &e)
-      {
-          qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-          return std::forward_as_tuple(false, T());
-      }
+    if (T *cell = find_cell(k.x, k.z); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 inline std::tuple<bool, Grid::T&> Grid::getCell(const Eigen::Vector2f &p)
 {
     if (not dim.contains(QPointF(p.x(), p.y())))
         return std::forward_as_tuple(false, T());
-    else
-        try
-        {
-            return std::forward_as_tuple(true, fmap.at(pointToKey(p.x(), p.y())));
-        }
-        catch(const std::exception &e)
-        {
-            //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
-            return std::forward_as_tuple(false, T());
-        }
+    if (T *cell = find_cell(p.x(), p.y()); cell != nullptr)
+        return std::forward_as_tuple(true, *cell);
+    //qWarning() << __FUNCTION__ << " No key found in grid: (" << k.x << k.z << ")";
+    return std::forward_as_tuple(false, T());
 }
 Grid::Key Grid::pointToKey(long int x, long int z) const
 {
@@ -158,24 +288,23 @@ void Grid::saveToFile(const std::string &fich)
 {
     std::ofstream myfile;
     myfile.open(fich);
-    for (const auto &[k, v] : fmap)
-        myfile << k << v << std::endl;
+    for_each_cell([&myfile](const Key &k, const T &v){ myfile << k << v << std::endl; });
 
     myfile.close();
-    std::cout << __FUNCTION__ << " " << fmap.size() << " elements written to " << fich << std::endl;
+    std::cout << __FUNCTION__ << " " << size() << " elements written to " << fich << std::endl;
 }
 std::string Grid::saveToString() const
 {
     std::ostringstream stream;
-    for (const auto &[k, v] : fmap)
-        stream << k << v << v.cost << std::endl;
+    for_each_cell([&stream](const Key &k, const T &v){ stream << k << v << v.cost << std::endl; });
 
-    std::cout << "Grid::" << __FUNCTION__ << " " << fmap.size() << " elements written to osdtringstream";
+    std::cout << "Grid::" << __FUNCTION__ << " " << size() << " elements written to osdtringstream";
     return stream.str();
 }
 void Grid::readFromString(const std::string &cadena)
 {
-    fmap.clear();
+    if (storage == Storage::Hashed)
+        fmap.clear();
 
     std::istringstream stream(cadena);
     std::string line;
@@ -189,9 +318,17 @@ void Grid::readFromString(const std::string &cadena)
         float cost;
         std::string node_name;
         ss >> x >> z >> free >> visited >> cost>> node_name;
-        fmap.emplace(pointToKey(x, z), T{count++, free, false, cost});
+        if (storage == Storage::Dense)  // cells are kept, only their values are read
+        {
+            if (T *cell = find_cell(x, z); cell != nullptr)
+            { cell->free = free; cell->visited = false; cell->cost = cost; count++; }
+        }
+        else
+            { fmap.emplace(pointToKey(x, z), T{(std::uint32_t)cell_index(x, z), free, false, 0, cost}); count++; }
     }
-    std::cout << __FUNCTION__ << " " << fmap.size() << " elements read from "  << std::endl;
+    brushfire = Brushfire();   // the next update_inflation recomputes every cell
+    coarse.dirty = true;
+    std::cout << __FUNCTION__ << " " << count << " elements read from "  << std::endl;
 }
 void Grid::readFromFile(const std::string &fich)
 {
@@ -211,9 +348,340 @@ void Grid::readFromFile(const std::string &fich)
         bool free, visited;
         std::string node_name;
         ss >> x >> z >> free >> visited >> node_name;
-        fmap.emplace(pointToKey(x, z), T{count++, free, false, 1.f});
+        if (storage == Storage::Dense)
+        {
+            if (T *cell = find_cell(x, z); cell != nullptr)
+            { cell->free = free; cell->visited = false; cell->cost = 1.f; count++; }
+        }
+        else
+            { fmap.emplace(pointToKey(x, z), T{(std::uint32_t)cell_index(x, z), free, false, 0, 1.f}); count++; }
+    }
+    brushfire = Brushfire();   // the next update_inflation recomputes every cell
+    coarse.dirty = true;
+    std::cout << __FUNCTION__ << " " << count << " elements read from " << fich << std::endl;
+}
+std::string Grid::saveToBinaryString() const
+{
+    const auto tiles = dense.nx * dense.nz;
+    std::string buffer(sizeof(BinaryHeader) + tiles * sizeof(BinaryCell), '\0');
+    auto *cells = reinterpret_cast<BinaryCell *>(buffer.data() + sizeof(BinaryHeader));
+    for (long int i = 0; i < tiles; i++)
+        if (const T *v = find_tile(i / dense.nz, i % dense.nz); v != nullptr)
+            cells[i] = BinaryCell{v->cost, v->occupancy, v->free, v->visited};
+    BinaryHeader header{};
+    std::copy(std::begin(binary_magic), std::end(binary_magic), header.magic);
+    header.version = binary_version;
+    header.cell_size = sizeof(BinaryCell);
+    header.nx = dense.nx;
+    header.nz = dense.nz;
+    header.tile_size = TILE_SIZE;
+    header.left = dim.left(); header.top = dim.top(); header.width = dim.width(); header.height = dim.height();
+    boost::crc_32_type crc;
+    crc.process_bytes(cells, tiles * sizeof(BinaryCell));
+    header.crc = crc.checksum();
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    return buffer;
+}
+bool Grid::saveToBinaryFile(const std::string &fich) const
+{
+    const auto buffer = saveToBinaryString();
+    std::ofstream myfile(fich, std::ios::binary | std::ios::trunc);
+    if (not myfile.write(buffer.data(), buffer.size()))
+    {
+        std::cout << __FUNCTION__ << " Could not write " << fich << std::endl;
+        return false;
+    }
+    std::cout << __FUNCTION__ << " " << dense.nx * dense.nz << " cells written to " << fich << std::endl;
+    return true;
+}
+bool Grid::readFromBinaryString(const std::string &buffer)
+{
+    return read_binary(buffer.data(), buffer.size());
+}
+bool Grid::readFromBinaryFile(const std::string &fich)
+{
+    int fd = open(fich.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << fich << " No file found" << std::endl;
+        return false;
+    }
+    struct stat st{};
+    void *data = (fstat(fd, &st) == 0 and st.st_size > 0) ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << __FUNCTION__ << " Could not map " << fich << std::endl;
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    bool res = read_binary(static_cast<const char *>(data), st.st_size);
+    munmap(data, st.st_size);
+    if (res)
+        std::cout << __FUNCTION__ << " " << dense.nx * dense.nz << " cells read from " << fich << std::endl;
+    return res;
+}
+bool Grid::read_binary(const char *data, std::size_t size)
+{
+    BinaryHeader header;
+    if (size < sizeof(header))
+    {
+        std::cout << __FUNCTION__ << " Not a binary grid" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (not std::equal(std::begin(binary_magic), std::end(binary_magic), header.magic))
+    {
+        std::cout << __FUNCTION__ << " Not a binary grid" << std::endl;
+        return false;
+    }
+    const std::size_t cell_size = header.version == 1 ? sizeof(BinaryCellV1) : sizeof(BinaryCell);
+    if ((header.version != 1 and header.version != binary_version) or header.cell_size != cell_size)
+    {
+        std::cout << __FUNCTION__ << " Unsupported binary grid version " << header.version << std::endl;
+        return false;
+    }
+    if (header.nx != dense.nx or header.nz != dense.nz or header.tile_size != TILE_SIZE or
+        header.left != (float)dim.left() or header.top != (float)dim.top())
+    {
+        std::cout << __FUNCTION__ << " Binary grid of " << header.nx << "x" << header.nz << " tiles does not match this grid of "
+                  << dense.nx << "x" << dense.nz << std::endl;
+        return false;
+    }
+    const auto tiles = dense.nx * dense.nz;
+    if (size != sizeof(header) + tiles * cell_size)
+    {
+        std::cout << __FUNCTION__ << " Truncated binary grid" << std::endl;
+        return false;
+    }
+    const char *payload = data + sizeof(header);
+    boost::crc_32_type crc;
+    crc.process_bytes(payload, tiles * cell_size);
+    if (crc.checksum() != header.crc)
+    {
+        std::cout << __FUNCTION__ << " Wrong CRC in binary grid" << std::endl;
+        return false;
+    }
+    for (long int i = 0; i < tiles; i++)
+    {
+        T *v = find_tile(i / dense.nz, i % dense.nz);
+        if (v == nullptr) continue;
+        if (header.version == 1)
+        {
+            BinaryCellV1 c;
+            std::memcpy(&c, payload + i * sizeof(BinaryCellV1), sizeof(c));
+            // maps saved with the former hit/miss counters have no log-odds, they are rebuilt from the counts
+            const double l = c.log_odds != 0. ? c.log_odds : OccupancyModel::to_log_odds(occupancy_model.hit) * c.hits +
+                                                             OccupancyModel::to_log_odds(occupancy_model.miss) * c.misses;
+            v->occupancy = occupancy_model.update(OccupancyModel::to_fixed(l), 0);
+            v->cost = c.cost; v->free = c.free; v->visited = c.visited;
+            continue;
+        }
+        BinaryCell c;
+        std::memcpy(&c, payload + i * sizeof(BinaryCell), sizeof(c));
+        v->occupancy = occupancy_model.update(c.occupancy, 0);    // within the bounds of this model
+        v->cost = c.cost; v->free = c.free; v->visited = c.visited;
+    }
+    brushfire = Brushfire();   // the next update_inflation recomputes every cell
+    flipped_cells.clear();
+    coarse.dirty = true;
+    device_upload = true;      // the changes of the device not synced yet are dropped
+    device_ahead = false;
+    return true;
+}
+
+////////////////////////////// MAP DELTAS /////////////////////////////////////////////////////////
+std::uint64_t Grid::commit_changes()
+{
+    sync_device();
+    const auto tiles = dense.nx * dense.nz;
+    if ((long int)sync.committed.size() != tiles)   // new geometry: older versions can only be sent whole
+    {
+        sync.committed.assign(tiles, DeltaCell{1.f, 0, 1, 0});
+        sync.changed.assign(tiles, 0);
+        sync.first = sync.version + 1;
+    }
+    const auto next = sync.version + 1;
+    bool changed = false;
+    for (long int i = 0; i < tiles; i++)
+    {
+        const T *v = find_tile(i / dense.nz, i % dense.nz);
+        if (v == nullptr or v->id >= tiles)
+            continue;
+        const DeltaCell c{v->cost, v->occupancy, std::uint8_t((v->free ? 1 : 0) | (v->visited ? 2 : 0)), 0};
+        if (not c.same(sync.committed[v->id]) or sync.changed[v->id] == Sync::reset)
+        {
+            sync.committed[v->id] = c;
+            sync.changed[v->id] = next;
+            changed = true;
+        }
     }
-    std::cout << __FUNCTION__ << " " << fmap.size() << " elements read from " << fich << std::endl;
+    sync.nx = dense.nx; sync.nz = dense.nz;
+    sync.ox = storage == Storage::Dense ? dense.ox : 0;
+    sync.oz = storage == Storage::Dense ? dense.oz : 0;
+    sync.left = dim.left(); sync.top = dim.top();
+    if (changed)
+        sync.version = next;
+    return sync.version;
+}
+/**
+ @brief Encodes the committed cells changed after 'since'. The changed tiles are grouped in runs of consecutive tiles
+ (closing gaps of one tile, cheaper than a new run) and the equal consecutive cells of a run are sent once.
+*/
+std::string Grid::encode_changes(std::uint64_t since) const
+{
+    DeltaHeader header{};
+    std::copy(std::begin(delta_magic), std::end(delta_magic), header.magic);
+    header.format = delta_format;
+    header.full = since == 0 or since < sync.first or since > sync.version;
+    header.base = header.full ? 0 : since;
+    header.version = sync.version;
+    header.nx = sync.nx;
+    header.nz = sync.nz;
+    header.tile_size = TILE_SIZE;
+    header.left = sync.left; header.top = sync.top;
+
+    const long int tiles = sync.nx * sync.nz;
+    auto id = [this](long int i){ return ((i / sync.nz + sync.ox) % sync.nx) * sync.nz + (i % sync.nz + sync.oz) % sync.nz; };
+    auto included = [&](long int i){ return header.full or sync.changed[id(i)] > since; };
+    std::string payload;
+    auto append = [&payload](const auto &value)
+    { payload.append(reinterpret_cast<const char *>(&value), sizeof(value)); };
+    for (long int i = 0; i < tiles; )
+    {
+        if (not included(i))
+        { i++; continue; }
+        long int end = i + 1;
+        while (end < tiles and (included(end) or (end + 1 < tiles and included(end + 1))))
+            end++;
+        append(DeltaRun{(std::uint32_t)i, (std::uint32_t)(end - i)});
+        for (long int j = i; j < end; )
+        {
+            DeltaCell c = sync.committed[id(j)];
+            long int k = j + 1;
+            while (k < end and k - j < 255 and sync.committed[id(k)].same(c))
+                k++;
+            c.repeat = k - j;
+            append(c);
+            j = k;
+        }
+        header.runs++;
+        i = end;
+    }
+    boost::crc_32_type crc;
+    crc.process_bytes(payload.data(), payload.size());
+    header.crc = crc.checksum();
+    std::string buffer(sizeof(header), '\0');
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    return buffer + payload;
+}
+bool Grid::apply_changes(const std::string &delta)
+{
+    DeltaHeader header;
+    if (delta.size() < sizeof(header))
+    {
+        std::cout << __FUNCTION__ << " Not a grid delta" << std::endl;
+        return false;
+    }
+    std::memcpy(&header, delta.data(), sizeof(header));
+    if (not std::equal(std::begin(delta_magic), std::end(delta_magic), header.magic) or header.format != delta_format)
+    {
+        std::cout << __FUNCTION__ << " Not a grid delta or unknown format" << std::endl;
+        return false;
+    }
+    if (header.nx != dense.nx or header.nz != dense.nz or header.tile_size != TILE_SIZE)
+    {
+        std::cout << __FUNCTION__ << " Grid geometry does not match: " << header.nx << "x" << header.nz << " tiles of "
+                  << header.tile_size << " against " << dense.nx << "x" << dense.nz << " of " << TILE_SIZE << std::endl;
+        return false;
+    }
+    if (not header.full and header.base != sync.received)
+    {
+        std::cout << __FUNCTION__ << " Delta from version " << header.base << ", the grid is at " << sync.received << std::endl;
+        return false;
+    }
+    const char *payload = delta.data() + sizeof(header);
+    const std::size_t size = delta.size() - sizeof(header);
+    boost::crc_32_type crc;
+    crc.process_bytes(payload, size);
+    if (crc.checksum() != header.crc)
+    {
+        std::cout << __FUNCTION__ << " Wrong CRC in grid delta" << std::endl;
+        return false;
+    }
+    // validate before touching the grid
+    const long int tiles = dense.nx * dense.nz;
+    std::size_t offset = 0;
+    bool valid = true;
+    for (std::uint32_t r = 0; r < header.runs and valid; r++)
+    {
+        DeltaRun run;
+        valid = offset + sizeof(run) <= size;
+        if (not valid)
+            break;
+        std::memcpy(&run, payload + offset, sizeof(run));
+        offset += sizeof(run);
+        valid = (long int)run.start + run.length <= tiles;
+        std::uint32_t n = 0;
+        for (DeltaCell c; valid and n < run.length; offset += sizeof(c))
+        {
+            valid = offset + sizeof(c) <= size;
+            if (valid)
+            {
+                std::memcpy(&c, payload + offset, sizeof(c));
+                n += c.repeat;
+            }
+        }
+    }
+    if (not valid or offset != size)
+    {
+        std::cout << __FUNCTION__ << " Malformed grid delta" << std::endl;
+        return false;
+    }
+    // a rolling window sender moved by whole tiles
+    if (header.left != (float)dim.left() or header.top != (float)dim.top())
+    {
+        const float dx = (header.left - (float)dim.left()) / TILE_SIZE, dz = (header.top - (float)dim.top()) / TILE_SIZE;
+        if (std::fabs(dx - std::round(dx)) > 1e-3f or std::fabs(dz - std::round(dz)) > 1e-3f or
+            not shift_window(std::lround(dx), std::lround(dz)))
+        {
+            std::cout << __FUNCTION__ << " Grid window does not match the delta" << std::endl;
+            return false;
+        }
+    }
+
+    sync_device();
+    offset = 0;
+    for (std::uint32_t r = 0; r < header.runs; r++)
+    {
+        DeltaRun run;
+        std::memcpy(&run, payload + offset, sizeof(run));
+        offset += sizeof(run);
+        for (long int tile = run.start; tile < (long int)run.start + run.length; offset += sizeof(DeltaCell))
+        {
+            DeltaCell c;
+            std::memcpy(&c, payload + offset, sizeof(c));
+            for (int k = 0; k < c.repeat and tile < (long int)run.start + run.length; k++, tile++)
+            {
+                T *v = find_tile(tile / dense.nz, tile % dense.nz);
+                if (v == nullptr)
+                    continue;
+                v->occupancy = c.occupancy;
+                v->visited = c.flags & 2;
+                if ((bool)(c.flags & 1) == v->free and c.cost == v->cost)
+                    continue;
+                set_occupancy(*v, c.flags & 1);
+                v->cost = c.cost;
+                paint_tile(*v, cost_brush(v->cost));
+            }
+        }
+    }
+    coarse.dirty = true;
+    if (device)
+        device_upload = true;
+    sync.received = header.version;
+    flush_render();
+    return true;
 }
 
 //////////////////////////////// STATUS //////////////////////////////////////////
@@ -240,9 +708,9 @@ void Grid::setFree(const Key &k)
     auto &&[success, v] = getCell(k);
     if(success)
     {
-        v.free = true;
-        if(v.tile != nullptr)
-            v.tile->setBrush(QBrush(QColor("white")));
+        set_occupancy(v, true);
+        paint_tile(v, QBrush(QColor("white")));
+        flush_render();
     }
 }
 void Grid::set_free(int cx, int cy)
@@ -266,9 +734,9 @@ void Grid::set_free(long int x, long int y)
     auto &&[success, v] = getCell(x, y);
     if(success)
     {
-        v.free = true;
-        if (v.tile != nullptr)
-            v.tile->setBrush(QBrush(QColor(params.free_color)));
+        set_occupancy(v, true);
+        paint_tile(v, QBrush(QColor(params.free_color)));
+        flush_render();
     }
 }
 //deprecated
@@ -277,7 +745,7 @@ void Grid::setOccupied(const Key &k)
     auto &&[success, v] = getCell(k);
     if(success)
     {
-        v.free = false;
+        set_occupancy(v, false);
 //        if(v.tile != nullptr)
 //            v.tile->setBrush(QBrush(QColor(params.occupied_color)));
     }
@@ -287,7 +755,7 @@ void Grid::setOccupied(long int x, long int y)
     auto &&[success, v] = getCell(x,y);
     if(success)
     {
-        v.free = false;
+        set_occupancy(v, false);
 //        if(v.tile != nullptr)
 //            v.tile->setBrush(QBrush(QColor("red")));
     }
@@ -300,62 +768,67 @@ void Grid::add_miss(const Eigen::Vector2f &p)
 {
     auto &&[success, v] = getCell((long int)p.x(),(long int)p.y());
     if(success)
-    {
-        v.misses++;
-        if((float)v.hits/(v.hits+v.misses) < params.occupancy_threshold)
-        //if((float)v.hits/(v.hits+v.misses) < params.prob_free)
-        {
-            if(not v.free)
-                this->flipped++;
-            v.free = true;
-            //v.tile->setBrush(QBrush(QColor(params.free_color)));
-        }
-        v.misses = std::clamp(v.misses, 0.f, 20.f);
-        this->updated++;
-    }
+        apply_miss(v);
 //    else
 //        qWarning() << __FUNCTION__ << "Cell not found" << "[" << p.x() << p.y() << "]";
 }
+void Grid::apply_miss(T &v)
+{
+    v.occupancy = occupancy_model.update(v.occupancy, occupancy_model.miss);
+    if(device)
+        device_edits.push_back(v.id);
+    if(occupancy_model.is_free(v.occupancy))
+    {
+        if(not v.free)
+            this->flipped++;
+        set_occupancy(v, true);
+    }
+    this->updated++;
+}
 void Grid::add_hit(const Eigen::Vector2f &p)
 {
     auto &&[success, v] = getCell((long int)p.x(),(long int)p.y());
     if(success)
+        apply_hit(v);
+}
+void Grid::apply_hit(T &v)
+{
+    v.occupancy = occupancy_model.update(v.occupancy, occupancy_model.hit);
+    if(device)
+        device_edits.push_back(v.id);
+    if(occupancy_model.is_occupied(v.occupancy))
     {
-        v.hits++;
-        if((float)v.hits/(v.hits+v.misses) >= params.occupancy_threshold)
-        //if((float)v.hits/(v.hits+v.misses) >= params.prob_occ)
-            {
-            if(v.free)
-                this->flipped++;
-            v.free = false;
-            //v.tile->setBrush(QBrush(QColor(params.occupied_color)));
-        }
-        v.hits = std::clamp(v.hits, 0.f, 20.f);
-        this->updated++;
+        if(v.free)
+            this->flipped++;
+        set_occupancy(v, false);
     }
+    this->updated++;
 }
 void Grid::log_update(const Eigen::Vector2f &p, float prob)
 {
-    static double TRESHOLD_P_FREE = log_odds(0.3);
-    static double TRESHOLD_P_OCC = log_odds(0.6);
+    // thresholds on the log-odds of p = 0.3 and p = 0.6, the comparisons need no exp
+    static const auto TRESHOLD_L_FREE = OccupancyModel::to_fixed(OccupancyModel::logit(0.3));
+    static const auto TRESHOLD_L_OCC = OccupancyModel::to_fixed(OccupancyModel::logit(0.6));
 
     // update probability matrix using inverse sensor model
     auto &&[success, v] = getCell(p);
     if(success)
     {
-        v.log_odds += log_odds(prob);
-        qInfo() << __FUNCTION__ << v.log_odds;
-        auto r = retrieve_p(v.log_odds);
-        if (r < TRESHOLD_P_FREE)
+        v.occupancy = occupancy_model.update(v.occupancy, occupancy_model.increment(prob));
+        if(device)
+            device_edits.push_back(v.id);
+        qInfo() << __FUNCTION__ << OccupancyModel::to_log_odds(v.occupancy);
+        if (v.occupancy < TRESHOLD_L_FREE)
         {
-            v.free = true;
-            v.tile->setBrush(QColor("White"));
+            set_occupancy(v, true);
+            paint_tile(v, QColor("White"));
         }
-        else if (r > TRESHOLD_P_OCC)
+        else if (v.occupancy > TRESHOLD_L_OCC)
         {
-            v.free = false;
-            v.tile->setBrush(QColor("Red"));
+            set_occupancy(v, false);
+            paint_tile(v, QColor("Red"));
         }
+        flush_render();
     }
 }
 double Grid::log_odds(double prob)
@@ -375,6 +848,15 @@ double Grid::retrieve_p(double l)
 
     return 1 - 1 / (1 + exp(l));
 }
+void Grid::set_occupancy_model(const OccupancyModel::Params &params)
+{
+    occupancy_model = OccupancyModel(params);
+}
+float Grid::occupancy_probability(const Eigen::Vector2f &p)
+{
+    auto &&[success, v] = getCell(p);
+    return success ? occupancy_model.probability(v.occupancy) : -1.f;
+}
 float Grid::percentage_changed()
 {
     return (flipped / updated);
@@ -387,9 +869,10 @@ void Grid::setVisited(const Key &k, bool visited)
 
         v.visited = visited;
         if(visited)
-            v.tile->setBrush(QColor("Orange"));
+            paint_tile(v, QColor("Orange"));
         else
-            v.tile->setBrush(QColor("White"));
+            paint_tile(v, QColor("White"));
+        flush_render();
     }
 }
 bool Grid::is_visited(const Key &k)
@@ -417,33 +900,34 @@ float Grid::get_cost(const Eigen::Vector2f &p)
 
 void Grid::set_all_costs(float value)
 {
-    for(auto &[key, cell] : fmap)
-        cell.cost = value;
+    for_each_cell([value](const Key &, T &cell){ cell.cost = value; });
 }
 int Grid::count_total() const
 {
-    return fmap.size();
+    return size();
 }
 int Grid::count_total_visited() const
 {
     int total = 0;
-    for(const auto &[k, v] : fmap)
-        if(v.visited)
-            total ++;
+    for_each_cell([&total](const Key &, const T &v){ if(v.visited) total ++; });
     return total;
 }
 void Grid::set_all_to_not_visited()
 {
-    for(auto &[k,v] : fmap)
-       setVisited(k, false);
+    for_each_cell([this](const Key &k, T &){ setVisited(k, false); });
 }
 void Grid::set_all_to_free()
 {
-    for(auto &[k,v] : fmap)
-        setFree(k);
+    for_each_cell([this](const Key &k, T &){ setFree(k); });
 }
 void Grid::markAreaInGridAs(const QPolygonF &poly, bool free)
 {
+    if (layered)
+    {
+        set_layer_area(LayeredCostmap::Static, poly, free ? 0.f : LayeredCostmap::lethal);
+        if (not free)
+            return;
+    }
     const qreal step = TILE_SIZE / 4;
     QRectF box = poly.boundingRect();
     for (auto &&x : iter::range(box.x() - step / 2, box.x() + box.width() + step / 2, step))
@@ -460,6 +944,11 @@ void Grid::markAreaInGridAs(const QPolygonF &poly, bool free)
 }
 void Grid::modifyCostInGrid(const QPolygonF &poly, float cost)
 {
+    if (layered)
+    {
+        set_layer_area(LayeredCostmap::Affordance, poly, cost);
+        return;
+    }
     const qreal step = TILE_SIZE / 4.f;
     QRectF box = poly.boundingRect();
     for (auto &&x : iter::range(box.x() - step / 2, box.x() + box.width() + step / 2, step))
@@ -471,6 +960,7 @@ void Grid::modifyCostInGrid(const QPolygonF &poly, float cost)
 ////////////////////////////////////// PATH //////////////////////////////////////////////////////////////
 std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &target_)
 {
+    sync_device();
     //qInfo() << __FUNCTION__  << " from nose pos: " << source_ << " to " << target_ ;
     Key source = pointToKey(source_.x(), source_.y());
     Key target = pointToKey(target_.x(), target_.y());
@@ -515,43 +1005,19 @@ std::list<QPointF> Grid::computePath(const QPointF &source_, const QPointF &targ
         return std::list<QPointF>();
     }
 
-    // vector de distancias inicializado a UINT_MAX
-    std::vector<uint32_t> min_distance(fmap.size(), std::numeric_limits<uint32_t>::max());
-    // initialize source position to 0
-    min_distance[val.id] = 0;
-    // vector de pares<std::uint32_t, Key> initialized to (-1, Key())
-    std::vector<std::pair<std::uint32_t, Key>> previous(fmap.size(), std::make_pair(-1, Key()));
-    // lambda to compare two vertices: a < b if a.id<b.id or
-    auto comp = [this](std::pair<std::uint32_t, Key> x, std::pair<std::uint32_t, Key> y){ return x.first <= y.first; };
-
-    // OPEN List
-    std::set<std::pair<std::uint32_t, Key>, decltype(comp)> active_vertices(comp);
-    active_vertices.insert({0, source});
-    while (not active_vertices.empty())
+    auto tiles = plan(cell_index(source.x, source.z), cell_index(target.x, target.z));
+    if (tiles.empty())
     {
-        Key where = active_vertices.begin()->second;
-        if (where == target)  // target found
-        {
-            auto p = orderPath(previous, source, target);
-            p = decimate_path(p);  // reduce size of path to half
-            return p;
-        }
-        active_vertices.erase(active_vertices.begin());
-        for (auto ed : neighboors_8(where))
-        {
-            //qInfo() << __FUNCTION__ << min_distance[ed.second.id] << ">" << min_distance[fmap.at(where).id] << "+" << ed.second.cost;
-            if (min_distance[ed.second.id] > min_distance[fmap.at(where).id] + ed.second.cost)
-            {
-                active_vertices.erase({min_distance[ed.second.id], ed.first});
-                min_distance[ed.second.id] = min_distance[fmap.at(where).id] + ed.second.cost;
-                previous[ed.second.id] = std::make_pair(fmap.at(where).id, where);
-                active_vertices.insert({min_distance[ed.second.id], ed.first}); // Djikstra
-                //active_vertices.insert( { min_distance[ed.second.id] + heuristicL2(ed.first, target), ed.first } ); //A*
-            }
-        }
+        qInfo() << __FUNCTION__ << "Path from (" << source.x << "," << source.z << ") to (" << target_.x() << "," << target_.y() << ") not  found. Returning empty path";
+        return std::list<QPointF>();
+    }
+    std::list<QPointF> p;
+    for (auto t = std::next(tiles.begin()); t != tiles.end(); ++t)   // the source is not included
+    {
+        auto k = index_to_key(*t);
+        p.emplace_back(k.x, k.z);
     }
-    qInfo() << __FUNCTION__ << "Path from (" << source.x << "," << source.z << ") to (" <<  target_.x() << "," << target_.y() << ") not  found. Returning empty path";
-    return std::list<QPointF>();
+    return decimate_path(p);  // reduce size of path to half
 };
 std::vector<Eigen::Vector2f> Grid::compute_path(const QPointF &source_, const QPointF &target_)
 {
@@ -634,7 +1100,7 @@ std::list<QPointF> Grid::orderPath(const std::vector<std::pair<std::uint32_t, Ke
 {
     std::list<QPointF> res;
     Key k = target;
-    std::uint32_t u = fmap.at(k).id;
+    std::uint32_t u = at(k).id;
     while (previous[u].first != (std::uint32_t)-1)
     {
         res.push_front(QPointF(k.x, k.z));
@@ -651,110 +1117,1112 @@ std::list<QPointF> Grid::decimate_path(const std::list<QPointF> &path)
         res.push_back(p[0]);
     return res;
 }
+void Grid::set_planner_params(const PlannerParams &params_)
+{
+    planner.params = params_;
+}
+void Grid::Planner::push(std::int32_t tile)
+{
+    heap_pos[tile] = (std::int32_t)heap.size();
+    heap.push_back(tile);
+    decrease(tile);
+}
+void Grid::Planner::decrease(std::int32_t tile)
+{
+    auto i = heap_pos[tile];
+    while (i > 0)
+    {
+        auto up = (i - 1) / 2;
+        if (f[heap[up]] <= f[tile]) break;
+        heap[i] = heap[up];
+        heap_pos[heap[i]] = i;
+        i = up;
+    }
+    heap[i] = tile;
+    heap_pos[tile] = i;
+}
+std::int32_t Grid::Planner::pop()
+{
+    auto top = heap.front();
+    auto last = heap.back();
+    heap.pop_back();
+    heap_pos[top] = -1;
+    if (heap.empty()) return top;
+    std::int32_t i = 0, n = (std::int32_t)heap.size();
+    while (true)
+    {
+        auto c = 2 * i + 1;
+        if (c >= n) break;
+        if (c + 1 < n and f[heap[c + 1]] < f[heap[c]]) c++;
+        if (f[last] <= f[heap[c]]) break;
+        heap[i] = heap[c];
+        heap_pos[heap[i]] = i;
+        i = c;
+    }
+    heap[i] = last;
+    heap_pos[last] = i;
+    return top;
+}
+// a free cell of cost 1 whose 8 neighbours are also free and of cost 1. JPS only jumps over these.
+template <typename Cost>
+bool Grid::is_interior(Planner &pl, long int nz, long int x, long int z, Cost &cost)
+{
+    auto tile = x * nz + z;
+    if (pl.interior_stamp[tile] == pl.generation)
+        return pl.interior[tile];
+    bool res = true;
+    for (int dx = -1; dx <= 1 and res; dx++)
+        for (int dz = -1; dz <= 1 and res; dz++)
+            res = cost(x + dx, z + dz) == 1.f;
+    pl.interior_stamp[tile] = pl.generation;
+    pl.interior[tile] = res;
+    return res;
+}
+/**
+ @brief Moves from (x, z) along (dx, dz) while the cells are interior and returns the first one that is not, the target or,
+ moving diagonally, a cell from which a straight jump finds one. Returns -1 if it leaves the free space. 'len' gets the
+ number of steps.
+*/
+template <typename Cost>
+std::int32_t Grid::jump(Planner &pl, long int nz, long int x, long int z, int dx, int dz, std::int32_t target, float &len, Cost &cost)
+{
+    const bool diagonal = dx != 0 and dz != 0;
+    len = 0;
+    while (true)
+    {
+        x += dx; z += dz; len++;
+        if (cost(x, z) < 0)
+            return -1;
+        auto tile = (std::int32_t)(x * nz + z);
+        if (tile == target or not is_interior(pl, nz, x, z, cost))
+            return tile;
+        if (diagonal)
+        {
+            float l;
+            if (jump(pl, nz, x, z, dx, 0, target, l, cost) != -1 or jump(pl, nz, x, z, 0, dz, target, l, cost) != -1)
+                return tile;
+        }
+    }
+}
+/**
+ @brief A* from source to target tiles (ix * nz + iz). Moving into a cell costs its cost times the step length, so the
+ octile distance is an admissible heuristic. Returns the tiles of the path, source and target included, or an empty
+ vector if there is none. With hierarchical_block > 1 and a far target, the route is first searched on the max-pooled
+ grid of blocks and the path is then searched only in the blocks around it.
+*/
+std::vector<std::int32_t> Grid::plan(std::int32_t source, std::int32_t target)
+{
+    if (source < 0 or target < 0 or tile_cell(source) == nullptr or tile_cell(target) == nullptr)
+        return {};
+    auto fine_cost = [this](long int x, long int z)
+    {
+        T *c = find_tile(x, z);
+        return (c == nullptr or blocked(*c)) ? -1.f : c->cost;
+    };
+    const long int block = planner.params.hierarchical_block;
+    const auto nz = dense.nz;
+    if (block > 1 and std::max(std::abs(source / nz - target / nz), std::abs(source % nz - target % nz)) > 4 * block)
+    {
+        update_coarse_grid();
+        const long int cnx = coarse.nx, cnz = coarse.nz;
+        auto to_block = [block, nz, cnz](std::int32_t t){ return (std::int32_t)((t / nz / block) * cnz + (t % nz) / block); };
+        auto coarse_path = search(coarse_planner, planner.params, cnx, cnz, to_block(source), to_block(target),
+                                  [this, cnz](long int x, long int z){ return coarse.cost[x * cnz + z]; }, false);
+        if (not coarse_path.empty())
+        {
+            // the corridor is the coarse path grown by one block
+            auto &corridor = coarse.corridor;
+            corridor.assign(coarse.cost.size(), 0);
+            for (auto b : coarse_path)
+                for (long int dx = -1; dx <= 1; dx++)
+                    for (long int dz = -1; dz <= 1; dz++)
+                        if (long int x = b / cnz + dx, z = b % cnz + dz; x >= 0 and x < cnx and z >= 0 and z < cnz)
+                            corridor[x * cnz + z] = 1;
+            auto path = search(planner, planner.params, dense.nx, nz, source, target, [&, block, cnz](long int x, long int z)
+                               { return corridor[(x / block) * cnz + z / block] ? fine_cost(x, z) : -1.f; }, false);
+            if (not path.empty())
+                return path;
+        }
+        // no path inside the corridor, the full grid is searched
+    }
+    return search(planner, planner.params, dense.nx, nz, source, target, fine_cost, planner.params.jps);
+}
+template <typename Cost>
+std::vector<std::int32_t> Grid::search(Planner &pl, const PlannerParams &params, long int nx, long int nz, std::int32_t source,
+                                       std::int32_t target, Cost &&cost, bool jps)
+{
+    const auto tiles = (std::size_t)(nx * nz);
+    if (pl.stamp.size() != tiles or ++pl.generation == 0)  // (re)allocate only when the grid changes
+    {
+        pl.stamp.assign(tiles, 0);
+        pl.interior_stamp.assign(tiles, 0);
+        pl.g.resize(tiles);
+        pl.f.resize(tiles);
+        pl.parent.resize(tiles);
+        pl.heap_pos.resize(tiles);
+        pl.interior.resize(tiles);
+        pl.generation = 1;
+    }
+    pl.heap.clear();
+    const long int tx = target / nz, tz = target % nz;
+    const float w = params.heuristic_weight;
+    auto h = [tx, tz](long int x, long int z)
+    {
+        auto dx = (float)std::abs(x - tx), dz = (float)std::abs(z - tz);
+        return std::max(dx, dz) + (float)(M_SQRT2 - 1) * std::min(dx, dz);
+    };
+    // relaxes 'to' reached from 'from' with cost 'step'
+    auto relax = [&pl, nz, w, h](std::int32_t from, std::int32_t to, float step)
+    {
+        const float g = pl.g[from] + step;
+        if (pl.stamp[to] != pl.generation)
+        {
+            pl.stamp[to] = pl.generation;
+            pl.g[to] = g;
+            pl.f[to] = g + w * h(to / nz, to % nz);
+            pl.parent[to] = from;
+            pl.push(to);
+        }
+        else if (pl.heap_pos[to] >= 0 and g < pl.g[to])
+        {
+            pl.f[to] -= pl.g[to] - g;
+            pl.g[to] = g;
+            pl.parent[to] = from;
+            pl.decrease(to);
+        }
+    };
+
+    pl.stamp[source] = pl.generation;
+    pl.g[source] = 0;
+    pl.f[source] = w * h(source / nz, source % nz);
+    pl.parent[source] = -1;
+    pl.push(source);
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::size_t expansions = 0;
+    std::int32_t best = source, goal = -1;
+    float best_h = std::numeric_limits<float>::max();
+    while (not pl.heap.empty())
+    {
+        const auto cur = pl.pop();
+        if (cur == target) { goal = cur; break; }
+        const long int x = cur / nz, z = cur % nz;
+        if (float hc = h(x, z); hc < best_h) { best_h = hc; best = cur; }
+        if (params.max_expansions > 0 and ++expansions > params.max_expansions) break;
+        if (params.time_budget_ms > 0 and (expansions & 63) == 0 and
+           std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count() > params.time_budget_ms)
+            break;
+
+        const auto par = pl.parent[cur];
+        if (jps and par >= 0 and is_interior(pl, nz, x, z, cost))
+        {
+            // pruned expansion: in an interior cell only the directions that continue the move from the parent are kept
+            const int dx = (x > par / nz) - (x < par / nz), dz = (z > par % nz) - (z < par % nz);
+            const std::array<std::pair<int, int>, 3> dirs{{{dx, dz}, {dx, 0}, {0, dz}}};
+            const int ndirs = (dx != 0 and dz != 0) ? 3 : 1;
+            for (int d = 0; d < ndirs; d++)
+            {
+                const auto [ddx, ddz] = dirs[d];
+                float len;
+                if (auto j = jump(pl, nz, x, z, ddx, ddz, target, len, cost); j != -1)
+                {
+                    const float diag = (ddx != 0 and ddz != 0) ? (float)M_SQRT2 : 1.f;
+                    relax(cur, j, diag * ((len - 1) + cost(j / nz, j % nz)));
+                }
+            }
+            continue;
+        }
+        for (int dx = -1; dx <= 1; dx++)
+            for (int dz = -1; dz <= 1; dz++)
+            {
+                if ((dx == 0 and dz == 0) or x + dx < 0 or x + dx >= nx or z + dz < 0 or z + dz >= nz) continue;
+                const float c = cost(x + dx, z + dz);
+                if (c < 0) continue;
+                const float diag = (dx != 0 and dz != 0) ? (float)M_SQRT2 : 1.f;
+                relax(cur, (std::int32_t)((x + dx) * nz + z + dz), diag * c);
+            }
+    }
+    if (goal == -1)
+    {
+        if (not params.partial_path or best == source)
+            return {};
+        goal = best;
+    }
+    // jump points are joined by straight or diagonal segments
+    std::vector<std::int32_t> path;
+    for (auto t = goal; t != -1; t = pl.parent[t])
+    {
+        path.push_back(t);
+        if (auto p = pl.parent[t]; p != -1)
+        {
+            const long int px = p / nz, pz = p % nz;
+            long int x = t / nz, z = t % nz;
+            const int dx = (px > x) - (px < x), dz = (pz > z) - (pz < z);
+            for (x += dx, z += dz; x != px or z != pz; x += dx, z += dz)
+                path.push_back((std::int32_t)(x * nz + z));
+        }
+    }
+    std::ranges::reverse(path);
+    return path;
+}
+/**
+ @brief Max-pools the cells into blocks of hierarchical_block x hierarchical_block tiles. A block costs as its most
+ expensive cell, 100 if any is occupied, and it is blocked (-1) only if none of its cells is free.
+*/
+void Grid::update_coarse_grid()
+{
+    const long int block = planner.params.hierarchical_block;
+    if (not coarse.dirty and coarse.block == block)
+        return;
+    coarse.block = block;
+    coarse.nx = (dense.nx + block - 1) / block;
+    coarse.nz = (dense.nz + block - 1) / block;
+    coarse.cost.assign(coarse.nx * coarse.nz, -1.f);
+    coarse.corridor.assign(coarse.cost.size(), 0);   // marks the blocks with occupied cells while pooling
+    for_each_cell([this, block](const Key &k, T &v)
+    {
+        auto tile = cell_index(k.x, k.z);
+        if (tile < 0) return;
+        auto b = (tile / dense.nz / block) * coarse.nz + (tile % dense.nz) / block;
+        if (not blocked(v))
+            coarse.cost[b] = std::max(coarse.cost[b], v.cost);
+        else
+            coarse.corridor[b] = 1;
+    });
+    for (auto &&[c, occupied] : iter::zip(coarse.cost, coarse.corridor))
+        if (c >= 0 and occupied)
+            c = 100.f;
+    coarse.dirty = false;
+}
 inline double Grid::heuristicL2(const Key &a, const Key &b) const
 {
     return sqrt((a.x - b.x) * (a.x - b.x) + (a.z - b.z) * (a.z - b.z));
 }
 
 /////////////////////////////// COSTS /////////////////////////////////////////////////////////
+/**
+ @brief Sets the cost of the cells from their distance to the obstacles. With 'wide' the costs are inflated with the
+ incremental brushfire (see update_inflation), otherwise only the occupied cells get cost 100.
+*/
 void Grid::update_costs(bool wide)
 {
+    if(wide or layered)
+    {
+        update_inflation();
+        return;
+    }
+
     static QBrush free_brush(QColor(params.free_color));
     static QBrush occ_brush(QColor(params.occupied_color));
-    static QBrush orange_brush(QColor("Orange"));
-    static QBrush yellow_brush(QColor("Yellow"));
-    static QBrush gray_brush(QColor("LightGray"));
 
-    for(auto &&[k,v] : iter::filter([](auto v){ return std::get<1>(v).cost > 1;}, fmap))
+    for_each_cell([this](const Key &, T &v)
     {
-        v.tile->setBrush(free_brush);
-        v.cost = 1.f;
-    }
+        if (v.cost > 1)
+        {
+            paint_tile(v, free_brush);
+            v.cost = 1.f;
+        }
+    });
 
     //update grid values
-    if(wide)
+    for_each_cell([this](const Key &, T &v)
     {
-        for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
+        if (not v.free)
         {
             v.cost = 100;
-            v.tile->setBrush(occ_brush);
-            // for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            // {
-            //     fmap.at(kk).cost = 100;
-            //     fmap.at(kk).tile->setBrush(occ_brush);
-            // }
-        }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 100; }, fmap))
-            
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 100)
+            paint_tile(v, occ_brush);
+        }
+    });
+    flush_render();
+}
+Grid::Inflation Grid::Inflation::steps()
+{
+    return Inflation{[](float d){ return d < 1.5f ? 50.f : (d < 2.5f ? 25.f : 15.f); }, 3.5f};
+}
+Grid::Inflation Grid::Inflation::linear(float max_cost, float radius)
+{
+    return Inflation{[max_cost, radius](float d){ return std::max(1.f, max_cost * (1.f - d / radius)); }, radius};
+}
+Grid::Inflation Grid::Inflation::exponential(float max_cost, float decay, float radius)
+{
+    return Inflation{[max_cost, decay](float d){ return std::max(1.f, max_cost * std::exp(-(d - 1.f) / decay)); }, radius};
+}
+void Grid::set_inflation(const Inflation &inflation_)
+{
+    inflation = inflation_;
+    brushfire = Brushfire();   // the next update recomputes every cell
+}
+const QBrush &Grid::cost_brush(float cost) const
+{
+    static QBrush free_brush(QColor(params.free_color));
+    static QBrush occ_brush(QColor(params.occupied_color));
+    static QBrush orange_brush(QColor("Orange"));
+    static QBrush yellow_brush(QColor("Yellow"));
+    static QBrush gray_brush(QColor("LightGray"));
+    return cost >= 100 ? occ_brush : cost >= 50 ? orange_brush : cost >= 25 ? yellow_brush : cost > 1 ? gray_brush : free_brush;
+}
+void Grid::update_inflation()
+{
+    if (layered)
+    {
+        compose_layers();
+        return;
+    }
+    const auto inflation_dist2 = (std::int32_t)std::floor(inflation.radius * inflation.radius);
+    if (device)
+    {
+        // the device computes the whole distance transform, the cost function is sampled at the squared distances
+        std::vector<float> cost_of_dist2(inflation_dist2 + 1);
+        for (std::int32_t d2 = 0; d2 <= inflation_dist2; d2++)
+            cost_of_dist2[d2] = std::max(1.f, inflation.cost(std::sqrt((float)d2)));
+        update_device();
+        device->update_inflation(cost_of_dist2);
+        device_ahead = true;
+        for (auto tile : brushfire.changed)    // the host field is only kept for the distance queries
+            brushfire.dirty[tile] = 0;
+        brushfire.changed.clear();
+        return;
+    }
+    update_distance_field();
+    for (auto tile : brushfire.changed)
+    {
+        brushfire.dirty[tile] = 0;
+        T *cell = tile_cell(tile);
+        if (cell == nullptr)
+            continue;
+        const auto d2 = brushfire.dist2[tile];
+        float cost = 1;
+        if (not cell->free)
+            cost = 100;
+        else if (d2 <= inflation_dist2)
+            cost = std::max(1.f, inflation.cost(std::sqrt((float)d2)));
+        if (cost == cell->cost and not brushfire.rebuilt)   // a distance change beyond the inflation radius
+            continue;
+        cell->cost = cost;
+        paint_tile(*cell, cost_brush(cost));
+    }
+    if (not brushfire.changed.empty())
+        coarse.dirty = true;
+    brushfire.changed.clear();
+    brushfire.rebuilt = false;
+    flush_render();
+}
+void Grid::set_distance_field_range(float range)
+{
+    distance_range = range;
+    brushfire = Brushfire();   // the next update recomputes every cell
+}
+void Grid::update_distance_field()
+{
+    sync_device();
+    const auto tiles = dense.nx * dense.nz;
+    if ((long int)brushfire.dist2.size() != tiles)
+        brushfire_rebuild();
+    else if (not flipped_cells.empty())
+    {
+        for (auto id : flipped_cells)
+        {
+            if (id >= brushfire.id_to_tile.size() or brushfire.id_to_tile[id] == Brushfire::none)
+                continue;
+            auto tile = brushfire.id_to_tile[id];
+            T *cell = tile_cell(tile);
+            bool is_obstacle = brushfire.source[tile] == tile;
+            if (not cell->free and not is_obstacle)
+                brushfire_set_obstacle(tile);
+            else if (cell->free and is_obstacle)
+                brushfire_remove_obstacle(tile);
+        }
+        brushfire_process();
+    }
+    flipped_cells.clear();
+}
+float Grid::distance_to_obstacle(const Eigen::Vector2f &p)
+{
+    update_distance_field();
+    const auto tile = cell_index(p.x(), p.y());
+    if (tile < 0 or brushfire.dist2[tile] == Brushfire::far)
+        return std::numeric_limits<float>::infinity();
+    return std::sqrt((float)brushfire.dist2[tile]) * TILE_SIZE;
+}
+std::vector<float> Grid::distance_to_obstacle(const std::vector<Eigen::Vector2f> &points)
+{
+    update_distance_field();
+    std::vector<float> res(points.size(), std::numeric_limits<float>::infinity());
+    for (std::size_t i = 0; i < points.size(); ++i)
+        if (auto tile = cell_index(points[i].x(), points[i].y()); tile >= 0 and brushfire.dist2[tile] != Brushfire::far)
+            res[i] = std::sqrt((float)brushfire.dist2[tile]) * TILE_SIZE;
+    return res;
+}
+void Grid::update_likelihood_field(LikelihoodField &field)
+{
+    update_distance_field();
+    auto &fc = field_changes;
+    const LikelihoodField::Geometry geometry{dense.nx, dense.nz, (float)dim.left(), (float)dim.top(), TILE_SIZE};
+    if (not fc.enabled or field.source_version() != fc.generation or not (field.geometry() == geometry) or field.empty())
+    {
+        fc.enabled = true;
+        fc.marked.assign(brushfire.dist2.size(), 0);
+        fc.tiles.clear();
+        field.reset(geometry, fc.generation);
+        field.set_all(brushfire.dist2.data());
+        return;
+    }
+    for (auto tile : fc.tiles)
+    {
+        fc.marked[tile] = 0;
+        field.set(tile, brushfire.dist2[tile]);
+    }
+    fc.tiles.clear();
+}
+void Grid::brushfire_rebuild()
+{
+    const auto tiles = dense.nx * dense.nz;
+    brushfire = Brushfire();
+    brushfire.dist2.assign(tiles, Brushfire::far);
+    brushfire.source.assign(tiles, Brushfire::none);
+    brushfire.raise.assign(tiles, 0);
+    brushfire.dirty.assign(tiles, 0);
+    brushfire.max_dist2 = Brushfire::far;
+    if (distance_range > 0)
+        brushfire.max_dist2 = (std::int32_t)std::floor(std::max(inflation.radius * inflation.radius,
+                                                                std::pow(distance_range / TILE_SIZE, 2.f)));
+    brushfire.rebuilt = true;
+    field_changes.generation++;
+    field_changes.tiles.clear();
+    if (field_changes.enabled)
+        field_changes.marked.assign(tiles, 0);
+    for_each_cell([this](const Key &k, T &v)
+    {
+        auto tile = (std::int32_t)cell_index(k.x, k.z);
+        if (v.id >= brushfire.id_to_tile.size())
+            brushfire.id_to_tile.resize(v.id + 1, Brushfire::none);
+        brushfire.id_to_tile[v.id] = tile;
+        if (tile < 0)
+            return;
+        brushfire_touch(tile);
+        if (not v.free)
+            brushfire_set_obstacle(tile);
+    });
+    brushfire_process();
+}
+inline void Grid::brushfire_touch(std::int32_t tile)
+{
+    if (not brushfire.dirty[tile])
+    {
+        brushfire.dirty[tile] = 1;
+        brushfire.changed.push_back(tile);
+    }
+    if (field_changes.enabled and not field_changes.marked[tile])
+    {
+        field_changes.marked[tile] = 1;
+        field_changes.tiles.push_back(tile);
+    }
+}
+void Grid::brushfire_set_obstacle(std::int32_t tile)
+{
+    brushfire.source[tile] = tile;
+    brushfire.dist2[tile] = 0;
+    brushfire.raise[tile] = 0;
+    brushfire.open.emplace(0, tile);
+    brushfire_touch(tile);
+}
+void Grid::brushfire_remove_obstacle(std::int32_t tile)
+{
+    brushfire.source[tile] = Brushfire::none;
+    brushfire.dist2[tile] = Brushfire::far;
+    brushfire.raise[tile] = 1;
+    brushfire.open.emplace(0, tile);
+    brushfire_touch(tile);
+}
+/**
+ @brief Processes the open list: 'raise' waves clear the cells whose obstacle disappeared and 'lower' waves propagate
+ the distance of the remaining obstacles into them, up to the inflation radius.
+*/
+void Grid::brushfire_process()
+{
+    auto &bf = brushfire;
+    const auto nx = dense.nx, nz = dense.nz;
+    while (not bf.open.empty())
+    {
+        auto [d, s] = bf.open.top();
+        bf.open.pop();
+        const long int sx = s / nz, sz = s % nz;
+        if (bf.raise[s])
+        {
+            for (int dx = -1; dx <= 1; dx++)
+                for (int dz = -1; dz <= 1; dz++)
                 {
-                    fmap.at(kk).cost = 50;
-                    fmap.at(kk).tile->setBrush(orange_brush);
+                    long int x = sx + dx, z = sz + dz;
+                    if ((dx == 0 and dz == 0) or x < 0 or x >= nx or z < 0 or z >= nz)
+                        continue;
+                    auto n = (std::int32_t)(x * nz + z);
+                    if (bf.source[n] == Brushfire::none or bf.raise[n])
+                        continue;
+                    auto old = bf.dist2[n];
+                    if (bf.source[bf.source[n]] != bf.source[n])  // its obstacle is gone
+                    {
+                        bf.source[n] = Brushfire::none;
+                        bf.dist2[n] = Brushfire::far;
+                        bf.raise[n] = 1;
+                        brushfire_touch(n);
+                    }
+                    bf.open.emplace(old, n);
                 }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 50; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 50)
+            bf.raise[s] = 0;
+        }
+        else if (bf.source[s] != Brushfire::none and bf.source[bf.source[s]] == bf.source[s])
+        {
+            const auto o = bf.source[s];
+            const long int ox = o / nz, oz = o % nz;
+            for (int dx = -1; dx <= 1; dx++)
+                for (int dz = -1; dz <= 1; dz++)
                 {
-                    // vv.free = true;
-                    fmap.at(kk).cost = 25;
-                    fmap.at(kk).tile->setBrush(yellow_brush);
+                    long int x = sx + dx, z = sz + dz;
+                    if ((dx == 0 and dz == 0) or x < 0 or x >= nx or z < 0 or z >= nz)
+                        continue;
+                    auto n = (std::int32_t)(x * nz + z);
+                    if (bf.raise[n])
+                        continue;
+                    auto nd = (std::int32_t)((x - ox) * (x - ox) + (z - oz) * (z - oz));
+                    if (nd < bf.dist2[n] and nd <= bf.max_dist2)
+                    {
+                        bf.dist2[n] = nd;
+                        bf.source[n] = o;
+                        bf.open.emplace(nd, n);
+                        brushfire_touch(n);
+                    }
                 }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 25; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &[kk, vv]: neighs)
+        }
+    }
+}
+/**
+ @brief Integer DDA (Amanatides-Woo) over the tiles crossed by the segment from -> to. visit(kx, kz, last) is called
+ once for every tile, in order, with last == true for the tile that holds 'to'. Tile kx covers the points that
+ pointToKey rounds to kx, i.e. [kx - 0.5, kx + 0.5) in tile units.
+*/
+template <typename F>
+void Grid::trace_ray(const Eigen::Vector2f &from, const Eigen::Vector2f &to, F &&visit)
+{
+    const float gx0 = (from.x() - dim.left()) / TILE_SIZE + 0.5f, gz0 = (from.y() - dim.top()) / TILE_SIZE + 0.5f;
+    const float gx1 = (to.x() - dim.left()) / TILE_SIZE + 0.5f, gz1 = (to.y() - dim.top()) / TILE_SIZE + 0.5f;
+    long int cx = std::floor(gx0), cz = std::floor(gz0);
+    const long int ex = std::floor(gx1), ez = std::floor(gz1);
+    const float dx = gx1 - gx0, dz = gz1 - gz0;
+    const int step_x = dx > 0 ? 1 : -1, step_z = dz > 0 ? 1 : -1;
+    const float inf = std::numeric_limits<float>::infinity();
+    const float delta_x = dx != 0 ? 1.f / std::fabs(dx) : inf, delta_z = dz != 0 ? 1.f / std::fabs(dz) : inf;
+    float max_x = dx != 0 ? (dx > 0 ? cx + 1 - gx0 : gx0 - cx) * delta_x : inf;
+    float max_z = dz != 0 ? (dz > 0 ? cz + 1 - gz0 : gz0 - cz) * delta_z : inf;
+    // every step moves one tile along x or z, so the end tile is reached in |ex - cx| + |ez - cz| steps
+    for (long int n = std::labs(ex - cx) + std::labs(ez - cz); n > 0; --n)
+    {
+        visit(cx, cz, false);
+        if (max_x < max_z)
+        { cx += step_x; max_x += delta_x; }
+        else
+        { cz += step_z; max_z += delta_z; }
+    }
+    visit(ex, ez, true);
+}
+void Grid::set_update_threads(std::uint32_t num_threads)
+{
+    if (num_threads > 1)
+        update_pool = std::make_unique<ThreadPool>(num_threads - 1);  // the caller also traces rays
+    else
+        update_pool.reset();
+}
+/**
+ @brief Updates the map with a scan. Each ray is traced with an integer DDA that visits every crossed tile once.
+ Over the whole scan a tile receives at most one miss and one hit, and tiles hit by any ray are not marked as free
+ by the others. The rays are traced in parallel if set_update_threads() was called, and the cell updates are applied
+ afterwards in the caller's thread.
+*/
+void Grid::update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range)
+{
+    if (device)
+    {
+        update_device();
+        device->update_map(points.empty() ? nullptr : points.front().data(), points.size(), robot_in_grid.x(), robot_in_grid.y(),
+                           max_laser_range, occupancy_model);
+        device_ahead = true;
+        return;
+    }
+    if (hit_stamp.size() != size())
+    {
+        hit_stamp = std::vector<std::atomic<std::uint32_t>>(size());
+        miss_stamp = std::vector<std::atomic<std::uint32_t>>(size());
+        scan_stamp = 0;
+    }
+    if (++scan_stamp == 0)  // wrapped around: forget old marks
+    {
+        for (auto &s : hit_stamp) s = 0;
+        for (auto &s : miss_stamp) s = 0;
+        scan_stamp = 1;
+    }
+    const auto stamp = scan_stamp;
+    auto mark = [stamp](std::vector<std::atomic<std::uint32_t>> &marks, const T &cell)
+    {
+        return cell.id < marks.size() and marks[cell.id].exchange(stamp) != stamp;
+    };
+
+    std::vector<T *> hits, misses;
+    std::mutex merge_mutex;
+    auto in_range = [&](const Eigen::Vector2f &point){ return (point - robot_in_grid).norm() <= max_laser_range; };
+    auto run = [this](std::size_t n, auto &&chunk)
+    {
+        if (update_pool)
+            update_pool->parallel_for(0, n, 0, chunk);
+        else
+            chunk(std::size_t(0), n);
+    };
+
+    // first the hits, so that the misses can skip the tiles hit in this scan
+    run(points.size(), [&](std::size_t b, std::size_t e)
+    {
+        std::vector<T *> local;
+        for (auto i = b; i < e; i++)
+        {
+            if (not in_range(points[i]))
+                continue;
+            long int kx = rint((points[i].x() - dim.left()) / TILE_SIZE), kz = rint((points[i].y() - dim.top()) / TILE_SIZE);
+            if (T *cell = find_tile(kx, kz); cell != nullptr and mark(hit_stamp, *cell))
+                local.push_back(cell);
+        }
+        std::lock_guard lock(merge_mutex);
+        hits.insert(hits.end(), local.begin(), local.end());
+    });
+    run(points.size(), [&](std::size_t b, std::size_t e)
+    {
+        std::vector<T *> local;
+        for (auto i = b; i < e; i++)
+        {
+            const bool hit = in_range(points[i]);
+            trace_ray(robot_in_grid, points[i], [&](long int kx, long int kz, bool last)
             {
-                if (vv.cost < 25)
+                if (last and hit)
+                    return;
+                if (T *cell = find_tile(kx, kz); cell != nullptr and
+                    not (cell->id < hit_stamp.size() and hit_stamp[cell->id].load() == stamp) and mark(miss_stamp, *cell))
+                    local.push_back(cell);
+            });
+        }
+        std::lock_guard lock(merge_mutex);
+        misses.insert(misses.end(), local.begin(), local.end());
+    });
+
+    // batch updates of the collected cells, a flip also changes the free flag
+    occupancy_model.apply(misses, occupancy_model.miss, [this](T &v){ flipped++; set_occupancy(v, true); });
+    occupancy_model.apply(hits, occupancy_model.hit, [this](T &v){ flipped++; set_occupancy(v, false); });
+    updated += misses.size() + hits.size();
+}
+bool Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coordinates
+{
+    sync_device();
+    for(const auto &p: path)
+        if(is_occupied(p) or get_cost(p)>=50)
+           return true;
+    return false;
+}
+/**
+ @brief Checks the trajectories pose by pose until the first collision. A pose collides if its center or one of the
+ footprint points falls on an occupied cell or out of the grid, or if an obstacle is closer than the footprint radius.
+ Distances come from the distance field (tile centers), so a pose costs one lookup per footprint point.
+*/
+std::vector<Grid::TrajectoryCheck> Grid::check_trajectories(const Eigen::Matrix3Xf &poses, std::size_t steps, const Footprint &footprint)
+{
+    if (steps == 0)
+        return {};
+    update_distance_field();   // the evaluation below is read only
+    const std::size_t n = poses.cols() / steps;
+    std::vector<TrajectoryCheck> res(n);
+    // distance to the closest obstacle (mm) from a point, -1 if it is on an obstacle or out of the grid
+    auto distance = [this](float x, float z)
+    {
+        const auto tile = cell_index(x, z);
+        if (tile < 0 or brushfire.dist2[tile] == 0)
+            return -1.f;
+        const auto d2 = brushfire.dist2[tile];
+        return d2 == Brushfire::far ? std::numeric_limits<float>::infinity() : std::sqrt((float)d2) * TILE_SIZE;
+    };
+    auto check = [&](std::size_t b, std::size_t e)
+    {
+        Eigen::Matrix2Xf outline(2, footprint.points.cols());
+        for (auto t = b; t < e; t++)
+        {
+            auto &r = res[t];
+            for (std::size_t i = 0; i < steps; i++)
+            {
+                const Eigen::Vector3f pose = poses.col(t * steps + i);
+                float clearance = distance(pose.x(), pose.y());
+                bool collision = clearance < 0 or clearance < footprint.radius;
+                clearance -= footprint.radius;
+                if (not collision and footprint.points.cols() > 0)
+                {
+                    const float c = std::cos(pose.z()), s = std::sin(pose.z());
+                    Eigen::Matrix2f rot;
+                    rot << c, -s, s, c;
+                    outline.noalias() = rot * footprint.points;
+                    outline.colwise() += pose.head<2>();
+                    for (long int j = 0; j < outline.cols() and not collision; j++)
+                    {
+                        const float d = distance(outline(0, j), outline(1, j));
+                        collision = d < 0;
+                        clearance = std::min(clearance, d);
+                    }
+                }
+                if (collision)
                 {
-                    // vv.free = true;
-                    fmap.at(kk).cost = 15;
-                    fmap.at(kk).tile->setBrush(gray_brush);
+                    r.first_collision = (int)i;
+                    r.clearance = 0.f;
+                    break;
                 }
+                r.clearance = std::min(r.clearance, clearance);
             }
+        }
+    };
+    if (update_pool)
+        update_pool->parallel_for(0, n, 0, check);
+    else
+        check(0, n);
+    return res;
+}
+////////////////////////////// LAYERED COSTS /////////////////////////////////////////////////////////
+static std::vector<Eigen::Vector2f> polygon_points(const QPolygonF &poly)
+{
+    std::vector<Eigen::Vector2f> points;
+    points.reserve(poly.size());
+    for (const auto &p : poly)
+        points.emplace_back(p.x(), p.y());
+    return points;
+}
+void Grid::set_layered_costs(bool enable)
+{
+    if (enable == layered)
+        return;
+    if (enable and device)
+        set_device_backend(false);
+    layered = enable;
+    layers = LayeredCostmap();  // the next update_inflation composes every cell
+    brushfire = Brushfire();    // and recomputes the distances, with or without layers
+    coarse.dirty = true;
+}
+void Grid::set_layer_area(LayeredCostmap::Layer layer, const QPolygonF &poly, float cost)
+{
+    auto it = std::ranges::find_if(layer_areas, [&](const LayerArea &a){ return a.layer == layer and a.poly == poly; });
+    if (it != layer_areas.end())
+    {
+        if (it->cost == cost)
+            return;
+        it->cost = cost;
     }
     else
+        layer_areas.push_back(LayerArea{layer, poly, cost});
+    if (not sync_layers())   // a reset has already rasterized it
+        layers.fill_polygon(layer, polygon_points(poly), cost);
+}
+void Grid::clear_layer_areas(LayeredCostmap::Layer layer)
+{
+    std::erase_if(layer_areas, [layer](const LayerArea &a){ return a.layer == layer; });
+    if (sync_layers())
+        return;
+    layers.fill(layer, 0.f);
+    for (const auto &a : layer_areas)
+        if (a.layer == layer)
+            layers.fill_polygon(layer, polygon_points(a.poly), a.cost);
+}
+bool Grid::sync_layers()
+{
+    const LayeredCostmap::Geometry geometry{dense.nx, dense.nz, (float)dim.left(), (float)dim.top(), TILE_SIZE};
+    if (layers.geometry() == geometry and (long int)layers.layer(LayeredCostmap::Static).size() == dense.nx * dense.nz)
+        return false;
+    layers.reset(geometry);
+    for (const auto &a : layer_areas)
+        layers.fill_polygon(a.layer, polygon_points(a.poly), a.cost);
+    layers_stale = true;
+    return true;
+}
+/**
+ @brief Writes the obstacle and inflation layers of the cells whose distance changed (all of them after a reset of the
+ layers) and composes the dirty bounds of every layer into the costs of the cells.
+*/
+void Grid::compose_layers()
+{
+    update_distance_field();
+    sync_layers();
+    const auto inflation_dist2 = (std::int32_t)std::floor(inflation.radius * inflation.radius);
+    auto write = [this, inflation_dist2](std::int32_t tile)
+    {
+        const T *cell = tile_cell(tile);
+        const bool occupied = cell != nullptr and not cell->free;
+        const auto d2 = brushfire.dist2[tile];
+        layers.set(LayeredCostmap::Obstacle, tile, occupied ? LayeredCostmap::lethal : 0.f);
+        layers.set(LayeredCostmap::Inflation, tile, (not occupied and d2 <= inflation_dist2) ?
+                                                    std::max(1.f, inflation.cost(std::sqrt((float)d2))) : 0.f);
+    };
+    if (layers_stale)
+        for (std::int32_t tile = 0; tile < (std::int32_t)(dense.nx * dense.nz); tile++)
+            write(tile);
+    else
+        for (auto tile : brushfire.changed)
+            write(tile);
+    layers_stale = false;
+    for (auto tile : brushfire.changed)
+        brushfire.dirty[tile] = 0;
+    brushfire.changed.clear();
+    brushfire.rebuilt = false;
+
+    const auto changed = layers.compose([this](std::int32_t tile, float cost)
     {
-        for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
+        if (T *cell = tile_cell(tile); cell != nullptr and cell->cost != cost)
         {
-            v.cost = 100;
-            v.tile->setBrush(occ_brush);
-            fmap.at(k).cost = 100;
-            fmap.at(k).tile->setBrush(occ_brush);
+            cell->cost = cost;
+            paint_tile(*cell, cost_brush(cost));
         }
+    });
+    if (changed > 0)
+        coarse.dirty = true;
+    flush_render();
+}
+////////////////////////////// GPU BACKEND /////////////////////////////////////////////////////////
+bool Grid::set_device_backend(bool enable)
+{
+    if (not enable)
+    {
+        sync_device();
+        device.reset();
+        device_edits.clear();
+        return true;
+    }
+    if (device)
+        return true;
+    if (layered)
+    {
+        qWarning() << __FUNCTION__ << "The GPU backend does not compose layered costs";
+        return false;
+    }
+    if (storage != Storage::Dense or dense.cells.empty() or not GridDevice::gpu())
+    {
+        qWarning() << __FUNCTION__ << "The GPU backend requires a Dense grid and a CUDA device";
+        return false;
     }
+    try
+    { device = std::make_unique<GridDevice>(); }
+    catch (const std::exception &e)
+    {
+        qWarning() << __FUNCTION__ << e.what();
+        return false;
+    }
+    device_edits.clear();
+    device_upload = true;
+    device_ahead = false;
+    return true;
 }
-void Grid::update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range)
+GridDevice::Geometry Grid::device_geometry() const
+{
+    return GridDevice::Geometry{dense.nx, dense.nz, dense.ox, dense.oz, dim.left(), dim.top(), TILE_SIZE};
+}
+/**
+ @brief Sends the host changes to the device: every cell after initialize, read_binary or shift_window, otherwise the
+ cells edited since the previous update (the host edit wins over a device change not synced yet).
+*/
+void Grid::update_device()
 {
-    for(const auto &point : points)
+    if (device_upload)
     {
-        float length = (point-robot_in_grid).norm();
-        int num_steps = ceil(length/(TILE_SIZE));
-        Eigen::Vector2f p;
-        for(const auto &&step : iter::range(0.0, 1.0-(1.0/num_steps), 1.0/num_steps))
+        const auto n = dense.cells.size();
+        std::vector<std::int16_t> occupancy(n);
+        std::vector<std::uint8_t> free(n);
+        std::vector<float> cost(n);
+        for (std::size_t i = 0; i < n; i++)
         {
-            p = robot_in_grid * (1-step) + point*step;
-            add_miss(p);
+            occupancy[i] = dense.cells[i].occupancy;
+            free[i] = dense.cells[i].free;
+            cost[i] = dense.cells[i].cost;
         }
-        if(length <= max_laser_range)
-            add_hit(point);
-
-        if((p-point).norm() < TILE_SIZE)  // in case last miss overlaps tip
-            add_hit(point);
+        device->upload(device_geometry(), occupancy.data(), free.data(), cost.data());
+        device_upload = false;
+        device_edits.clear();
+        return;
+    }
+    if (device_edits.empty())
+        return;
+    std::sort(device_edits.begin(), device_edits.end());
+    device_edits.erase(std::unique(device_edits.begin(), device_edits.end()), device_edits.end());
+    std::vector<std::int16_t> occupancy(device_edits.size());
+    std::vector<std::uint8_t> free(device_edits.size());
+    for (std::size_t i = 0; i < device_edits.size(); i++)
+    {
+        occupancy[i] = dense.cells[device_edits[i]].occupancy;
+        free[i] = dense.cells[device_edits[i]].free;
     }
+    device->write(device_edits, occupancy, free);
+    device_edits.clear();
 }
-bool Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coordinates
+/**
+ @brief Copies the cells changed on the device since the previous sync and repaints them. The flips are recorded for
+ the host distance field if it was already built.
+*/
+void Grid::sync_device()
 {
-    for(const auto &p: path)
-        if(is_occupied(p) or get_cost(p)>=50)
-           return true;
+    if (not device or not device_ahead)
+        return;
+    const auto cells = device->download();
+    const bool field = (long int)brushfire.dist2.size() == dense.nx * dense.nz;
+    for (std::size_t i = 0; i < cells.id.size(); i++)
+    {
+        T &v = dense.cells[cells.id[i]];
+        v.occupancy = cells.occupancy[i];
+        const bool free = cells.free[i];
+        if (free == v.free and cells.cost[i] == v.cost)
+            continue;
+        if (free != v.free and field)
+            flipped_cells.push_back(v.id);
+        v.free = free;
+        v.cost = cells.cost[i];
+        coarse.dirty = true;
+        paint_tile(v, cost_brush(v.cost));
+    }
+    updated += cells.updated;
+    flipped += cells.flipped;
+    device_ahead = false;
+    flush_render();
+}
+
+////////////////////////////// SNAPSHOTS /////////////////////////////////////////////////////////
+/**
+ @brief Makes a new version of the read-only copy of the grid and publishes it. The blocks equal to the ones of the
+ previous version (same geometry) are shared with it. Called by the thread that updates the grid, the readers of
+ snapshot() are never blocked by it.
+*/
+std::shared_ptr<const Grid::Snapshot> Grid::publish()
+{
+    sync_device();
+    const auto previous = published.load(std::memory_order_acquire);
+    auto next = std::make_shared<Snapshot>();
+    next->dim = dim;
+    next->tile = TILE_SIZE;
+    next->nx = dense.nx;
+    next->nz = dense.nz;
+    next->bnx = (dense.nx + Snapshot::BLOCK - 1) / Snapshot::BLOCK;
+    next->bnz = (dense.nz + Snapshot::BLOCK - 1) / Snapshot::BLOCK;
+    next->version_ = previous ? previous->version_ + 1 : 1;
+    next->blocks.resize(next->bnx * next->bnz);
+    const bool same_geometry = previous and previous->dim == dim and previous->tile == TILE_SIZE and
+                               previous->nx == dense.nx and previous->nz == dense.nz;
+    constexpr long int B = Snapshot::BLOCK;
+    Snapshot::Block block(B * B);
+    for (long int bx = 0; bx < next->bnx; bx++)
+        for (long int bz = 0; bz < next->bnz; bz++)
+        {
+            std::fill(block.begin(), block.end(), -1.f);     // the tiles past the border are never free
+            for (long int x = bx * B; x < std::min((bx + 1) * B, dense.nx); x++)
+                for (long int z = bz * B; z < std::min((bz + 1) * B, dense.nz); z++)
+                    if (const T *c = find_tile(x, z); c != nullptr and not blocked(*c))
+                        block[(x % B) * B + z % B] = c->cost;
+            auto &slot = next->blocks[bx * next->bnz + bz];
+            if (same_geometry)
+                if (const auto &old = previous->blocks[bx * next->bnz + bz]; *old == block)
+                {
+                    slot = old;
+                    next->shared++;
+                    continue;
+                }
+            slot = std::make_shared<const Snapshot::Block>(block);
+        }
+    std::shared_ptr<const Snapshot> result = std::move(next);
+    published.store(result, std::memory_order_release);
+    return result;
+}
+float Grid::Snapshot::get_cost(const Eigen::Vector2f &p) const
+{
+    if (not dim.contains(QPointF(p.x(), p.y())))
+        return -1;
+    const long int kx = rint((p.x() - dim.left()) / tile), kz = rint((p.y() - dim.top()) / tile);
+    if (kx < 0 or kx >= nx or kz < 0 or kz >= nz)
+        return -1;
+    const float c = tile_cost(kx, kz);
+    return c < 0 ? 100.f : c;      // occupied cells keep cost 100 in the grid after update_costs
+}
+bool Grid::Snapshot::is_occupied(const Eigen::Vector2f &p) const
+{
+    if (not dim.contains(QPointF(p.x(), p.y())))
+        return true;
+    return tile_cost(rint((p.x() - dim.left()) / tile), rint((p.y() - dim.top()) / tile)) < 0;
+}
+bool Grid::Snapshot::is_path_blocked(const std::vector<Eigen::Vector2f> &path) const
+{
+    for (const auto &p : path)
+        if (is_occupied(p) or get_cost(p) >= 50)
+            return true;
     return false;
 }
+std::int32_t Grid::Snapshot::closest_free(long int kx, long int kz) const
+{
+    // rings of growing radius around the tile
+    for (long int r = 1; r < std::max(nx, nz); r++)
+        for (long int dx = -r; dx <= r; dx++)
+            for (long int dz = -r; dz <= r; dz += (std::abs(dx) == r ? 1 : 2 * r))
+                if (tile_cost(kx + dx, kz + dz) >= 0)
+                    return (std::int32_t)((kx + dx) * nz + kz + dz);
+    return -1;
+}
+std::vector<Eigen::Vector2f> Grid::Snapshot::compute_path(const QPointF &source, const QPointF &target) const
+{
+    return compute_path(source, target, PlannerParams());
+}
+std::vector<Eigen::Vector2f> Grid::Snapshot::compute_path(const QPointF &source, const QPointF &target, const PlannerParams &params) const
+{
+    if (not dim.contains(source) or not dim.contains(target) or nx == 0 or nz == 0)
+        return {};
+    const long int sx = std::clamp<long int>(rint((source.x() - dim.left()) / tile), 0, nx - 1);
+    const long int sz = std::clamp<long int>(rint((source.y() - dim.top()) / tile), 0, nz - 1);
+    const long int tx = std::clamp<long int>(rint((target.x() - dim.left()) / tile), 0, nx - 1);
+    const long int tz = std::clamp<long int>(rint((target.y() - dim.top()) / tile), 0, nz - 1);
+    auto s = (std::int32_t)(sx * nz + sz), t = (std::int32_t)(tx * nz + tz);
+    if (s == t)
+        return {};
+    // as computePath, a source or target on an occupied cell is moved to the closest free one
+    if (tile_cost(tx, tz) < 0 and (t = closest_free(tx, tz)) < 0)
+        return {};
+    if (tile_cost(sx, sz) < 0 and (s = closest_free(sx, sz)) < 0)
+        return {};
+
+    thread_local Planner pl;
+    const auto tiles = search(pl, params, nx, nz, s, t, [this](long int x, long int z){ return tile_cost(x, z); }, params.jps);
+    // the source is not included and, as decimate_path does, one of every two tiles is kept
+    std::vector<Eigen::Vector2f> path;
+    for (std::size_t i = 1; i < tiles.size(); i += 2)
+        path.emplace_back(dim.left() + (tiles[i] / nz) * tile, dim.top() + (tiles[i] % nz) * tile);
+    return path;
+}
 ////////////////////////////// DRAW /////////////////////////////////////////////////////////
+////////////////////////////// RENDER /////////////////////////////////////////////////////////
+void Grid::paint_tile(T &v, const QBrush &brush)
+{
+    if (v.tile != nullptr)
+        v.tile->setBrush(brush);
+    else if (image_item != nullptr and v.id < dense.nx * dense.nz)   // ids are the storage order given by initialize
+    {
+        const auto i = storage == Storage::Dense ? dense.logical(v.id) : (long int)v.id;
+        image_item->set(i / dense.nz, i % dense.nz, brush.color().rgb());
+    }
+}
+void Grid::flush_render()
+{
+    if (image_item != nullptr)
+        image_item->flush();
+}
 void Grid::draw()
 {
+    if (render == Render::Image)  // the cells are painted in place
+    {
+        for_each_cell([this](const Key &, T &value)
+        {
+            paint_tile(value, value.free ? QColor(params.free_color) : QColor(params.occupied_color));
+        });
+        flush_render();
+        return;
+    }
     //clear previous points
     for (QGraphicsRectItem* item : scene_grid_points)
         scene->removeItem((QGraphicsItem*)item);
@@ -762,7 +2230,7 @@ void Grid::draw()
     scene_grid_points.clear();
     //create new representation
     std::string color;
-    for( const auto &[key,value] : fmap)
+    for_each_cell([this, &color](const Key &key, const T &value)
     {
         if(value.free)
         {
@@ -792,13 +2260,89 @@ void Grid::draw()
         aux->setZValue(1);
         aux->setPos(key.x, key.z);
         scene_grid_points.push_back(aux);
-    }
+    });
 }
 void Grid::clear()
 {
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
+    for_each_cell([this](const Key &, T &value){ if(value.tile != nullptr) scene->removeItem(value.tile); });
+    delete image_item;
+    image_item = nullptr;
     fmap.clear();
+    dense.cells.clear();
+    dense.ox = dense.oz = 0;
+}
+
+////////////////////////////// ROLLING WINDOW /////////////////////////////////////////////////////////
+inline QPointF Grid::tile_scene_pos(long int kx, long int kz) const
+{
+    Eigen::Matrix2f matrix;
+    matrix << cos(grid_angle) , -sin(grid_angle) , sin(grid_angle) , cos(grid_angle);
+    Eigen::Vector2f res = matrix * Eigen::Vector2f(dim.left() + kx * TILE_SIZE, dim.top() + kz * TILE_SIZE) +
+                          Eigen::Vector2f(grid_center.x(), grid_center.y());
+    return QPointF(res.x(), res.y());
+}
+/**
+ @brief Moves the grid (dx, dz) tiles. The cells still inside keep their content and the ones entering through the
+ border are cleared. The cells are not moved: the ring offsets of the dense storage are advanced and only the
+ exposed rows and columns are rewritten, so the cost depends on the border and not on the area.
+*/
+bool Grid::shift_window(long int dx, long int dz)
+{
+    if (storage != Storage::Dense or dense.cells.empty())
+    {
+        qWarning() << __FUNCTION__ << "The rolling window requires a Dense grid";
+        return false;
+    }
+    if (dx == 0 and dz == 0)
+        return true;
+    sync_device();
+    const auto nx = dense.nx, nz = dense.nz;
+    dim.translate(dx * TILE_SIZE, dz * TILE_SIZE);
+    dense.ox = ((dense.ox + dx) % nx + nx) % nx;
+    dense.oz = ((dense.oz + dz) % nz + nz) % nz;
+    const QColor white("White");
+    if (image_item != nullptr)
+        image_item->scroll(dx, dz, TILE_SIZE, white.rgb());
+
+    const auto reset = [this, &white](long int kx, long int kz)
+    {
+        T &v = *find_tile(kx, kz);
+        v.free = true;
+        v.visited = false;
+        v.cost = 1.0;
+        v.occupancy = 0;
+        if (v.id < sync.changed.size())
+            sync.changed[v.id] = Sync::reset;     // sent in the next commit even if it ends up as it was
+        if (v.tile != nullptr)
+        {
+            v.tile->setPos(tile_scene_pos(kx, kz));
+            v.tile->setBrush(QBrush(white));
+        }
+    };
+    const bool all = std::abs(dx) >= nx or std::abs(dz) >= nz;
+    // exposed rows of the columns that remain inside
+    const long int z_begin = dz > 0 ? nz - dz : 0, z_end = dz > 0 ? nz : -dz;
+    for (long int kx = 0; kx < nx; ++kx)
+        if (all or kx + dx < 0 or kx + dx >= nx)
+            for (long int kz = 0; kz < nz; ++kz)
+                reset(kx, kz);
+        else
+            for (long int kz = z_begin; kz < z_end; ++kz)
+                reset(kx, kz);
+
+    // the distances and the coarse grid are indexed by tile position
+    brushfire = Brushfire();
+    flipped_cells.clear();
+    coarse.dirty = true;
+    device_upload = true;
+    if (bounding_box != nullptr)
+        bounding_box->setRect(dim);
+    return true;
+}
+bool Grid::center_window_at(const QPointF &p)
+{
+    const auto c = dim.center();
+    return shift_window(std::lround((p.x() - c.x()) / TILE_SIZE), std::lround((p.y() - c.y()) / TILE_SIZE));
 }
 
 ////////////////////////////// NEIGHS /////////////////////////////////////////////////////////
@@ -826,6 +2370,14 @@ std::optional<QPointF> Grid::closestMatching_spiralMove(const QPointF &p, std::f
 }
 std::optional<QPointF> Grid::closest_obstacle(const QPointF &p)
 {
+    update_distance_field();
+    if (auto tile = cell_index(p.x(), p.y()); tile >= 0)
+    {
+        if (auto o = brushfire.source[tile]; o != Brushfire::none)
+            return QPointF(dim.left() + (o / dense.nz) * TILE_SIZE, dim.top() + (o % dense.nz) * TILE_SIZE);
+        if (distance_range <= 0)     // the field covers the whole grid: there are no obstacles
+            return {};
+    }
     return this->closestMatching_spiralMove(p, [](auto cell){ return not cell.second.free; });
 }
 std::optional<QPointF> Grid::closest_free(const QPointF &p)
@@ -849,6 +2401,20 @@ std::tuple<bool, QVector2D> Grid::vectorToClosestObstacle(QPointF center)
     QVector2D closestVector;
     bool obstacleFound = false;
 
+    // closest obstacle up to two tiles away (the 16 neighbourhood) from the distance field, unless the cell itself
+    // is occupied: the closest of its occupied neighbours is searched below
+    update_distance_field();
+    if (auto tile = cell_index(k.x, k.z); tile >= 0 and brushfire.dist2[tile] > 0 and
+                                          brushfire.max_dist2 >= 8)
+    {
+        const auto o = brushfire.source[tile];
+        if (o == Brushfire::none or brushfire.dist2[tile] > 8)
+            return std::make_tuple(false, closestVector);
+        closestVector = QVector2D(QPointF(k.x, k.z)) - QVector2D(QPointF(dim.left() + (o / dense.nz) * TILE_SIZE,
+                                                                           dim.top() + (o % dense.nz) * TILE_SIZE));
+        return std::make_tuple(true, closestVector);
+    }
+
     auto neigh = neighboors_8(k, true);
     float dist = std::numeric_limits<float>::max();
     for (auto n : neigh)
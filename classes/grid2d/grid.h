@@ -29,6 +29,15 @@
 #include <Eigen/Dense>
 #include <QVector2D>
 #include <QColor>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <threadpool/threadpool.h>
+#include <grid2d/occupancy.h>
+#include <grid2d/grid_device.h>
+#include <grid2d/likelihood_field.h>
+#include <grid2d/costmap_layers.h>
 
 class Grid
 {
@@ -94,11 +103,18 @@ public:
         std::uint32_t id;
         bool free = true;
         bool visited = false;
+        std::int16_t occupancy = 0;   // fixed-point log-odds (see OccupancyModel), 0 is the prior p = 0.5
         float cost = 1;
-        float hits = 0;
-        float misses = 0;
-        QGraphicsRectItem *tile;
-        double log_odds = 0.0;  //log prior
+        QGraphicsRectItem *tile;   // last, so the fields used by the algorithms share the first bytes of the cell
+
+        // Former fields, now functions of 'occupancy'. log_odds() is exact; hits() and misses() are the counts that
+        // reach the same log-odds from the prior with the default OccupancyModel, one of them is always 0.
+        [[deprecated("use occupancy and Grid::get_occupancy_model()")]] double log_odds() const
+        { return OccupancyModel::to_log_odds(occupancy); };
+        [[deprecated("use occupancy and Grid::get_occupancy_model()")]] float hits() const
+        { return occupancy > 0 ? occupancy / (float)default_model().hit : 0.f; };
+        [[deprecated("use occupancy and Grid::get_occupancy_model()")]] float misses() const
+        { return occupancy < 0 ? occupancy / (float)default_model().miss : 0.f; };
 
         // method to save the value
         void save(std::ostream &os) const
@@ -106,32 +122,155 @@ public:
 
         void read(std::istream &is)
         { is >> free >> visited; };
+
+    private:
+        static const OccupancyModel &default_model()
+        { static const OccupancyModel model; return model; };
     };
 
     using FMap = std::unordered_map<Key, T, KeyHasher>;
     Dimensions dim = QRectF();
 
+    // Cell storage selected in initialize: Hashed keeps the cells in 'fmap', Dense in a row-major array indexed by
+    // (x, z) tile coordinates, so a cell access is index arithmetic instead of hashing the key.
+    enum class Storage { Hashed, Dense };
+    // Items creates a QGraphicsRectItem per cell. Image paints the whole grid in one item backed by a QImage with a
+    // pixel per tile, and only the region of the tiles changed since the last flush_render() is repainted.
+    enum class Render { Items, Image };
+
     void initialize(QRectF dim_,
                     int tile_size,
                     QGraphicsScene *scene,
                     bool read_from_file = true,
                     const std::string &file_name = std::string(),
                     QPointF grid_center = QPointF(0,0),
-                    float grid_angle = 0.f);
+                    float grid_angle = 0.f,
+                    Storage storage_ = Storage::Hashed,
+                    Render render_ = Render::Items);
     void clear();
+    void flush_render();    // Render::Image: schedules the repaint of the tiles changed since the last call
     std::list<QPointF> computePath(const QPointF &source_, const QPointF &target_);
     std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
+
+    // computePath search options
+    struct PlannerParams
+    {
+        bool jps = false;                   // jump over the free areas of cost 1 (Jump Point Search)
+        float heuristic_weight = 1.f;       // > 1 expands less nodes, the path cost is at most weight times the optimal
+        std::size_t max_expansions = 0;     // 0 for no limit
+        float time_budget_ms = 0.f;         // 0 for no limit
+        bool partial_path = false;          // if a limit is reached, return the path to the node closest to the target
+        // > 1: for long routes a corridor is first found on a grid of blocks of this many tiles per side, and the
+        // path is searched only inside it (JPS is not used then)
+        int hierarchical_block = 0;
+    };
+    void set_planner_params(const PlannerParams &params_);
     void update_map( const std::vector<Eigen::Vector2f> &points, const Eigen::Vector2f &robot_in_grid, float max_laser_range);
+    void set_update_threads(std::uint32_t num_threads);   // threads used by update_map to trace the rays (0 or 1: caller's thread)
+
+    // GPU backend (Dense storage, grid_device.cpp compiled by nvcc): update_map and update_inflation run on the device,
+    // which then owns the occupancy and the costs. The cells changed there are copied back by sync_device(), that
+    // compute_path, publish and the distance queries call, so the other accessors see the grid of the last sync.
+    // Host edits (setOccupied, markAreaInGridAs, add_hit, ...) are sent to the device before its next update.
+    // The device computes the exact distance transform, so set_distance_field_range does not apply to the costs.
+    bool set_device_backend(bool enable);     // false if there is no GPU or the storage is not Dense
+    bool device_backend() const
+    { return device != nullptr; };
+    void sync_device();
     bool is_path_blocked(const std::vector<Eigen::Vector2f> &path); // grid coordinates
 
+    // Batched collision checking of sampled trajectories (DWA, MPC rollouts) against the distance field.
+    // 'poses' holds the trajectories one after another, 'steps' poses (x, z, angle) each, in grid coordinates.
+    // The footprint is a disc of 'radius' around the pose plus optional outline points in the robot frame.
+    // The trajectories are evaluated in parallel if set_update_threads() was called.
+    struct Footprint
+    {
+        float radius = 0.f;                 // mm
+        Eigen::Matrix2Xf points;            // (x, z) mm, robot frame
+    };
+    struct TrajectoryCheck
+    {
+        int first_collision = -1;           // first colliding pose, -1 if none
+        float clearance = std::numeric_limits<float>::infinity();   // min footprint to obstacle distance, 0 if colliding
+    };
+    std::vector<TrajectoryCheck> check_trajectories(const Eigen::Matrix3Xf &poses, std::size_t steps, const Footprint &footprint);
+
+    // Versioned read-only copies of the occupancy and the costs, so that planners can run on other threads while the
+    // mapping thread keeps updating the grid. The writer calls publish() when a consistent state is ready (after
+    // update_map and update_costs) and it is swapped in atomically; readers take snapshot() and plan on it without
+    // locking the grid. The cells are copied in blocks of BLOCK x BLOCK tiles and a block that did not change since
+    // the previous version is shared with it, so publishing reads every cell but only copies the blocks that changed.
+    class Snapshot
+    {
+    public:
+        static constexpr long int BLOCK = 64;
+
+        std::uint64_t version() const { return version_; }
+        QRectF dimensions() const { return dim; }
+        int tile_size() const { return tile; }
+        float get_cost(const Eigen::Vector2f &p) const;    // -1 if out of the grid, 100 if occupied
+        bool is_occupied(const Eigen::Vector2f &p) const;  // out of the grid is occupied
+        bool is_path_blocked(const std::vector<Eigen::Vector2f> &path) const;   // as Grid::is_path_blocked
+        // As Grid::compute_path with 'params' (hierarchical_block is not used). Each thread keeps its own search buffers.
+        std::vector<Eigen::Vector2f> compute_path(const QPointF &source, const QPointF &target, const PlannerParams &params) const;
+        std::vector<Eigen::Vector2f> compute_path(const QPointF &source, const QPointF &target) const;
+        std::size_t shared_blocks() const { return shared; }   // taken from the previous version
+
+    private:
+        friend class Grid;
+        using Block = std::vector<float>;                  // cost per tile, -1 if occupied
+        inline float tile_cost(long int kx, long int kz) const
+        {
+            if (kx < 0 or kx >= nx or kz < 0 or kz >= nz)
+                return -1.f;
+            return (*blocks[(kx / BLOCK) * bnz + kz / BLOCK])[(kx % BLOCK) * BLOCK + kz % BLOCK];
+        };
+        std::int32_t closest_free(long int kx, long int kz) const;     // tile, -1 if none
+        QRectF dim;
+        int tile = 0;
+        long int nx = 0, nz = 0, bnx = 0, bnz = 0;
+        std::uint64_t version_ = 0;
+        std::size_t shared = 0;
+        std::vector<std::shared_ptr<const Block>> blocks;
+    };
+    std::shared_ptr<const Snapshot> publish();
+    std::shared_ptr<const Snapshot> snapshot() const
+    { return published.load(std::memory_order_acquire); };
+
 
     inline std::tuple<bool, T &> getCell(long int x, long int z);
     inline std::tuple<bool, T &> getCell(const Key &k);
     inline std::tuple<bool, T &> getCell(const Eigen::Vector2f &p);
-//    T at(const Key &k) const
-//    { return fmap.at(k); };
-//    T &at(const Key &k)
-//    { return fmap.at(k); };
+    T &at(const Key &k);   // throws std::out_of_range if k is not a cell of the grid
+
+    // Calls f(key, cell) for every cell, with any storage. begin()/end() only iterate the Hashed storage.
+    template <typename F>
+    void for_each_cell(F &&f)
+    {
+        if (storage == Storage::Dense)
+        {
+            for (long int i = 0; i < (long int) dense.cells.size(); ++i)
+                f(index_to_key(i), dense.cells[i]);
+        }
+        else
+            for (auto &[k, v] : fmap)
+                f(k, v);
+    }
+    template <typename F>
+    void for_each_cell(F &&f) const
+    {
+        if (storage == Storage::Dense)
+        {
+            for (long int i = 0; i < (long int) dense.cells.size(); ++i)
+                f(index_to_key(i), dense.cells[i]);
+        }
+        else
+            for (const auto &[k, v] : fmap)
+                f(k, v);
+    }
+    Storage get_storage() const
+    { return storage; };
+
     typename FMap::iterator begin()
     { return fmap.begin(); };
     typename FMap::iterator end()
@@ -141,12 +280,34 @@ public:
     typename FMap::const_iterator end() const
     { return fmap.begin(); };
     size_t size() const
-    { return fmap.size(); };
+    { return storage == Storage::Dense ? dense.cells.size() : fmap.size(); };
     void insert(const Key &key, const T &value);
     void saveToFile(const std::string &fich);
     void readFromFile(const std::string &fich);
     std::string saveToString() const;
     void readFromString(const std::string &cadena);
+    // Binary format: a BinaryHeader followed by one BinaryCell per tile in ix * nz + iz order, with a CRC32 of the
+    // cells. It can only be read into a grid initialized with the same dimensions and tile size. Files of version 1,
+    // with the log-odds in nats or the former hit/miss counters, are converted on load.
+    bool saveToBinaryFile(const std::string &fich) const;
+    bool readFromBinaryFile(const std::string &fich);    // the file is mmap'ed and bulk-copied into the cells
+    std::string saveToBinaryString() const;
+    bool readFromBinaryString(const std::string &buffer);
+
+    // Map distribution: versioned deltas of the grid, so that sending it to other components costs in proportion to
+    // what changed. The sender calls commit_changes() after its updates, which compares the cells with the previous
+    // commit and stamps the changed ones with a new version. encode_changes(since) returns the cells changed after
+    // version 'since' as run-length encoded patches of tiles, or the whole grid if 'since' is 0 (a new subscriber) or
+    // older than the tracking. The receiver, initialized with the same dimensions and tile size, patches its cells
+    // with apply_changes() and keeps the version it reached, to be sent back as the next 'since'. A rolling window
+    // sender is followed by shifting the receiver's window.
+    std::uint64_t commit_changes();
+    std::uint64_t committed_version() const
+    { return sync.version; };
+    std::string encode_changes(std::uint64_t since) const;
+    bool apply_changes(const std::string &delta);     // false if corrupted, of another geometry or not from received_version()
+    std::uint64_t received_version() const
+    { return sync.received; };
     Key pointToKey(long int x, long int z) const;
     Key pointToKey(const QPointF &p) const;
     Key pointToKey(const Eigen::Vector2f &p) const;
@@ -172,12 +333,58 @@ public:
     void log_update(const Eigen::Vector2f &p, float prob);
     double log_odds(double prob);
     double retrieve_p(double l);
+    // Hit and miss increments, clamping and thresholds used by update_map, add_hit, add_miss and log_update
+    void set_occupancy_model(const OccupancyModel::Params &params);
+    const OccupancyModel &get_occupancy_model() const
+    { return occupancy_model; };
+    float occupancy_probability(const Eigen::Vector2f &p);      // -1 out of the grid
     float percentage_changed();
     int count_total() const;
     int count_total_visited() const;
     void markAreaInGridAs(const QPolygonF &poly, bool free);   // if true area becomes free
     void modifyCostInGrid(const QPolygonF &poly, float cost);
     void update_costs(bool wide=true);
+
+    // Cost inflation around the occupied cells. 'cost' gives the cost of a free cell at a distance (in tiles) from
+    // the closest occupied cell, cells farther than 'radius' get cost 1 and occupied cells 100.
+    struct Inflation
+    {
+        std::function<float(float)> cost;
+        float radius = 3.f;
+        static Inflation steps();   // 50, 25 and 15 rings around the obstacles, as the former update_costs
+        static Inflation linear(float max_cost, float radius);
+        static Inflation exponential(float max_cost, float decay, float radius);
+    };
+    void set_inflation(const Inflation &inflation_);
+    // Updates the costs from the cells whose occupancy changed since the last call (all of them the first time)
+    void update_inflation();
+
+    // Layered costs (costmap_layers.h): the cost of a cell is composed from the obstacle and inflation layers, written
+    // by update_inflation from the distance field, and the static, semantic and affordance layers. In this mode
+    // markAreaInGridAs(poly, false) and modifyCostInGrid rasterize their polygon once into the Static and Affordance
+    // layers, where it stays until clear_layer_areas. The polygons are kept and rasterized again when the geometry
+    // changes (shift_window). Lethal cells (cost 100) are not crossed by the planner even if they are free. Edited
+    // layers are composed into the cells, only over their dirty bounds, by update_inflation and update_costs.
+    // The GPU backend is switched off, the costs are composed on the host.
+    void set_layered_costs(bool enable);
+    bool layered_costs() const
+    { return layered; };
+    LayeredCostmap &cost_layers()        // tile kx * nz + kz, as the distance field
+    { return layers; };
+    void set_layer_area(LayeredCostmap::Layer layer, const QPolygonF &poly, float cost);  // replaces the same polygon
+    void clear_layer_areas(LayeredCostmap::Layer layer);
+
+    // Distance field: the brushfire keeps, for every cell within 'range' of an obstacle (all of them by default), the
+    // distance to its closest obstacle, so these queries are a lookup. The field follows the occupancy changes on each
+    // query; the costs are only updated by update_inflation().
+    void set_distance_field_range(float range);      // mm, 0 for no limit
+    void update_distance_field();
+    float distance_to_obstacle(const Eigen::Vector2f &p);   // mm between tile centers, infinity if out of range
+    std::vector<float> distance_to_obstacle(const std::vector<Eigen::Vector2f> &points);
+    // Likelihood field for laser localization (likelihood_field.h) from the distance field. The first call fills it,
+    // the next ones only rewrite the cells whose distance changed since the previous call; a new geometry or a rebuilt
+    // distance field fills it again. The changes are recorded for a single field.
+    void update_likelihood_field(LikelihoodField &field);
     std::optional<QPointF> closest_obstacle(const QPointF &p);
     std::optional<QPointF> closest_free(const QPointF &p);
     std::optional<QPointF> closest_free_4x4(const QPointF &p);
@@ -187,12 +394,246 @@ public:
     std::vector<std::pair<Key, T>> neighboors_16(const Key &k, bool all = false);
     void draw();
 
+    // Rolling window (Dense storage): the grid is moved by whole tiles keeping the cells that remain inside. Only the
+    // exposed border is cleared, as the cells are addressed through a ring offset instead of being copied.
+    // The inflation is recomputed from scratch in the next update_inflation().
+    bool shift_window(long int dx, long int dz);     // in tiles
+    bool center_window_at(const QPointF &p);         // moves the window to the tile closest to p being its center
+
 private:
     FMap fmap;
+
+    // Dense storage: cell (ix, iz) is at ((ix + ox) % nx) * nz + (iz + oz) % nz, which is also its id. The offsets
+    // (ox, oz) are the ring origin moved by shift_window, 0 until then.
+    // nx and nz (number of tiles along x and z) are kept for both storages.
+    struct Dense
+    {
+        long int nx = 0, nz = 0;
+        long int ox = 0, oz = 0;
+        std::vector<T> cells;
+        inline long int physical(long int kx, long int kz) const
+        { return ((kx + ox) % nx) * nz + (kz + oz) % nz; };
+        inline long int logical(long int i) const       // inverse of physical, as a tile index kx * nz + kz
+        { return ((i / nz - ox + nx) % nx) * nz + (i % nz - oz + nz) % nz; };
+    };
+    Storage storage = Storage::Hashed;
+    Dense dense;
+    inline long int cell_index(long int x, long int z) const;    // -1 if out of the grid
+    inline Key index_to_key(long int i) const
+    { i = dense.logical(i); return Key((long int)(dim.left() + (i / dense.nz) * TILE_SIZE), (long int)(dim.top() + (i % dense.nz) * TILE_SIZE)); };
+    inline T *find_cell(long int x, long int z);
+    inline T *find_tile(long int kx, long int kz);   // by tile coordinates, the ones computed by pointToKey
+    inline const T *find_tile(long int kx, long int kz) const;
+
+    // binary map file
+    struct BinaryHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t cell_size;              // sizeof(BinaryCell)
+        std::int64_t nx, nz;
+        float tile_size, left, top, width, height;
+        std::uint32_t crc;                    // CRC32 of the cells
+        std::uint32_t reserved;
+    };
+    struct BinaryCell                         // version 2: the occupancy as kept in the cells
+    {
+        float cost;
+        std::int16_t occupancy;               // fixed-point log-odds, see OccupancyModel
+        std::uint8_t free, visited;
+    };
+    struct BinaryCellV1                       // version 1: log-odds in nats, or the former hit/miss counters
+    {
+        double log_odds;
+        float cost, hits, misses;
+        std::uint8_t free, visited, pad[2];
+    };
+    static_assert(sizeof(BinaryHeader) == 64 and sizeof(BinaryCell) == 8 and sizeof(BinaryCellV1) == 24,
+                  "binary map layout changed");
+    static constexpr char binary_magic[8] = {'R', 'C', 'G', 'R', 'I', 'D', '\0', '\0'};
+    static constexpr std::uint32_t binary_version = 2;      // version 1 is still read
+    bool read_binary(const char *data, std::size_t size);
+
+    // map deltas: header, then 'runs' times a DeltaRun followed by DeltaCells whose 'repeat' add up to its length.
+    // Tiles are numbered ix * nz + iz in the window of the header.
+    struct DeltaHeader
+    {
+        char magic[8];
+        std::uint32_t format;
+        std::uint32_t full;                   // 1 if every tile is in the delta
+        std::uint64_t base, version;          // changes after 'base' up to 'version'
+        std::int64_t nx, nz;
+        float tile_size, left, top;
+        std::uint32_t runs;
+        std::uint32_t crc;                    // CRC32 of the runs
+        std::uint32_t reserved;
+    };
+    struct DeltaRun
+    {
+        std::uint32_t start, length;          // consecutive tiles
+    };
+    struct DeltaCell
+    {
+        float cost;
+        std::int16_t occupancy;
+        std::uint8_t flags;                   // free, visited
+        std::uint8_t repeat;                  // number of consecutive tiles with this value (0 in the committed copy)
+        bool same(const DeltaCell &o) const
+        { return cost == o.cost and occupancy == o.occupancy and flags == o.flags; };
+    };
+    static_assert(sizeof(DeltaHeader) == 72 and sizeof(DeltaRun) == 8 and sizeof(DeltaCell) == 8, "delta layout changed");
+    static constexpr char delta_magic[8] = {'R', 'C', 'G', 'D', 'E', 'L', 'T', 'A'};
+    static constexpr std::uint32_t delta_format = 1;
+    // committed copy of the cells (by id) with the version of their last change, and the window they were committed in
+    struct Sync
+    {
+        std::uint64_t version = 0, first = 1;           // deltas from versions before 'first' are sent whole
+        std::uint64_t received = 0;                     // receiver: last version applied
+        std::vector<DeltaCell> committed;
+        std::vector<std::uint64_t> changed;
+        long int nx = 0, nz = 0, ox = 0, oz = 0;
+        float left = 0, top = 0;
+        static constexpr std::uint64_t reset = std::numeric_limits<std::uint64_t>::max();   // changed by shift_window
+    };
+    Sync sync;
+
+    // update_map: per scan marks (indexed by cell id) so that a cell gets at most one hit and one miss per scan
+    std::vector<std::atomic<std::uint32_t>> hit_stamp, miss_stamp;
+    std::uint32_t scan_stamp = 0;
+    std::unique_ptr<ThreadPool> update_pool;
+    template <typename F>
+    void trace_ray(const Eigen::Vector2f &from, const Eigen::Vector2f &to, F &&visit);
+    void apply_miss(T &v);
+    void apply_hit(T &v);
+    OccupancyModel occupancy_model;
+
+    // GPU backend: cells edited on the host since the last update of the device, and whether the device has
+    // changes not copied to the host yet
+    std::unique_ptr<GridDevice> device;
+    std::vector<std::uint32_t> device_edits;
+    bool device_upload = false;               // every cell, after initialize, read_binary or shift_window
+    bool device_ahead = false;
+    void update_device();
+    GridDevice::Geometry device_geometry() const;
+
+    // all the changes of 'free' go through set_occupancy, that records the cells that flipped for update_inflation
+    std::vector<std::uint32_t> flipped_cells;
+    inline void set_occupancy(T &v, bool free)
+    {
+        if (v.free != free)
+        {
+            flipped_cells.push_back(v.id);
+            coarse.dirty = true;
+            if (device)
+                device_edits.push_back(v.id);
+        }
+        v.free = free;
+    };
+
+    // Incremental brushfire (dynamic Euclidean distance transform, Lau et al. 2010) over tile indices ix * nz + iz.
+    // Every cell keeps the squared distance to its closest obstacle and that obstacle, and only the cells around the
+    // obstacles that appear or disappear are updated.
+    struct Brushfire
+    {
+        static constexpr std::int32_t none = -1;
+        static constexpr std::int32_t far = std::numeric_limits<std::int32_t>::max();
+        std::vector<std::int32_t> dist2;       // squared distance in tiles to the closest obstacle (far if none)
+        std::vector<std::int32_t> source;      // tile of that obstacle (none if none)
+        std::vector<std::uint8_t> raise, dirty;
+        std::vector<std::int32_t> id_to_tile;
+        std::vector<std::int32_t> changed;     // tiles whose distance changed in the last update
+        using Entry = std::pair<std::int32_t, std::int32_t>;   // (distance, tile)
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<>> open;
+        std::int32_t max_dist2 = 0;
+        bool rebuilt = false;                  // 'changed' holds every cell
+    };
+    Brushfire brushfire;
+    struct FieldChanges                        // tiles whose distance changed since the last update_likelihood_field
+    {
+        bool enabled = false;
+        std::uint64_t generation = 0;          // brushfire rebuilds
+        std::vector<std::uint8_t> marked;
+        std::vector<std::int32_t> tiles;
+    };
+    FieldChanges field_changes;
+
+    // Layered costs
+    struct LayerArea
+    {
+        LayeredCostmap::Layer layer;
+        QPolygonF poly;
+        float cost;
+    };
+    LayeredCostmap layers;
+    std::vector<LayerArea> layer_areas;
+    bool layered = false;
+    bool layers_stale = false;                 // the obstacle and inflation layers are rewritten from every cell
+    bool sync_layers();                        // resets the layers if the geometry changed
+    void compose_layers();
+    inline bool blocked(const T &c) const
+    { return not c.free or (layered and c.cost >= LayeredCostmap::lethal); };
+    Inflation inflation = Inflation::steps();
+    float distance_range = 0.f;
+    void brushfire_rebuild();
+    void brushfire_set_obstacle(std::int32_t tile);
+    void brushfire_remove_obstacle(std::int32_t tile);
+    void brushfire_process();
+    inline void brushfire_touch(std::int32_t tile);
+    T *tile_cell(std::int32_t tile)
+    { return find_tile(tile / dense.nz, tile % dense.nz); };
+
+    // A* over tile indices. The buffers are kept between calls and validated with a generation stamp, so a search
+    // only touches the cells it reaches. The open list is a binary heap with decrease-key (heap_pos).
+    struct Planner
+    {
+        PlannerParams params;
+        std::uint32_t generation = 0;
+        std::vector<std::uint32_t> stamp, interior_stamp;
+        std::vector<float> g, f;
+        std::vector<std::int32_t> parent, heap_pos;      // heap_pos -1 once closed
+        std::vector<std::uint8_t> interior;
+        std::vector<std::int32_t> heap;
+        void push(std::int32_t tile);
+        void decrease(std::int32_t tile);
+        std::int32_t pop();
+    };
+    Planner planner, coarse_planner;
+    std::vector<std::int32_t> plan(std::int32_t source, std::int32_t target);
+    // The search only sees the grid through 'cost', so it also runs on the blocks of a Snapshot
+    template <typename Cost>      // Cost(x, z) -> cost of entering tile (x, z), < 0 if it can not be entered or is out of the grid
+    static std::vector<std::int32_t> search(Planner &pl, const PlannerParams &params, long int nx, long int nz, std::int32_t source,
+                                            std::int32_t target, Cost &&cost, bool jps);
+
+    // hierarchical planning: max-pooled grid of blocks, rebuilt when the occupancy or the costs change
+    struct Coarse
+    {
+        long int block = 0, nx = 0, nz = 0;
+        std::vector<float> cost;                // -1 if blocked
+        std::vector<std::uint8_t> corridor;
+        bool dirty = true;
+    };
+    Coarse coarse;
+    void update_coarse_grid();
+    template <typename Cost>
+    static bool is_interior(Planner &pl, long int nz, long int x, long int z, Cost &cost);
+    template <typename Cost>
+    static std::int32_t jump(Planner &pl, long int nz, long int x, long int z, int dx, int dz, std::int32_t target, float &len, Cost &cost);
+
+    std::atomic<std::shared_ptr<const Snapshot>> published;
     QGraphicsScene *scene;
+    QGraphicsRectItem *bounding_box = nullptr;
+    QPointF grid_center = QPointF(0, 0);   // pose of the grid in the scene, as given to initialize
+    float grid_angle = 0.f;
+    inline QPointF tile_scene_pos(long int kx, long int kz) const;
     std::vector<QGraphicsRectItem *> scene_grid_points;
     double updated=0.0, flipped=0.0;
 
+    class ImageItem;    // Render::Image item, defined in grid.cpp
+    Render render = Render::Items;
+    ImageItem *image_item = nullptr;
+    void paint_tile(T &v, const QBrush &brush);
+    const QBrush &cost_brush(float cost) const;     // color of the inflation levels
+
 
     std::list<QPointF> orderPath(const std::vector<std::pair<std::uint32_t, Key>> &previous, const Key &source, const Key &target);
     inline double heuristicL2(const Key &a, const Key &b) const;
@@ -0,0 +1,532 @@
+/*
+ * GridDevice: CUDA kernels of the GPU backend of Grid, or their host reference when not compiled by nvcc.
+ * The kernels are function objects applied to every index of a range, so that both builds share their code.
+ */
+#include <grid2d/grid_device.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef __CUDACC__
+#include <cuda_runtime.h>
+#define GD_HD __host__ __device__
+#else
+#define GD_HD
+#endif
+
+namespace
+{
+using counter_t = unsigned long long;
+enum Counter { TOUCHED, CHANGED, UPDATED, FLIPPED, NUM_COUNTERS };
+constexpr std::uint32_t HIT = 1, MISS = 2;
+constexpr std::int32_t NO_OBSTACLE = -1;
+
+#ifdef __CUDACC__
+void check(cudaError_t e, const char *what)
+{
+    if (e != cudaSuccess)
+        throw std::runtime_error(std::string("GridDevice: ") + what + ": " + cudaGetErrorString(e));
+}
+template <typename F>
+__global__ void for_each_kernel(std::size_t n, F f)
+{
+    const std::size_t i = blockIdx.x * (std::size_t)blockDim.x + threadIdx.x;
+    if (i < n)
+        f(i);
+}
+template <typename F>
+void launch(std::size_t n, const F &f)
+{
+    constexpr unsigned threads = 256;
+    if (n == 0)
+        return;
+    for_each_kernel<<<unsigned((n + threads - 1) / threads), threads>>>(n, f);
+    check(cudaGetLastError(), "kernel launch");
+}
+#else
+template <typename F>
+void launch(std::size_t n, const F &f)
+{
+    for (std::size_t i = 0; i < n; i++)
+        f(i);
+}
+#endif
+
+GD_HD inline std::uint32_t atomic_or(std::uint32_t *p, std::uint32_t v)
+{
+#ifdef __CUDA_ARCH__
+    return atomicOr(p, v);
+#else
+    return std::atomic_ref<std::uint32_t>(*p).fetch_or(v);
+#endif
+}
+GD_HD inline std::uint32_t atomic_exchange(std::uint32_t *p, std::uint32_t v)
+{
+#ifdef __CUDA_ARCH__
+    return atomicExch(p, v);
+#else
+    return std::atomic_ref<std::uint32_t>(*p).exchange(v);
+#endif
+}
+GD_HD inline counter_t atomic_add(counter_t *p, counter_t v)
+{
+#ifdef __CUDA_ARCH__
+    return atomicAdd(p, v);
+#else
+    return std::atomic_ref<counter_t>(*p).fetch_add(v);
+#endif
+}
+
+// Device memory, or host memory in the reference build
+template <typename T>
+class Buffer
+{
+public:
+    Buffer() = default;
+    ~Buffer() { release(); }
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    void resize(std::size_t n)
+    {
+        if (n == count)
+            return;
+        release();
+        if (n > 0)
+        {
+#ifdef __CUDACC__
+            check(cudaMalloc(&ptr, n * sizeof(T)), "cudaMalloc");
+#else
+            ptr = new T[n];
+#endif
+        }
+        count = n;
+    }
+    void reserve(std::size_t n) { if (n > count) resize(n); }
+    void upload(const T *host, std::size_t n)
+    {
+        if (n == 0) return;
+#ifdef __CUDACC__
+        check(cudaMemcpy(ptr, host, n * sizeof(T), cudaMemcpyHostToDevice), "cudaMemcpy");
+#else
+        std::memcpy(ptr, host, n * sizeof(T));
+#endif
+    }
+    void download(T *host, std::size_t n, std::size_t offset = 0) const
+    {
+        if (n == 0) return;
+#ifdef __CUDACC__
+        check(cudaMemcpy(host, ptr + offset, n * sizeof(T), cudaMemcpyDeviceToHost), "cudaMemcpy");
+#else
+        std::memcpy(host, ptr + offset, n * sizeof(T));
+#endif
+    }
+    void zero(std::size_t offset = 0, std::size_t n = std::size_t(-1))
+    {
+        n = std::min(n, count - offset);
+        if (n == 0) return;
+#ifdef __CUDACC__
+        check(cudaMemset(ptr + offset, 0, n * sizeof(T)), "cudaMemset");
+#else
+        std::memset(ptr + offset, 0, n * sizeof(T));
+#endif
+    }
+    T *data() const { return ptr; }
+    std::size_t size() const { return count; }
+
+private:
+    void release()
+    {
+        if (ptr == nullptr) return;
+#ifdef __CUDACC__
+        cudaFree(ptr);
+#else
+        delete[] ptr;
+#endif
+        ptr = nullptr;
+        count = 0;
+    }
+    T *ptr = nullptr;
+    std::size_t count = 0;
+};
+
+using Geometry = GridDevice::Geometry;
+GD_HD inline long int physical(const Geometry &g, long int kx, long int kz)
+{
+    return ((kx + g.ox) % g.nx) * g.nz + (kz + g.oz) % g.nz;
+}
+
+// Lists a cell once among the ones to download
+struct Changed
+{
+    std::uint32_t *flag, *list;
+    counter_t *counters;
+    GD_HD inline void operator()(std::uint32_t id) const
+    {
+        if (atomic_exchange(flag + id, 1) == 0)
+            list[atomic_add(counters + CHANGED, 1)] = id;
+    }
+};
+// Marks a tile with a hit or a miss, the first mark lists it to be updated
+struct Mark
+{
+    std::uint32_t *marks, *touched;
+    counter_t *counters;
+    GD_HD inline void operator()(long int id, std::uint32_t mark) const
+    {
+        if (atomic_or(marks + id, mark) == 0)
+            touched[atomic_add(counters + TOUCHED, 1)] = (std::uint32_t)id;
+    }
+};
+
+struct MarkHits
+{
+    Geometry g;
+    const float *xz;
+    float rx, rz, max_range;
+    Mark mark;
+    GD_HD void operator()(std::size_t i) const
+    {
+        const float x = xz[2 * i], z = xz[2 * i + 1];
+        if (sqrtf((x - rx) * (x - rx) + (z - rz) * (z - rz)) > max_range)
+            return;
+        const long int kx = rint((double(x) - g.left) / g.tile), kz = rint((double(z) - g.top) / g.tile);
+        if (kx < 0 or kx >= g.nx or kz < 0 or kz >= g.nz)
+            return;
+        mark(physical(g, kx, kz), HIT);
+    }
+};
+
+// Same traversal as Grid::trace_ray, the tiles hit in this scan are skipped
+struct TraceMisses
+{
+    Geometry g;
+    const float *xz;
+    float rx, rz, max_range;
+    Mark mark;
+    GD_HD void operator()(std::size_t i) const
+    {
+        const float x = xz[2 * i], z = xz[2 * i + 1];
+        const bool hit = sqrtf((x - rx) * (x - rx) + (z - rz) * (z - rz)) <= max_range;
+        const float gx0 = (double(rx) - g.left) / g.tile + 0.5f, gz0 = (double(rz) - g.top) / g.tile + 0.5f;
+        const float gx1 = (double(x) - g.left) / g.tile + 0.5f, gz1 = (double(z) - g.top) / g.tile + 0.5f;
+        long int cx = floorf(gx0), cz = floorf(gz0);
+        const long int ex = floorf(gx1), ez = floorf(gz1);
+        const float dx = gx1 - gx0, dz = gz1 - gz0;
+        const int step_x = dx > 0 ? 1 : -1, step_z = dz > 0 ? 1 : -1;
+        const float delta_x = dx != 0 ? 1.f / fabsf(dx) : HUGE_VALF, delta_z = dz != 0 ? 1.f / fabsf(dz) : HUGE_VALF;
+        float max_x = dx != 0 ? (dx > 0 ? cx + 1 - gx0 : gx0 - cx) * delta_x : HUGE_VALF;
+        float max_z = dz != 0 ? (dz > 0 ? cz + 1 - gz0 : gz0 - cz) * delta_z : HUGE_VALF;
+        for (long int n = (ex > cx ? ex - cx : cx - ex) + (ez > cz ? ez - cz : cz - ez); n > 0; --n)
+        {
+            visit(cx, cz);
+            if (max_x < max_z)
+            { cx += step_x; max_x += delta_x; }
+            else
+            { cz += step_z; max_z += delta_z; }
+        }
+        if (not hit)
+            visit(ex, ez);
+    }
+    GD_HD inline void visit(long int kx, long int kz) const
+    {
+        if (kx < 0 or kx >= g.nx or kz < 0 or kz >= g.nz)
+            return;
+        const long int id = physical(g, kx, kz);
+        if (not (mark.marks[id] & HIT))
+            mark(id, MISS);
+    }
+};
+
+// One hit or one miss per marked tile, as OccupancyModel::apply
+struct ApplyMarks
+{
+    std::uint32_t *marks;
+    const std::uint32_t *touched;
+    std::int16_t *occupancy;
+    std::uint8_t *free;
+    std::int16_t hit, miss, min, max, free_below, occupied_from;
+    Changed changed;
+    GD_HD void operator()(std::size_t i) const
+    {
+        if (i >= changed.counters[TOUCHED])
+            return;
+        const std::uint32_t id = touched[i];
+        const int delta = marks[id] & HIT ? hit : miss;
+        marks[id] = 0;
+        const int sum = occupancy[id] + delta;
+        const std::int16_t v = sum < min ? min : (sum > max ? max : sum);
+        occupancy[id] = v;
+        const bool was_free = free[id];
+        if (was_free ? v >= occupied_from : v < free_below)
+        {
+            free[id] = not was_free;
+            atomic_add(changed.counters + FLIPPED, 1);
+        }
+        atomic_add(changed.counters + UPDATED, 1);
+        changed(id);
+    }
+};
+
+// Distance in tiles to the closest occupied tile of the same column (big if none), logical order kx * nz + kz
+struct ColumnDistance
+{
+    Geometry g;
+    const std::uint8_t *free;
+    std::int32_t *column;
+    GD_HD void operator()(std::size_t kx) const
+    {
+        const std::int32_t far = 1 << 30;
+        std::int32_t d = far;
+        for (long int kz = 0; kz < g.nz; kz++)
+        {
+            d = not free[physical(g, kx, kz)] ? 0 : (d == far ? far : d + 1);
+            column[kx * g.nz + kz] = d;
+        }
+        d = far;
+        for (long int kz = g.nz - 1; kz >= 0; kz--)
+        {
+            d = column[kx * g.nz + kz] == 0 ? 0 : (d == far ? far : d + 1);
+            if (d < column[kx * g.nz + kz])
+                column[kx * g.nz + kz] = d;
+        }
+    }
+};
+
+// Squared distance along the rows, by the lower envelope of the parabolas of the column distances (Felzenszwalb and
+// Huttenlocher 2004). 'sites' and 'bounds' are the envelope scratch of the row, nx and nx + 1 entries.
+struct RowDistance
+{
+    Geometry g;
+    const std::int32_t *column;
+    std::int32_t *dist2, *sites;
+    double *bounds;
+    GD_HD void operator()(std::size_t kz) const
+    {
+        const std::int32_t far = 1 << 30;
+        std::int32_t *v = sites + kz * g.nx;
+        double *z = bounds + kz * (g.nx + 1);
+        auto f = [&](long int q) { const double c = column[q * g.nz + kz]; return c * c; };
+        long int k = -1;
+        for (long int q = 0; q < g.nx; q++)
+        {
+            if (column[q * g.nz + kz] == far)
+                continue;
+            double s = 0;
+            while (k >= 0)
+            {
+                s = ((f(q) + double(q) * q) - (f(v[k]) + double(v[k]) * v[k])) / (2. * q - 2. * v[k]);
+                if (s > z[k])
+                    break;
+                k--;
+            }
+            k++;
+            v[k] = q;
+            z[k] = k == 0 ? -HUGE_VAL : s;
+            z[k + 1] = HUGE_VAL;
+        }
+        for (long int q = 0, j = 0; q < g.nx; q++)
+        {
+            if (k < 0)
+            {
+                dist2[q * g.nz + kz] = NO_OBSTACLE;
+                continue;
+            }
+            while (z[j + 1] < q)
+                j++;
+            dist2[q * g.nz + kz] = (std::int32_t)((q - v[j]) * (q - v[j]) + f(v[j]));
+        }
+    }
+};
+
+struct InflateCosts
+{
+    Geometry g;
+    const std::int32_t *dist2;
+    const std::uint8_t *free;
+    float *cost;
+    const float *table;
+    std::int64_t table_size;
+    Changed changed;
+    GD_HD void operator()(std::size_t tile) const
+    {
+        const long int id = physical(g, tile / g.nz, tile % g.nz);
+        const std::int32_t d2 = dist2[tile];
+        float c = 1.f;
+        if (not free[id])
+            c = 100.f;
+        else if (d2 >= 0 and d2 < table_size)
+            c = table[d2];
+        if (c != cost[id])
+        {
+            cost[id] = c;
+            changed((std::uint32_t)id);
+        }
+    }
+};
+
+struct Scatter
+{
+    const std::uint32_t *ids;
+    const std::int16_t *in_occupancy;
+    const std::uint8_t *in_free;
+    std::int16_t *occupancy;
+    std::uint8_t *free;
+    GD_HD void operator()(std::size_t i) const
+    {
+        occupancy[ids[i]] = in_occupancy[i];
+        free[ids[i]] = in_free[i];
+    }
+};
+
+struct Gather
+{
+    const std::uint32_t *ids;
+    std::uint32_t *flag;
+    const std::int16_t *occupancy;
+    const std::uint8_t *free;
+    const float *cost;
+    std::int16_t *out_occupancy;
+    std::uint8_t *out_free;
+    float *out_cost;
+    GD_HD void operator()(std::size_t i) const
+    {
+        const auto id = ids[i];
+        out_occupancy[i] = occupancy[id];
+        out_free[i] = free[id];
+        out_cost[i] = cost[id];
+        flag[id] = 0;
+    }
+};
+}
+
+struct GridDevice::Buffers
+{
+    // per cell, physical order
+    Buffer<std::int16_t> occupancy;
+    Buffer<std::uint8_t> free;
+    Buffer<float> cost;
+    Buffer<std::uint32_t> marks, changed_flag;
+    // lists of cell ids, the number of entries is in 'counters'
+    Buffer<std::uint32_t> touched, changed;
+    Buffer<counter_t> counters;
+    // per tile, logical order
+    Buffer<std::int32_t> column, dist2;
+    // scratch
+    Buffer<std::int32_t> sites;
+    Buffer<double> bounds;
+    Buffer<float> points, table;
+    Buffer<std::uint32_t> ids;
+    Buffer<std::int16_t> io_occupancy;
+    Buffer<std::uint8_t> io_free;
+    Buffer<float> io_cost;
+
+    Changed changes()
+    { return Changed{changed_flag.data(), changed.data(), counters.data()}; }
+};
+
+bool GridDevice::gpu()
+{
+#ifdef __CUDACC__
+    int n = 0;
+    return cudaGetDeviceCount(&n) == cudaSuccess and n > 0;
+#else
+    return false;
+#endif
+}
+GridDevice::GridDevice() : buffers(std::make_unique<Buffers>())
+{
+#ifdef __CUDACC__
+    if (not gpu())
+        throw std::runtime_error("GridDevice: no CUDA device");
+#endif
+    buffers->counters.resize(NUM_COUNTERS);
+    buffers->counters.zero();
+}
+GridDevice::~GridDevice() = default;
+
+void GridDevice::upload(const Geometry &geometry, const std::int16_t *occupancy, const std::uint8_t *free, const float *cost)
+{
+    auto &b = *buffers;
+    geom = geometry;
+    const std::size_t n = geom.nx * geom.nz;
+    b.occupancy.resize(n); b.free.resize(n); b.cost.resize(n);
+    b.marks.resize(n); b.changed_flag.resize(n); b.touched.resize(n); b.changed.resize(n);
+    b.column.resize(n); b.dist2.resize(n);
+    b.sites.resize(geom.nx * geom.nz); b.bounds.resize((geom.nx + 1) * geom.nz);
+    b.occupancy.upload(occupancy, n);
+    b.free.upload(free, n);
+    b.cost.upload(cost, n);
+    b.marks.zero();
+    b.changed_flag.zero();
+    b.counters.zero();
+}
+void GridDevice::write(const std::vector<std::uint32_t> &ids, const std::vector<std::int16_t> &occupancy, const std::vector<std::uint8_t> &free)
+{
+    auto &b = *buffers;
+    b.ids.reserve(ids.size()); b.io_occupancy.reserve(ids.size()); b.io_free.reserve(ids.size());
+    b.ids.upload(ids.data(), ids.size());
+    b.io_occupancy.upload(occupancy.data(), ids.size());
+    b.io_free.upload(free.data(), ids.size());
+    launch(ids.size(), Scatter{b.ids.data(), b.io_occupancy.data(), b.io_free.data(), b.occupancy.data(), b.free.data()});
+}
+void GridDevice::update_map(const float *xz, std::size_t num_points, float robot_x, float robot_z, float max_laser_range,
+                            const OccupancyModel &model)
+{
+    auto &b = *buffers;
+    if (b.occupancy.size() == 0)
+        return;
+    b.points.reserve(2 * num_points);
+    b.points.upload(xz, 2 * num_points);
+    const Mark mark{b.marks.data(), b.touched.data(), b.counters.data()};
+    launch(num_points, MarkHits{geom, b.points.data(), robot_x, robot_z, max_laser_range, mark});
+    launch(num_points, TraceMisses{geom, b.points.data(), robot_x, robot_z, max_laser_range, mark});
+    // one thread per cell at most, the ones past the number of marked tiles return at once
+    launch(b.occupancy.size(), ApplyMarks{b.marks.data(), b.touched.data(), b.occupancy.data(), b.free.data(), model.hit,
+                                          model.miss, model.min, model.max, model.free_below, model.occupied_from, b.changes()});
+    b.counters.zero(TOUCHED, 1);
+}
+void GridDevice::update_inflation(const std::vector<float> &cost_of_dist2)
+{
+    auto &b = *buffers;
+    if (b.occupancy.size() == 0)
+        return;
+    b.table.reserve(std::max<std::size_t>(cost_of_dist2.size(), 1));
+    b.table.upload(cost_of_dist2.data(), cost_of_dist2.size());
+    launch(geom.nx, ColumnDistance{geom, b.free.data(), b.column.data()});
+    launch(geom.nz, RowDistance{geom, b.column.data(), b.dist2.data(), b.sites.data(), b.bounds.data()});
+    launch(b.occupancy.size(), InflateCosts{geom, b.dist2.data(), b.free.data(), b.cost.data(), b.table.data(),
+                                            (std::int64_t)cost_of_dist2.size(), b.changes()});
+}
+std::vector<std::int32_t> GridDevice::distance_field() const
+{
+    std::vector<std::int32_t> logical(buffers->dist2.size()), res(logical.size());
+    buffers->dist2.download(logical.data(), logical.size());
+    for (long int kx = 0; kx < geom.nx; kx++)
+        for (long int kz = 0; kz < geom.nz; kz++)
+            res[physical(geom, kx, kz)] = logical[kx * geom.nz + kz];
+    return res;
+}
+GridDevice::Cells GridDevice::download()
+{
+    auto &b = *buffers;
+    counter_t counters[NUM_COUNTERS];
+    b.counters.download(counters, NUM_COUNTERS);
+    Cells cells;
+    cells.updated = counters[UPDATED];
+    cells.flipped = counters[FLIPPED];
+    const std::size_t n = counters[CHANGED];
+    b.io_occupancy.reserve(n); b.io_free.reserve(n); b.io_cost.reserve(n);
+    launch(n, Gather{b.changed.data(), b.changed_flag.data(), b.occupancy.data(), b.free.data(), b.cost.data(),
+                     b.io_occupancy.data(), b.io_free.data(), b.io_cost.data()});
+    cells.id.resize(n); cells.occupancy.resize(n); cells.free.resize(n); cells.cost.resize(n);
+    b.changed.download(cells.id.data(), n);
+    b.io_occupancy.download(cells.occupancy.data(), n);
+    b.io_free.download(cells.free.data(), n);
+    b.io_cost.download(cells.cost.data(), n);
+    b.counters.zero(CHANGED, NUM_COUNTERS - CHANGED);
+    return cells;
+}
@@ -0,0 +1,75 @@
+/*
+ * Device mirror of a Dense Grid, used by the optional GPU backend of Grid (Grid::set_device_backend).
+ *
+ * The device keeps the log-odds, the free flag and the cost of every cell, indexed as the cells of Grid (physical
+ * order, with the ring offsets of the rolling window). update_map casts every beam in its own thread: a first pass
+ * marks the hit tiles, a second one traces the rays and marks the crossed tiles that were not hit, and a third one
+ * applies one hit or one miss to every marked tile, as Grid::update_map does. update_inflation computes the exact
+ * squared Euclidean distance transform of the occupied cells (two separable passes, one thread per column and per
+ * row) and the costs from it. The cells whose occupancy or cost changed are listed on the device, and download()
+ * copies only those to the host.
+ *
+ * grid_device.cpp is CUDA source when compiled by nvcc (set LANGUAGE CUDA on it and link CUDA::cudart). Compiled as
+ * plain C++ the same kernels run as loops on the host and gpu() is false; that build is the reference of the
+ * device code and the fallback where no GPU is present.
+ */
+
+#ifndef GRID_DEVICE_H
+#define GRID_DEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <grid2d/occupancy.h>
+
+class GridDevice
+{
+public:
+    struct Geometry
+    {
+        long int nx = 0, nz = 0;         // tiles along x and z
+        long int ox = 0, oz = 0;         // ring origin of the rolling window
+        double left = 0, top = 0;        // grid coordinates of the center of tile (0, 0)
+        int tile = 100;                  // mm
+    };
+    struct Cells                         // cells changed on the device since the previous download
+    {
+        std::vector<std::uint32_t> id;
+        std::vector<std::int16_t> occupancy;
+        std::vector<std::uint8_t> free;
+        std::vector<float> cost;
+        std::uint64_t updated = 0, flipped = 0;   // hits and misses applied, and changes of 'free', in those updates
+    };
+
+    static bool gpu();                   // compiled by nvcc and a CUDA device is present
+
+    GridDevice();                        // throws std::runtime_error if the device can not be used
+    ~GridDevice();
+    GridDevice(const GridDevice &) = delete;
+    GridDevice &operator=(const GridDevice &) = delete;
+
+    // Sets the geometry and copies every cell (physical order). Reallocates if the number of cells changed.
+    void upload(const Geometry &geometry, const std::int16_t *occupancy, const std::uint8_t *free, const float *cost);
+    // Writes the occupancy and the free flag of some cells, edited on the host. The values are given per id.
+    void write(const std::vector<std::uint32_t> &ids, const std::vector<std::int16_t> &occupancy, const std::vector<std::uint8_t> &free);
+
+    // 'xz' holds the (x, z) of the points one after another, in grid coordinates
+    void update_map(const float *xz, std::size_t num_points, float robot_x, float robot_z, float max_laser_range, const OccupancyModel &model);
+    // Cost of the free cells at a squared distance d2 (in tiles) of the closest occupied cell, cost_of_dist2[d2] for
+    // d2 < size(), 1 beyond. Occupied cells get 100.
+    void update_inflation(const std::vector<float> &cost_of_dist2);
+    // Squared distance (in tiles) of the last update_inflation, per cell in physical order, -1 if no obstacle
+    std::vector<std::int32_t> distance_field() const;
+
+    Cells download();
+
+    const Geometry &geometry() const { return geom; }
+
+private:
+    struct Buffers;
+    std::unique_ptr<Buffers> buffers;
+    Geometry geom;
+};
+
+#endif // GRID_DEVICE_H
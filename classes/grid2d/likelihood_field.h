@@ -0,0 +1,166 @@
+/*
+ * Likelihood field of a range sensor, for localization against a Grid (Thrun et al., Probabilistic Robotics, 6.4).
+ *
+ * The end point of a beam at a distance d of the closest obstacle has log-likelihood log(z_hit * exp(-d² / 2σ²) +
+ * z_rand), so weighting a particle needs no ray casting: the beams are moved to its pose and the values are read
+ * from a dense float array, with bilinear interpolation between tile centers. The array has a border of one tile
+ * that holds the value of max_distance, so the end points out of the grid need no test. The values come from the
+ * distance field of Grid: Grid::update_likelihood_field fills the field the first time and then rewrites only the
+ * cells whose distance changed. The field is read only while it is scored, so the scoring can run in parallel.
+ *
+ *      LikelihoodField field({.sigma = 100.f, .max_distance = 800.f});
+ *      grid.update_likelihood_field(field);                      // after update_map
+ *      // RCParticleFilterSoA<3>, beams (x, z) in the robot frame
+ *      pf.update([&](const auto &s, auto &&likelihood, uint32_t) { field.likelihood(s, beams, likelihood); });
+ *      // RCParticleFilter_Particle::computeWeight
+ *      weight = std::exp(field.score(Eigen::Vector3f(x, z, angle), data.beams));
+ */
+
+#ifndef LIKELIHOOD_FIELD_H
+#define LIKELIHOOD_FIELD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <Eigen/Dense>
+
+class LikelihoodField
+{
+public:
+    struct Params
+    {
+        float sigma = 150.f;            // mm, spread of the end points around the obstacles
+        float max_distance = 1000.f;    // mm, farther end points (and those out of the grid) are scored at this distance
+        float z_hit = 0.9f;             // weights of the gaussian and of the uniform term (unmodeled objects, max ranges)
+        float z_rand = 0.1f;
+        float temperature = 1.f;        // exponent of the likelihood of a scan, under 1 when the beams are correlated
+    };
+    struct Geometry
+    {
+        long int nx = 0, nz = 0;        // tiles along x and z
+        float left = 0, top = 0;        // grid coordinates of the center of tile (0, 0)
+        int tile = 100;                 // mm
+        bool operator==(const Geometry &) const = default;
+    };
+
+    LikelihoodField() : LikelihoodField(Params()) {}
+    explicit LikelihoodField(const Params &params) { set_params(params); }
+
+    // The values are recomputed from the distances kept in the field
+    void set_params(const Params &params_)
+    {
+        params = params_;
+        const float tiles = params.max_distance / geom.tile;
+        table.resize(std::size_t(std::ceil(tiles * tiles)) + 1);
+        for (std::size_t d2 = 0; d2 < table.size(); d2++)
+            table[d2] = log_likelihood(std::sqrt((float)d2) * geom.tile);
+        outside = log_likelihood(params.max_distance);
+        std::fill(values.begin(), values.end(), outside);
+        for (std::size_t i = 0; i < dist2.size(); i++)
+            values[padded((long int)i)] = value(dist2[i]);
+    }
+    const Params &parameters() const { return params; }
+
+    // Filled by Grid::update_likelihood_field: the geometry, then the squared distance (in tiles) of every cell to its
+    // closest obstacle, as tile kx * nz + kz. 'source' identifies the distance field the values come from.
+    void reset(const Geometry &geometry, std::uint64_t source_)
+    {
+        const bool rescale = geometry.tile != geom.tile;
+        geom = geometry;
+        source = source_;
+        dist2.assign(geom.nx * geom.nz, far);
+        values.assign((geom.nx + 2) * (geom.nz + 2), outside);
+        if (rescale)
+            set_params(params);
+    }
+    void set(std::int32_t tile, std::int32_t d2)
+    {
+        dist2[tile] = d2;
+        values[padded(tile)] = value(d2);
+    }
+    void set_all(const std::int32_t *d2)
+    {
+        for (long int t = 0; t < (long int)dist2.size(); t++)
+            set((std::int32_t)t, d2[t]);
+    }
+    const Geometry &geometry() const { return geom; }
+    std::uint64_t source_version() const { return source; }
+    bool empty() const { return dist2.empty(); }
+
+    // Log-likelihood of an end point at (x, z), grid coordinates
+    float sample(float x, float z) const
+    {
+        if (empty())
+            return outside;
+        const float fx = std::clamp((x - geom.left) / geom.tile, -1.f, (float)geom.nx);
+        const float fz = std::clamp((z - geom.top) / geom.tile, -1.f, (float)geom.nz);
+        const long int ix = std::min((long int)std::floor(fx), geom.nx - 1);
+        const long int iz = std::min((long int)std::floor(fz), geom.nz - 1);
+        const float wx = fx - ix, wz = fz - iz;
+        const std::size_t stride = geom.nz + 2, i = (ix + 1) * stride + iz + 1;
+        const float a = values[i] + wz * (values[i + 1] - values[i]);
+        const float b = values[i + stride] + wz * (values[i + stride + 1] - values[i + stride]);
+        return a + wx * (b - a);
+    }
+
+    // Log-likelihood of a scan from 'pose' (x, z, angle) in grid coordinates. 'beams' holds the end points (x, z) in
+    // the robot frame, the beams with no return left out.
+    double score(const Eigen::Vector3f &pose, const Eigen::Matrix2Xf &beams) const
+    {
+        const float c = std::cos(pose.z()), s = std::sin(pose.z());
+        double sum = 0.;
+        for (long int b = 0; b < beams.cols(); b++)
+        {
+            const float bx = beams(0, b), bz = beams(1, b);
+            sum += sample(pose.x() + c * bx - s * bz, pose.y() + s * bx + c * bz);
+        }
+        return params.temperature * sum;
+    }
+
+    // Batch versions over the columns of 'poses' (any 3 x N Eigen expression, as the blocks of RCParticleFilterSoA).
+    // 'out' gets one value per pose; likelihood() writes exp(score), which RCParticleFilterSoA::update expects.
+    template <typename Poses, typename Out>
+    void score(const Eigen::MatrixBase<Poses> &poses, const Eigen::Matrix2Xf &beams, Out &&out) const
+    {
+        for (long int p = 0; p < poses.cols(); p++)
+            out(p) = score(Eigen::Vector3f(poses(0, p), poses(1, p), poses(2, p)), beams);
+    }
+    template <typename Poses, typename Out>
+    void likelihood(const Eigen::MatrixBase<Poses> &poses, const Eigen::Matrix2Xf &beams, Out &&out) const
+    {
+        for (long int p = 0; p < poses.cols(); p++)
+            out(p) = std::exp(score(Eigen::Vector3f(poses(0, p), poses(1, p), poses(2, p)), beams));
+    }
+
+    // Dense values, (nx + 2) x (nz + 2) with the border, row kx + 1 and column kz + 1 for tile (kx, kz)
+    const std::vector<float> &data() const { return values; }
+
+private:
+    static constexpr std::int32_t far = INT32_MAX;
+
+    float log_likelihood(float d) const
+    {
+        d = std::min(d, params.max_distance);
+        return std::log(params.z_hit * std::exp(-d * d / (2.f * params.sigma * params.sigma)) + params.z_rand);
+    }
+    float value(std::int32_t d2) const
+    {
+        return d2 >= 0 and (std::size_t)d2 < table.size() ? table[d2] : outside;
+    }
+    std::size_t padded(long int tile) const
+    {
+        return (tile / geom.nz + 1) * (geom.nz + 2) + tile % geom.nz + 1;
+    }
+
+    Params params;
+    Geometry geom;
+    std::uint64_t source = 0;
+    std::vector<float> table;           // value per squared distance in tiles, up to max_distance
+    float outside = 0.f;
+    std::vector<std::int32_t> dist2;
+    std::vector<float> values;
+};
+
+#endif // LIKELIHOOD_FIELD_H
@@ -0,0 +1,112 @@
+/*
+ * Fixed-point log-odds occupancy, shared by Grid and Local_Grid.
+ *
+ * A cell keeps its log-odds l = log(p / (1 - p)) as an int16 in units of 1/SCALE, clamped to [min, max]. The hit and
+ * miss increments and the thresholds are converted once, when the model is built, so an update is an integer add and
+ * a clamp, and the probability of a value is a table lookup. The defaults reproduce the former hit/miss counters:
+ * a cell is occupied while hits win (l >= 0) and free otherwise.
+ *
+ *      OccupancyModel model;                               // or OccupancyModel({.p_hit = 0.8f, .p_miss = 0.35f})
+ *      cell.occupancy = model.update(cell.occupancy, model.hit);
+ *      if (model.is_occupied(cell.occupancy)) ...
+ *      float p = model.probability(cell.occupancy);
+ *      model.apply(beam, n, model.miss, [](auto &cell){ cell.free = not cell.free; });   // a run of cells
+ */
+
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class OccupancyModel
+{
+public:
+    using value_type = std::int16_t;
+    static constexpr float SCALE = 256.f;           // fixed-point units per nat
+
+    struct Params
+    {
+        float p_hit = 0.7f;                         // inverse sensor model of a hit and of a miss
+        float p_miss = 0.4f;
+        float p_min = 0.12f;                        // clamping: how certain a cell can become (bounds the time to flip it)
+        float p_max = 0.97f;
+        float p_free = 0.5f;                        // a cell becomes free under p_free and occupied from p_occupied,
+        float p_occupied = 0.5f;                    // and keeps its state in between
+    };
+
+    OccupancyModel() : OccupancyModel(Params()) {}
+    explicit OccupancyModel(const Params &params) : params(params)
+    {
+        hit = to_fixed(logit(params.p_hit));
+        miss = to_fixed(logit(params.p_miss));
+        min = to_fixed(logit(params.p_min));
+        max = to_fixed(logit(params.p_max));
+        free_below = to_fixed(logit(params.p_free));
+        occupied_from = to_fixed(logit(params.p_occupied));
+        probabilities.resize(max - min + 1);
+        for (int v = min; v <= max; v++)
+            probabilities[v - min] = float(1. - 1. / (1. + std::exp(v / SCALE)));
+        for (std::size_t i = 0; i < increments.size(); i++)
+            increments[i] = to_fixed(logit(std::clamp((i + 0.5) / increments.size(), 1e-3, 1. - 1e-3)));
+    }
+
+    const Params &parameters() const { return params; }
+
+    // log-odds in nats to fixed point, saturated to the int16 range, and back
+    static value_type to_fixed(double l)
+    {
+        return (value_type)std::clamp(std::lround(l * SCALE), (long) INT16_MIN, (long) INT16_MAX);
+    }
+    static double to_log_odds(value_type v) { return v / (double) SCALE; }
+    static double logit(double p) { return std::log(p / (1 - p)); }
+
+    value_type update(value_type v, value_type delta) const
+    {
+        return (value_type)std::clamp<int>(v + delta, min, max);
+    }
+    // increment of an observation of probability 'p', from a table of 256 steps
+    value_type increment(float p) const
+    {
+        return increments[std::clamp<int>(int(p * increments.size()), 0, increments.size() - 1)];
+    }
+    float probability(value_type v) const { return probabilities[std::clamp<int>(v, min, max) - min]; }
+    bool is_free(value_type v) const { return v < free_below; }
+    bool is_occupied(value_type v) const { return v >= occupied_from; }
+
+    // Batch updates of contiguous cells or of a list of cells with members 'occupancy' and 'free'. 'flip(cell)' is
+    // called for the cells whose value crossed the threshold of the state opposite to 'free'.
+    template <typename Cell, typename Flip>
+    void apply(Cell *cells, std::size_t n, value_type delta, Flip &&flip) const
+    {
+        for (std::size_t i = 0; i < n; i++)
+            apply_one(cells[i], delta, flip);
+    }
+    template <typename Cell, typename Flip>
+    void apply(const std::vector<Cell *> &cells, value_type delta, Flip &&flip) const
+    {
+        for (Cell *c : cells)
+            apply_one(*c, delta, flip);
+    }
+
+    value_type hit, miss, min, max, free_below, occupied_from;
+
+private:
+    template <typename Cell, typename Flip>
+    inline void apply_one(Cell &c, value_type delta, Flip &flip) const
+    {
+        c.occupancy = update(c.occupancy, delta);
+        if (c.free ? is_occupied(c.occupancy) : is_free(c.occupancy))
+            flip(c);
+    }
+
+    Params params;
+    std::vector<float> probabilities;               // of every value in [min, max]
+    std::array<value_type, 256> increments;
+};
+
+#endif // OCCUPANCY_H
@@ -0,0 +1,740 @@
+#ifndef IPP_PORTABLE_H
+#define IPP_PORTABLE_H
+
+// Portable implementation of the subset of IPP wrapped by ippWrapper.h, used when neither IPP nor Framewave
+// are installed (or when IPP_PORTABLE is defined). The functions keep the IPP names and signatures.
+//
+// The per row kernels have a scalar version plus AVX2 and AVX-512 (BW) versions on x86, selected at run time
+// from the CPU, and a NEON version on ARM. All of them use the same fixed point arithmetic, so the
+// results are identical whatever the version: gray is (77R + 150G + 29B + 128) >> 8, YUV uses 6 bit
+// coefficients, and bilinear resize uses 7 bit weights. The environment variable IPP_PORTABLE_ISA
+// (scalar, avx2, avx512, neon) or ippPortable::setIsa() force a version.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define IPP_PORTABLE_X86
+#include <immintrin.h>
+#define IPP_PORTABLE_TARGET_AVX2 __attribute__((target("avx2")))
+#define IPP_PORTABLE_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#elif defined(__ARM_NEON)
+#define IPP_PORTABLE_NEON
+#include <arm_neon.h>
+#endif
+
+// Basic types
+typedef unsigned char Ipp8u;
+typedef short Ipp16s;
+typedef float Ipp32f;
+typedef int IppStatus;
+
+// Image related types
+typedef struct { int width; int height; } IppiSize;
+typedef struct { int x; int y; int width; int height; } IppiRect;
+typedef enum { ippAxsHorizontal, ippAxsVertical, ippAxsBoth } IppiAxis;
+
+// Defines
+enum { ippStsNoErr = 0, ippStsSizeErr = -6, ippStsNullPtrErr = -8, ippStsStepErr = -14, ippStsInterpolationErr = -22, ippStsResizeFactorErr = -23 };
+#define IPPI_INTER_NN 1
+#define IPPI_INTER_LINEAR 2
+
+namespace ippPortable
+{
+enum class Isa { Scalar, AVX2, AVX512, NEON };
+
+// Row kernels of one implementation
+struct Kernels
+{
+    Isa isa;
+    void (*rgbToGray)(const Ipp8u *src, Ipp8u *dst, int n);
+    void (*yuv422ToRgb)(const Ipp8u *src, Ipp8u *dst, int n);                  // n even
+    void (*splitRgb)(const Ipp8u *src, Ipp8u *r, Ipp8u *g, Ipp8u *b, int n);
+    void (*reverse)(Ipp8u *row, int n);
+    void (*lerpRows)(const Ipp16s *h0, const Ipp16s *h1, Ipp8u *dst, int n, Ipp16s f);   // f: Q15 weight of h1
+};
+
+namespace detail
+{
+inline Ipp8u clamp8(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+inline void rgbToGrayScalar(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    for (int i = 0; i < n; i++, src += 3)
+        dst[i] = (77 * src[0] + 150 * src[1] + 29 * src[2] + 128) >> 8;
+}
+
+// YUY2: Y0 U Y1 V. R = Y + 1.140 V, G = Y - 0.394 U - 0.581 V, B = Y + 2.032 U
+inline void yuv422ToRgbScalar(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    for (int i = 0; i < n; i += 2, src += 4, dst += 6)
+    {
+        const int d = src[1] - 128, e = src[3] - 128;
+        const int dr = (73 * e + 32) >> 6, dg = (25 * d + 37 * e + 32) >> 6, db = (130 * d + 32) >> 6;
+        dst[0] = clamp8(src[0] + dr); dst[1] = clamp8(src[0] - dg); dst[2] = clamp8(src[0] + db);
+        dst[3] = clamp8(src[2] + dr); dst[4] = clamp8(src[2] - dg); dst[5] = clamp8(src[2] + db);
+    }
+}
+
+inline void splitRgbScalar(const Ipp8u *src, Ipp8u *r, Ipp8u *g, Ipp8u *b, int n)
+{
+    for (int i = 0; i < n; i++, src += 3)
+    {
+        r[i] = src[0]; g[i] = src[1]; b[i] = src[2];
+    }
+}
+
+inline void reverseScalar(Ipp8u *row, int n) { std::reverse(row, row + n); }
+
+inline void lerpRowsScalar(const Ipp16s *h0, const Ipp16s *h1, Ipp8u *dst, int n, Ipp16s f)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const int v = h0[i] + ((int(h1[i] - h0[i]) * f + 16384) >> 15);
+        dst[i] = clamp8((v + 64) >> 7);
+    }
+}
+
+#ifdef IPP_PORTABLE_X86
+// pshufb masks to split 16 interleaved RGB pixels (three 16 byte chunks) into planes and back
+struct RgbShuffles
+{
+    alignas(16) int8_t load[3][3][16];      // [channel][chunk]
+    alignas(16) int8_t store[3][3][16];     // [chunk][channel]
+};
+constexpr RgbShuffles makeRgbShuffles()
+{
+    RgbShuffles s{};
+    for (int ch = 0; ch < 3; ch++)
+        for (int k = 0; k < 3; k++)
+            for (int i = 0; i < 16; i++)
+            {
+                const int from = 3 * i + ch - 16 * k;
+                s.load[ch][k][i] = (from >= 0 && from < 16) ? from : -1;
+                const int g = 16 * k + i;
+                s.store[k][ch][i] = (g % 3 == ch) ? g / 3 : -1;
+            }
+    return s;
+}
+inline constexpr RgbShuffles rgbShuffles = makeRgbShuffles();
+
+__attribute__((target("ssse3"))) inline __m128i gatherChannel(__m128i a, __m128i b, __m128i c, int ch)
+{
+    const auto &m = rgbShuffles.load[ch];
+    return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_load_si128((const __m128i *)m[0])),
+                                     _mm_shuffle_epi8(b, _mm_load_si128((const __m128i *)m[1]))),
+                        _mm_shuffle_epi8(c, _mm_load_si128((const __m128i *)m[2])));
+}
+
+__attribute__((target("ssse3"))) inline void load3(const Ipp8u *src, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i a = _mm_loadu_si128((const __m128i *)src);
+    const __m128i m = _mm_loadu_si128((const __m128i *)(src + 16));
+    const __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+    r = gatherChannel(a, m, c, 0);
+    g = gatherChannel(a, m, c, 1);
+    b = gatherChannel(a, m, c, 2);
+}
+
+__attribute__((target("ssse3"))) inline void store3(Ipp8u *dst, __m128i r, __m128i g, __m128i b)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        const auto &m = rgbShuffles.store[k];
+        const __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, _mm_load_si128((const __m128i *)m[0])),
+                                                    _mm_shuffle_epi8(g, _mm_load_si128((const __m128i *)m[1]))),
+                                       _mm_shuffle_epi8(b, _mm_load_si128((const __m128i *)m[2])));
+        _mm_storeu_si128((__m128i *)(dst + 16 * k), v);
+    }
+}
+
+// 16 x int16 of a 256 bit register to 16 bytes, saturated
+IPP_PORTABLE_TARGET_AVX2 inline __m128i pack16(__m256i v)
+{
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08));
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline void rgbToGrayAvx2(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i r, g, b;
+        load3(src + 3 * i, r, g, b);
+        __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(r), _mm256_set1_epi16(77)),
+                                     _mm256_mullo_epi16(_mm256_cvtepu8_epi16(g), _mm256_set1_epi16(150)));
+        y = _mm256_add_epi16(y, _mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(b), _mm256_set1_epi16(29)), _mm256_set1_epi16(128)));
+        _mm_storeu_si128((__m128i *)(dst + i), pack16(_mm256_srli_epi16(y, 8)));
+    }
+    rgbToGrayScalar(src + 3 * i, dst + i, n - i);
+}
+
+// GCC 12 warns about the undefined pass-through operand of the AVX-512 intrinsics outside -mavx512f builds
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+IPP_PORTABLE_TARGET_AVX512 inline void rgbToGrayAvx512(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m128i r0, g0, b0, r1, g1, b1;
+        load3(src + 3 * i, r0, g0, b0);
+        load3(src + 3 * i + 48, r1, g1, b1);
+        __m512i y = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_set_m128i(r1, r0)), _mm512_set1_epi16(77)),
+                                     _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_set_m128i(g1, g0)), _mm512_set1_epi16(150)));
+        y = _mm512_add_epi16(y, _mm512_add_epi16(_mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_set_m128i(b1, b0)), _mm512_set1_epi16(29)), _mm512_set1_epi16(128)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm512_cvtepi16_epi8(_mm512_srli_epi16(y, 8)));
+    }
+    rgbToGrayAvx2(src + 3 * i, dst + i, n - i);
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline void yuv422ToRgbAvx2(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(src + 2 * i));
+        const __m256i y = _mm256_and_si256(v, _mm256_set1_epi16(0x00ff));
+        const __m256i uv = _mm256_srli_epi16(v, 8);                                  // U V U V ... as int16
+        __m256i u = _mm256_and_si256(uv, _mm256_set1_epi32(0xffff));
+        __m256i w = _mm256_srli_epi32(uv, 16);
+        const __m256i d = _mm256_sub_epi16(_mm256_or_si256(u, _mm256_slli_epi32(u, 16)), _mm256_set1_epi16(128));
+        const __m256i e = _mm256_sub_epi16(_mm256_or_si256(w, _mm256_slli_epi32(w, 16)), _mm256_set1_epi16(128));
+        const __m256i half = _mm256_set1_epi16(32);
+        const __m256i dr = _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(e, _mm256_set1_epi16(73)), half), 6);
+        const __m256i dg = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_set1_epi16(25)),
+                                                                               _mm256_mullo_epi16(e, _mm256_set1_epi16(37))), half), 6);
+        const __m256i db = _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_set1_epi16(130)), half), 6);
+        store3(dst + 3 * i, pack16(_mm256_add_epi16(y, dr)), pack16(_mm256_sub_epi16(y, dg)), pack16(_mm256_add_epi16(y, db)));
+    }
+    yuv422ToRgbScalar(src + 2 * i, dst + 3 * i, n - i);
+}
+
+IPP_PORTABLE_TARGET_AVX512 inline void yuv422ToRgbAvx512(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    const __m512i zero = _mm512_setzero_si512();
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m512i v = _mm512_loadu_si512((const void *)(src + 2 * i));
+        const __m512i y = _mm512_and_si512(v, _mm512_set1_epi16(0x00ff));
+        const __m512i uv = _mm512_srli_epi16(v, 8);
+        __m512i u = _mm512_and_si512(uv, _mm512_set1_epi32(0xffff));
+        __m512i w = _mm512_srli_epi32(uv, 16);
+        const __m512i d = _mm512_sub_epi16(_mm512_or_si512(u, _mm512_slli_epi32(u, 16)), _mm512_set1_epi16(128));
+        const __m512i e = _mm512_sub_epi16(_mm512_or_si512(w, _mm512_slli_epi32(w, 16)), _mm512_set1_epi16(128));
+        const __m512i half = _mm512_set1_epi16(32);
+        const __m512i dr = _mm512_srai_epi16(_mm512_add_epi16(_mm512_mullo_epi16(e, _mm512_set1_epi16(73)), half), 6);
+        const __m512i dg = _mm512_srai_epi16(_mm512_add_epi16(_mm512_add_epi16(_mm512_mullo_epi16(d, _mm512_set1_epi16(25)),
+                                                                               _mm512_mullo_epi16(e, _mm512_set1_epi16(37))), half), 6);
+        const __m512i db = _mm512_srai_epi16(_mm512_add_epi16(_mm512_mullo_epi16(d, _mm512_set1_epi16(130)), half), 6);
+        const __m256i r = _mm512_cvtusepi16_epi8(_mm512_max_epi16(_mm512_add_epi16(y, dr), zero));
+        const __m256i g = _mm512_cvtusepi16_epi8(_mm512_max_epi16(_mm512_sub_epi16(y, dg), zero));
+        const __m256i b = _mm512_cvtusepi16_epi8(_mm512_max_epi16(_mm512_add_epi16(y, db), zero));
+        store3(dst + 3 * i, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+        store3(dst + 3 * i + 48, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+    }
+    yuv422ToRgbAvx2(src + 2 * i, dst + 3 * i, n - i);
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline void splitRgbAvx2(const Ipp8u *src, Ipp8u *r, Ipp8u *g, Ipp8u *b, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i vr, vg, vb;
+        load3(src + 3 * i, vr, vg, vb);
+        _mm_storeu_si128((__m128i *)(r + i), vr);
+        _mm_storeu_si128((__m128i *)(g + i), vg);
+        _mm_storeu_si128((__m128i *)(b + i), vb);
+    }
+    splitRgbScalar(src + 3 * i, r + i, g + i, b + i, n - i);
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline __m256i rev(__m256i v)
+{
+    const __m256i mask = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    v = _mm256_shuffle_epi8(v, mask);
+    return _mm256_permute2x128_si256(v, v, 1);
+}
+
+// swaps reversed blocks from both ends towards the middle
+IPP_PORTABLE_TARGET_AVX2 inline void reverseAvx2(Ipp8u *row, int n)
+{
+    int i = 0, j = n;
+    for (; j - i >= 64; i += 32, j -= 32)
+    {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)(row + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(row + j - 32));
+        _mm256_storeu_si256((__m256i *)(row + i), rev(b));
+        _mm256_storeu_si256((__m256i *)(row + j - 32), rev(a));
+    }
+    std::reverse(row + i, row + j);
+}
+
+IPP_PORTABLE_TARGET_AVX512 inline __m512i rev(__m512i v)
+{
+    const __m512i mask = _mm512_broadcast_i32x4(_mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+    v = _mm512_shuffle_epi8(v, mask);
+    return _mm512_shuffle_i64x2(v, v, 0x1b);
+}
+
+IPP_PORTABLE_TARGET_AVX512 inline void reverseAvx512(Ipp8u *row, int n)
+{
+    int i = 0, j = n;
+    for (; j - i >= 128; i += 64, j -= 64)
+    {
+        const __m512i a = _mm512_loadu_si512((const void *)(row + i));
+        const __m512i b = _mm512_loadu_si512((const void *)(row + j - 64));
+        _mm512_storeu_si512((void *)(row + i), rev(b));
+        _mm512_storeu_si512((void *)(row + j - 64), rev(a));
+    }
+    reverseAvx2(row + i, j - i);
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline __m256i lerp16(const Ipp16s *h0, const Ipp16s *h1, __m256i weight)
+{
+    const __m256i a = _mm256_loadu_si256((const __m256i *)h0);
+    const __m256i b = _mm256_loadu_si256((const __m256i *)h1);
+    const __m256i v = _mm256_add_epi16(a, _mm256_mulhrs_epi16(_mm256_sub_epi16(b, a), weight));
+    return _mm256_srai_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(64)), 7);
+}
+
+IPP_PORTABLE_TARGET_AVX2 inline void lerpRowsAvx2(const Ipp16s *h0, const Ipp16s *h1, Ipp8u *dst, int n, Ipp16s f)
+{
+    const __m256i weight = _mm256_set1_epi16(f);
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m256i lo = lerp16(h0 + i, h1 + i, weight), hi = lerp16(h0 + i + 16, h1 + i + 16, weight);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+    }
+    lerpRowsScalar(h0 + i, h1 + i, dst + i, n - i, f);
+}
+
+IPP_PORTABLE_TARGET_AVX512 inline void lerpRowsAvx512(const Ipp16s *h0, const Ipp16s *h1, Ipp8u *dst, int n, Ipp16s f)
+{
+    const __m512i weight = _mm512_set1_epi16(f), half = _mm512_set1_epi16(64), zero = _mm512_setzero_si512();
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        const __m512i a = _mm512_loadu_si512((const void *)(h0 + i));
+        const __m512i b = _mm512_loadu_si512((const void *)(h1 + i));
+        const __m512i v = _mm512_add_epi16(a, _mm512_mulhrs_epi16(_mm512_sub_epi16(b, a), weight));
+        const __m512i o = _mm512_max_epi16(_mm512_srai_epi16(_mm512_add_epi16(v, half), 7), zero);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm512_cvtusepi16_epi8(o));
+    }
+    lerpRowsAvx2(h0 + i, h1 + i, dst + i, n - i, f);
+}
+#pragma GCC diagnostic pop
+#endif // IPP_PORTABLE_X86
+
+#ifdef IPP_PORTABLE_NEON
+inline void rgbToGrayNeon(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8x16x3_t p = vld3q_u8(src + 3 * i);
+        uint16x8_t lo = vmull_u8(vget_low_u8(p.val[0]), vdup_n_u8(77));
+        lo = vmlal_u8(lo, vget_low_u8(p.val[1]), vdup_n_u8(150));
+        lo = vmlal_u8(lo, vget_low_u8(p.val[2]), vdup_n_u8(29));
+        uint16x8_t hi = vmull_u8(vget_high_u8(p.val[0]), vdup_n_u8(77));
+        hi = vmlal_u8(hi, vget_high_u8(p.val[1]), vdup_n_u8(150));
+        hi = vmlal_u8(hi, vget_high_u8(p.val[2]), vdup_n_u8(29));
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    rgbToGrayScalar(src + 3 * i, dst + i, n - i);
+}
+
+inline void yuv422ToRgbNeon(const Ipp8u *src, Ipp8u *dst, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8x8x4_t q = vld4_u8(src + 2 * i);                 // Y even, U, Y odd, V of 8 pairs
+        const int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(q.val[1])), vdupq_n_s16(128));
+        const int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(q.val[3])), vdupq_n_s16(128));
+        const int16x8_t half = vdupq_n_s16(32);
+        const int16x8_t dr = vshrq_n_s16(vaddq_s16(vmulq_n_s16(e, 73), half), 6);
+        const int16x8_t dg = vshrq_n_s16(vaddq_s16(vaddq_s16(vmulq_n_s16(d, 25), vmulq_n_s16(e, 37)), half), 6);
+        const int16x8_t db = vshrq_n_s16(vaddq_s16(vmulq_n_s16(d, 130), half), 6);
+        const int16x8_t ye = vreinterpretq_s16_u16(vmovl_u8(q.val[0]));
+        const int16x8_t yo = vreinterpretq_s16_u16(vmovl_u8(q.val[2]));
+        const uint8x8x2_t r = vzip_u8(vqmovun_s16(vaddq_s16(ye, dr)), vqmovun_s16(vaddq_s16(yo, dr)));
+        const uint8x8x2_t g = vzip_u8(vqmovun_s16(vsubq_s16(ye, dg)), vqmovun_s16(vsubq_s16(yo, dg)));
+        const uint8x8x2_t b = vzip_u8(vqmovun_s16(vaddq_s16(ye, db)), vqmovun_s16(vaddq_s16(yo, db)));
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+        out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+        out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+        vst3q_u8(dst + 3 * i, out);
+    }
+    yuv422ToRgbScalar(src + 2 * i, dst + 3 * i, n - i);
+}
+
+inline void splitRgbNeon(const Ipp8u *src, Ipp8u *r, Ipp8u *g, Ipp8u *b, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const uint8x16x3_t p = vld3q_u8(src + 3 * i);
+        vst1q_u8(r + i, p.val[0]);
+        vst1q_u8(g + i, p.val[1]);
+        vst1q_u8(b + i, p.val[2]);
+    }
+    splitRgbScalar(src + 3 * i, r + i, g + i, b + i, n - i);
+}
+
+inline void reverseNeon(Ipp8u *row, int n)
+{
+    auto rev = [](uint8x16_t v) { v = vrev64q_u8(v); return vextq_u8(v, v, 8); };
+    int i = 0, j = n;
+    for (; j - i >= 32; i += 16, j -= 16)
+    {
+        const uint8x16_t a = vld1q_u8(row + i), b = vld1q_u8(row + j - 16);
+        vst1q_u8(row + i, rev(b));
+        vst1q_u8(row + j - 16, rev(a));
+    }
+    std::reverse(row + i, row + j);
+}
+
+inline void lerpRowsNeon(const Ipp16s *h0, const Ipp16s *h1, Ipp8u *dst, int n, Ipp16s f)
+{
+    const int16x8_t weight = vdupq_n_s16(f), half = vdupq_n_s16(64);
+    auto lerp = [&](int k) {
+        const int16x8_t a = vld1q_s16(h0 + k), b = vld1q_s16(h1 + k);
+        const int16x8_t v = vaddq_s16(a, vqrdmulhq_s16(vsubq_s16(b, a), weight));
+        return vqmovun_s16(vshrq_n_s16(vaddq_s16(v, half), 7));
+    };
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(dst + i, vcombine_u8(lerp(i), lerp(i + 8)));
+    lerpRowsScalar(h0 + i, h1 + i, dst + i, n - i, f);
+}
+#endif // IPP_PORTABLE_NEON
+
+inline bool supported(Isa isa)
+{
+    switch (isa)
+    {
+        case Isa::Scalar: return true;
+#ifdef IPP_PORTABLE_X86
+        case Isa::AVX2: return __builtin_cpu_supports("avx2");
+        case Isa::AVX512: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+#ifdef IPP_PORTABLE_NEON
+        case Isa::NEON: return true;
+#endif
+        default: return false;
+    }
+}
+
+inline Kernels kernelsFor(Isa isa)
+{
+    switch (supported(isa) ? isa : Isa::Scalar)
+    {
+#ifdef IPP_PORTABLE_X86
+        case Isa::AVX2: return {Isa::AVX2, rgbToGrayAvx2, yuv422ToRgbAvx2, splitRgbAvx2, reverseAvx2, lerpRowsAvx2};
+        case Isa::AVX512: return {Isa::AVX512, rgbToGrayAvx512, yuv422ToRgbAvx512, splitRgbAvx2, reverseAvx512, lerpRowsAvx512};
+#endif
+#ifdef IPP_PORTABLE_NEON
+        case Isa::NEON: return {Isa::NEON, rgbToGrayNeon, yuv422ToRgbNeon, splitRgbNeon, reverseNeon, lerpRowsNeon};
+#endif
+        default: return {Isa::Scalar, rgbToGrayScalar, yuv422ToRgbScalar, splitRgbScalar, reverseScalar, lerpRowsScalar};
+    }
+}
+
+inline Isa detectIsa()
+{
+    if (const char *forced = std::getenv("IPP_PORTABLE_ISA"))
+    {
+        const Isa named[] = {Isa::Scalar, Isa::AVX2, Isa::AVX512, Isa::NEON};
+        const char *names[] = {"scalar", "avx2", "avx512", "neon"};
+        for (int i = 0; i < 4; i++)
+            if (std::strcmp(forced, names[i]) == 0 && supported(named[i]))
+                return named[i];
+    }
+    for (Isa isa : {Isa::AVX512, Isa::AVX2, Isa::NEON})
+        if (supported(isa))
+            return isa;
+    return Isa::Scalar;
+}
+
+inline Kernels &activeKernels()
+{
+    static Kernels k = kernelsFor(detectIsa());
+    return k;
+}
+
+// Bilinear and nearest neighbour resize shared by ippiResize and ippiResizeSqrPixel. Destination pixel x
+// samples source coordinate (x + 0.5 - xShift) / xFactor - 0.5, clamped to the source ROI.
+inline int resizeBufferSize(int width, int channels)
+{
+    return 3 * width * sizeof(int) + 2 * (width * channels + 32) * sizeof(Ipp16s) + 64;
+}
+
+inline void resizeMap(int count, int first, double factor, double shift, int lo, int hi, bool linear, int *index, int *next, int *weight)
+{
+    for (int i = 0; i < count; i++)
+    {
+        double s = (first + i + 0.5 - shift) / factor - 0.5;
+        if (!linear)
+        {
+            index[i] = next[i] = std::clamp(int(std::floor(s + 0.5)), lo, hi);
+            weight[i] = 0;
+            continue;
+        }
+        s = std::clamp(s, double(lo), double(hi));
+        int k = int(std::floor(s));
+        int w = int(std::lround((s - k) * 128));
+        if (w == 128)
+        {
+            k++;
+            w = 0;
+        }
+        index[i] = k;
+        next[i] = std::min(k + 1, hi);
+        weight[i] = w;
+    }
+}
+
+inline IppStatus resize(const Ipp8u *pSrc, IppiSize srcSize, int srcStep, IppiRect srcRoi, Ipp8u *pDst, int dstStep, IppiRect dstRoi,
+                        double xFactor, double yFactor, double xShift, double yShift, int interpolation, int channels, Ipp8u *pBuffer)
+{
+    if (pSrc == nullptr || pDst == nullptr)
+        return ippStsNullPtrErr;
+    if (interpolation != IPPI_INTER_NN && interpolation != IPPI_INTER_LINEAR)
+        return ippStsInterpolationErr;
+    if (!(xFactor > 0) || !(yFactor > 0))
+        return ippStsResizeFactorErr;
+    const int x0 = std::max(srcRoi.x, 0), x1 = std::min(srcRoi.x + srcRoi.width, srcSize.width) - 1;
+    const int y0 = std::max(srcRoi.y, 0), y1 = std::min(srcRoi.y + srcRoi.height, srcSize.height) - 1;
+    const int w = dstRoi.width, h = dstRoi.height;
+    if (x1 < x0 || y1 < y0 || w <= 0 || h <= 0)
+        return ippStsSizeErr;
+
+    std::vector<Ipp8u> local;
+    if (pBuffer == nullptr)
+    {
+        local.resize(resizeBufferSize(w, channels));
+        pBuffer = local.data();
+    }
+    int *xi = (int *)(((uintptr_t)pBuffer + 63) & ~uintptr_t(63));
+    int *xn = xi + w, *xw = xn + w;
+    Ipp16s *rows[2] = {(Ipp16s *)(xw + w), (Ipp16s *)(xw + w) + w * channels + 32};
+    int rowOf[2] = {-1, -1};
+    const bool linear = interpolation == IPPI_INTER_LINEAR;
+    resizeMap(w, dstRoi.x, xFactor, xShift, x0, x1, linear, xi, xn, xw);
+    for (int i = 0; i < w; i++)
+    {
+        xi[i] *= channels;
+        xn[i] *= channels;
+    }
+
+    const Kernels &k = activeKernels();
+    auto horizontal = [&](int sy, Ipp16s *out) {
+        const Ipp8u *s = pSrc + sy * srcStep;
+        for (int i = 0; i < w; i++)
+        {
+            const Ipp8u *a = s + xi[i], *b = s + xn[i];
+            const int f = xw[i];
+            for (int c = 0; c < channels; c++)
+                out[i * channels + c] = a[c] * (128 - f) + b[c] * f;
+        }
+    };
+    for (int j = 0; j < h; j++)
+    {
+        Ipp8u *d = pDst + (dstRoi.y + j) * dstStep + dstRoi.x * channels;
+        int iy, iyn, fy;
+        resizeMap(1, dstRoi.y + j, yFactor, yShift, y0, y1, linear, &iy, &iyn, &fy);
+        if (!linear)
+        {
+            const Ipp8u *s = pSrc + iy * srcStep;
+            for (int i = 0; i < w; i++)
+                for (int c = 0; c < channels; c++)
+                    d[i * channels + c] = s[xi[i] + c];
+            continue;
+        }
+        // consecutive destination rows mostly share source rows, keep the last two
+        if (rowOf[0] != iy)
+        {
+            if (rowOf[1] == iy)
+            {
+                std::swap(rows[0], rows[1]);
+                std::swap(rowOf[0], rowOf[1]);
+            }
+            else
+            {
+                horizontal(iy, rows[0]);
+                rowOf[0] = iy;
+            }
+        }
+        const Ipp16s *second = rows[0];
+        if (fy != 0 && iyn != iy)
+        {
+            if (rowOf[1] != iyn)
+            {
+                horizontal(iyn, rows[1]);
+                rowOf[1] = iyn;
+            }
+            second = rows[1];
+        }
+        k.lerpRows(rows[0], second, d, w * channels, Ipp16s(fy << 8));
+    }
+    return ippStsNoErr;
+}
+
+inline IppStatus mirror(Ipp8u *pSrcDst, int step, IppiSize roi, IppiAxis flip, int channels)
+{
+    if (pSrcDst == nullptr)
+        return ippStsNullPtrErr;
+    if (roi.width <= 0 || roi.height <= 0)
+        return ippStsSizeErr;
+    const int bytes = roi.width * channels;
+    if (flip == ippAxsHorizontal || flip == ippAxsBoth)
+        for (int top = 0, bottom = roi.height - 1; top < bottom; top++, bottom--)
+            std::swap_ranges(pSrcDst + top * step, pSrcDst + top * step + bytes, pSrcDst + bottom * step);
+    if (flip == ippAxsVertical || flip == ippAxsBoth)
+    {
+        const Kernels &k = activeKernels();
+        for (int y = 0; y < roi.height; y++)
+        {
+            Ipp8u *row = pSrcDst + y * step;
+            if (channels == 1)
+                k.reverse(row, roi.width);
+            else
+                for (int a = 0, b = roi.width - 1; a < b; a++, b--)
+                    std::swap_ranges(row + a * channels, row + (a + 1) * channels, row + b * channels);
+        }
+    }
+    return ippStsNoErr;
+}
+} // namespace detail
+
+// Forces an implementation, for benchmarking and testing. Not to be called while other threads use the functions.
+inline bool setIsa(Isa isa)
+{
+    if (!detail::supported(isa))
+        return false;
+    detail::activeKernels() = detail::kernelsFor(isa);
+    return true;
+}
+inline Isa activeIsa() { return detail::activeKernels().isa; }
+} // namespace ippPortable
+
+// Functions
+inline IppStatus ippiCopy_8u_C1R(const Ipp8u *pSrc, int srcStep, Ipp8u *pDst, int dstStep, IppiSize roiSize)
+{
+    if (pSrc == nullptr || pDst == nullptr)
+        return ippStsNullPtrErr;
+    if (roiSize.width <= 0 || roiSize.height <= 0)
+        return ippStsSizeErr;
+    for (int y = 0; y < roiSize.height; y++)
+        std::memcpy(pDst + y * dstStep, pSrc + y * srcStep, roiSize.width);
+    return ippStsNoErr;
+}
+
+inline IppStatus ippiCopy_8u_C3P3R(const Ipp8u *pSrc, int srcStep, Ipp8u *const pDst[3], int dstStep, IppiSize roiSize)
+{
+    if (pSrc == nullptr || pDst == nullptr || pDst[0] == nullptr || pDst[1] == nullptr || pDst[2] == nullptr)
+        return ippStsNullPtrErr;
+    if (roiSize.width <= 0 || roiSize.height <= 0)
+        return ippStsSizeErr;
+    const auto &k = ippPortable::detail::activeKernels();
+    for (int y = 0; y < roiSize.height; y++)
+        k.splitRgb(pSrc + y * srcStep, pDst[0] + y * dstStep, pDst[1] + y * dstStep, pDst[2] + y * dstStep, roiSize.width);
+    return ippStsNoErr;
+}
+#define ippiCopy_8u_C3P3RR ippiCopy_8u_C3P3R
+
+inline IppStatus ippiMirror_8u_C1IR(Ipp8u *pSrcDst, int srcDstStep, IppiSize roiSize, IppiAxis flip)
+{
+    return ippPortable::detail::mirror(pSrcDst, srcDstStep, roiSize, flip, 1);
+}
+
+inline IppStatus ippiMirror_8u_C3IR(Ipp8u *pSrcDst, int srcDstStep, IppiSize roiSize, IppiAxis flip)
+{
+    return ippPortable::detail::mirror(pSrcDst, srcDstStep, roiSize, flip, 3);
+}
+
+// in place, square ROI only
+inline IppStatus ippiTranspose_8u_C1IR(Ipp8u *pSrcDst, int srcDstStep, IppiSize roiSize)
+{
+    if (pSrcDst == nullptr)
+        return ippStsNullPtrErr;
+    if (roiSize.width <= 0 || roiSize.width != roiSize.height)
+        return ippStsSizeErr;
+    const int n = roiSize.width, block = 32;
+    for (int by = 0; by < n; by += block)
+        for (int bx = by; bx < n; bx += block)
+            for (int y = by; y < std::min(by + block, n); y++)
+                for (int x = std::max(bx, y + 1); x < std::min(bx + block, n); x++)
+                    std::swap(pSrcDst[y * srcDstStep + x], pSrcDst[x * srcDstStep + y]);
+    return ippStsNoErr;
+}
+
+inline IppStatus ippiResize_8u_C1R(const Ipp8u *pSrc, IppiSize srcSize, int srcStep, IppiRect srcRoi, Ipp8u *pDst, int dstStep,
+                                   IppiSize dstRoiSize, double xFactor, double yFactor, int interpolation)
+{
+    const IppiRect dstRoi = {0, 0, dstRoiSize.width, dstRoiSize.height};
+    return ippPortable::detail::resize(pSrc, srcSize, srcStep, srcRoi, pDst, dstStep, dstRoi, xFactor, yFactor,
+                                       -srcRoi.x * xFactor, -srcRoi.y * yFactor, interpolation, 1, nullptr);
+}
+
+inline IppStatus ippiResizeGetBufSize(IppiRect srcRoi, IppiRect dstRoi, int nChannel, int interpolation, int *pBufferSize)
+{
+    (void)srcRoi;
+    if (pBufferSize == nullptr)
+        return ippStsNullPtrErr;
+    if (interpolation != IPPI_INTER_NN && interpolation != IPPI_INTER_LINEAR)
+        return ippStsInterpolationErr;
+    *pBufferSize = ippPortable::detail::resizeBufferSize(dstRoi.width, nChannel);
+    return ippStsNoErr;
+}
+
+inline IppStatus ippiResizeSqrPixel_8u_C3R(const Ipp8u *pSrc, IppiSize srcSize, int srcStep, IppiRect srcRoi, Ipp8u *pDst, int dstStep,
+                                           IppiRect dstRoi, double xFactor, double yFactor, double xShift, double yShift,
+                                           int interpolation, Ipp8u *pBuffer)
+{
+    return ippPortable::detail::resize(pSrc, srcSize, srcStep, srcRoi, pDst, dstStep, dstRoi, xFactor, yFactor,
+                                       xShift, yShift, interpolation, 3, pBuffer);
+}
+
+inline IppStatus ippiRGBToGray_8u_C3C1R(const Ipp8u *pSrc, int srcStep, Ipp8u *pDst, int dstStep, IppiSize roiSize)
+{
+    if (pSrc == nullptr || pDst == nullptr)
+        return ippStsNullPtrErr;
+    if (roiSize.width <= 0 || roiSize.height <= 0)
+        return ippStsSizeErr;
+    const auto &k = ippPortable::detail::activeKernels();
+    for (int y = 0; y < roiSize.height; y++)
+        k.rgbToGray(pSrc + y * srcStep, pDst + y * dstStep, roiSize.width);
+    return ippStsNoErr;
+}
+
+// roiSize.width must be even
+inline IppStatus ippiYUV422ToRGB_8u_C2C3R(const Ipp8u *pSrc, int srcStep, Ipp8u *pDst, int dstStep, IppiSize roiSize)
+{
+    if (pSrc == nullptr || pDst == nullptr)
+        return ippStsNullPtrErr;
+    if (roiSize.width <= 0 || roiSize.height <= 0 || roiSize.width % 2 != 0)
+        return ippStsSizeErr;
+    const auto &k = ippPortable::detail::activeKernels();
+    for (int y = 0; y < roiSize.height; y++)
+        k.yuv422ToRgb(pSrc + y * srcStep, pDst + y * dstStep, roiSize.width);
+    return ippStsNoErr;
+}
+
+inline Ipp8u *ippsMalloc_8u(int len)
+{
+    return len > 0 ? (Ipp8u *)std::aligned_alloc(64, (len + 63) & ~63) : nullptr;
+}
+
+inline void ippsFree(void *ptr) { std::free(ptr); }
+
+#endif // IPP_PORTABLE_H
@@ -3,6 +3,9 @@
 
 #ifdef IPP_FOUND
 #include <ipp.h>
+#elif defined(IPP_PORTABLE) || !__has_include(<fwImage.h>)
+// neither IPP nor Framewave: portable SIMD implementation of the same subset
+#include "ippPortable.h"
 #else
 
 
@@ -10,10 +10,14 @@
 
 void Local_Grid::initialize(  Ranges angle_dim_,
                               Ranges radius_dim_,
-                              QGraphicsScene *scene_)
+                              QGraphicsScene *scene_,
+                              Storage storage_)
 {
     angle_dim = angle_dim_;
     radius_dim = radius_dim_;
+    semantic_layer.clear();     // removes the items of a previous initialization
+    draw_semantic_layer();
+    semantic_layer = SemanticLayer(params.max_object_unseen_timelife);
     dim = QRectF(angle_dim.init, radius_dim.init, angle_dim.end-angle_dim.init, radius_dim.end-radius_dim.init);
     static std::vector<QGraphicsItem*> lines, circles;
     scene = scene_;
@@ -22,9 +26,15 @@ void Local_Grid::initialize(  Ranges angle_dim_,
     qInfo() << __FILE__ << __FUNCTION__ <<  "dim " << dim;
 
     // clean existing map
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
+    for_each_cell([this](const Key &, T &value){ scene->removeItem(value.tile); });
     fmap.clear();
+    dense.cells.clear();
+    storage = storage_;
+    dense.na = dense.nr = 0;
+    for (int ang = angle_dim.init; ang < angle_dim.end; ang += angle_dim.step) dense.na++;
+    for (int rad = radius_dim.init; rad < radius_dim.end; rad += radius_dim.step) dense.nr++;
+    if (storage == Storage::Dense)
+        dense.cells.resize(dense.na * dense.nr);
 
     int id = 0;
     for (int ang = angle_dim.init; ang < angle_dim.end; ang += angle_dim.step)
@@ -40,7 +50,10 @@ void Local_Grid::initialize(  Ranges angle_dim_,
             tile->setRotation(-ang);
             scene->addItem(tile);
             aux.tile = tile;
-            fmap.insert(std::make_pair(Key(ang, rad), aux));
+            if (storage == Storage::Dense)
+                dense.cells[aux.id] = aux;
+            else
+                fmap.insert(std::make_pair(Key(ang, rad), aux));
         }
 
     //auto kv = std::views::keys(fmap);
@@ -78,11 +91,26 @@ void Local_Grid::insert(const Key &key, const T &value)
 {
     fmap.insert(std::make_pair(key, value));
 }
+inline long int Local_Grid::cell_index(int ang, int rad) const
+{
+    long int ka = rint((ang - angle_dim.init) / angle_dim.step);
+    long int kr = rint((rad - radius_dim.init) / radius_dim.step);
+    if (ka < 0 or ka >= dense.na or kr < 0 or kr >= dense.nr)
+        return -1;
+    return ka * dense.nr + kr;
+}
 inline std::tuple<bool, Local_Grid::T&> Local_Grid::getCell(int ang, int rad)
 {
     //qInfo() << __FUNCTION__ << ((ang<angle_dim.init) or ang>=angle_dim.end or rad<radius_dim.init or rad>=radius_dim.end);
     if(ang<angle_dim.init or ang>=angle_dim.end or rad<radius_dim.init or rad>=radius_dim.end)
         return std::forward_as_tuple(false, T());
+    else if (storage == Storage::Dense)
+    {
+        auto i = cell_index(ang, rad);
+        if (i < 0)
+            return std::forward_as_tuple(false, T());
+        return std::forward_as_tuple(true, dense.cells[i]);
+    }
     else
     {
         Key key = pointToKey(ang, rad);
@@ -100,6 +128,8 @@ inline std::tuple<bool, Local_Grid::T&> Local_Grid::getCell(const Key &k)
 {
     if(k.ang<angle_dim.init or k.ang>=angle_dim.end or k.rad<radius_dim.init or k.rad>=radius_dim.end)
         return std::forward_as_tuple(false, T());
+    else if (storage == Storage::Dense)
+        return getCell(k.ang, k.rad);
     else
       try
       {
@@ -183,34 +213,48 @@ void Local_Grid::add_miss(const Eigen::Vector2f &p)
     auto pd = radians_to_degrees(p.x());
     auto &&[success, v] = getCell(pd, p.y());
     if(success)
-    {
-        v.misses++;
-        if((float)v.hits/(v.hits+v.misses) < params.occupancy_threshold)
-        {
-            v.free = true;
-            if(v.tile != nullptr)
-                v.tile->setFreeColor();
-        }
-        v.misses = std::clamp(v.misses, 0.f, 20.f);
-        this->updated++;
-    }
+        apply_miss(v);
+}
+void Local_Grid::apply_miss(T &v)
+{
+    v.occupancy = occupancy_model.update(v.occupancy, occupancy_model.miss);
+    if(not v.free and occupancy_model.is_free(v.occupancy))
+        flip(v);
+    this->updated++;
 }
 void Local_Grid::add_hit(const Eigen::Vector2f &p)
 {
     auto pd = radians_to_degrees(p.x());
     auto &&[success, v] = getCell(pd, p.y());
     if(success)
+        apply_hit(v);
+}
+void Local_Grid::apply_hit(T &v)
+{
+    v.occupancy = occupancy_model.update(v.occupancy, occupancy_model.hit);
+    if(v.free and occupancy_model.is_occupied(v.occupancy))
+        flip(v);
+    this->updated++;
+}
+void Local_Grid::flip(T &v)
+{
+    if(v.tile != nullptr)
     {
-        v.hits++;
-        if((float)v.hits/(v.hits+v.misses) >= params.occupancy_threshold)
-        {
-            v.free = false;
-            if(v.tile != nullptr)
-                v.tile->setOccupiedColor(0);
-        }
-        v.hits = std::clamp(v.hits, 0.f, 20.f);
-        this->updated++;
+        if(v.free)
+            v.tile->setOccupiedColor(0);
+        else
+            v.tile->setFreeColor();
     }
+    v.free = not v.free;
+}
+void Local_Grid::set_occupancy_model(const OccupancyModel::Params &params)
+{
+    occupancy_model = OccupancyModel(params);
+}
+float Local_Grid::occupancy_probability(const Eigen::Vector2f &p)
+{
+    auto &&[success, v] = getCell(radians_to_degrees(p.x()), p.y());
+    return success ? occupancy_model.probability(v.occupancy) : -1.f;
 }
 void Local_Grid::setCost(const Key &k,float cost)
 {
@@ -228,17 +272,20 @@ float Local_Grid::get_cost(const Eigen::Vector2f &p)
 }
 void Local_Grid::set_all_costs(float value)
 {
-    for(auto &[key, cell] : fmap)
-        cell.cost = value;
+    for_each_cell([value](const Key &, T &cell){ cell.cost = value; });
 }
 int Local_Grid::count_total() const
 {
-    return fmap.size();
+    return size();
 }
 void Local_Grid::set_all_to_free()
 {
-    for(auto &[k,v] : fmap)
-        set_free(k.ang, k.rad);
+    for_each_cell([](const Key &, T &v)
+    {
+        v.free = true;
+        if (v.tile != nullptr)
+            v.tile->setFreeColor();
+    });
 }
 void Local_Grid::markAreaInGridAs(const QPolygonF &poly, bool free)
 {
@@ -418,68 +465,90 @@ inline double Local_Grid::heuristicL2(const Key &a, const Key &b) const
 /////////////////////////////// COSTS /////////////////////////////////////////////////////////
 void Local_Grid::update_costs(bool wide)
 {
-    for(auto &&[k,v] : iter::filter([](auto v){ return std::get<1>(v).cost > 1;}, fmap))
+    for_each_cell([](const Key &, T &v)
     {
-        v.tile->setFreeColor();
-        v.cost = 1.f;
-    }
+        if (v.cost > 1)
+        {
+            v.tile->setFreeColor();
+            v.cost = 1.f;
+        }
+    });
 
     //update grid values
     if(wide)
     {
-        for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
+        for_each_cell([this](const Key &k, T &v)
         {
+            if (v.free) return;
             v.cost = 100;
             v.tile->setOccupiedColor(0);
             for (auto neighs = neighboors_16(k); auto &&[kk, vv]: neighs)
             {
-                fmap.at(kk).cost = 100;
-                fmap.at(kk).tile->setOccupiedColor(0);
-            }
-        }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 100; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 100)
-                {
-                    fmap.at(kk).cost = 50;
-                    fmap.at(kk).tile->setOccupiedColor(1);
-                }
-            }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 50; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
-            {
-                if (vv.cost < 50)
-                {
-                    fmap.at(kk).cost = 25;
-                    fmap.at(kk).tile->setOccupiedColor(2);
-                }
+                auto &&[success, c] = getCell(kk);
+                c.cost = 100;
+                c.tile->setOccupiedColor(0);
             }
-        for (auto &&[k, v]: iter::filter([](auto v) { return std::get<1>(v).cost == 25; }, fmap))
-            for (auto neighs = neighboors_8(k); auto &[kk, vv]: neighs)
+        });
+        // rings of decreasing cost around the occupied cells
+        for (auto &&[from, to, color] : {std::make_tuple(100.f, 50.f, 1), std::make_tuple(50.f, 25.f, 2), std::make_tuple(25.f, 15.f, 3)})
+            for_each_cell([this, from, to, color](const Key &k, T &v)
             {
-                if (vv.cost < 25)
-                {
-                    fmap.at(kk).cost = 15;
-                    fmap.at(kk).tile->setOccupiedColor(3);
-                }
-            }
+                if (v.cost != from) return;
+                for (auto neighs = neighboors_8(k); auto &&[kk, vv]: neighs)
+                    if (vv.cost < from)
+                    {
+                        auto &&[success, c] = getCell(kk);
+                        c.cost = to;
+                        c.tile->setOccupiedColor(color);
+                    }
+            });
     }
     else  // not wide
     {
-        for (auto &&[k, v]: iter::filterfalse([](auto v) { return std::get<1>(v).free; }, fmap))
+        for_each_cell([](const Key &, T &v)
         {
+            if (v.free) return;
             v.cost = 100;
             v.tile->setOccupiedColor(0);
-            fmap.at(k).cost = 100;
-            fmap.at(k).tile->setOccupiedColor(0);
-        }
+        });
     }
 }
 
 /////////////////////////////// UPDATE /////////////////////////////////////////////////////////
 void Local_Grid::update_map_from_polar_data( const std::vector<Eigen::Vector2f> &points, float max_laser_range)
 {
+    if (storage == Storage::Dense)
+    {
+        // each beam is a contiguous run of cells of its angle: misses up to the last sample before the tip, then the hit
+        for(const auto &point : points) // point.x() = angle; point.y() = radius
+        {
+            const float dist = point.y();
+            const int num_steps = ceil(dist/(radius_dim.step));
+            if (num_steps < 1) continue;
+            const int ang = radians_to_degrees(point.x());
+            if (ang < angle_dim.init or ang >= angle_dim.end) continue;
+            const long int ka = rint((ang - angle_dim.init) / angle_dim.step);
+            if (ka < 0 or ka >= dense.na) continue;
+            T *beam = &dense.cells[ka * dense.nr];
+            auto to_ring = [this](float rad){ return (long int)rint((int(rad) - radius_dim.init) / radius_dim.step); };
+            const float last_miss = num_steps > 1 ? dist * (num_steps - 2) / num_steps : -1.f;   // as the samples of the hashed path
+            const long int first = std::max(0L, to_ring(0.f)), last = std::min((long int)dense.nr - 1, to_ring(last_miss));
+            if (last_miss >= 0 and last >= first)
+            {
+                occupancy_model.apply(beam + first, last - first + 1, occupancy_model.miss, [this](T &v){ flip(v); });
+                updated += last - first + 1;
+            }
+            const long int tip = to_ring(dist);
+            if (tip >= 0 and tip < dense.nr and (int)dist >= radius_dim.init and (int)dist < radius_dim.end)
+            {
+                if (dist < max_laser_range)
+                    apply_hit(beam[tip]);
+                if (dist - std::max(last_miss, 0.f) < radius_dim.step)  // in case last miss overlaps tip
+                    apply_hit(beam[tip]);
+            }
+        }
+        return;
+    }
     Eigen::Vector2f paux;
     //qInfo() << __FUNCTION__ << points.size() << "points";
     for(const auto &point : points) // point.x() = angle; point.y() = radius
@@ -503,63 +572,144 @@ void Local_Grid::update_map_from_polar_data( const std::vector<Eigen::Vector2f>
 }
 void Local_Grid::update_map_from_3D_points( const std::vector<std::tuple<float, float, float>> &points)
 {
-
-
+    update_from_points(points.size(), [&points](std::size_t i){ return points[i]; });
 }
-void Local_Grid::update_semantic_layer(float ang, float dist, int object, int type)  // ang: -PI, PI is translated to 0-360 with 0,360 at front. dist mm
+void Local_Grid::update_map_from_3D_points(const float *xyz, std::size_t num_points, std::size_t stride)
 {
-    ang = 180-qRadiansToDegrees(ang);
-    auto &&[success, v] = getCell(int(ang), int(dist));
-    if(success)
+    update_from_points(num_points, [xyz, stride](std::size_t i)
     {
-        if(not semantic_map.contains(object))
+        const float *p = xyz + i * stride;
+        return std::make_tuple(p[0], p[1], p[2]);
+    });
+}
+void Local_Grid::update_map_from_3D_points(const float *x, const float *y, const float *z, std::size_t num_points)
+{
+    update_from_points(num_points, [x, y, z](std::size_t i){ return std::make_tuple(x[i], y[i], z[i]); });
+}
+void Local_Grid::set_update_threads(std::uint32_t num_threads)
+{
+    update_threads = std::max(1u, num_threads);
+    if (num_threads > 1)
+        update_pool = std::make_unique<ThreadPool>(num_threads - 1);  // the caller also bins points
+    else
+        update_pool.reset();
+}
+/**
+ @brief Bins the points by grid angle, keeping per bin the closest point in the height band and the farthest point
+ of any height, in parallel chunks with their own bins that are merged afterwards. Each bin then becomes one polar
+ beam: to its closest obstacle, or a free beam up to the farthest point if it has none.
+*/
+template <typename Point>
+void Local_Grid::update_from_points(std::size_t num_points, Point &&point)
+{
+    const int na = std::max(1, (int)ceil((angle_dim.end - angle_dim.init) / angle_dim.step));
+    constexpr float none = std::numeric_limits<float>::max();
+    struct Bins
+    {
+        std::vector<float> closest, farthest;
+    };
+    const std::size_t chunks = update_pool ? std::min<std::size_t>(4 * update_threads, std::max<std::size_t>(1, num_points / 4096)) : 1;
+    std::vector<Bins> bins(chunks, Bins{std::vector<float>(na, none), std::vector<float>(na, 0.f)});
+    const float min_h = params.min_obstacle_height, max_h = params.max_obstacle_height;
+    const float ang_init = angle_dim.init, ang_step = angle_dim.step, max_range = radius_dim.end;
+    auto bin_chunk = [&](std::size_t c)
+    {
+        auto &b = bins[c];
+        for (std::size_t i = c * num_points / chunks, end = (c + 1) * num_points / chunks; i < end; i++)
         {
-            float x = dist * sin(qDegreesToRadians(ang));
-            float y= -dist * cos(qDegreesToRadians(ang));
-            semantic_map.insert(std::make_pair(object, Object{.id=object,
-                    .ang=ang,
-                    .dist=dist,
-                    //.bbox=scene->addRect(- 250, - 250, 500, 500, QPen(QColor("green"), 40)),
-                    //.bbox=scene->addPixmap(human_image),
-                    .timestamp=rc::Timer<>::now()}));
-            if(type==0)  //human
-            {
-                semantic_map[object].bbox=scene->addPixmap(human_image);
-                semantic_map[object].bbox->setPos(x-human_image.width()/2, y-human_image.height()/2);
-            }
-            else if(type==56)  //chair
-            {
-                semantic_map[object].bbox=scene->addPixmap(chair_image);
-                semantic_map[object].bbox->setPos(x-chair_image.width()/2, y-chair_image.height()/2);
-
-            }
-            else if(type==58)  //plant
-            {
-                semantic_map[object].bbox = scene->addPixmap(plant_image);
-                semantic_map[object].bbox->setPos(x-chair_image.width()/2, y-chair_image.height()/2);
-            }
-            else
-            {
-                semantic_map[object].bbox = scene->addRect(-250, -250, 500, 500, QPen(QColor("green"), 40), QBrush(QColor("green")));
-                semantic_map[object].bbox->setPos(dist * sin(qDegreesToRadians(ang)), -dist * cos(qDegreesToRadians(ang)));
-            }
+            const auto [x, y, z] = point(i);
+            const float range = std::hypot(x, y);
+            if (not std::isfinite(range) or range >= max_range) continue;
+            const float ang = radians_to_degrees(std::atan2(x, y));
+            const int a = (int)((ang - ang_init) / ang_step);
+            if (a < 0 or a >= na) continue;
+            if (z >= min_h and z <= max_h)
+                b.closest[a] = std::min(b.closest[a], range);
+            b.farthest[a] = std::max(b.farthest[a], range);
         }
-        else //update only position and timealive
+    };
+    if (update_pool and chunks > 1)
+        update_pool->parallel_for(0, chunks, 1, bin_chunk);
+    else
+        for (std::size_t c = 0; c < chunks; c++) bin_chunk(c);
+
+    std::vector<Eigen::Vector2f> beams, free_beams;
+    beams.reserve(na);
+    for (int a = 0; a < na; a++)
+    {
+        float closest = none, farthest = 0.f;
+        for (const auto &b : bins)
         {
-            semantic_map[object].ang = ang;
-            semantic_map[object].dist = dist;
-            semantic_map[object].bbox->setPos(dist*sin(qDegreesToRadians(ang)), -dist*cos(qDegreesToRadians(ang)));
-            semantic_map[object].timestamp = rc::Timer<>::now();
+            closest = std::min(closest, b.closest[a]);
+            farthest = std::max(farthest, b.farthest[a]);
         }
-        // get list of removable objects
-        auto removable = semantic_map | std::views::values | std::views::filter([p = params](auto o) { return (rc::Timer<>::now() - o.timestamp) > p.max_object_unseen_timelife; });
-        for(const auto &r : removable)
+        if (farthest == 0.f) continue;   // nothing seen in this bin
+        const float ang = qDegreesToRadians(ang_init + (a + 0.5f) * ang_step);
+        if (closest != none)
+            beams.emplace_back(ang, closest);
+        else if (farthest >= radius_dim.step)   // shorter free beams would be taken as hits
+            free_beams.emplace_back(ang, farthest);
+    }
+    update_map_from_polar_data(beams, max_range);
+    update_map_from_polar_data(free_beams, 0.f);   // no hit at their end
+}
+void Local_Grid::update_semantic_layer(float ang, float dist, int object, int type)  // ang: -PI, PI is translated to 0-360 with 0,360 at front. dist mm
+{
+    update_semantic_layer(std::vector<Detection>{Detection{ang, dist, object, type}});
+}
+void Local_Grid::update_semantic_layer(const std::vector<Detection> &detections)
+{
+    const auto now = rc::Timer<>::now();
+    for (const auto &d : detections)
+    {
+        const float ang = 180 - qRadiansToDegrees(d.ang);
+        auto &&[success, v] = getCell(int(ang), int(d.dist));
+        if (success)
+            semantic_layer.observe(d.object, d.type, ang, d.dist, now);
+    }
+    semantic_layer.expire(now);
+    draw_semantic_layer();
+}
+void Local_Grid::draw_semantic_layer()
+{
+    const auto changes = semantic_layer.take_changes();
+    for (int id : changes.removed)
+        if (auto it = semantic_items.find(id); it != semantic_items.end())
         {
-            scene->removeItem(r.bbox);
-            delete r.bbox;
-            semantic_map.erase(r.id);
+            scene->removeItem(it->second);
+            delete it->second;
+            semantic_items.erase(it);
         }
+    auto place = [](QGraphicsItem *item, const SemanticLayer::Object &o)
+    { item->setPos(o.dist * sin(qDegreesToRadians(o.ang)), -o.dist * cos(qDegreesToRadians(o.ang))); };
+    for (int id : changes.added)
+    {
+        const auto &o = *semantic_layer.find(id);
+        QGraphicsItem *item;
+        auto pixmap = [this](const QPixmap &image)
+        {
+            auto p = scene->addPixmap(image);
+            p->setOffset(-image.width() / 2, -image.height() / 2);   // centered at the object
+            return p;
+        };
+        if (o.type == 0)  //human
+            item = pixmap(human_image);
+        else if (o.type == 56)  //chair
+            item = pixmap(chair_image);
+        else if (o.type == 58)  //plant
+            item = pixmap(plant_image);
+        else
+            item = scene->addRect(-250, -250, 500, 500, QPen(QColor("green"), 40), QBrush(QColor("green")));
+        place(item, o);
+        semantic_items[id] = item;
     }
+    for (int id : changes.moved)
+        place(semantic_items.at(id), *semantic_layer.find(id));
+}
+std::vector<int> Local_Grid::semantic_objects_in_sector(float ang_from, float ang_to) const
+{
+    // the grid angle runs opposite to the detections angle
+    return semantic_layer.in_sector(180 - qRadiansToDegrees(ang_to), 180 - qRadiansToDegrees(ang_from));
 }
 /////////////////////////////// AUX /////////////////////////////////////////////////////////
 bool Local_Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // grid coordinates
@@ -571,9 +721,9 @@ bool Local_Grid::is_path_blocked(const std::vector<Eigen::Vector2f> &path) // gr
 }
 void Local_Grid::clear()
 {
-    for (const auto &[key, value]: fmap)
-        scene->removeItem(value.tile);
+    for_each_cell([this](const Key &, T &value){ scene->removeItem(value.tile); });
     fmap.clear();
+    dense.cells.clear();
 }
 ////////////////////////////// NEIGHS /////////////////////////////////////////////////////////
 std::optional<QPointF> Local_Grid::closestMatching_spiralMove(const QPointF &p, std::function<bool(std::pair<Local_Grid::Key, Local_Grid::T>)> pred)
@@ -34,6 +34,10 @@
 #include "qgraphicscellitem.h"
 #include <ranges>
 #include <timer/timer.h>
+#include <threadpool/threadpool.h>
+#include <grid2d/occupancy.h>
+#include "semantic_layer.h"
+#include <memory>
 
 
 class Local_Grid
@@ -82,11 +86,9 @@ public:
         std::uint32_t id;
         bool free = true;
         bool visited = false;
+        std::int16_t occupancy = 0;   // fixed-point log-odds (see OccupancyModel), 0 is the prior p = 0.5
         float cost = 1;
-        float hits = 0;
-        float misses = 0;
         QGraphicsCellItem *tile;
-        double log_odds = 0.0;  //log prior
 
         // semantic elements
         int semantic_id;
@@ -98,16 +100,17 @@ public:
         { is >> free >> visited; };
     };
 
-    // Object data structure
-    struct Object
+    // Semantic objects: the layer keeps their state and expiry, the items of the scene are updated once per call
+    // to update_semantic_layer from the changes of the layer
+    struct Detection
     {
-        int id;
-        float ang;
-        float dist;
-        QGraphicsItem *bbox;
-        std::int64_t timestamp;
+        float ang;      // rads, -PI, PI with 0 at front
+        float dist;     // mm
+        int object;     // id
+        int type;       // 0 human, 56 chair, 58 plant, other
     };
-    std::map<int, Object> semantic_map;
+    SemanticLayer semantic_layer;
+    std::unordered_map<int, QGraphicsItem *> semantic_items;
 
     using FMap = std::unordered_map<Key, T, KeyHasher>;
     std::vector<Key> keys_vector;
@@ -120,15 +123,28 @@ public:
     QRectF dim;
     Ranges angle_dim, radius_dim;
 
+    // Cell storage selected in initialize: Hashed keeps the cells in 'fmap', Dense in an [angle][radius] array, so
+    // the cells of a beam are contiguous and a scan is applied as one run of misses and a hit per beam.
+    enum class Storage { Hashed, Dense };
+
     void initialize( Ranges angle_dim_,
                      Ranges radius_dim_,
-                     QGraphicsScene *scene_ = nullptr);
+                     QGraphicsScene *scene_ = nullptr,
+                     Storage storage_ = Storage::Hashed);
     void clear();
     std::list<QPointF> computePath(const QPointF &source_, const QPointF &target_);
     std::vector<Eigen::Vector2f> compute_path(const QPointF &source_, const QPointF &target_);
     void update_map_from_polar_data( const std::vector<Eigen::Vector2f> &points, float max_laser_range);
+    // 3D points in the robot frame (mm, z up, angle measured from +y towards +x): the points in the height band are
+    // binned by grid angle, the closest of each bin is its hit and the bins with no obstacle are cleared up to the
+    // farthest point seen in them
     void update_map_from_3D_points(const std::vector<std::tuple<float, float, float>> &points);
+    void update_map_from_3D_points(const float *xyz, std::size_t num_points, std::size_t stride = 3);  // x, y, z[, ...] per point
+    void update_map_from_3D_points(const float *x, const float *y, const float *z, std::size_t num_points);
+    void set_update_threads(std::uint32_t num_threads);   // threads used to bin the 3D points (0 or 1: caller's thread)
     void update_semantic_layer(float ang, float dist, int object, int type);
+    void update_semantic_layer(const std::vector<Detection> &detections);     // one frame of detections
+    std::vector<int> semantic_objects_in_sector(float ang_from, float ang_to) const;   // rads, as the detections
     bool is_path_blocked(const std::vector<Eigen::Vector2f> &path); // grid coordinates
 
     // Cell access
@@ -136,6 +152,22 @@ public:
     inline std::tuple<bool, T &> getCell(const Key &k);
     inline std::tuple<bool, T &> getCell(const Eigen::Vector2f &p);
     
+    // Calls f(key, cell) for every cell, with any storage. begin()/end() only iterate the Hashed storage.
+    template <typename F>
+    void for_each_cell(F &&f)
+    {
+        if (storage == Storage::Dense)
+        {
+            for (long int i = 0; i < (long int) dense.cells.size(); ++i)
+                f(index_to_key(i), dense.cells[i]);
+        }
+        else
+            for (auto &[k, v] : fmap)
+                f(k, v);
+    }
+    Storage get_storage() const
+    { return storage; };
+
     // Iterators
     typename FMap::iterator begin()
     { return fmap.begin(); };
@@ -146,7 +178,7 @@ public:
     typename FMap::const_iterator end() const
     { return fmap.begin(); };
     size_t size() const
-    { return fmap.size(); };
+    { return storage == Storage::Dense ? dense.cells.size() : fmap.size(); };
 
     // Access to content
     void insert(const Key &key, const T &value);
@@ -171,6 +203,11 @@ public:
     void log_update(const Eigen::Vector2f &p, float prob);
     double log_odds(double prob);
     double retrieve_p(double l);
+    // Hit and miss increments, clamping and thresholds used by update_map_from_polar_data, add_hit and add_miss
+    void set_occupancy_model(const OccupancyModel::Params &params);
+    const OccupancyModel &get_occupancy_model() const
+    { return occupancy_model; };
+    float occupancy_probability(const Eigen::Vector2f &p);      // p = (angle in radians, radius), -1 out of the grid
     float percentage_changed();
     int count_total() const;
     int count_total_visited() const;
@@ -190,6 +227,28 @@ public:
 
 private:
     FMap fmap;
+
+    // Dense storage: cell (ia, ir) is at ia * nr + ir, which is also its id
+    struct Dense
+    {
+        int na = 0, nr = 0;
+        std::vector<T> cells;
+    };
+    Storage storage = Storage::Hashed;
+    Dense dense;
+    inline long int cell_index(int ang, int rad) const;    // deg, mm. -1 if out of the grid
+    inline Key index_to_key(long int i) const
+    { return Key(angle_dim.init + (i / dense.nr) * angle_dim.step, radius_dim.init + (i % dense.nr) * radius_dim.step); };
+    void apply_miss(T &v);
+    void apply_hit(T &v);
+    void flip(T &v);
+    void draw_semantic_layer();
+    OccupancyModel occupancy_model;
+    std::unique_ptr<ThreadPool> update_pool;
+    std::uint32_t update_threads = 1;
+    template <typename Point>
+    void update_from_points(std::size_t num_points, Point &&point);
+
     QGraphicsScene *scene;
     std::vector<QGraphicsRectItem *> scene_grid_points;
     double updated=0.0, flipped=0.0;
@@ -208,6 +267,8 @@ private:
         const QString occupied_color = "orange";
         const float occupancy_threshold = 0.5;
         const std::uint32_t max_object_unseen_timelife = 2000; //ms
+        const float min_obstacle_height = 100; // mm. Band of the 3D points taken as obstacles
+        const float max_obstacle_height = 1800;
     };
     Params params;
 
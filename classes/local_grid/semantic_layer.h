@@ -0,0 +1,259 @@
+/*
+ * Semantic layer of Local_Grid: the objects detected around the robot, with no Qt dependency.
+ *
+ * The objects are stored contiguously and found by id through a hash map. Each observation pushes its time to a
+ * min-heap, so expire() only pops the entries older than the time to live (entries superseded by a later observation
+ * are skipped when they come out). The objects are also indexed in angular buckets, for sector queries. The graphic
+ * side is not touched: the layer records which objects were added, moved or removed, and take_changes() returns each
+ * of them once, so the items can be updated once per frame whatever the number of detections.
+ *
+ *      SemanticLayer layer(2000);                      // ms unseen before an object is removed
+ *      for (const auto &d : detections)
+ *          layer.observe(d.id, d.type, d.ang, d.dist, now);
+ *      layer.expire(now);
+ *      auto changes = layer.take_changes();            // removed first, then added and moved
+ *      layer.for_each_in_sector(350.f, 10.f, [](const auto &o){ ... });
+ */
+
+#ifndef SEMANTIC_LAYER_H
+#define SEMANTIC_LAYER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class SemanticLayer
+{
+public:
+    struct Object
+    {
+        int id;
+        int type;
+        float ang;                      // degrees, [0, 360)
+        float dist;                     // mm
+        std::int64_t timestamp;         // ms, last observation
+    };
+    struct Changes
+    {
+        std::vector<int> removed;       // ids, an id may also be in added when it was removed and seen again
+        std::vector<int> added;
+        std::vector<int> moved;
+    };
+
+    explicit SemanticLayer(std::int64_t max_unseen = 2000, float bucket_degrees = 10.f)
+        : max_unseen(max_unseen), bucket_degrees(bucket_degrees), buckets(std::size_t(std::ceil(360.f / bucket_degrees)))
+    {}
+
+    // New object or new position of a known one. A change of type is taken as a new object.
+    void observe(int id, int type, float ang, float dist, std::int64_t now)
+    {
+        ang = wrap(ang);
+        if (auto it = index.find(id); it != index.end())
+        {
+            Entry &e = objects[it->second];
+            if (e.object.type != type)
+            {
+                remove(it->second);
+                add(Object{id, type, ang, dist, now});
+            }
+            else
+            {
+                e.object.ang = ang;
+                e.object.dist = dist;
+                e.object.timestamp = now;
+                rebucket(it->second);
+                mark(e, Pending::Moved);
+            }
+        }
+        else
+            add(Object{id, type, ang, dist, now});
+        heap.emplace(now, id);
+        if (heap.size() > 4 * objects.size() + 64)
+            compact();
+    }
+    // Removes the objects unseen for more than max_unseen ms. Returns how many.
+    std::size_t expire(std::int64_t now)
+    {
+        std::size_t n = 0;
+        while (not heap.empty() and now - heap.top().first > max_unseen)
+        {
+            const auto [t, id] = heap.top();
+            heap.pop();
+            if (auto it = index.find(id); it != index.end() and objects[it->second].object.timestamp == t)
+            {
+                remove(it->second);
+                n++;
+            }
+        }
+        return n;
+    }
+    bool erase(int id)
+    {
+        auto it = index.find(id);
+        if (it == index.end())
+            return false;
+        remove(it->second);
+        return true;
+    }
+    void clear()
+    {
+        for (const Entry &e : objects)
+            changes.removed.push_back(e.object.id);
+        objects.clear();
+        index.clear();
+        heap = Heap();
+        for (auto &b : buckets)
+            b.clear();
+        dirty.clear();
+    }
+
+    const Object *find(int id) const
+    {
+        auto it = index.find(id);
+        return it == index.end() ? nullptr : &objects[it->second].object;
+    }
+    std::size_t size() const { return objects.size(); }
+    std::int64_t time_to_live() const { return max_unseen; }
+    template <typename F>
+    void for_each(F &&f) const
+    {
+        for (const Entry &e : objects)
+            f(e.object);
+    }
+    // Objects with angle in [from, to] degrees, going counterclockwise from 'from', so (350, 10) crosses 0
+    template <typename F>
+    void for_each_in_sector(float from, float to, F &&f) const
+    {
+        from = wrap(from);
+        to = wrap(to);
+        const float width = to >= from ? to - from : to + 360.f - from;
+        const std::size_t first = bucket(from), count = std::size_t(width / bucket_degrees) + 2;
+        for (std::size_t i = 0; i < std::min(count, buckets.size()); i++)
+            for (std::uint32_t slot : buckets[(first + i) % buckets.size()])
+            {
+                const Object &o = objects[slot].object;
+                float d = o.ang - from;
+                if (d < 0) d += 360.f;
+                if (d <= width)
+                    f(o);
+            }
+    }
+    std::vector<int> in_sector(float from, float to) const
+    {
+        std::vector<int> ids;
+        for_each_in_sector(from, to, [&ids](const Object &o){ ids.push_back(o.id); });
+        return ids;
+    }
+
+    // Changes since the previous call, each object once
+    Changes take_changes()
+    {
+        Changes out = std::move(changes);
+        changes = Changes();
+        for (int id : dirty)
+            if (auto it = index.find(id); it != index.end())
+            {
+                Entry &e = objects[it->second];
+                if (e.pending == Pending::Added)
+                    out.added.push_back(id);
+                else if (e.pending == Pending::Moved)
+                    out.moved.push_back(id);
+                e.pending = Pending::None;
+            }
+        dirty.clear();
+        return out;
+    }
+
+private:
+    enum class Pending : std::uint8_t { None, Moved, Added };
+    struct Entry
+    {
+        Object object;
+        std::uint32_t bucket, bucket_pos;
+        Pending pending;
+    };
+    using Heap = std::priority_queue<std::pair<std::int64_t, int>, std::vector<std::pair<std::int64_t, int>>, std::greater<>>;
+
+    static float wrap(float ang)
+    {
+        ang = std::fmod(ang, 360.f);
+        return ang < 0 ? ang + 360.f : ang;
+    }
+    std::size_t bucket(float ang) const { return std::min(std::size_t(ang / bucket_degrees), buckets.size() - 1); }
+
+    void mark(Entry &e, Pending p)
+    {
+        if (e.pending == Pending::None)
+            dirty.push_back(e.object.id);
+        if (e.pending != Pending::Added)
+            e.pending = p;
+    }
+    void add(const Object &o)
+    {
+        const auto slot = (std::uint32_t)objects.size();
+        const auto b = (std::uint32_t)bucket(o.ang);
+        objects.push_back(Entry{o, b, (std::uint32_t)buckets[b].size(), Pending::None});
+        buckets[b].push_back(slot);
+        index[o.id] = slot;
+        mark(objects.back(), Pending::Added);
+    }
+    void unbucket(std::uint32_t slot)
+    {
+        const Entry &e = objects[slot];
+        auto &b = buckets[e.bucket];
+        objects[b.back()].bucket_pos = e.bucket_pos;
+        b[e.bucket_pos] = b.back();
+        b.pop_back();
+    }
+    void rebucket(std::uint32_t slot)
+    {
+        Entry &e = objects[slot];
+        const auto b = (std::uint32_t)bucket(e.object.ang);
+        if (b == e.bucket)
+            return;
+        unbucket(slot);
+        e.bucket = b;
+        e.bucket_pos = (std::uint32_t)buckets[b].size();
+        buckets[b].push_back(slot);
+    }
+    // swaps the last object into the slot, its index and bucket entries follow it
+    void remove(std::uint32_t slot)
+    {
+        changes.removed.push_back(objects[slot].object.id);
+        unbucket(slot);
+        index.erase(objects[slot].object.id);
+        const auto last = (std::uint32_t)objects.size() - 1;
+        if (slot != last)
+        {
+            objects[slot] = objects[last];
+            index[objects[slot].object.id] = slot;
+            buckets[objects[slot].bucket][objects[slot].bucket_pos] = slot;
+        }
+        objects.pop_back();
+    }
+    // drops the superseded heap entries, one per object remains
+    void compact()
+    {
+        std::vector<std::pair<std::int64_t, int>> entries;
+        entries.reserve(objects.size());
+        for (const Entry &e : objects)
+            entries.emplace_back(e.object.timestamp, e.object.id);
+        heap = Heap(std::greater<>(), std::move(entries));
+    }
+
+    std::int64_t max_unseen;
+    float bucket_degrees;
+    std::vector<Entry> objects;
+    std::unordered_map<int, std::uint32_t> index;
+    Heap heap;
+    std::vector<std::vector<std::uint32_t>> buckets;     // slots of the objects by angle
+    std::vector<int> dirty;                              // ids with a pending change
+    Changes changes;
+};
+
+#endif // SEMANTIC_LAYER_H
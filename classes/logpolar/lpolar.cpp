@@ -17,6 +17,14 @@
  *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "lpolar.h"
+#include <string.h>
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 LPolar::LPolar()
 {
@@ -55,71 +63,167 @@ void LPolar::initLPolar(int _ecc, int _ang, int _w, int _h)
 	if (w < h) s = w;
 	else s= h;
 
-	//Tables for short conversion
-	TX = new int*[ecc];
-	for(int i=0;i<ecc;i++)
-  		TX[i] = new int[ang];
-	TY = new int*[ecc];
-	for(int i=0;i<ecc;i++)
-  		TY[i] = new int[ang];
-
-	//Tables for conversion using the mean of region
-	LX = new int**[ecc];
-	for(int i=0;i<ecc;i++)
-		LX[i] = new int*[ang];
-	LY = new int**[ecc];
-	for(int i=0;i<ecc;i++)
-  		LY[i] = new int*[ang];
+	//Tables shared with the other instances of the same geometry. The ones for the conversion using the mean of
+	//region and for the dense inverse are built on first use.
+	tables = sharedTables(ecc, ang, w, h);
+	offsets = Offsets();
+	initData();
+}
 
-	//Initialize 2D array of TData for dense inverse
-	for(int i=0; i<s; i++)
+/**
+ * Tables of a geometry, created empty the first time it is asked for and alive while an instance uses them
+ */
+std::shared_ptr<LPolar::Tables> LPolar::sharedTables(int ecc, int ang, int w, int h)
+{
+	static std::mutex mutex;
+	static std::map<std::tuple<int,int,int,int>, std::weak_ptr<Tables>> cache;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto &entry = cache[std::make_tuple(ecc, ang, w, h)];
+	std::shared_ptr<Tables> t = entry.lock();
+	if (not t)
 	{
-		QVector<TDato> cols(s);
-		DILP.push_back(cols);
+		t = std::make_shared<Tables>();
+		entry = t;
 	}
-
-	initData();
-	initDataCompleto();
-	initDataDILP(ecc,ang,s);
+	return t;
 }
 	
 void LPolar::convert(unsigned char *in, unsigned char *out )
 {
-	int i,j;
-		
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
- 			 *(out+(i*ang+j))= in[TY[i][j]*s+TX[i][j]];
-	}
+	convert(in, out, s, 1);
 }
 void LPolar::convertPromedio(unsigned char *in, unsigned char *out )
 {
-	int i,j,k,tam,sum;
-	
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
-  	  	tam=LX[i][j][0];
-  	  	sum=0;
-  	  	for(k=1;k<tam+1;k++)
-  	  		sum += in[LY[i][j][k]*s+LX[i][j][k]];
- 			 	*(out+(i*ang+j))= sum/tam;
- 			}
+	convertPromedio(in, out, s, 1);
 }
-void LPolar::inverse(unsigned char *in, unsigned char *out )
+
+/**
+ * Byte offsets of the table pixels for an input with 'stride' bytes per row and 'channels' bytes per pixel
+ */
+const LPolar::Offsets &LPolar::prepareOffsets(int stride, int channels, bool region)
 {
-	int i,j;
-	
-	for (i=1;i<ecc;i++)
-  	  for (j=0;j<ang;j++){
-			out[TY[i][j]*s+TX[i][j]]= in[i*ang+j];
+	const Tables &t = *tables;
+	if (offsets.stride != stride or offsets.channels != channels)
+	{
+		offsets.stride = stride;
+		offsets.channels = channels;
+		offsets.sample.resize(t.TX.size());
+		for (size_t c=0; c<t.TX.size(); c++)
+			offsets.sample[c] = t.TY[c]*stride + t.TX[c]*channels;
+		offsets.region.clear();
+	}
+	if (region and offsets.region.empty())
+	{
+		initDataCompleto();
+		offsets.region.resize(t.regionX.size());
+		for (size_t k=0; k<t.regionX.size(); k++)
+			offsets.region[k] = t.regionY[k]*stride + t.regionX[k]*channels;
+	}
+	return offsets;
+}
+
+/**
+ * Conversion sampling a pixel per cell
+ * @param in cartesian image, 'stride' bytes per row
+ * @param out log-polar image, ecc x ang cells of 'channels' bytes
+ */
+void LPolar::convert(const unsigned char *in, unsigned char *out, int stride, int channels)
+{
+	const Offsets &o = prepareOffsets(stride, channels);
+	const int *off = o.sample.data();
+	int c = ang, end = ecc*ang;
+	if (channels == 1)
+	{
+#ifdef __AVX2__
+		// 8 cells per gather of 32 bits. The pixels of the last row can not be read 4 bytes at a time.
+		const int last = (s-1)*stride;
+		for (; c+8 <= end; c+=8)
+		{
+			__m256i idx = _mm256_loadu_si256((const __m256i *)(off+c));
+			if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(idx, _mm256_set1_epi32(last-1))) != 0)
+			{
+				for (int k=c; k<c+8; k++)
+					out[k] = in[off[k]];
+				continue;
+			}
+			__m256i v = _mm256_and_si256(_mm256_i32gather_epi32((const int *)in, idx, 1), _mm256_set1_epi32(0xff));
+			v = _mm256_packus_epi32(v, v);
+			v = _mm256_packus_epi16(v, v);
+			const int lo = _mm256_extract_epi32(v, 0), hi = _mm256_extract_epi32(v, 4);
+			memcpy(out+c, &lo, 4);
+			memcpy(out+c+4, &hi, 4);
+		}
+#endif
+		for (; c<end; c++)
+			out[c] = in[off[c]];
+	}
+	else
+		for (; c<end; c++)
+			for (int k=0; k<channels; k++)
+				out[c*channels+k] = in[off[c]+k];
+}
+
+/**
+ * Conversion averaging the pixels of the region of every cell
+ */
+void LPolar::convertPromedio(const unsigned char *in, unsigned char *out, int stride, int channels)
+{
+	const Offsets &o = prepareOffsets(stride, channels, true);
+	const std::vector<int> &regionStart = tables->regionStart;
+	const int *off = o.region.data();
+	int sum[4];
+	for (int c=ang; c<ecc*ang; c++)
+	{
+		const int b = regionStart[c], e = regionStart[c+1], tam = e-b;
+		if (channels == 1)
+		{
+			int acc = 0;
+			for (int k=b; k<e; k++)
+				acc += in[off[k]];
+			out[c] = acc/tam;
+			continue;
+		}
+		for (int ch=0; ch<channels; ch+=4)
+		{
+			const int n = std::min(4, channels-ch);
+			sum[0] = sum[1] = sum[2] = sum[3] = 0;
+			for (int k=b; k<e; k++)
+				for (int m=0; m<n; m++)
+					sum[m] += in[off[k]+ch+m];
+			for (int m=0; m<n; m++)
+				out[c*channels+ch+m] = sum[m]/tam;
+		}
 	}
 }
+
+void LPolar::convertBatch(const std::vector<const unsigned char *> &in, const std::vector<unsigned char *> &out, int stride, int channels, bool promedio)
+{
+	prepareOffsets(stride, channels, promedio);  // before the threads, so that they only read the tables
+	const int n = std::min(in.size(), out.size());
+	#pragma omp parallel for schedule(dynamic)
+	for (int f=0; f<n; f++)
+	{
+		if (promedio)
+			convertPromedio(in[f], out[f], stride, channels);
+		else
+			convert(in[f], out[f], stride, channels);
+	}
+}
+
+void LPolar::inverse(unsigned char *in, unsigned char *out )
+{
+	const Tables &t = *tables;
+	for (int c=ang; c<ecc*ang; c++)
+		out[t.TY[c]*s+t.TX[c]]= in[c];
+}
 // Inverse conversion with interpolation to fill the whole cartesian image
 void LPolar::inverseComplete(unsigned char *in, unsigned char *out, int width )
 {
 	int i,j;
 	
 	width=width;
+	initDataDILP(ecc,ang,s);
+	const QVector<QVector<TDato > > &DILP = tables->DILP;
 	for (i=0;i<s;i++)
   	  for (j=0;j<s;j++)
 		{
@@ -128,10 +232,15 @@ void LPolar::inverseComplete(unsigned char *in, unsigned char *out, int width )
 }
 void LPolar::initData( )
 {
+	Tables &t = *tables;
+	std::call_once(t.sampleBuilt, [&]
+	{
 	float p,alfa,base;
 	float radius=s/2.;
 	int x,y;
   	
+	t.TX.assign(ecc*ang, 0);
+	t.TY.assign(ecc*ang, 0);
 	base = exp(log(radius)/((float)ecc));  //Such that pow(base,ecc) = radius
 	for (int i=1;i<ecc;i++)
     	for (int j=0;j<ang;j++)
@@ -142,22 +251,24 @@ void LPolar::initData( )
         		y = (int)round(p*sin(alfa)+radius+1);
         		if (x >= s) x=s-1;
         		if (y >= s) y=s-1;
-        		TX[i][j]=x; 
-        		TY[i][j]=y;
+        		t.TX[i*ang+j]=x; 
+        		t.TY[i*ang+j]=y;
    			}
-
+	});
 }
 
 // Inicializaci�n completa de tablas
 
 void LPolar::initDataCompleto( )
 {
+  Tables &t = *tables;
+  std::call_once(t.regionBuilt, [&]
+  {
   float p,alfa;
-  int x,y,tamx=0,tamy=0,k,l,tam,radio,xL,yL;
+  int x,y,k,l,tam,radio,xL,yL;
+  std::vector<int> &regionStart = t.regionStart, &regionX = t.regionX, &regionY = t.regionY;
   
-	if (w < h) s = w; 
-	else s= h; 
-	
+	regionStart.assign(ecc*ang+1, 0);
 	base = exp(log((float)s/2.)/((float)ecc));
 	for (int i=1;i<ecc;i++){
 		p = pow(base,i);	
@@ -169,29 +280,9 @@ void LPolar::initDataCompleto( )
         	y = (int)round(p*sin(alfa)+(s/2)+1);
         	if (x >= s) x=x-1;
         	if (y >= s) y=y-1;
-        	tam=0; 
-        	//calculo cuantos elementos hay
-        	for(k=x-radio;k<x+radio;k++)
-        		for(l=y-radio;l<y+radio;l++)
-        		   if(sqrt(((k-x)*(k-x))+((l-y)*(l-y))) <= radio) {
-         			 tam++;
-        			}
-        	//hago sitio y relleno
-        	if(tam==0){
-        		LX[i][j]=new int[2];
-        		LX[i][j][0]=1;
-        		LX[i][j][1]=x;
-        		LY[i][j]=new int[2];
-        		LY[i][j][0]=1;
-        		LY[i][j][1]=y;
-        	}
-        	else{
-        		tamx=1;
-        		tamy=1;
-        		LX[i][j]=new int[tam+1];
-        		LX[i][j][0]=tam;
-        		LY[i][j]=new int[tam+1];
-        		LY[i][j][0]=tam;
+        	//relleno: the cells are filled in order, so each region starts where the previous one ends
+        	regionStart[i*ang+j]=regionX.size();
+        	tam=0;
         		for(k=x-radio;k<x+radio;k++)
         			for(l=y-radio;l<y+radio;l++)
         		   		if(sqrt(((k-x)*(k-x))+((l-y)*(l-y))) <= radio)
@@ -202,13 +293,19 @@ void LPolar::initDataCompleto( )
         		    		if(yL>(s-1)) yL=(s-1); 
          			  		if(xL<0) xL=0;
          					if(yL<0) yL=0;
-         			  		LX[i][j][tamx++]=xL;
-         			  		LY[i][j][tamy++]=yL;
+         			  		regionX.push_back(xL);
+         			  		regionY.push_back(yL);
+         			  		tam++;
         				}
+        	if(tam==0){
+        		regionX.push_back(x);
+        		regionY.push_back(y);
         	}
+        	regionStart[i*ang+j+1]=regionX.size();
          // printf("n campo %d",tam);
         }
    }
+  });
 }
 
 /**
@@ -218,9 +315,19 @@ void LPolar::initDataCompleto( )
  */
 void LPolar::initDataDILP(int ecc, int ang, int s)
 {
+	Tables &t = *tables;
+	std::call_once(t.dilpBuilt, [&]
+	{
 	float base,mod,lmod,alfa,lalfa,x,y;
 	float radius= (float)s/2.;
+	QVector<QVector<TDato > > &DILP = t.DILP;
 	  		
+	//Initialize 2D array of TData for dense inverse
+	for(int i=0; i<s; i++)
+	{
+		QVector<TDato> cols(s);
+		DILP.push_back(cols);
+	}
 	base = exp(log(radius)/((float)ecc));  //Such that pow(base,ecc) = radius
 
 	for(int i=0; i<s; i++)
@@ -242,7 +349,7 @@ void LPolar::initDataDILP(int ecc, int ang, int s)
 			DILP[i][j].ang = (int)rintf(lalfa);
 			
 		}
-		
+	});
 }
 
 //CUIDADO. USANDO LAS TABLAS TX,TY
@@ -254,8 +361,100 @@ void LPolar::initDataDILP(int ecc, int ang, int s)
  */
 void LPolar::convertPointLPtoC( int e, int a, int * x, int * y )
 {
-  *x = TX[e][a];
-  *y = TY[e][a];
+  *x = tables->TX[e*ang+a];
+  *y = tables->TY[e*ang+a];
 }
 
 
+
+/**
+ * Bilinear reconstruction table for an output of outWidth x outHeight pixels. Every output pixel is taken back to
+ * the s x s square, to its continuous (eccentricity, angle) coordinates, and the weights of the 4 surrounding cells
+ * are stored in fixed point. The angle wraps around and the eccentricity is clamped to 1..ecc-1.
+ */
+const std::vector<LPolar::Bilinear> &LPolar::bilinearTable(int outWidth, int outHeight)
+{
+	Tables &t = *tables;
+	std::lock_guard<std::mutex> lock(t.bilinearMutex);
+	std::vector<Bilinear> &table = t.bilinear[std::make_pair(outWidth, outHeight)];
+	if (not table.empty())
+		return table;
+
+	const double radius = s/2., logBase = log(radius)/ecc;
+	table.resize(outWidth*outHeight);
+	for (int oy=0; oy<outHeight; oy++)
+		for (int ox=0; ox<outWidth; ox++)
+		{
+			// pixel centers, and the same +1 offset as the direct tables
+			const double x = (ox+0.5)*s/outWidth - 0.5 - radius - 1, y = (oy+0.5)*s/outHeight - 0.5 - radius - 1;
+			const double mod = std::max(sqrt(x*x + y*y), 1e-6);
+			const double le = std::min(std::max(log(mod)/logBase, 1.), ecc-1.);
+			const double la = (atan2(y, x) + M_PI) * ang / (2.*M_PI);
+			const int e0 = std::min((int)le, ecc-1), e1 = std::min(e0+1, ecc-1);
+			const int a = (int)floor(la), a0 = ((a % ang) + ang) % ang, a1 = (a0+1) % ang;
+			const double fe = le - e0, fa = la - a;
+			Bilinear &b = table[oy*outWidth+ox];
+			b.cell[0] = e0*ang+a0; b.cell[1] = e0*ang+a1;
+			b.cell[2] = e1*ang+a0; b.cell[3] = e1*ang+a1;
+			const double wgt[4] = {(1-fe)*(1-fa), (1-fe)*fa, fe*(1-fa), fe*fa};
+			int sum = 0, largest = 0;
+			for (int k=0; k<4; k++)
+			{
+				b.weight[k] = (uint16_t)lrint(wgt[k]*16384);
+				sum += b.weight[k];
+				if (b.weight[k] > b.weight[largest]) largest = k;
+			}
+			b.weight[largest] += 16384 - sum;     // the weights add up to 1 exactly
+		}
+	return table;
+}
+
+void LPolar::inverseBilinear(const unsigned char *in, unsigned char *out, int outWidth, int outHeight, int channels, int threads)
+{
+	if (outWidth <= 0 or outHeight <= 0) { outWidth = s; outHeight = s; }
+	const Bilinear *table = bilinearTable(outWidth, outHeight).data();
+#ifdef _OPENMP
+	if (threads <= 0) threads = omp_get_max_threads();
+#endif
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for (int oy=0; oy<outHeight; oy++)
+		for (int ox=oy*outWidth; ox<(oy+1)*outWidth; ox++)
+		{
+			const Bilinear &b = table[ox];
+			for (int ch=0; ch<channels; ch++)
+			{
+				const int v = b.weight[0]*in[b.cell[0]*channels+ch] + b.weight[1]*in[b.cell[1]*channels+ch] +
+				              b.weight[2]*in[b.cell[2]*channels+ch] + b.weight[3]*in[b.cell[3]*channels+ch];
+				out[ox*channels+ch] = (v + 8192) >> 14;
+			}
+		}
+}
+
+void LPolar::convertInverse(const unsigned char *in, unsigned char *out, int stride, int channels, int outWidth, int outHeight, bool promedio, int threads)
+{
+	if (promedio)
+	{
+		polarBuffer.resize(ecc*ang*channels);
+		convertPromedio(in, polarBuffer.data(), stride, channels);
+		inverseBilinear(polarBuffer.data(), out, outWidth, outHeight, channels, threads);
+		return;
+	}
+	if (outWidth <= 0 or outHeight <= 0) { outWidth = s; outHeight = s; }
+	const int *off = prepareOffsets(stride, channels).sample.data();
+	const Bilinear *table = bilinearTable(outWidth, outHeight).data();
+#ifdef _OPENMP
+	if (threads <= 0) threads = omp_get_max_threads();
+#endif
+	#pragma omp parallel for num_threads(threads) schedule(static)
+	for (int oy=0; oy<outHeight; oy++)
+		for (int ox=oy*outWidth; ox<(oy+1)*outWidth; ox++)
+		{
+			const Bilinear &b = table[ox];
+			const int o0 = off[b.cell[0]], o1 = off[b.cell[1]], o2 = off[b.cell[2]], o3 = off[b.cell[3]];
+			for (int ch=0; ch<channels; ch++)
+			{
+				const int v = b.weight[0]*in[o0+ch] + b.weight[1]*in[o1+ch] + b.weight[2]*in[o2+ch] + b.weight[3]*in[o3+ch];
+				out[ox*channels+ch] = (v + 8192) >> 14;
+			}
+		}
+}
@@ -22,6 +22,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
 
 /**
 @author Pablo Bustos
@@ -29,11 +34,34 @@
 class LPolar{
 private:
     int ecc,ang,w,h,s;
-    int **TX,***LX;
-    int **TY,***LY;	   
     float base;
 	struct TDato { int ang; int ecc; };
-	QVector<QVector<TDato > > DILP; //Tabla para reconstruccion inversa densa
+
+	// Bilinear reconstruction of an output pixel from 4 cells with weights in 1/16384 (they add up to 16384)
+	struct Bilinear { int cell[4]; uint16_t weight[4]; };
+
+	// Conversion tables, shared by all the instances with the same (ecc, ang, w, h). The cell (e, a) is at
+	// e * ang + a (eccentricity 0 is not used). Only the sampling table is built on construction, the others on
+	// first use.
+	struct Tables
+	{
+		std::vector<int> TX, TY;                  // pixel sampled by convert
+		std::vector<int> regionStart;             // pixels averaged by convertPromedio: regionX/Y[regionStart[c] .. regionStart[c+1])
+		std::vector<int> regionX, regionY;
+		QVector<QVector<TDato > > DILP;           //Tabla para reconstruccion inversa densa
+		std::map<std::pair<int,int>, std::vector<Bilinear>> bilinear;   // by output size
+		std::once_flag sampleBuilt, regionBuilt, dilpBuilt;
+		std::mutex bilinearMutex;
+	};
+	std::shared_ptr<Tables> tables;
+	static std::shared_ptr<Tables> sharedTables(int ecc, int ang, int w, int h);
+	const std::vector<Bilinear> &bilinearTable(int outWidth, int outHeight);
+
+	// Byte offsets in the input image of the tables above, for the last stride and number of channels used
+	struct Offsets { int stride = -1, channels = 0; std::vector<int> sample, region; };
+	Offsets offsets;
+	const Offsets &prepareOffsets(int stride, int channels, bool region=false);
+	std::vector<unsigned char> polarBuffer;   // convertInverse with averaging
 	
 public:
 	LPolar();
@@ -48,6 +76,22 @@ public:
 	void initDataDILP(int ecc, int ang, int s);
 	void convertPromedio(unsigned char *in, unsigned char *out );
 	void convertPointLPtoC(int e, int a, int *x, int*y);
+
+	// Same conversions for an image with 'stride' bytes per row and 'channels' interleaved channels (RGB: 3). The
+	// output keeps the channels interleaved, ecc * ang * channels bytes. The tables are re-based when the stride or the
+	// channels change between calls, so converting with different layouts from several threads is not safe.
+	void convert(const unsigned char *in, unsigned char *out, int stride, int channels=1);
+	void convertPromedio(const unsigned char *in, unsigned char *out, int stride, int channels=1);
+	// Converts a sequence of frames of the same layout, the frames in parallel (OpenMP)
+	void convertBatch(const std::vector<const unsigned char *> &in, const std::vector<unsigned char *> &out, int stride, int channels=1, bool promedio=false);
+
+	// Reconstruction of the cartesian image interpolating bilinearly between the 4 closest cells, into an image of
+	// outWidth x outHeight pixels (0: the s x s square of the conversion) with 'channels' interleaved channels.
+	// The output rows are split among 'threads' threads (OpenMP, 0: the default).
+	void inverseBilinear(const unsigned char *in, unsigned char *out, int outWidth=0, int outHeight=0, int channels=1, int threads=0);
+	// Forward and inverse conversion in one pass: the output pixels are interpolated straight from the cartesian
+	// pixels sampled by the cells, without the intermediate log-polar image (with promedio it is computed first).
+	void convertInverse(const unsigned char *in, unsigned char *out, int stride, int channels=1, int outWidth=0, int outHeight=0, bool promedio=false, int threads=0);
 };
 
 #endif
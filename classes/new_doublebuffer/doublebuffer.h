@@ -1,4 +1,27 @@
 // DounbleBuffer class template definition
+//
+// Storage policies (third template argument):
+//      MutexSlots     (default) every put and read takes the buffer mutex.
+//      LockFreeSlots  slots are atomic pointers to preallocated, reference counted nodes. Writers fill a free node and
+//                     swap it into its slot, readers count a reference to it: no locks and, once enough nodes exist
+//                     for the views held by the readers, no allocations. The copy of the data returned by get()
+//                     happens outside any lock. Resizing the buffer is not thread-safe in this mode.
+//      decl: DoubleBuffer<std::tuple<RoboCompLaser::TLaserData>, std::tuple<RoboCompLaser::TLaserData>, LockFreeSlots> laser_buffer;
+//
+// Timestamps are kept in insertion order, so get(targetTime) and get_neighbours(targetTime) use a binary search
+// (with full steady_clock resolution) instead of scanning the whole buffer.
+//
+// Overload policies of put(). The inputs wait in a queue until a worker of the thread pool transforms them. If the
+// transformation is slower than the input rate the queue is bounded by set_overload_policy:
+//      Unbounded       (default) every input is transformed.
+//      DropOldest      when max_pending inputs are waiting, the oldest of them is discarded.
+//      DropNewest      when max_pending inputs are waiting, put() discards the new one and returns false.
+//      Block           put() waits until fewer than max_pending inputs are waiting.
+//      CoalesceLatest  a new input replaces every waiting one, only the newest is transformed.
+//      use: laser_buffer.set_overload_policy(OverloadPolicy::CoalesceLatest);
+//      use: auto s = laser_buffer.put_stats();      // pending inputs, drops, blocked puts...
+
+#pragma once
 
 #include <iostream>
 #include <thread>
@@ -10,9 +33,11 @@
 #include <tuple>
 #include <functional>
 #include <queue>
+#include <deque>
 #include <future>
 #include <optional>
-//#include <boost/lockfree/queue.hpp>
+#include <memory>
+#include <utility>
 #include "../threadpool/threadpool.h"
 
 // concept Printable to check if the type can be printed to std::cout
@@ -36,99 +61,445 @@ struct is_iterable : std::false_type {};
 template <typename  T>
 struct is_iterable<T, std::void_t<decltype(std::declval<T>().begin()), decltype(std::declval<T>().end())>> : std::true_type {};
 
+// Slot storage policies
+struct MutexSlots {};
+struct LockFreeSlots {};
+
+// What put() does when the transformations do not keep up with the inputs
+enum class OverloadPolicy { Unbounded, DropOldest, DropNewest, Block, CoalesceLatest };
+
+// Circular buffer of immutable elements shared by counted references (element_ptr). Elements get a sequence number
+// when they are pushed. read(f) calls f with a view where view[0] is the most recent element, view[1] the previous
+// one...
+// Elements are copied out of the view after the read, so the data itself is never copied while holding a lock.
+template <typename Policy, typename Element>
+class slot_ring;
+
+template <typename Element>
+class slot_ring<MutexSlots, Element>
+{
+    public:
+        using element_ptr = std::shared_ptr<const Element>;
+        static constexpr bool always_lock_free = false;
+        static bool is_lock_free() { return false; }
+
+        explicit slot_ring(size_t size) : slots(size) {};
+
+        void resize(size_t size)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            slots.assign(size, nullptr);
+            head = 0;
+            count = 0;
+        }
+
+        void push(Element &&e)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                e.seq = seq++;
+                // keep timestamps sorted for the binary searches when several workers finish at the same time
+                e.timestamp = std::max(e.timestamp, last_timestamp);
+                last_timestamp = e.timestamp;
+                slots[head] = std::make_shared<const Element>(std::move(e));
+                head = (head + 1) % slots.size();
+                if (count < slots.size())
+                    ++count;
+            }
+            cv.notify_all();
+        }
+
+        void wait() const
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return count > 0; });
+        }
+
+        template <typename F>
+        auto read(F &&f) const
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            return f(view{this});
+        }
+
+        element_ptr newest() const
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            return count > 0 ? slots[(head + slots.size() - 1) % slots.size()] : nullptr;
+        }
+
+        // Aliasing shared_ptr: points to a part of the element but owns the whole element
+        template <typename T>
+        static std::shared_ptr<const T> share(element_ptr &&e, const T *part)
+        {
+            return std::shared_ptr<const T>(std::move(e), part);
+        }
+
+        struct view
+        {
+            const slot_ring *ring;
+            size_t size() const { return ring->count; }
+            element_ptr operator[](size_t i) const
+            {
+                return ring->slots[(ring->head + ring->slots.size() - i - 1) % ring->slots.size()];
+            }
+        };
+
+    private:
+        std::vector<element_ptr> slots;
+        size_t head = 0;
+        size_t count = 0;
+        uint64_t seq = 0;
+        decltype(Element::timestamp) last_timestamp{};
+        mutable std::mutex mtx;
+        mutable std::condition_variable cv;
+};
+
+template <typename Element>
+class slot_ring<LockFreeSlots, Element>
+{
+        // Elements live in nodes allocated once and reused. A node counts one reference per slot that holds it and
+        // one per element_ptr; a writer reuses a node whose count is 0. Nodes are added only when every one is in
+        // use (views held by readers), and freed with the last view after the buffer is gone.
+        struct node
+        {
+            Element element;
+            std::atomic<uint32_t> refs = 0;
+            node *next_node = nullptr;
+        };
+        struct pool
+        {
+            std::atomic<node *> nodes = nullptr;
+            ~pool()
+            {
+                for (node *n = nodes.load(); n != nullptr;)
+                    delete std::exchange(n, n->next_node);
+            }
+            // A node with a reference, taken by the caller
+            node *claim()
+            {
+                for (node *n = nodes.load(); n != nullptr; n = n->next_node)
+                {
+                    uint32_t free = 0;
+                    if (n->refs.load(std::memory_order_relaxed) == 0 and n->refs.compare_exchange_strong(free, 1))
+                        return n;
+                }
+                node *n = add();
+                n->refs = 1;
+                return n;
+            }
+            node *add()
+            {
+                node *n = new node;
+                n->next_node = nodes.load();
+                while (not nodes.compare_exchange_weak(n->next_node, n));
+                return n;
+            }
+        };
+
+    public:
+        static constexpr bool always_lock_free = std::atomic<node *>::is_always_lock_free and
+                                                 std::atomic<uint32_t>::is_always_lock_free and
+                                                 std::atomic<uint64_t>::is_always_lock_free;
+        static bool is_lock_free()
+        {
+            return std::atomic<node *>().is_lock_free() and std::atomic<uint32_t>().is_lock_free() and
+                   std::atomic<uint64_t>().is_lock_free();
+        }
+
+        // Counted reference to the element of a node, the node is not reused while it lives
+        class element_ptr
+        {
+            public:
+                element_ptr() = default;
+                element_ptr(std::nullptr_t) {}
+                element_ptr(const element_ptr &other) : n(other.n) { if (n != nullptr) n->refs.fetch_add(1); }
+                element_ptr(element_ptr &&other) noexcept : n(std::exchange(other.n, nullptr)) {}
+                element_ptr &operator=(element_ptr other) noexcept { std::swap(n, other.n); return *this; }
+                ~element_ptr() { if (n != nullptr) n->refs.fetch_sub(1); }
+
+                const Element *operator->() const { return &n->element; }
+                const Element &operator*() const { return n->element; }
+                friend bool operator==(const element_ptr &e, std::nullptr_t) { return e.n == nullptr; }
+
+            private:
+                friend class slot_ring;
+                explicit element_ptr(node *adopted) : n(adopted) {}
+                node *n = nullptr;
+        };
+
+        explicit slot_ring(size_t size) : nodes(std::make_shared<pool>()), slots(size)
+        {
+            for (size_t i = 0; i < 2 * size + 2; ++i)
+                nodes->add();
+        };
+        ~slot_ring() { release_slots(); }
+
+        void resize(size_t size)
+        {
+            release_slots();
+            slots = std::vector<std::atomic<node *>>(size);
+            next = 0;
+            published = 0;
+        }
+
+        // Several writers can push at the same time: each one claims a sequence number, fills a free node, swaps it
+        // into its slot and then moves 'published' forward. A reader that finds a slot with an unexpected sequence
+        // number skips it. The timestamp is taken after claiming the sequence number so that timestamps follow the
+        // slot order (up to the jitter between writers that push at the same instant).
+        void push(Element &&e)
+        {
+            auto s = next.fetch_add(1);
+            node *n = nodes->claim();
+            n->element = std::move(e);
+            n->element.seq = s;
+            n->element.timestamp = std::chrono::steady_clock::now();
+            if (node *old = slots[s % slots.size()].exchange(n); old != nullptr)
+                old->refs.fetch_sub(1);
+            auto p = published.load();
+            while (p < s + 1 && !published.compare_exchange_weak(p, s + 1));
+
+            // Only readers waiting for the first element use the mutex.
+            if (waiting.load() > 0)
+            {
+                { std::lock_guard<std::mutex> lock(wait_mtx); }
+                cv.notify_all();
+            }
+        }
+
+        void wait() const
+        {
+            if (published.load() > 0)
+                return;
+            std::unique_lock<std::mutex> lock(wait_mtx);
+            waiting.fetch_add(1);
+            cv.wait(lock, [this]() { return published.load() > 0; });
+            waiting.fetch_sub(1);
+        }
+
+        template <typename F>
+        auto read(F &&f) const
+        {
+            return f(view{this, published.load()});
+        }
+
+        // Element with the highest sequence number in any slot, whatever the sequence number the slot should hold.
+        // Not null once wait() has returned: a published slot is never emptied.
+        element_ptr newest() const
+        {
+            element_ptr best;
+            for (const auto &slot : slots)
+                if (auto e = acquire(slot); e != nullptr and (best == nullptr or e->seq > best->seq))
+                    best = std::move(e);
+            return best;
+        }
+
+        // shared_ptr to a part of the element that keeps the node, and the pool, alive
+        template <typename T>
+        std::shared_ptr<const T> share(element_ptr &&e, const T *part) const
+        {
+            struct holder
+            {
+                std::shared_ptr<pool> nodes;
+                element_ptr element;
+                void operator()(const T *) const {}
+            };
+            return std::shared_ptr<const T>(part, holder{nodes, std::move(e)});
+        }
+
+        struct view
+        {
+            const slot_ring *ring;
+            uint64_t last;
+            size_t size() const { return std::min<uint64_t>(last, ring->slots.size()); }
+            // nullptr if the slot is still being written or has already been overwritten
+            element_ptr operator[](size_t i) const
+            {
+                auto s = last - i - 1;
+                auto e = ring->acquire(ring->slots[s % ring->slots.size()]);
+                return (e != nullptr && e->seq == s) ? e : nullptr;
+            }
+        };
+
+    private:
+        std::shared_ptr<pool> nodes;
+        std::vector<std::atomic<node *>> slots;
+        std::atomic<uint64_t> next = 0;
+        std::atomic<uint64_t> published = 0;
+        mutable std::atomic<uint32_t> waiting = 0;
+        mutable std::mutex wait_mtx;
+        mutable std::condition_variable cv;
+
+        // The count is taken before checking that the slot still holds the node: a writer that swapped it out in
+        // between can not have reused it, the node is released and the slot read again.
+        static element_ptr acquire(const std::atomic<node *> &slot)
+        {
+            while (true)
+            {
+                node *n = slot.load();
+                if (n == nullptr)
+                    return nullptr;
+                n->refs.fetch_add(1);
+                if (slot.load() == n)
+                    return element_ptr(n);
+                n->refs.fetch_sub(1);
+            }
+        }
+        void release_slots()
+        {
+            for (auto &slot : slots)
+                if (node *n = slot.exchange(nullptr); n != nullptr)
+                    n->refs.fetch_sub(1);
+        }
+};
+
 // Primary template (never used directly)
-template <typename InputTypes, typename OutputTypes>
+template <typename InputTypes, typename OutputTypes, typename Storage = MutexSlots>
 class DoubleBuffer;
 
-template <typename... InputTypes, typename... OutputTypes>
-class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>>
+template <typename... InputTypes, typename... OutputTypes, typename Storage>
+class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>, Storage>
 {
     public:
         struct DataElement
         {
             std::chrono::steady_clock::time_point timestamp;
             std::tuple<OutputTypes...> data;
+            uint64_t seq = 0;
+        };
+
+        using transform_fn = std::function<std::tuple<OutputTypes...>(std::tuple<InputTypes...> &&)>;
+
+        /// True if the slots take no locks (LockFreeSlots, with lock-free atomics on this platform)
+        static constexpr bool always_lock_free = slot_ring<Storage, DataElement>::always_lock_free;
+        static bool is_lock_free() { return slot_ring<Storage, DataElement>::is_lock_free(); }
+
+        /// Counters of put(). 'pending' inputs are waiting for a worker; 'dropped' counts the inputs discarded by
+        /// the overload policy (replaced ones included) and 'blocked' the puts that had to wait.
+        struct PutStats
+        {
+            size_t pending = 0;
+            size_t peak_pending = 0;
+            uint64_t accepted = 0;
+            uint64_t dropped = 0;
+            uint64_t blocked = 0;
+            uint64_t transformed = 0;
         };
 
-        DoubleBuffer() : buffer(1), bufferSize(1), head(0), count(0), threadPool(1) {};
+        DoubleBuffer() : buffer(1), workers(1), threadPool(1) {};
         DoubleBuffer(size_t size, size_t threadPoolSize)
-                : buffer(size), bufferSize(size), head(0), count(0), threadPool(threadPoolSize)
+                : buffer(size == 0 ? 1 : size), workers(threadPoolSize), threadPool(threadPoolSize)
         {
             if (size == 0)
                 throw std::invalid_argument("Buffer size must be greater than zero");
             if (threadPoolSize == 0)
                 throw std::invalid_argument("Thread pool size must be greater than zero");
         };
-        ~DoubleBuffer() {};
+        // Waiting inputs are discarded and blocked producers released, the transformations in progress finish
+        ~DoubleBuffer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(pending_mtx);
+                stopping = true;
+                pending.clear();
+            }
+            pending_cv.notify_all();
+        };
         void set_buffer_size(size_t size)
         {
             if (size == 0)
                 throw std::invalid_argument("Buffer size must be greater than zero");
-            bufferSize = size;
             buffer.resize(size);
         }
 
-        /// Producer puts input data into the buffer queue with a transformation function
-        void put(std::tuple<InputTypes...> &&inputs, std::function<std::tuple<OutputTypes...>(std::tuple<InputTypes...> &&)> transform)
+        /// max_pending is the number of inputs that can wait for a worker, it is not used by Unbounded and
+        /// CoalesceLatest. Producers blocked by a previous policy are released to check the new one.
+        void set_overload_policy(OverloadPolicy policy, size_t max_pending = 1)
         {
-            // Submit the transformation task to the thread pool
-            threadPool.spawn_task([this, inputs = std::move(inputs), transform = std::move(transform)]() mutable
-                                  {
-                                      std::tuple<OutputTypes...> temp;
-                                      if(this->convert_is_possible(std::move(inputs), temp, transform))
-                                      {
-                                          auto transformedData = transform(std::move(inputs));
-                                          auto timestamp = std::chrono::steady_clock::now();
-                                          std::unique_lock<std::mutex> lock(mtx);
-                                          buffer[head] = {timestamp, std::move(transformedData)};
-                                          head = (head + 1) % bufferSize;
-                                          if (count < bufferSize)
-                                              ++count;
-                                          cv.notify_all();
-                                      }
-                                  });
+            if (max_pending == 0)
+                throw std::invalid_argument("max_pending must be greater than zero");
+            {
+                std::lock_guard<std::mutex> lock(pending_mtx);
+                overload = policy;
+                maxPending = max_pending;
+            }
+            pending_cv.notify_all();
         }
 
-        /// Consumer requests data closest to the given timestamp (or the most recent if timestamp is zero)
-        std::tuple<OutputTypes...> get(const std::chrono::steady_clock::time_point &targetTime = std::chrono::steady_clock::time_point::min())
+        PutStats put_stats() const
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [this]()
-            { return count > 0; });
+            std::lock_guard<std::mutex> lock(pending_mtx);
+            PutStats s = stats;
+            s.pending = pending.size();
+            return s;
+        }
 
-            if (targetTime == std::chrono::steady_clock::time_point::min())
+        /// Producer puts input data into the buffer queue with a transformation function. Returns false if the input
+        /// was discarded (DropNewest with a full queue).
+        bool put(std::tuple<InputTypes...> &&inputs, transform_fn transform)
+        {
+            std::unique_lock<std::mutex> lock(pending_mtx);
+            if (overload == OverloadPolicy::CoalesceLatest)
             {
-                // Return the most recent element
-                return buffer[(head + bufferSize - 1) % bufferSize].data;
+                stats.dropped += pending.size();
+                pending.clear();
             }
-
-            size_t closestIndex = 0;
-            auto minDiff = std::chrono::steady_clock::duration::max();
-
-            for (size_t i = 0; i < count; ++i)
+            else if (overload != OverloadPolicy::Unbounded and pending.size() >= maxPending)
             {
-                size_t index = (head + bufferSize - i - 1) % bufferSize;
-                auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(buffer[index].timestamp - targetTime);
-                if (std::abs(diff.count()) < std::abs(std::chrono::duration_cast<std::chrono::milliseconds>(minDiff).count()))
+                switch (overload)
                 {
-                    closestIndex = index;
-                    minDiff = diff;
+                    case OverloadPolicy::DropNewest:
+                        stats.dropped++;
+                        return false;
+                    case OverloadPolicy::DropOldest:
+                        while (pending.size() >= maxPending)
+                        {
+                            pending.pop_front();
+                            stats.dropped++;
+                        }
+                        break;
+                    default:
+                        stats.blocked++;
+                        pending_cv.wait(lock, [this]() {
+                            return stopping or overload != OverloadPolicy::Block or pending.size() < maxPending;
+                        });
+                        if (stopping)
+                            return false;
+                        break;
                 }
             }
 
-            return buffer[closestIndex].data;
+            pending.push_back(PendingInput{std::move(inputs), std::move(transform)});
+            stats.accepted++;
+            stats.peak_pending = std::max(stats.peak_pending, pending.size());
+
+            // A worker takes waiting inputs until the queue is empty, there are at most as many as threads.
+            if (running < workers)
+            {
+                running++;
+                lock.unlock();
+                threadPool.spawn_task([this]() { transform_pending(); });
+            }
+            return true;
+        }
+
+        /// Consumer requests data closest to the given timestamp (or the most recent if timestamp is zero)
+        std::tuple<OutputTypes...> get(const std::chrono::steady_clock::time_point &targetTime = std::chrono::steady_clock::time_point::min())
+        {
+            buffer.wait();
+            auto element = read_element([&targetTime](const auto &view) { return closest(view, targetTime); });
+            return element->data;
         }
 
         /// Consumer requests a new, fresh data given the timestamp of its latest read
         std::optional<std::tuple<OutputTypes...>> get_new(const std::chrono::steady_clock::time_point &lastTime)
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [this]()
-            { return count > 0; });
+            buffer.wait();
+            auto element = read_element([](const auto &view) { return most_recent(view); });
 
             // if lastTime is newer than the most recent data, return most recent data, else return empty tuple
-            if (lastTime >= buffer[(head + bufferSize - 1) % bufferSize].timestamp)
-                return buffer[(head + bufferSize - 1) % bufferSize].data;
+            if (lastTime >= element->timestamp)
+                return element->data;
             else    // return empty tuple
                 return {};
         }
@@ -136,45 +507,241 @@ class DoubleBuffer<std::tuple<InputTypes...>, std::tuple<OutputTypes...>>
         /// Consumer requests all data newer the timestamp of its latest read
         std::vector<std::tuple<OutputTypes...>> get_all_new(const std::chrono::steady_clock::time_point &lastTime)
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [this]()
-            { return count > 0; });
+            buffer.wait();
+            auto elements = buffer.read([&lastTime](const auto &view) { return newer_than(view, lastTime); });
 
             std::vector<std::tuple<OutputTypes...>> newData;
-           for (int i = count - 1; i >= 0; --i) // iterate from the most recent data backwards so they are inserted in the correct order
-           {
-                size_t index = (head + bufferSize - i - 1) % bufferSize;
-                if (buffer[index].timestamp > lastTime)
-                    newData.push_back(buffer[index].data);
-           }
+            newData.reserve(elements.size());
+            for (const auto &e : elements)
+                newData.push_back(e->data);
             return newData;
         }
 
+        /// Zero-copy versions of get, get_new and get_all_new. They return views of the stored data that stay valid
+        /// (and keep the slot content alive) until released, even if the buffer overwrites that slot meanwhile.
+        using data_view = std::shared_ptr<const std::tuple<OutputTypes...>>;
+
+        data_view get_shared(const std::chrono::steady_clock::time_point &targetTime = std::chrono::steady_clock::time_point::min())
+        {
+            buffer.wait();
+            return view_of(read_element([&targetTime](const auto &view) { return closest(view, targetTime); }));
+        }
+
+        std::optional<data_view> get_new_shared(const std::chrono::steady_clock::time_point &lastTime)
+        {
+            buffer.wait();
+            auto element = read_element([](const auto &view) { return most_recent(view); });
+            if (lastTime >= element->timestamp)
+                return view_of(std::move(element));
+            return {};
+        }
+
+        /// Elements right before (or at) and right after targetTime, to interpolate between them.
+        /// Any of them can be empty if targetTime is out of the buffer time span.
+        struct Neighbours
+        {
+            data_view before;
+            std::chrono::steady_clock::time_point before_time;
+            data_view after;
+            std::chrono::steady_clock::time_point after_time;
+        };
+
+        Neighbours get_neighbours(const std::chrono::steady_clock::time_point &targetTime)
+        {
+            buffer.wait();
+            auto [before, after] = buffer.read([&targetTime](const auto &view) { return bracket(view, targetTime); });
+            Neighbours n;
+            if (before != nullptr)
+            {
+                n.before_time = before->timestamp;
+                n.before = view_of(std::move(before));
+            }
+            if (after != nullptr)
+            {
+                n.after_time = after->timestamp;
+                n.after = view_of(std::move(after));
+            }
+            return n;
+        }
+
+        std::vector<data_view> get_all_new_shared(const std::chrono::steady_clock::time_point &lastTime)
+        {
+            buffer.wait();
+            auto elements = buffer.read([&lastTime](const auto &view) { return newer_than(view, lastTime); });
+            std::vector<data_view> views;
+            views.reserve(elements.size());
+            for (auto &e : elements)
+                views.push_back(view_of(std::move(e)));
+            return views;
+        }
+
         /// Prints the current state of the buffer with timestamps
         void print() const requires AllPrintable<OutputTypes...>
         {
-            std::unique_lock<std::mutex> lock(mtx);
-            std::cout << "[print] Buffer state: \n";
-            for (size_t i = 0; i < count; ++i)
+            buffer.read([this](const auto &view)
             {
-                size_t index = (head + bufferSize - i - 1) % bufferSize;
-                auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(buffer[index].timestamp.time_since_epoch()).count();
-                std::cout << "  " << ts << " ms, Data: [";
-                printTuple(buffer[index].data);
-                std::cout << "]\n";
-            }
+                std::cout << "[print] Buffer state: \n";
+                for (size_t i = 0; i < view.size(); ++i)
+                {
+                    auto e = view[i];
+                    if (e == nullptr)
+                        continue;
+                    auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(e->timestamp.time_since_epoch()).count();
+                    std::cout << "  " << ts << " ms, Data: [";
+                    printTuple(e->data);
+                    std::cout << "]\n";
+                }
+                return 0;
+            });
         }
 
     private:
-        std::vector<DataElement> buffer;
-        size_t bufferSize;
-        size_t head;
-        size_t count;
-        mutable std::mutex mtx;
-        std::condition_variable cv;
-        bool stopWorker;
+        using element_ptr = typename slot_ring<Storage, DataElement>::element_ptr;
+
+        struct PendingInput
+        {
+            std::tuple<InputTypes...> inputs;
+            transform_fn transform;
+        };
+
+        slot_ring<Storage, DataElement> buffer;
+
+        // inputs waiting for a worker, see put()
+        std::deque<PendingInput> pending;
+        mutable std::mutex pending_mtx;
+        std::condition_variable pending_cv;
+        OverloadPolicy overload = OverloadPolicy::Unbounded;
+        size_t maxPending = 1;
+        size_t workers;
+        size_t running = 0;
+        bool stopping = false;
+        PutStats stats;
+
+        // declared last so that its threads are joined before the queue and the buffer are destroyed
         ThreadPool threadPool;
 
+        void transform_pending()
+        {
+            std::unique_lock<std::mutex> lock(pending_mtx);
+            while (not pending.empty())
+            {
+                auto p = std::move(pending.front());
+                pending.pop_front();
+                lock.unlock();
+                pending_cv.notify_one();
+
+                // a failed transformation loses its input only, the worker goes on with the queue
+                try
+                {
+                    std::tuple<OutputTypes...> temp;
+                    if (this->convert_is_possible(std::move(p.inputs), temp, p.transform))
+                    {
+                        auto transformedData = p.transform(std::move(p.inputs));
+                        buffer.push(DataElement{std::chrono::steady_clock::now(), std::move(transformedData)});
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "[DoubleBuffer] transformation failed: " << e.what() << std::endl;
+                }
+                catch (...)
+                {
+                    std::cerr << "[DoubleBuffer] transformation failed: unknown exception" << std::endl;
+                }
+
+                lock.lock();
+                stats.transformed++;
+            }
+            running--;
+        }
+
+        // With LockFreeSlots the selected element can be missing: every candidate slot overwritten while reading, or
+        // left with an older element by a late writer (a small buffer with several writers). The newest element stored
+        // is taken then, instead of spinning until the next put.
+        template <typename F>
+        element_ptr read_element(F &&select) const
+        {
+            if (auto element = buffer.read(select); element != nullptr)
+                return element;
+            return buffer.newest();
+        }
+
+        // Points to the data, keeps the whole element
+        data_view view_of(element_ptr &&element) const
+        {
+            const auto *data = &element->data;
+            return buffer.share(std::move(element), data);
+        }
+
+        // Element closest in time to targetTime (or the most recent one if targetTime is min())
+        template <typename View>
+        static element_ptr closest(const View &view, const std::chrono::steady_clock::time_point &targetTime)
+        {
+            if (targetTime == std::chrono::steady_clock::time_point::min())
+                return most_recent(view);
+
+            auto [before, after] = bracket(view, targetTime);
+            if (before == nullptr)
+                return after;
+            if (after == nullptr)
+                return before;
+            return (after->timestamp - targetTime < targetTime - before->timestamp) ? after : before;
+        }
+
+        // Binary search over the timestamps of a view (view[0] is the newest element). Returns the newest element at
+        // or before 'time' and the oldest one after it, any of them can be nullptr. Slots that are still being
+        // written (LockFreeSlots) are skipped.
+        template <typename View>
+        static std::pair<element_ptr, element_ptr> bracket(const View &view, const std::chrono::steady_clock::time_point &time)
+        {
+            // first index whose timestamp is <= time
+            size_t lo = 0, hi = view.size();
+            while (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                size_t m = mid;
+                auto e = view[m];
+                while (e == nullptr and m + 1 < hi)
+                    e = view[++m];
+                if (e == nullptr or e->timestamp <= time)
+                    hi = mid;
+                else
+                    lo = m + 1;
+            }
+
+            element_ptr before, after;
+            for (size_t i = lo; i < view.size() and before == nullptr; ++i)
+                before = view[i];
+            for (size_t i = lo; i > 0 and after == nullptr; --i)
+                after = view[i - 1];
+            return {before, after};
+        }
+
+        // Elements newer than lastTime, oldest first
+        template <typename View>
+        static std::vector<element_ptr> newer_than(const View &view, const std::chrono::steady_clock::time_point &lastTime)
+        {
+            std::vector<element_ptr> newer;
+            for (int i = view.size() - 1; i >= 0; --i) // iterate from the oldest data forwards so they are inserted in the correct order
+            {
+                auto e = view[i];
+                if (e != nullptr and e->timestamp > lastTime)
+                    newer.push_back(std::move(e));
+            }
+            return newer;
+        }
+
+        // Most recent element of a view. With LockFreeSlots the newest slot can still be in flight, so take the
+        // first complete one.
+        template <typename View>
+        static element_ptr most_recent(const View &view)
+        {
+            for (size_t i = 0; i < view.size(); ++i)
+                if (auto e = view[i]; e != nullptr)
+                    return e;
+            return nullptr;
+        }
+
         template <std::size_t Index = 0>
         void printTuple(const std::tuple<OutputTypes...> &t) const
         {
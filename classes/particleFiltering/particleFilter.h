@@ -5,6 +5,10 @@
 #include <QVector>
 
 #include <biasedRandomSelector.h>
+#include <particleFiltering/resampling.h>
+#include <random/rng.h>
+
+#include <random>
 
 #include <omp.h>
 
@@ -148,6 +152,12 @@ public:
 	{
 		return resampledParticles[p];
 	}
+
+	// Engine used by clone() to draw the new particles, Systematic by default
+	void setResampling(RCResampling scheme)
+	{
+		resampling = scheme;
+	}
 protected:
 	QMutex mutex;
 	RCParticleFilterConfig *config;
@@ -156,6 +166,10 @@ protected:
 	BiasedSelector *selector;
 	RCPFControl lastControl;
 	QVector < RCPFParticle > resampledParticles, weightedParticles;
+	RCResampling resampling = RCResampling::Systematic;
+	std::vector<double> weights;
+	std::vector<uint32_t> ancestors;
+	RCRng generator{RCRandom::local()()};
 
 	void lock()
 	{
@@ -209,51 +223,33 @@ protected:
 			}
 		}
 
+		// the candidates are written directly and sorted once (setWeight looks the id up and may sort every call)
+		weights.resize(config->particles);
 		for (uint i=0; i<config->particles; ++i)
 		{
-			selector->setWeight(i, (1000.0*p[i].getWeight())*1000.0, true);
+			weights[i] = std::max(0., (1000.0*p[i].getWeight())*1000.0);
 		}
-
-		try
+		for (auto &c : selector->candidates)
 		{
-			selector->sort();
-		}
-		catch (std::string s)
-		{
-			printf("catch %s\n", s.c_str());
+			c.weight = BIASED_MULT * weights[c.id];
 		}
+		selector->sort();
 
 	}
 	
 	void clone(const RCPFControl &control)
 	{
 		// Check if there is any considerably probable particle...
-		int selected;
-		try
-		{
-			noCandidates = false;
-			selected = selector->get();
-		}
-		catch (...)
-		{
-			noCandidates = true;
-		}
-		// Clone
-		try
-		{
-			best = weightedParticles.operator[](selector->getFirst());
-			// If there was, perform a regular clone process
-			for (uint i=0; i<config->particles; ++i)
-			{
-				selected = noCandidates?i:selector->get();
-				RCPFParticle p = weightedParticles.operator[](selected);
-// 				p.adapt(lastControl, control, noCandidates);
-				resampledParticles.operator[](i) = p;
-			}
-		}
-		catch (...)
+		noCandidates = fabs(selector->getTotalWeight()) <= 0.000000000000000000000000001;
+		best = weightedParticles.operator[](selector->getFirst());
+		// If there was, perform a regular clone process in one pass over the weights (see resampling.h)
+		if (not noCandidates)
+			rcResample(resampling, weights, config->particles, ancestors, generator);
+		for (uint i=0; i<config->particles; ++i)
 		{
-			qFatal("THIS SHOULD NEVER HAPPEN! selector->get\n");
+			const uint32_t selected = noCandidates?i:ancestors[i];
+// 			p.adapt(lastControl, control, noCandidates);
+			resampledParticles.operator[](i) = weightedParticles.operator[](selected);
 		}
 	}
 };
@@ -0,0 +1,255 @@
+#ifndef ROBOCOMPPARTICLEFILTERSOA_H
+#define ROBOCOMPPARTICLEFILTERSOA_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <omp.h>
+
+#include <particleFiltering/resampling.h>
+#include <random/rng.h>
+
+/**
+===================================================================
+==  Structure of arrays particle filter (RCParticleFilterSoA):   ==
+===================================================================
+The state of all the particles is kept in one row-major matrix, a row per state variable and a column per particle,
+so every state variable is a contiguous array. Motion models and likelihoods are written as batch kernels that get a
+block of consecutive particles (states.middleCols(first, count)) and work on whole rows at once. The blocks are
+processed in parallel with OpenMP.
+
+Resampling does not copy particle objects: the ancestor of every particle is computed and the ancestor indices are
+permuted in place so that the selected particles keep their column. Only the columns of the particles that were not
+selected are overwritten, with no second buffer. With KLD-sampling enabled the number of particles follows the
+spread of the posterior: the drawn particles are binned and the filter keeps as many as rcKLDSampleCount asks for.
+
+RCParticleFilterSoA<3> pf(10000);          // x, z, angle
+pf.initialize([&](auto &s, uint32_t first) { s.setRandom(); s *= 5000.f; });
+while (XXX)
+{
+	pf.predict([&](auto &s, uint32_t first)
+	{
+		s.row(0).array() += s.row(2).array().cos() * advance;
+		s.row(1).array() += s.row(2).array().sin() * advance;
+		s.row(2).array() += rotation;
+	});
+	pf.update([&](const auto &s, auto &&likelihood, uint32_t first)
+	{
+		likelihood = (-(s.row(0).array() - gps.x()).square() / sigma2).exp().transpose().template cast<double>();
+	});
+	pf.resample();
+	std::cout << pf.getBest().transpose();
+}
+**/
+
+template < int StateDim, typename Scalar = float >
+class RCParticleFilterSoA
+{
+public:
+	using States = Eigen::Matrix<Scalar, StateDim, Eigen::Dynamic, Eigen::RowMajor>;
+	using State = Eigen::Matrix<Scalar, StateDim, 1>;
+	using Weights = Eigen::Array<double, Eigen::Dynamic, 1>;
+
+	// maxThreads: 0 runs the kernels in the caller's thread, -1 uses the OpenMP default
+	RCParticleFilterSoA(uint32_t particles, int32_t maxThreads=-1, uint64_t seed=RCRandom::local()())
+	 : maxThreads(maxThreads), generator(seed)
+	{
+		resize(particles);
+	}
+
+	// initialize(states_block, first) sets the state of the particles in the block
+	template < typename Init >
+	void initialize(Init &&init)
+	{
+		forBlocks([&](uint32_t first, uint32_t count)
+		{
+			auto block = states.middleCols(first, count);
+			init(block, first);
+		});
+		weights.setConstant(1.0 / size());
+		best = states.col(0);
+	}
+
+	// motion(states_block, first) moves the particles in the block. The blocks run in parallel, so the noise should
+	// come from the generator of the thread, RCRandom::local()
+	template < typename Motion >
+	void predict(Motion &&motion)
+	{
+		forBlocks([&](uint32_t first, uint32_t count)
+		{
+			auto block = states.middleCols(first, count);
+			motion(block, first);
+		});
+	}
+
+	// likelihood(states_block, likelihood_block, first) writes the likelihood of the data for the particles in the
+	// block, which multiplies their weight. The weights are normalized afterwards.
+	template < typename Likelihood >
+	void update(Likelihood &&likelihood)
+	{
+		forBlocks([&](uint32_t first, uint32_t count)
+		{
+			const auto block = states.middleCols(first, count);
+			likelihood(block, likelihoods.segment(first, count), first);
+		});
+		weights *= likelihoods;
+		const double total = weights.sum();
+		if (not (total > 0.) or not std::isfinite(total))   // no particle explains the data: start again uniform
+			weights.setConstant(1.0 / size());
+		else
+			weights /= total;
+		Eigen::Index b;
+		weights.maxCoeff(&b);
+		best = states.col(b);
+	}
+
+	// KLD-sampling: the state space is divided in bins of 'binSize' and the particle count is kept between
+	// minParticles and maxParticles
+	struct KLDConfig
+	{
+		State binSize;
+		double epsilon = 0.05;
+		double z = 2.326;
+		uint32_t minParticles = 100, maxParticles = 100000;
+	};
+
+	// Resampling in a single pass (see resampling.h), only if the effective sample size is under
+	// threshold * size() or KLD-sampling is enabled
+	void resample()
+	{
+		const uint32_t n = size();
+		if (not kld and effectiveSampleSize() >= resampleThreshold * n)
+			return;
+		rcResample(resampling, weights, n, ancestors, generator);
+		uint32_t count = n;
+		if (kld)
+		{
+			count = std::clamp(rcKLDSampleCount(occupiedBins(), kld->epsilon, kld->z), kld->minParticles, kld->maxParticles);
+			if (count != n)
+				rcResample(resampling, weights, count, ancestors, generator);
+		}
+		if (count == n)
+			applyAncestors();
+		else
+		{
+			States next(StateDim, count);
+			for (uint32_t i = 0; i < count; ++i)
+				next.col(i) = states.col(ancestors[i]);
+			states.swap(next);
+			resize(count);
+		}
+		weights.setConstant(1.0 / count);
+	}
+
+	// The three steps of the filter
+	template < typename Motion, typename Likelihood >
+	void step(Motion &&motion, Likelihood &&likelihood)
+	{
+		predict(motion);
+		update(likelihood);
+		resample();
+	}
+
+	void resize(uint32_t particles)
+	{
+		states.resize(StateDim, particles);
+		weights.setConstant(particles, 1.0 / std::max<uint32_t>(particles, 1));
+		likelihoods.resize(particles);
+		ancestors.resize(particles);
+	}
+
+	uint32_t size() const { return states.cols(); }
+	// the filter resamples when the effective sample size falls under threshold * size() (1 resamples always)
+	void setResampleThreshold(double threshold) { resampleThreshold = threshold; }
+	void setResampling(RCResampling scheme) { resampling = scheme; }
+	void setKLD(const KLDConfig &config) { kld = config; }
+	void disableKLD() { kld.reset(); }
+	double effectiveSampleSize() const { return 1.0 / weights.square().sum(); }
+
+	const States &getStates() const { return states; }
+	States &getStates() { return states; }
+	const Weights &getWeights() const { return weights; }
+	// the particle with the largest weight in the last update
+	State getBest() const { return best; }
+	// weighted mean of the states
+	State getMean() const { return (states.template cast<double>() * weights.matrix()).template cast<Scalar>(); }
+
+protected:
+	int32_t maxThreads;
+	RCRng generator;
+	double resampleThreshold = 1.;
+	RCResampling resampling = RCResampling::Systematic;
+	std::optional<KLDConfig> kld;
+	std::unordered_set<uint64_t> bins;
+	States states;
+	State best = State::Zero();
+	Weights weights, likelihoods;
+	std::vector<uint32_t> ancestors;
+
+	template < typename F >
+	void forBlocks(F &&f)
+	{
+		const int64_t n = size();
+		if (n == 0)
+			return;
+		const int32_t threads = maxThreads < 0 ? omp_get_max_threads() : std::max(maxThreads, 1);
+		const int64_t blocks = std::min<int64_t>(n, 4 * threads), count = (n + blocks - 1) / blocks;
+		#pragma omp parallel for num_threads(threads) schedule(static) if(threads > 1)
+		for (int64_t b = 0; b < blocks; ++b)
+		{
+			const int64_t first = b * count;
+			if (first < n)
+				f(uint32_t(first), uint32_t(std::min(count, n - first)));
+		}
+	}
+
+	// number of bins of the state space holding the drawn ancestors
+	uint32_t occupiedBins()
+	{
+		bins.clear();
+		bins.reserve(ancestors.size());
+		for (uint32_t i = 0; i < ancestors.size(); ++i)
+		{
+			if (i > 0 and ancestors[i] == ancestors[i - 1])   // the ancestors come sorted
+				continue;
+			uint64_t h = 0;
+			for (int d = 0; d < StateDim; ++d)
+			{
+				const auto b = int64_t(std::floor(states(d, ancestors[i]) / kld->binSize[d]));
+				h ^= uint64_t(b) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+			}
+			bins.insert(h);
+		}
+		return bins.size();
+	}
+
+	// Permutes 'ancestors' so that every selected particle is its own ancestor (Murray et al., 2016), then copies
+	// the selected state into the remaining columns. The sources are never overwritten, so no buffer is needed.
+	void applyAncestors()
+	{
+		const uint32_t n = size();
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			uint32_t a = ancestors[i];
+			while (a != i and ancestors[a] != a)
+			{
+				std::swap(ancestors[i], ancestors[a]);
+				a = ancestors[i];
+			}
+		}
+		for (uint32_t i = 0; i < n; ++i)
+			if (ancestors[i] != i)
+				states.col(i) = states.col(ancestors[i]);
+	}
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ROBOCOMPRESAMPLING_H
+#define ROBOCOMPRESAMPLING_H
+
+#include <stdint.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+/**
+ *    R C R e s a m p l i n g
+ *
+ * Resampling engines of the particle filters. They draw the ancestors of the new particles from the weights in a
+ * single pass over the cumulative weights, O(N + count):
+ *   - Systematic: one random offset and 'count' evenly spaced pointers (the low variance resampler).
+ *   - Stratified: one random pointer inside each of the 'count' strata.
+ *   - Multinomial: independent draws, generated already sorted from exponential spacings.
+ *
+ * std::vector<uint32_t> ancestors;
+ * rcResample(RCResampling::Systematic, weights, weights.size(), ancestors, generator);
+ */
+enum class RCResampling { Multinomial, Systematic, Stratified };
+
+// 'weights' is any container with size() and operator[], they do not need to be normalized. The ancestors come out
+// in increasing order. With no weight at all every particle is its own ancestor.
+template < typename Weights, typename Generator >
+void rcResample(RCResampling scheme, const Weights &weights, uint32_t count, std::vector<uint32_t> &ancestors, Generator &generator)
+{
+	const uint32_t n = weights.size();
+	ancestors.resize(count);
+	double total = 0.;
+	for (uint32_t j = 0; j < n; ++j)
+		total += weights[j];
+	if (n == 0 or count == 0)
+		return;
+	if (not (total > 0.))
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			ancestors[i] = i % n;
+		return;
+	}
+
+	std::uniform_real_distribution<double> uniform(0., 1.);
+	const double step = total / count;
+	// multinomial: the partial sums of count + 1 exponentials, scaled to 'total', are sorted uniforms
+	std::vector<double> spacings;
+	if (scheme == RCResampling::Multinomial)
+	{
+		std::exponential_distribution<double> exponential(1.);
+		spacings.resize(count + 1);
+		double sum = 0.;
+		for (auto &e : spacings)
+			e = sum += exponential(generator);
+		for (auto &e : spacings)
+			e *= total / sum;
+	}
+
+	double u = scheme == RCResampling::Systematic ? uniform(generator) * step : 0., accum = weights[0];
+	for (uint32_t i = 0, j = 0; i < count; ++i)
+	{
+		switch (scheme)
+		{
+			case RCResampling::Systematic: if (i > 0) u += step; break;
+			case RCResampling::Stratified: u = (i + uniform(generator)) * step; break;
+			case RCResampling::Multinomial: u = spacings[i]; break;
+		}
+		while (u > accum and j + 1 < n)
+			accum += weights[++j];
+		ancestors[i] = j;
+	}
+}
+
+// KLD-sampling (Fox, 2003): number of particles that bounds with probability 1 - delta the Kullback-Leibler divergence
+// between the sample based and the true posterior by 'epsilon', when the samples fall in 'bins' bins of the state
+// space. 'z' is the 1 - delta quantile of the standard normal (2.326 for delta = 0.01).
+inline uint32_t rcKLDSampleCount(uint32_t bins, double epsilon, double z)
+{
+	if (bins < 2)
+		return 1;
+	const double k = bins - 1, a = 2. / (9. * k);
+	return uint32_t(std::ceil(k / (2. * epsilon) * std::pow(1. - a + std::sqrt(a) * z, 3)));
+}
+
+#endif
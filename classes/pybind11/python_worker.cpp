@@ -0,0 +1,83 @@
+//
+// Persistent embedded Python interpreter for components. See python_worker.h
+//
+#include "python_worker.h"
+
+PythonWorker::PythonWorker(const std::vector<std::string> &sys_paths)
+    : pool(ThreadPool::Config{.num_threads = 1, .name = "rc-python"})
+{
+    // the interpreter is created on the worker thread, which then releases the GIL and keeps its thread state
+    pool.spawn_task_waitable([this, sys_paths]() {
+        py::initialize_interpreter();
+        py::list path = py::module::import("sys").attr("path");
+        for (const auto &p : sys_paths)
+            path.append(p);
+        main_state = PyEval_SaveThread();
+    }).get();
+}
+
+PythonWorker::~PythonWorker()
+{
+    // the Python objects have to go before the interpreter, on its own thread
+    pool.spawn_task_waitable([this]() {
+        PyEval_RestoreThread(main_state);
+        callables.clear();
+        py::finalize_interpreter();
+    }).get();
+}
+
+PythonWorker::Callable PythonWorker::import(const std::string &module, const std::string &attr)
+{
+    const std::string key = attr.empty() ? module : module + "." + attr;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (auto it = names.find(key); it != names.end())
+            return it->second;
+    }
+    Callable callable = submit([this, &module, &attr]() {
+        py::object object = py::module::import(module.c_str());
+        if (not attr.empty())
+            object = object.attr(attr.c_str());
+        callables.push_back(std::move(object));
+        return callables.size() - 1;
+    }).get();
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    // a concurrent import of the same name may have won, both objects stay valid
+    return names.try_emplace(key, callable).first->second;
+}
+
+py::array PythonWorker::View::array() const
+{
+    // a base object keeps numpy from copying or freeing the memory, none is enough since the owner is C++
+    py::array a(dtype(), std::vector<py::ssize_t>(shape.begin(), shape.begin() + ndim),
+                std::vector<py::ssize_t>(strides.begin(), strides.begin() + ndim), data, py::none());
+    if (not writable)
+        py::detail::array_proxy(a.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return a;
+}
+
+#ifdef PYTHON_WORKER_OPENCV
+PythonWorker::View PythonWorker::mat_view(const cv::Mat &m, bool writable)
+{
+    if (m.dims != 2)
+        throw std::invalid_argument("PythonWorker::view: only 2D cv::Mat are supported");
+    View v;
+    switch (m.depth())
+    {
+        case CV_8U: v.dtype = &py::dtype::of<uint8_t>; break;
+        case CV_8S: v.dtype = &py::dtype::of<int8_t>; break;
+        case CV_16U: v.dtype = &py::dtype::of<uint16_t>; break;
+        case CV_16S: v.dtype = &py::dtype::of<int16_t>; break;
+        case CV_32S: v.dtype = &py::dtype::of<int32_t>; break;
+        case CV_32F: v.dtype = &py::dtype::of<float>; break;
+        case CV_64F: v.dtype = &py::dtype::of<double>; break;
+        default: throw std::invalid_argument("PythonWorker::view: unsupported cv::Mat depth");
+    }
+    v.data = const_cast<uchar *>(m.data);
+    v.ndim = m.channels() > 1 ? 3 : 2;
+    v.shape = {m.rows, m.cols, m.channels()};
+    v.strides = {static_cast<py::ssize_t>(m.step[0]), static_cast<py::ssize_t>(m.step[1]), static_cast<py::ssize_t>(m.elemSize1())};
+    v.writable = writable;
+    return v;
+}
+#endif
@@ -0,0 +1,189 @@
+//
+// Persistent embedded Python interpreter for components.
+//
+// A PythonWorker starts one interpreter on a dedicated thread and keeps it for the life of the object,
+// so modules are imported once and each call only pays for the call itself. Work is sent to that thread
+// with submit() (a task queue backed by ThreadPool) and runs holding the GIL; between tasks the GIL is
+// released, so any other thread can also call into Python directly with with_gil().
+//
+// Large data is not copied: view() describes a C++ buffer (Eigen matrix, cv::Mat, std::vector or raw
+// pointer) and it is exposed to Python as a numpy array that points to the same memory. The C++ object
+// must outlive the call and must not be resized while Python uses it; Python code must not keep the array.
+//
+// Example:
+//      PythonWorker python({"/home/robocomp/scripts"});
+//      auto detect = python.import("detector", "detect");              // imported once, cached
+//      Eigen::MatrixXf points(3, 1000);
+//      std::vector<float> scores(1000);
+//      python.call<void>(detect, PythonWorker::view(points), PythonWorker::view(scores));   // no copies
+//      auto n = python.call<int>(python.import("numpy", "count_nonzero"), PythonWorker::view(scores));
+//
+//      auto f = python.submit([](){ return py::module::import("sys").attr("version").cast<std::string>(); });
+//      std::cout << f.get() << std::endl;
+//
+// Python objects must only be touched holding the GIL: inside submit()/with_gil() tasks. Values returned
+// to the caller are converted to C++ types before leaving the task.
+//
+#ifndef PYTHON_WORKER_H
+#define PYTHON_WORKER_H
+
+#include <array>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <pybind11/embed.h>
+#include <pybind11/numpy.h>
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+#include <Eigen/Core>
+#if __has_include(<opencv2/core.hpp>)
+#include <opencv2/core.hpp>
+#define PYTHON_WORKER_OPENCV
+#endif
+#include <threadpool/threadpool.h>
+
+namespace py = pybind11;
+
+class PythonWorker
+{
+public:
+    // Non owning description of a C++ buffer, cheap to copy and usable from any thread.
+    // It becomes a numpy array sharing the memory when it is passed to call().
+    struct View
+    {
+        void *data = nullptr;
+        py::dtype (*dtype)() = nullptr;
+        int ndim = 0;
+        std::array<py::ssize_t, 3> shape{};
+        std::array<py::ssize_t, 3> strides{};           // bytes
+        bool writable = false;
+
+        py::array array() const;                        // with the GIL held
+    };
+    using Callable = std::size_t;
+
+    explicit PythonWorker(const std::vector<std::string> &sys_paths = {});
+    ~PythonWorker();
+    PythonWorker(const PythonWorker &) = delete;
+    PythonWorker &operator=(const PythonWorker &) = delete;
+
+    // Runs fn on the interpreter thread holding the GIL. Python exceptions reach the future as std::runtime_error.
+    template <typename Function>
+    auto submit(Function &&fn)
+    {
+        using R = std::invoke_result_t<Function>;
+        static_assert(not std::is_base_of_v<py::handle, R>, "convert Python results to C++ types inside the task");
+        return pool.spawn_task_waitable([f = std::forward<Function>(fn)]() mutable -> R {
+            py::gil_scoped_acquire gil;
+            try { return f(); }
+            catch (py::error_already_set &e) { throw std::runtime_error(e.what()); }
+        });
+    }
+
+    // Runs fn on the calling thread holding the GIL, no thread switch: for short calls from a control loop.
+    template <typename Function>
+    auto with_gil(Function &&fn)
+    {
+        using R = std::invoke_result_t<Function>;
+        static_assert(not std::is_base_of_v<py::handle, R>, "convert Python results to C++ types inside the task");
+        py::gil_scoped_acquire gil;
+        try { return fn(); }
+        catch (py::error_already_set &e) { throw std::runtime_error(e.what()); }
+    }
+
+    // Imports module.attr once and returns a handle to the cached object. attr empty caches the module itself.
+    Callable import(const std::string &module, const std::string &attr = "");
+
+    // Calls a cached callable on the interpreter thread and converts its result to R (void discards it).
+    // Arguments are used in place, the call blocks until it has finished.
+    template <typename R, typename... Arguments>
+    R call(Callable callable, const Arguments &... args)
+    {
+        return submit([this, callable, &args...]() -> R { return invoke<R>(callable, args...); }).get();
+    }
+
+    // Same as call() but running on the calling thread.
+    template <typename R, typename... Arguments>
+    R call_here(Callable callable, const Arguments &... args)
+    {
+        return with_gil([this, callable, &args...]() -> R { return invoke<R>(callable, args...); });
+    }
+
+    // Queued call, arguments are copied (views copy only the description, not the data).
+    template <typename R, typename... Arguments>
+    std::future<R> call_async(Callable callable, Arguments... args)
+    {
+        return submit([this, callable, args...]() -> R { return invoke<R>(callable, args...); });
+    }
+
+    // Zero copy views
+    template <typename T>
+    static View view(std::vector<T> &v) { return view(v.data(), {static_cast<py::ssize_t>(v.size())}, {static_cast<py::ssize_t>(sizeof(T))}, true); }
+    template <typename T>
+    static View view(const std::vector<T> &v) { return view(const_cast<T *>(v.data()), {static_cast<py::ssize_t>(v.size())}, {static_cast<py::ssize_t>(sizeof(T))}, false); }
+    template <typename Derived>
+    static View view(Eigen::PlainObjectBase<Derived> &m) { return eigen_view(m, true); }
+    template <typename Derived>
+    static View view(const Eigen::PlainObjectBase<Derived> &m) { return eigen_view(m, false); }
+    template <typename T>
+    static View view(T *data, std::initializer_list<py::ssize_t> shape, std::initializer_list<py::ssize_t> strides, bool writable = true)
+    {
+        if (shape.size() != strides.size() or shape.size() == 0 or shape.size() > 3)
+            throw std::invalid_argument("PythonWorker::view: 1 to 3 dimensions with one stride each");
+        View v;
+        v.data = const_cast<std::remove_const_t<T> *>(data);
+        v.dtype = &py::dtype::of<std::remove_const_t<T>>;
+        v.ndim = static_cast<int>(shape.size());
+        std::copy(shape.begin(), shape.end(), v.shape.begin());
+        std::copy(strides.begin(), strides.end(), v.strides.begin());
+        v.writable = writable and not std::is_const_v<T>;
+        return v;
+    }
+#ifdef PYTHON_WORKER_OPENCV
+    // rows x cols, or rows x cols x channels for multichannel images
+    static View view(cv::Mat &m) { return mat_view(m, true); }
+    static View view(const cv::Mat &m) { return mat_view(m, false); }
+#endif
+
+private:
+    ThreadPool pool;                                // one thread, owns the interpreter
+    PyThreadState *main_state = nullptr;            // interpreter thread state while the GIL is released
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, Callable> names;
+    std::vector<py::object> callables;              // only touched with the GIL held
+
+    template <typename R, typename... Arguments>
+    R invoke(Callable callable, const Arguments &... args)
+    {
+        py::object result = callables.at(callable)(to_python(args)...);
+        if constexpr (not std::is_void_v<R>)
+            return result.template cast<R>();
+    }
+    static py::array to_python(const View &v) { return v.array(); }
+    template <typename T>
+    static py::object to_python(const T &value) { return py::cast(value); }
+
+    template <typename Derived>
+    static View eigen_view(const Eigen::PlainObjectBase<Derived> &m, bool writable)
+    {
+        using Scalar = typename Derived::Scalar;
+        auto data = const_cast<Scalar *>(m.data());
+        const py::ssize_t s = sizeof(Scalar);
+        if constexpr (Derived::IsVectorAtCompileTime)
+            return view(data, {static_cast<py::ssize_t>(m.size())}, {s * m.innerStride()}, writable);
+        else if constexpr (Derived::IsRowMajor)
+            return view(data, {m.rows(), m.cols()}, {s * m.outerStride(), s * m.innerStride()}, writable);
+        else
+            return view(data, {m.rows(), m.cols()}, {s * m.innerStride(), s * m.outerStride()}, writable);
+    }
+#ifdef PYTHON_WORKER_OPENCV
+    static View mat_view(const cv::Mat &m, bool writable);
+#endif
+};
+
+#endif // PYTHON_WORKER_H
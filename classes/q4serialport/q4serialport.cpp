@@ -18,12 +18,16 @@
  */
 #include "q4serialport.h"
 
-QSerialPort::QSerialPort() : portOpen(false)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+QSerialPort::QSerialPort() : portOpen(false), lector(NULL)
 {
 }
 
 QSerialPort::~QSerialPort()
 {
+	close();
 }
 
 bool QSerialPort::open(const QString& name)
@@ -83,6 +87,7 @@ void QSerialPort::close()
 {
 	if(!portOpen)
 		return;
+	stopReader();
 	//portFile.close();
 	::close(portDesc);
 	portOpen=false;
@@ -105,6 +110,12 @@ void QSerialPort::flush()
 
 	if(!portOpen)
 		return;
+	if (lector)
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		ring.clear();
+		return;
+	}
 	while(size()>0)
 	{
 		if(size() < 100) read(data,size());
@@ -117,13 +128,19 @@ qint64 QSerialPort::size() const
 	int nbytes;
 	if(!portOpen)
 		return 0;
+	if (lector)
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		return ring.size();
+	}
 
 	if(ioctl(portDesc, FIONREAD, &nbytes)<0)
 		return 0;
 	return nbytes;
 }
 
-//Lectura No Bloqueante
+//Lectura No Bloqueante: waits up to one second for maxlen bytes, sleeping in poll() or, with the reader running,
+//on the ring buffer
 qint64 QSerialPort::read(char* data, qint64 maxlen)
 {
     int retval=1;
@@ -133,31 +150,42 @@ qint64 QSerialPort::read(char* data, qint64 maxlen)
         return 0;
 
 	QMutexLocker locker(&mutex);
+	if (lector)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		std::unique_lock<std::mutex> lock(bufferMutex);
+		while (true)
+		{
+			nBytes += ring.pop(data+nBytes, maxlen-nBytes);
+			if (nBytes == maxlen or not bufferReady.wait_until(lock, deadline, [this]{ return ring.size() > 0 or stopping; }) or stopping)
+				break;
+		}
+		return nBytes;
+	}
+
 	QTime time;
 	time.start();
 
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-
-
-	while (nBytes<maxlen && leidos != -1 && time.elapsed() < 1000)
+	while (nBytes<maxlen && leidos != -1)
 	{
-		FD_ZERO(&rfds);
-		FD_SET(portDesc, &rfds);
-
-		retval = select(portDesc+1, &rfds, NULL, NULL, &tv);
+		const int remaining = 1000 - time.elapsed();
+		if (remaining <= 0)
+			break;
+		struct pollfd pfd = {portDesc, POLLIN, 0};
+		retval = poll(&pfd, 1, remaining);
 		if (retval==0)
 		{
 			//qDebug()<<"Read SerialPort: value=0";
-			continue;
+			break;
 		}
 		else if (retval==-1)
 		{
+			if (errno == EINTR)
+				continue;
 			switch(errno)
 			{
-			case EBADF: printf("An invalid file descriptor was given in one of the sets.\n"); break;
-			case EINTR: printf("A signal was caught.\n"); break;
-			case EINVAL: printf("nfds is negative or the value contained within timeout is invalid.\n"); break;
+			case EFAULT: printf("The array given as argument was not contained in the calling program's address space.\n"); break;
+			case EINVAL: printf("The nfds value exceeds the RLIMIT_NOFILE value.\n"); break;
 			case ENOMEM: printf("unable to allocate memory for internal tables.\n"); break;
 			default: printf("??\n");
 			}
@@ -166,32 +194,15 @@ qint64 QSerialPort::read(char* data, qint64 maxlen)
 		}
 		else
 		{
-			if (retval > maxlen-nBytes)
-			{
-				
-				leidos = ::read(portDesc, data+nBytes, maxlen-nBytes);
-				if (leidos != maxlen-nBytes)
-				{
-// 					printf("leidos != maxlen-nBytes     (%d, %lld)!!\n", leidos, maxlen-nBytes);
-				}
-			}
-			else
-			{
-				
-				leidos = ::read(portDesc, data+nBytes, retval);
-				if (leidos != retval)
-				{
-// 					printf("leidos != retval     (%d, %d)!!\n", leidos, retval);
-				}
-			}
-
+			// everything available, not only one byte
+			leidos = ::read(portDesc, data+nBytes, maxlen-nBytes);
 
 			if (leidos == -1)
 			{
 				switch(errno)
 				{
-					case EINTR: printf("La llamada ha sido interrumpida por una señal antes de que se haya leído ningún dato.\n"); break;
-					case EAGAIN: printf("Se ha seleccionado E/S no bloqueante empleando O_NONBLOCK y no había ningún dato i\n"); break;
+					case EINTR:
+					case EAGAIN: leidos = 0; continue;
 					case EIO: printf("Error de E/S. Esto puede ocurrir por ejemplo cuando el proceso está en un grupo de pr\n"); break;
 					case EISDIR: printf("fd se refiere a un directorio.\n"); break;
 					case EBADF: printf("fd no es un descriptor de fichero válido o no está abierto para lectura.\n"); break;
@@ -200,6 +211,8 @@ qint64 QSerialPort::read(char* data, qint64 maxlen)
 					default: printf("??\n");
 				}
 			}
+			else if (leidos == 0 or (pfd.revents & (POLLHUP|POLLERR)))
+				break;      // hang up
 			else
 				nBytes += leidos;
 		}
@@ -219,11 +232,23 @@ qint64 QSerialPort::readLine(char * data, qint64 maxlen)
 
 	if(!portOpen)
         return 0;
+	if (lector)
+	{
+		// a whole line, or maxlen-1 bytes, within a second
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+		std::unique_lock<std::mutex> lock(bufferMutex);
+		auto ready = [&]{ return ring.find(10) > 0 or qint64(ring.size()) >= maxlen-1 or stopping; };
+		bufferReady.wait_until(lock, deadline, ready);
+		size_t line = ring.find(10);
+		nBytes = ring.pop(data, line > 0 ? std::min<qint64>(line, maxlen-1) : maxlen-1);
+		data[nBytes] = '\0';
+		return nBytes;
+	}
 	do
 		{
 			leidos = ::read(portDesc, data+nBytes, 1);
 			if(leidos > -1) nBytes += leidos;
-		} while( ( data[nBytes-1] != 10 ) && ( leidos != -1 ) && ( nBytes < maxlen ) );
+		} while( ( nBytes == 0 || data[nBytes-1] != 10 ) && ( leidos != -1 ) && ( nBytes < maxlen ) );
 
 	data[nBytes] = '\0';
 	return nBytes;
@@ -237,8 +262,20 @@ qint64 QSerialPort::write(  char* data, qint64 maxlen)
 
 	if(!portOpen)
 	    return 0;
-	while(nBytes<maxlen && nBytes != -1)
-		nBytes += ::write(portDesc, data+nBytes, maxlen-nBytes);
+	while(nBytes<maxlen)
+	{
+		const int w = ::write(portDesc, data+nBytes, maxlen-nBytes);
+		if (w >= 0)
+			nBytes += w;
+		else if (errno == EAGAIN)
+		{
+			struct pollfd pfd = {portDesc, POLLOUT, 0};
+			if (poll(&pfd, 1, 1000) <= 0)
+				break;
+		}
+		else if (errno != EINTR)
+			break;
+	}
 
   	return nBytes;
 }
@@ -545,3 +582,277 @@ int QSerialPort::getStatusBits() const
 	return statusBits;
 }
 
+
+bool QSerialPort::startReader(size_t bufferSize)
+{
+	if(!portOpen)
+		return false;
+	if (lector)
+		return true;
+
+	portFlags = fcntl(portDesc, F_GETFL);
+	fcntl(portDesc, F_SETFL, portFlags | O_NONBLOCK);
+	epollDesc = epoll_create1(EPOLL_CLOEXEC);
+	wakeDesc = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = portDesc;
+	bool ok = epollDesc >= 0 and wakeDesc >= 0 and epoll_ctl(epollDesc, EPOLL_CTL_ADD, portDesc, &ev) == 0;
+	ev.data.fd = wakeDesc;
+	ok = ok and epoll_ctl(epollDesc, EPOLL_CTL_ADD, wakeDesc, &ev) == 0;
+	if (not ok)
+	{
+		perror("QSerialPort::startReader");
+		if (epollDesc >= 0) ::close(epollDesc);
+		if (wakeDesc >= 0) ::close(wakeDesc);
+		epollDesc = wakeDesc = -1;
+		fcntl(portDesc, F_SETFL, portFlags);
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		ring.reset(bufferSize);
+	}
+	waitingOutput = false;
+	stopping = false;
+	lector = new Lector(this);
+	lector->start();
+	return true;
+}
+
+void QSerialPort::stopReader()
+{
+	if (not lector)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		stopping = true;
+	}
+	bufferReady.notify_all();
+	wake();
+	lector->wait();
+	delete lector;
+	lector = NULL;
+	::close(epollDesc);
+	::close(wakeDesc);
+	epollDesc = wakeDesc = -1;
+	// a port opened in blocking mode blocks again in the legacy read functions
+	fcntl(portDesc, F_SETFL, portFlags);
+}
+
+size_t QSerialPort::overruns()
+{
+	std::lock_guard<std::mutex> lock(bufferMutex);
+	return ring.overruns;
+}
+
+void Lector::run()
+{
+	port->serve();
+}
+
+void QSerialPort::wake()
+{
+	const uint64_t one = 1;
+	if (wakeDesc >= 0 and ::write(wakeDesc, &one, sizeof(one)) < 0 and errno != EAGAIN)
+		perror("QSerialPort::wake");
+}
+
+// Reader thread loop
+void QSerialPort::serve()
+{
+	char chunk[4096];
+	struct epoll_event events[2];
+	while (not stopping)
+	{
+		const int n = epoll_wait(epollDesc, events, 2, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("QSerialPort reader");
+			break;
+		}
+		for (int e=0; e<n; e++)
+		{
+			if (events[e].data.fd == wakeDesc)
+			{
+				uint64_t count;
+				if (::read(wakeDesc, &count, sizeof(count)) < 0) {}
+				continue;
+			}
+			if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				ssize_t leidos;
+				while ((leidos = ::read(portDesc, chunk, sizeof(chunk))) > 0 or (leidos < 0 and errno == EINTR))
+					if (leidos > 0)
+						received(chunk, leidos);
+				if (leidos == 0 or (leidos < 0 and errno != EAGAIN))
+				{
+					printf("QSerialPort: %s closed, reader stopped\n", portName.toLatin1().data());
+					std::lock_guard<std::mutex> lock(bufferMutex);
+					stopping = true;
+				}
+			}
+		}
+		drainWrites(false);
+	}
+	bufferReady.notify_all();
+}
+
+void QSerialPort::received(const char *data, size_t n)
+{
+	{
+		std::lock_guard<std::mutex> lock(framingMutex);
+		if (framing != Framing::None)
+		{
+			pending.insert(pending.end(), data, data + n);
+			frame();
+			return;
+		}
+	}
+	size_t available;
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		ring.push(data, n);
+		available = ring.size();
+	}
+	bufferReady.notify_all();
+	emit readyRead(available);
+}
+
+// Passes the complete packets of 'pending' to the callback and keeps the rest. Called with framingMutex held, so the
+// callback must not change the framing.
+void QSerialPort::frame()
+{
+	size_t start = 0;
+	if (framing == Framing::Delimiter)
+	{
+		for (size_t i=0; i<pending.size(); i++)
+			if (pending[i] == delimiter or int(i - start + 1) >= maxPacket)
+			{
+				packetCallback(pending.data() + start, i - start + 1);
+				start = i + 1;
+			}
+	}
+	else
+	{
+		while (int(pending.size() - start) >= headerSize)
+		{
+			const int length = packetLength ? packetLength(pending.data() + start) : headerSize;
+			if (length <= 0)
+			{
+				start++;        // not a header, resynchronize
+				continue;
+			}
+			if (pending.size() - start < size_t(length))
+				break;
+			packetCallback(pending.data() + start, length);
+			start += length;
+		}
+	}
+	pending.erase(pending.begin(), pending.begin() + start);
+}
+
+void QSerialPort::setDelimiterFraming(char delimiter_, PacketCallback callback, int maxPacket_)
+{
+	std::lock_guard<std::mutex> lock(framingMutex);
+	framing = callback ? Framing::Delimiter : Framing::None;
+	packetCallback = callback;
+	delimiter = delimiter_;
+	maxPacket = std::max(maxPacket_, 1);
+	pending.clear();
+}
+
+void QSerialPort::setLengthFraming(int length, PacketCallback callback)
+{
+	setLengthFraming(length, std::function<int(const char *)>(), callback);
+}
+
+void QSerialPort::setLengthFraming(int headerSize_, std::function<int(const char *header)> packetLength_, PacketCallback callback)
+{
+	std::lock_guard<std::mutex> lock(framingMutex);
+	framing = callback and headerSize_ > 0 ? Framing::Length : Framing::None;
+	packetCallback = callback;
+	packetLength = packetLength_;
+	headerSize = headerSize_;
+	pending.clear();
+}
+
+void QSerialPort::queueWrite(const char *data, qint64 len)
+{
+	bool first;
+	{
+		std::lock_guard<std::mutex> lock(writeMutex);
+		first = writeQueue.empty();
+		writeQueue.insert(writeQueue.end(), data, data + len);
+	}
+	if (lector and first)
+		wake();
+}
+
+bool QSerialPort::flushWrites()
+{
+	if(!portOpen)
+		return false;
+	return drainWrites(true);
+}
+
+// Writes the queued data. Without 'blocking' it stops when the port buffer is full and waits for EPOLLOUT.
+bool QSerialPort::drainWrites(bool blocking)
+{
+	std::lock_guard<std::mutex> lock(writeMutex);
+	while (true)
+	{
+		if (written == writing.size())
+		{
+			writing.clear();
+			written = 0;
+			if (writeQueue.empty())
+				break;
+			writing.swap(writeQueue);   // whatever was queued goes in one write()
+		}
+		const ssize_t w = ::write(portDesc, writing.data() + written, writing.size() - written);
+		if (w > 0)
+			written += w;
+		else if (w < 0 and errno == EINTR)
+			continue;
+		else if (w < 0 and errno == EAGAIN)
+		{
+			if (not blocking)
+			{
+				if (not waitingOutput and epollDesc >= 0)
+				{
+					struct epoll_event ev;
+					memset(&ev, 0, sizeof(ev));
+					ev.events = EPOLLIN | EPOLLOUT;
+					ev.data.fd = portDesc;
+					epoll_ctl(epollDesc, EPOLL_CTL_MOD, portDesc, &ev);
+					waitingOutput = true;
+				}
+				return false;
+			}
+			struct pollfd pfd = {portDesc, POLLOUT, 0};
+			if (poll(&pfd, 1, 1000) <= 0)
+				return false;
+		}
+		else
+		{
+			perror("QSerialPort write");
+			writing.clear();
+			written = 0;
+			return false;
+		}
+	}
+	if (waitingOutput and epollDesc >= 0)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = portDesc;
+		epoll_ctl(epollDesc, EPOLL_CTL_MOD, portDesc, &ev);
+		waitingOutput = false;
+	}
+	return true;
+}
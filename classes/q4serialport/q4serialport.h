@@ -31,6 +31,16 @@
 #include <sys/ioctl.h>
 #include <sys/time.h>
 
+#include <poll.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
 #include <QIODevice>
 #include <QtCore>
 
@@ -44,20 +54,83 @@
 extern int errno;
 
 
-class Lector: public QThread
-{
+class QSerialPort;
 
+/**
+ * Byte ring buffer of the asynchronous reader. The capacity is rounded up to a power of two. When it is full the
+ * oldest bytes are dropped and counted as overruns. Not synchronized, QSerialPort protects it.
+ */
+class SerialRingBuffer
+{
 public:
-	Lector(QFile *_f){f=_f;};
-	~Lector(){};
-	QFile *f;
-	void run()
+	explicit SerialRingBuffer(size_t capacity = 1<<16) { reset(capacity); }
+	void reset(size_t capacity)
+	{
+		size_t c = 1;
+		while (c < capacity) c <<= 1;
+		buffer.assign(c, 0);
+		head = tail = 0;
+		overruns = 0;
+	}
+	inline size_t size() const { return head - tail; }
+	inline void clear() { tail = head; }
+	inline size_t capacity() const { return buffer.size(); }
+	void push(const char *data, size_t n)
 	{
-		for(;;)
+		if (n > capacity())
+		{
+			overruns += n - capacity();
+			data += n - capacity();
+			n = capacity();
+		}
+		if (size() + n > capacity())
 		{
-			f->waitForReadyRead(-1);
+			overruns += size() + n - capacity();
+			tail = head + n - capacity();
 		}
-	};
+		const size_t mask = capacity() - 1, at = head & mask, first = std::min(n, capacity() - at);
+		memcpy(buffer.data() + at, data, first);
+		memcpy(buffer.data(), data + first, n - first);
+		head += n;
+	}
+	size_t pop(char *data, size_t n)
+	{
+		n = std::min(n, size());
+		const size_t mask = capacity() - 1, at = tail & mask, first = std::min(n, capacity() - at);
+		memcpy(data, buffer.data() + at, first);
+		memcpy(data + first, buffer.data(), n - first);
+		tail += n;
+		return n;
+	}
+	// Number of bytes up to and including the first 'delimiter', 0 if there is none
+	size_t find(char delimiter) const
+	{
+		const size_t mask = capacity() - 1;
+		for (size_t i = tail; i != head; i++)
+			if (buffer[i & mask] == delimiter)
+				return i - tail + 1;
+		return 0;
+	}
+	size_t overruns;
+
+private:
+	std::vector<char> buffer;
+	size_t head, tail;           // free running, the position is taken modulo the capacity
+};
+
+
+/**
+ * Reader thread of QSerialPort::startReader(). It sleeps in epoll_wait() until the port has data or there are
+ * queued writes, reads everything available in one call and hands it to the port.
+ */
+class Lector: public QThread
+{
+
+public:
+	Lector(QSerialPort *_port){port=_port;};
+	~Lector(){};
+	QSerialPort *port;
+	void run();
 };
 
 
@@ -146,6 +219,9 @@ public:
 	QFile portFile;
 	int portDesc;
 	Lector *lector;
+
+	// Called from the reader thread with every complete packet
+	typedef std::function<void(const char *data, int size)> PacketCallback;
 	
 protected slots:
 	void slotNotifierActivated();
@@ -191,9 +267,58 @@ public:
 	virtual void setRts(bool set=true);
 	int getStatusBits() const;
 
+	// Asynchronous reading: a thread waits for the port with epoll and stores the incoming bytes in a ring buffer of
+	// 'bufferSize' bytes. read(), readLine(), getch() and size() then take the data from the buffer, sleeping until it
+	// arrives instead of polling the port. readyRead(int) is emitted from the reader thread.
+	bool startReader(size_t bufferSize = 1<<16);
+	void stopReader();
+	inline bool readerRunning() const {return lector != NULL;}
+	// Bytes lost because the ring buffer was full
+	size_t overruns();
+	// Framing: instead of going to the ring buffer the bytes are split in packets, passed to 'callback' from the
+	// reader thread. By delimiter (included in the packet; longer packets are cut at maxPacket bytes), by fixed
+	// length, or by a length given by 'packetLength' from the first 'headerSize' bytes (header included, <= 0 to
+	// drop one byte and resynchronize). An empty callback disables the framing.
+	void setDelimiterFraming(char delimiter, PacketCallback callback, int maxPacket = 4096);
+	void setLengthFraming(int length, PacketCallback callback);
+	void setLengthFraming(int headerSize, std::function<int(const char *header)> packetLength, PacketCallback callback);
+
+	// Batched writes: the data is appended to a queue that goes to the port in as few write() calls as possible,
+	// from the reader thread if it is running or else on flushWrites()
+	void queueWrite(const char *data, qint64 len);
+	bool flushWrites();
+
 private:
 	QMutex mutex;
 
+	friend class Lector;
+	void serve();
+	void received(const char *data, size_t n);
+	void frame();
+	bool drainWrites(bool blocking);
+	void wake();
+
+	int epollDesc = -1, wakeDesc = -1;
+	int portFlags = 0;                      // flags of portDesc before startReader(), restored by stopReader()
+	std::atomic_bool stopping{false};
+	mutable std::mutex bufferMutex;
+	std::condition_variable bufferReady;
+	SerialRingBuffer ring;
+
+	enum class Framing { None, Delimiter, Length };
+	Framing framing = Framing::None;
+	std::mutex framingMutex;
+	PacketCallback packetCallback;
+	std::function<int(const char *)> packetLength;
+	char delimiter = 0;
+	int maxPacket = 0, headerSize = 0;
+	std::vector<char> pending;                // bytes of the packet being framed
+
+	std::mutex writeMutex;
+	std::vector<char> writeQueue, writing;    // queued and being written
+	size_t written = 0;                       // bytes of 'writing' already sent
+	bool waitingOutput = false;               // EPOLLOUT armed
+
 signals:
 	void readyRead(int);
 };
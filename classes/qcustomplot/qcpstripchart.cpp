@@ -0,0 +1,415 @@
+/*
+ *    Copyright (C) 2023 by RoboLab - University of Extremadura
+ *
+ *    This file is part of RoboComp
+ *
+ *    RoboComp is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    RoboComp is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcpstripchart.h"
+
+#include <cmath>
+#include <limits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPStripChartData
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+QCPStripChartData::QCPStripChartData(int capacity) :
+  mHead(0),
+  mSize(0),
+  mAdded(0),
+  mColumnWidth(0),
+  mColumnsUpTo(0),
+  mColumnsEvicted(false)
+{
+  setCapacity(capacity);
+}
+
+/*!
+  Sets the maximum number of points. The current data is discarded.
+*/
+void QCPStripChartData::setCapacity(int capacity)
+{
+  mKeys.fill(0, qMax(1, capacity));
+  mValues.fill(0, qMax(1, capacity));
+  clear();
+}
+
+/*!
+  Appends a point, evicting the oldest one if the container is full. Returns false (and ignores
+  the point) if \a key is smaller than the key of the newest point.
+*/
+bool QCPStripChartData::add(double key, double value)
+{
+  if (mSize > 0 && key < keyAt(mSize-1))
+    return false;
+  if (mSize == mKeys.size())
+  {
+    mHead = ringIndex(1);
+    --mSize;
+    mColumnsEvicted = true;
+  }
+  const int i = ringIndex(mSize);
+  mKeys[i] = key;
+  mValues[i] = value;
+  ++mSize;
+  ++mAdded;
+  return true;
+}
+
+/*! \overload */
+void QCPStripChartData::add(const QVector<double> &keys, const QVector<double> &values)
+{
+  const int n = qMin(keys.size(), values.size());
+  for (int i=0; i<n; ++i)
+    add(keys.at(i), values.at(i));
+}
+
+/*!
+  Removes the points with keys smaller than \a sortKey.
+*/
+void QCPStripChartData::removeBefore(double sortKey)
+{
+  const int n = findBegin(sortKey);
+  if (n == 0)
+    return;
+  mHead = ringIndex(n);
+  mSize -= n;
+  mColumnsEvicted = true;
+}
+
+void QCPStripChartData::clear()
+{
+  mHead = 0;
+  mSize = 0;
+  mColumns.clear();
+  mColumnWidth = 0;
+  mColumnsUpTo = mAdded;
+  mColumnsEvicted = false;
+}
+
+/*!
+  Returns the index of the first point with a key greater or equal to \a sortKey (\ref size if
+  there is none). Binary search, O(log n).
+*/
+int QCPStripChartData::findBegin(double sortKey) const
+{
+  int lo = 0, hi = mSize;
+  while (lo < hi)
+  {
+    const int mid = (lo+hi)/2;
+    if (keyAt(mid) < sortKey)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+QCPRange QCPStripChartData::keyRange(bool &foundRange, QCP::SignDomain signDomain) const
+{
+  foundRange = false;
+  int first = 0, last = mSize-1;
+  if (signDomain == QCP::sdPositive)
+  {
+    first = findBegin(0);
+    while (first < mSize && !(keyAt(first) > 0))
+      ++first;
+  } else if (signDomain == QCP::sdNegative)
+    last = findBegin(0)-1;
+  while (first <= last && qIsNaN(valueAt(first)))
+    ++first;
+  while (last >= first && qIsNaN(valueAt(last)))
+    --last;
+  if (first > last)
+    return QCPRange();
+  foundRange = true;
+  return QCPRange(keyAt(first), keyAt(last));
+}
+
+QCPRange QCPStripChartData::valueRange(bool &foundRange, QCP::SignDomain signDomain, const QCPRange &inKeyRange) const
+{
+  const bool restrictKeyRange = inKeyRange != QCPRange();
+  const int first = restrictKeyRange ? findBegin(inKeyRange.lower) : 0;
+  QCPRange range;
+  foundRange = false;
+  for (int i=first; i<mSize; ++i)
+  {
+    if (restrictKeyRange && keyAt(i) > inKeyRange.upper)
+      break;
+    const double v = valueAt(i);
+    if (qIsNaN(v) || (signDomain == QCP::sdPositive && !(v > 0)) || (signDomain == QCP::sdNegative && !(v < 0)))
+      continue;
+    if (!foundRange)
+    {
+      range.lower = range.upper = v;
+      foundRange = true;
+    } else
+    {
+      if (v < range.lower) range.lower = v;
+      if (v > range.upper) range.upper = v;
+    }
+  }
+  return range;
+}
+
+/*!
+  Returns the points decimated in columns of \a width key units, at least from the column before
+  \a keyRange up to the newest point. Columns without points are not stored.
+
+  The result is cached: if \a width is the one of the previous call, only the points added since
+  then are processed and the columns left of the range are dropped. Changing the width (zooming)
+  or moving the range back over the dropped columns rebuilds the cache from the points in the
+  range.
+*/
+const std::deque<QCPStripChartData::Column> &QCPStripChartData::columns(const QCPRange &keyRange, double width) const
+{
+  if (mSize == 0 || !(width > 0))
+  {
+    mColumns.clear();
+    mColumnsUpTo = mAdded;
+    return mColumns;
+  }
+  const qint64 firstColumn = qint64(std::floor(keyRange.lower/width))-1;
+  const quint64 oldest = mAdded-mSize;       // absolute number of the oldest point
+  bool rebuild = qAbs(width-mColumnWidth) > 1e-9*width || mColumnsUpTo < oldest;
+  if (!rebuild && !mColumns.empty() && mColumns.front().index > firstColumn && keyAt(0) < mColumns.front().index*width)
+    rebuild = true;                          // the range went back over dropped columns
+  if (rebuild)
+  {
+    mColumnWidth = width;
+    rebuildColumns(firstColumn);
+    return mColumns;
+  }
+
+  // columns that are out of the range or whose points were all removed
+  const qint64 oldestColumn = qint64(std::floor(keyAt(0)/width));
+  while (!mColumns.empty() && (mColumns.front().index < firstColumn || mColumns.front().index < oldestColumn))
+    mColumns.pop_front();
+  // the first column may have lost some of its points: recompute it
+  if (mColumnsEvicted && !mColumns.empty() && mColumns.front().index == oldestColumn)
+  {
+    Column &c = mColumns.front();
+    const double end = (c.index+1)*width;
+    c.count = 0;
+    for (int i=0; i<mSize && keyAt(i) < end && quint64(i)+oldest < mColumnsUpTo; ++i)
+    {
+      const double v = valueAt(i);
+      if (qIsNaN(v))
+        continue;
+      if (c.count == 0)
+        c.first = c.min = c.max = v;
+      c.last = v;
+      if (v < c.min) c.min = v;
+      if (v > c.max) c.max = v;
+      ++c.count;
+    }
+    if (c.count == 0)
+      mColumns.pop_front();
+  }
+  mColumnsEvicted = false;
+
+  // new points
+  for (quint64 p=mColumnsUpTo; p<mAdded; ++p)
+  {
+    const int i = int(p-oldest);
+    fold(keyAt(i), valueAt(i));
+  }
+  mColumnsUpTo = mAdded;
+  return mColumns;
+}
+
+void QCPStripChartData::rebuildColumns(qint64 firstColumn) const
+{
+  mColumns.clear();
+  for (int i=findBegin(firstColumn*mColumnWidth); i<mSize; ++i)
+    fold(keyAt(i), valueAt(i));
+  mColumnsUpTo = mAdded;
+  mColumnsEvicted = false;
+}
+
+void QCPStripChartData::fold(double key, double value) const
+{
+  if (qIsNaN(value))
+    return;
+  const qint64 index = qint64(std::floor(key/mColumnWidth));
+  if (mColumns.empty() || index > mColumns.back().index)
+  {
+    Column c;
+    c.index = index;
+    c.first = c.last = c.min = c.max = value;
+    c.count = 1;
+    mColumns.push_back(c);
+    return;
+  }
+  Column &c = mColumns.back();
+  c.last = value;
+  if (value < c.min) c.min = value;
+  if (value > c.max) c.max = value;
+  ++c.count;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPStripChart
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*!
+  Constructs a strip chart on \a keyAxis and \a valueAxis that keeps the last \a capacity points.
+  As other plottables, it is owned by the QCustomPlot of the axes.
+*/
+QCPStripChart::QCPStripChart(QCPAxis *keyAxis, QCPAxis *valueAxis, int capacity) :
+  QCPAbstractPlottable(keyAxis, valueAxis),
+  mDataContainer(new QCPStripChartData(capacity))
+{
+  setPen(QPen(Qt::blue, 0));
+  setBrush(Qt::NoBrush);
+  setSelectable(QCP::stWhole);
+}
+
+QCPStripChart::~QCPStripChart()
+{
+}
+
+/*!
+  Replaces the container. It can be shared with other strip charts.
+*/
+void QCPStripChart::setData(QSharedPointer<QCPStripChartData> data)
+{
+  if (data)
+    mDataContainer = data;
+}
+
+/* inherits documentation from base class */
+double QCPStripChart::selectTest(const QPointF &pos, bool onlySelectable, QVariant *details) const
+{
+  Q_UNUSED(details)
+  if ((onlySelectable && mSelectable == QCP::stNone) || mDataContainer->isEmpty())
+    return -1;
+  if (!mKeyAxis || !mValueAxis)
+    return -1;
+  if (!mKeyAxis.data()->axisRect()->rect().contains(pos.toPoint()) && !mParentPlot->interactions().testFlag(QCP::iSelectPlottablesBeyondAxisRect))
+    return -1;
+
+  // the drawn polyline near the key of pos
+  QVector<QPointF> lines;
+  getLines(&lines);
+  const double tolerance = mParentPlot->selectionTolerance();
+  const bool horizontal = mKeyAxis.data()->orientation() == Qt::Horizontal;
+  const double position = horizontal ? pos.x() : pos.y();
+  double minDistSqr = (std::numeric_limits<double>::max)();
+  for (int i=1; i<lines.size(); ++i)
+  {
+    const double a = horizontal ? lines.at(i-1).x() : lines.at(i-1).y();
+    const double b = horizontal ? lines.at(i).x() : lines.at(i).y();
+    if (qMax(a, b) < position-tolerance || qMin(a, b) > position+tolerance)
+      continue;
+    const double distSqr = QCPVector2D(pos).distanceSquaredToLine(lines.at(i-1), lines.at(i));
+    if (distSqr < minDistSqr)
+      minDistSqr = distSqr;
+  }
+  if (lines.size() == 1)
+    minDistSqr = QCPVector2D(pos-lines.first()).lengthSquared();
+  return minDistSqr == (std::numeric_limits<double>::max)() ? -1 : qSqrt(minDistSqr);
+}
+
+/* inherits documentation from base class */
+QCPRange QCPStripChart::getKeyRange(bool &foundRange, QCP::SignDomain inSignDomain) const
+{
+  return mDataContainer->keyRange(foundRange, inSignDomain);
+}
+
+/* inherits documentation from base class */
+QCPRange QCPStripChart::getValueRange(bool &foundRange, QCP::SignDomain inSignDomain, const QCPRange &inKeyRange) const
+{
+  return mDataContainer->valueRange(foundRange, inSignDomain, inKeyRange);
+}
+
+/* inherits documentation from base class */
+void QCPStripChart::draw(QCPPainter *painter)
+{
+  if (!mKeyAxis || !mValueAxis) { qDebug() << Q_FUNC_INFO << "invalid key or value axis"; return; }
+  if (mKeyAxis.data()->range().size() <= 0 || mDataContainer->isEmpty()) return;
+
+  getLines(&mLines);
+  if (mLines.isEmpty())
+    return;
+  if (selected() && mSelectionDecorator)
+    mSelectionDecorator->applyPen(painter);
+  else
+    painter->setPen(mPen);
+  painter->setBrush(Qt::NoBrush);
+  applyDefaultAntialiasingHint(painter);
+  painter->drawPolyline(mLines.constData(), mLines.size());
+}
+
+/* inherits documentation from base class */
+void QCPStripChart::drawLegendIcon(QCPPainter *painter, const QRectF &rect) const
+{
+  applyDefaultAntialiasingHint(painter);
+  painter->setPen(mPen);
+  painter->drawLine(QLineF(rect.left(), rect.top()+rect.height()/2.0, rect.right()+5, rect.top()+rect.height()/2.0));
+}
+
+/*! \internal
+
+  Fills \a lines with the pixel coordinates of the visible part of the chart: the points
+  themselves if there are less than two per pixel of the key axis, the first, minimum, maximum
+  and last value of every pixel column otherwise.
+*/
+void QCPStripChart::getLines(QVector<QPointF> *lines) const
+{
+  lines->clear();
+  QCPAxis *keyAxis = mKeyAxis.data();
+  const QCPRange range = keyAxis->range();
+  const double pixels = qAbs(keyAxis->coordToPixel(range.upper)-keyAxis->coordToPixel(range.lower));
+  const QCPStripChartData &data = *mDataContainer;
+
+  // one point before and after the range, so the line reaches the borders
+  const int begin = qMax(0, data.findBegin(range.lower)-1);
+  const int end = qMin(data.size(), data.findBegin(range.upper)+1);
+  if (end <= begin)
+    return;
+  if (end-begin <= 2*pixels)
+  {
+    lines->reserve(end-begin);
+    for (int i=begin; i<end; ++i)
+      if (!qIsNaN(data.valueAt(i)))
+        lines->append(coordsToPixels(data.keyAt(i), data.valueAt(i)));
+    return;
+  }
+
+  const double width = range.size()/qMax(1.0, pixels);
+  const std::deque<QCPStripChartData::Column> &columns = data.columns(range, width);
+  const qint64 firstColumn = qint64(std::floor(range.lower/width))-1;
+  const qint64 lastColumn = qint64(std::floor(range.upper/width))+1;
+  lines->reserve(4*int(qMin<qint64>(columns.size(), lastColumn-firstColumn+1)));
+  for (std::deque<QCPStripChartData::Column>::const_iterator it=columns.begin(); it!=columns.end(); ++it)
+  {
+    if (it->index < firstColumn)
+      continue;
+    if (it->index > lastColumn)
+      break;
+    const double key = (it->index+0.5)*width;
+    lines->append(coordsToPixels(key, it->first));
+    if (it->count > 1)
+    {
+      // the line goes through the extremes of the column in the order they would be drawn
+      const bool rising = it->last >= it->first;
+      lines->append(coordsToPixels(key, rising ? it->min : it->max));
+      lines->append(coordsToPixels(key, rising ? it->max : it->min));
+      lines->append(coordsToPixels(key, it->last));
+    }
+  }
+}
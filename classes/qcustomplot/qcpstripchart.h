@@ -0,0 +1,136 @@
+/*
+ *    Copyright (C) 2023 by RoboLab - University of Extremadura
+ *
+ *    This file is part of RoboComp
+ *
+ *    RoboComp is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    RoboComp is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCPSTRIPCHART_H
+#define QCPSTRIPCHART_H
+
+#include <deque>
+
+#include "qcustomplot.h"
+
+/*! \class QCPStripChartData
+  \brief Fixed capacity ring buffer of (key, value) points for scrolling time series
+
+  Appending is O(1) and, once the capacity is reached, every new point evicts the oldest one
+  (also O(1)). Keys must not decrease: points older than the newest one are rejected by \ref add.
+
+  \ref columns returns the points decimated to min/max/first/last per column of a given key width
+  (one column per pixel in \ref QCPStripChart). The columns are aligned to multiples of the width
+  and cached: while the width does not change, only the points added since the last call are
+  folded into the cache and the columns that scrolled out of the range are dropped.
+*/
+class QCP_LIB_DECL QCPStripChartData
+{
+public:
+  struct Column
+  {
+    qint64 index;                  // the column covers [index*width, (index+1)*width)
+    double first, last, min, max;
+    int count;
+  };
+
+  explicit QCPStripChartData(int capacity=100000);
+
+  // getters:
+  int capacity() const { return mKeys.size(); }
+  int size() const { return mSize; }
+  bool isEmpty() const { return mSize == 0; }
+  double keyAt(int i) const { return mKeys.at(ringIndex(i)); }      // 0 is the oldest point
+  double valueAt(int i) const { return mValues.at(ringIndex(i)); }
+
+  // non-virtual methods:
+  void setCapacity(int capacity);
+  bool add(double key, double value);
+  void add(const QVector<double> &keys, const QVector<double> &values);
+  void removeBefore(double sortKey);
+  void clear();
+  int findBegin(double sortKey) const;
+  QCPRange keyRange(bool &foundRange, QCP::SignDomain signDomain=QCP::sdBoth) const;
+  QCPRange valueRange(bool &foundRange, QCP::SignDomain signDomain=QCP::sdBoth, const QCPRange &inKeyRange=QCPRange()) const;
+  const std::deque<Column> &columns(const QCPRange &keyRange, double width) const;
+
+protected:
+  QVector<double> mKeys, mValues;
+  int mHead, mSize;
+  quint64 mAdded;                            // points added since the creation, the newest one is mAdded-1
+
+  // decimation cache:
+  mutable std::deque<Column> mColumns;
+  mutable double mColumnWidth;
+  mutable quint64 mColumnsUpTo;              // absolute number of the first point not folded into mColumns
+  mutable bool mColumnsEvicted;              // the oldest cached column may hold removed points
+
+  int ringIndex(int i) const { const int r = mHead+i; return r >= mKeys.size() ? r-mKeys.size() : r; }
+  void fold(double key, double value) const;
+  void rebuildColumns(qint64 firstColumn) const;
+};
+
+
+/*! \class QCPStripChart
+  \brief Plottable line for real time strip charts backed by a \ref QCPStripChartData
+
+  The visible range is drawn from the cached min/max columns of the container, one column per
+  pixel of the key axis, so each replot costs the same whatever the number of points. When there
+  are fewer points than two per pixel they are drawn as they are.
+
+  \code
+  QCPStripChart *chart = new QCPStripChart(plot->xAxis, plot->yAxis, 60*100);
+  chart->addData(t, value);                  // 100 Hz, keeps one minute
+  plot->xAxis->setRange(t, 10, Qt::AlignRight);
+  plot->replot(QCustomPlot::rpQueuedReplot);
+  \endcode
+*/
+class QCP_LIB_DECL QCPStripChart : public QCPAbstractPlottable
+{
+  Q_OBJECT
+public:
+  explicit QCPStripChart(QCPAxis *keyAxis, QCPAxis *valueAxis, int capacity=100000);
+  virtual ~QCPStripChart() Q_DECL_OVERRIDE;
+
+  // getters:
+  QSharedPointer<QCPStripChartData> data() const { return mDataContainer; }
+
+  // setters:
+  void setData(QSharedPointer<QCPStripChartData> data);
+
+  // non-property methods:
+  bool addData(double key, double value) { return mDataContainer->add(key, value); }
+  void addData(const QVector<double> &keys, const QVector<double> &values) { mDataContainer->add(keys, values); }
+  void removeDataBefore(double key) { mDataContainer->removeBefore(key); }
+
+  // reimplemented virtual methods:
+  virtual double selectTest(const QPointF &pos, bool onlySelectable, QVariant *details=nullptr) const Q_DECL_OVERRIDE;
+  virtual QCPRange getKeyRange(bool &foundRange, QCP::SignDomain inSignDomain=QCP::sdBoth) const Q_DECL_OVERRIDE;
+  virtual QCPRange getValueRange(bool &foundRange, QCP::SignDomain inSignDomain=QCP::sdBoth, const QCPRange &inKeyRange=QCPRange()) const Q_DECL_OVERRIDE;
+
+protected:
+  QSharedPointer<QCPStripChartData> mDataContainer;
+  QVector<QPointF> mLines;                   // reused between replots
+
+  // reimplemented virtual methods:
+  virtual void draw(QCPPainter *painter) Q_DECL_OVERRIDE;
+  virtual void drawLegendIcon(QCPPainter *painter, const QRectF &rect) const Q_DECL_OVERRIDE;
+
+  // non-virtual methods:
+  void getLines(QVector<QPointF> *lines) const;
+
+private:
+  Q_DISABLE_COPY(QCPStripChart)
+};
+
+#endif
@@ -720,6 +720,85 @@ void QCPPaintBufferPixmap::reallocateBuffer()
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////// QCPPaintBufferImage
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/*! \class QCPPaintBufferImage
+  \brief A double buffered paint buffer based on QImage, using software raster rendering
+
+  This paint buffer is used if \ref QCustomPlot::setAsyncRendering is enabled. Unlike QPixmap,
+  QImage can be painted outside the GUI thread. Painting goes to a back image while \ref draw
+  shows the front one, and \ref swapBuffers exchanges them once the whole replot is done, so the
+  widget can be repainted while the render thread draws the next frame.
+*/
+
+/*!
+  Creates an image paint buffer instance with the specified \a size and \a devicePixelRatio, if
+  applicable.
+*/
+QCPPaintBufferImage::QCPPaintBufferImage(const QSize &size, double devicePixelRatio) :
+  QCPAbstractPaintBuffer(size, devicePixelRatio)
+{
+  QCPPaintBufferImage::reallocateBuffer();
+}
+
+QCPPaintBufferImage::~QCPPaintBufferImage()
+{
+}
+
+/* inherits documentation from base class */
+QCPPainter *QCPPaintBufferImage::startPainting()
+{
+  QCPPainter *result = new QCPPainter(&mBack);
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+  result->setRenderHint(QPainter::HighQualityAntialiasing);
+#endif
+  return result;
+}
+
+/* inherits documentation from base class */
+void QCPPaintBufferImage::draw(QCPPainter *painter) const
+{
+  if (painter && painter->isActive())
+    painter->drawImage(0, 0, mFront);
+  else
+    qDebug() << Q_FUNC_INFO << "invalid or inactive painter passed";
+}
+
+/* inherits documentation from base class */
+void QCPPaintBufferImage::clear(const QColor &color)
+{
+  mBack.fill(color);
+}
+
+/* inherits documentation from base class */
+void QCPPaintBufferImage::swapBuffers()
+{
+  mFront.swap(mBack);
+}
+
+/* inherits documentation from base class */
+void QCPPaintBufferImage::reallocateBuffer()
+{
+  setInvalidated();
+  QSize size = mSize;
+#ifdef QCP_DEVICEPIXELRATIO_SUPPORTED
+  size *= mDevicePixelRatio;
+#else
+  mDevicePixelRatio = 1.0;
+#endif
+  mFront = QImage(size, QImage::Format_ARGB32_Premultiplied);
+  mBack = QImage(size, QImage::Format_ARGB32_Premultiplied);
+#ifdef QCP_DEVICEPIXELRATIO_SUPPORTED
+  mFront.setDevicePixelRatio(mDevicePixelRatio);
+  mBack.setDevicePixelRatio(mDevicePixelRatio);
+#endif
+  mFront.fill(Qt::transparent);
+  mBack.fill(Qt::transparent);
+}
+
+
 #ifdef QCP_OPENGL_PBUFFER
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////// QCPPaintBufferGlPbuffer
@@ -1197,7 +1276,7 @@ void QCPLayer::drawToPaintBuffer()
 */
 void QCPLayer::replot()
 {
-  if (mMode == lmBuffered && !mParentPlot->hasInvalidatedPaintBuffers())
+  if (mMode == lmBuffered && !mParentPlot->hasInvalidatedPaintBuffers() && !mParentPlot->asyncRendering())
   {
     if (QSharedPointer<QCPAbstractPaintBuffer> pb = mPaintBuffer.toStrongRef())
     {
@@ -13625,6 +13704,12 @@ QCustomPlot::QCustomPlot(QWidget *parent) :
   mReplotQueued(false),
   mReplotTime(0),
   mReplotTimeAverage(0),
+  mMaxReplotRate(0),
+  mAsyncRendering(false),
+  mRenderInFlight(false),
+  mReplotPending(false),
+  mRenderRefreshPriority(rpRefreshHint),
+  mRenderDone(false),
   mOpenGlMultisamples(16),
   mOpenGlAntialiasedElementsBackup(QCP::aeNone),
   mOpenGlCacheLabelsBackup(true)
@@ -13694,6 +13779,7 @@ QCustomPlot::QCustomPlot(QWidget *parent) :
 
 QCustomPlot::~QCustomPlot()
 {
+  waitForRender();
   clearPlottables();
   clearItems();
 
@@ -14065,6 +14151,7 @@ void QCustomPlot::setSelectionRect(QCPSelectionRect *selectionRect)
 */
 void QCustomPlot::setOpenGl(bool enabled, int multisampling)
 {
+  waitForRender();
   mOpenGlMultisamples = qMax(0, multisampling);
 #ifdef QCUSTOMPLOT_USE_OPENGL
   mOpenGl = enabled;
@@ -14119,6 +14206,7 @@ void QCustomPlot::setOpenGl(bool enabled, int multisampling)
 */
 void QCustomPlot::setViewport(const QRect &rect)
 {
+  waitForRender();
   mViewport = rect;
   if (mPlotLayout)
     mPlotLayout->setOuterRect(mViewport);
@@ -14140,6 +14228,7 @@ void QCustomPlot::setBufferDevicePixelRatio(double ratio)
   if (!qFuzzyCompare(ratio, mBufferDevicePixelRatio))
   {
 #ifdef QCP_DEVICEPIXELRATIO_SUPPORTED
+    waitForRender();
     mBufferDevicePixelRatio = ratio;
     foreach (QSharedPointer<QCPAbstractPaintBuffer> buffer, mPaintBuffers)
       buffer->setDevicePixelRatio(mBufferDevicePixelRatio);
@@ -15088,6 +15177,22 @@ void QCustomPlot::deselectAll()
   }
 }
 
+/*! \internal
+
+  Task of the global thread pool that draws the buffered layers of an asynchronous replot (see \ref
+  QCustomPlot::setAsyncRendering).
+*/
+class QCPAsyncRenderTask : public QRunnable
+{
+public:
+  QCPAsyncRenderTask(QCustomPlot *plot, const QList<QCPLayer*> &layers) : mPlot(plot), mLayers(layers) {}
+  virtual void run() Q_DECL_OVERRIDE { mPlot->renderBufferedLayers(mLayers); }
+  
+private:
+  QCustomPlot *mPlot;
+  QList<QCPLayer*> mLayers;
+};
+
 /*!
   Causes a complete replot into the internal paint buffer(s). Finally, the widget surface is
   refreshed with the new buffer contents. This is the method that must be called to make changes to
@@ -15119,18 +15224,20 @@ void QCustomPlot::replot(QCustomPlot::RefreshPriority refreshPriority)
 {
   if (refreshPriority == QCustomPlot::rpQueuedReplot)
   {
-    if (!mReplotQueued)
-    {
-      mReplotQueued = true;
-      QTimer::singleShot(0, this, SLOT(replot()));
-    }
+    scheduleQueuedReplot();
     return;
   }
   
+  if (mRenderInFlight) // the render thread is still drawing the previous replot, do this one when it's done
+  {
+    mReplotPending = true;
+    return;
+  }
   if (mReplotting) // incase signals loop back to replot slot
     return;
   mReplotting = true;
   mReplotQueued = false;
+  mLastReplotTimer.start();
   emit beforeReplot();
   
 # if QT_VERSION < QT_VERSION_CHECK(4, 8, 0)
@@ -15144,6 +15251,27 @@ void QCustomPlot::replot(QCustomPlot::RefreshPriority refreshPriority)
   updateLayout();
   // draw all layered objects (grid, axes, plottables, items, legend,...) into their buffers:
   setupPaintBuffers();
+  if (mAsyncRendering && !mOpenGl)
+  {
+    // logical layers are drawn here, buffered layers by the render thread. finishAsyncReplot completes the replot
+    QList<QCPLayer*> bufferedLayers;
+    foreach (QCPLayer *layer, mLayers)
+    {
+      if (layer->mode() == QCPLayer::lmBuffered)
+        bufferedLayers.append(layer);
+      else
+        layer->drawToPaintBuffer();
+    }
+    mRenderInFlight = true;
+    {
+      QMutexLocker locker(&mRenderMutex);
+      mRenderDone = false;
+    }
+    mRenderRefreshPriority = refreshPriority;
+    QThreadPool::globalInstance()->start(new QCPAsyncRenderTask(this, bufferedLayers));
+    mReplotting = false;
+    return;
+  }
   foreach (QCPLayer *layer, mLayers)
     layer->drawToPaintBuffer();
   foreach (QSharedPointer<QCPAbstractPaintBuffer> buffer, mPaintBuffers)
@@ -15179,6 +15307,158 @@ double QCustomPlot::replotTime(bool average) const
   return average ? mReplotTimeAverage : mReplotTime;
 }
 
+/*!
+  Limits the rate of queued replots (\ref rpQueuedReplot) to \a hz replots per second: requests
+  that come sooner than 1/\a hz after the previous replot are merged into one replot, performed as
+  soon as the period has elapsed. This keeps a plot that is updated on every incoming data packet
+  from replotting faster than it can be displayed.
+
+  0 (the default) disables the limit. A negative value uses the refresh rate of the screen the
+  widget is shown on.
+
+  Replots with other priorities are not limited.
+*/
+void QCustomPlot::setMaxReplotRate(double hz)
+{
+  mMaxReplotRate = hz;
+}
+
+/*!
+  Enables drawing the layers in \ref QCPLayer::lmBuffered mode on a worker thread. The typical use
+  is to put the plottables of realtime data on a buffered layer, so the GUI thread only lays out
+  the plot, draws the (lightweight) logical layers and composites the buffers. The paint buffers
+  are then QImage based (\ref QCPPaintBufferImage) and double buffered: the widget keeps showing
+  the previous frame until the new one is complete, and replots requested meanwhile are merged in
+  one replot done afterwards. \ref afterReplot is emitted when the frame is complete.
+
+  While a render is in progress, the objects on buffered layers must not be changed: call \ref
+  waitForRender before changing them (e.g. adding data to a graph on a buffered layer). The event
+  handlers of QCustomPlot (mouse interactions, resizing) and the export functions already do.
+
+  This has no effect while OpenGL is enabled (\ref setOpenGl).
+*/
+void QCustomPlot::setAsyncRendering(bool enabled)
+{
+  if (enabled == mAsyncRendering)
+    return;
+  waitForRender();
+  mAsyncRendering = enabled;
+  // recreate all paint buffers:
+  mPaintBuffers.clear();
+  setupPaintBuffers();
+  replot(rpQueuedReplot);
+}
+
+/*!
+  If asynchronous rendering (\ref setAsyncRendering) is drawing a replot, blocks until it's done and
+  completes the replot. Afterwards, the objects of the plot can be changed safely.
+*/
+void QCustomPlot::waitForRender()
+{
+  if (!mRenderInFlight)
+    return;
+  {
+    QMutexLocker locker(&mRenderMutex);
+    while (!mRenderDone)
+      mRenderDoneCondition.wait(&mRenderMutex);
+  }
+  mRenderRefreshPriority = rpQueuedRefresh; // may be called from within paint events, don't repaint immediately
+  finishAsyncReplot();
+}
+
+/*! \internal
+
+  Returns the replot rate limit in replots per second resolved from \ref setMaxReplotRate, 0 if
+  there is no limit.
+*/
+double QCustomPlot::effectiveReplotRate() const
+{
+  if (mMaxReplotRate >= 0)
+    return mMaxReplotRate;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+  QScreen *screen = window() && window()->windowHandle() ? window()->windowHandle()->screen() : QGuiApplication::primaryScreen();
+  if (screen && screen->refreshRate() > 0)
+    return screen->refreshRate();
+#endif
+  return 60;
+}
+
+/*! \internal
+
+  Queues a replot for the next event loop iteration, or for when the period of the replot rate
+  limit (\ref setMaxReplotRate) since the last replot has elapsed. Only one replot is queued at a
+  time.
+*/
+void QCustomPlot::scheduleQueuedReplot()
+{
+  if (mReplotQueued)
+    return;
+  mReplotQueued = true;
+  int delay = 0;
+  const double rate = effectiveReplotRate();
+  if (rate > 0 && mLastReplotTimer.isValid())
+    delay = qMax(0, qRound(1000.0/rate - double(mLastReplotTimer.elapsed())));
+  QTimer::singleShot(delay, this, SLOT(replot()));
+}
+
+/*! \internal
+
+  Runs on the render thread started by \ref replot when asynchronous rendering is enabled: draws
+  the buffered \a layers into their paint buffers and queues \ref finishAsyncReplot on the GUI
+  thread.
+*/
+void QCustomPlot::renderBufferedLayers(const QList<QCPLayer*> &layers)
+{
+  foreach (QCPLayer *layer, layers)
+    layer->drawToPaintBuffer();
+  QMutexLocker locker(&mRenderMutex);
+  mRenderDone = true;
+  mRenderDoneCondition.wakeAll();
+  QMetaObject::invokeMethod(this, "finishAsyncReplot", Qt::QueuedConnection);
+}
+
+/*! \internal
+
+  GUI thread part of an asynchronous replot once the render thread is done: shows the new buffers,
+  refreshes the widget and emits \ref afterReplot. A replot requested meanwhile is queued then.
+*/
+void QCustomPlot::finishAsyncReplot()
+{
+  {
+    QMutexLocker locker(&mRenderMutex);
+    if (!mRenderInFlight || !mRenderDone) // already finished by waitForRender
+      return;
+  }
+  mRenderInFlight = false;
+  foreach (QSharedPointer<QCPAbstractPaintBuffer> buffer, mPaintBuffers)
+  {
+    buffer->swapBuffers();
+    buffer->setInvalidated(false);
+  }
+  
+  if ((mRenderRefreshPriority == rpRefreshHint && mPlottingHints.testFlag(QCP::phImmediateRefresh)) || mRenderRefreshPriority==rpImmediateRefresh)
+    repaint();
+  else
+    update();
+  
+# if QT_VERSION < QT_VERSION_CHECK(4, 8, 0)
+  mReplotTime = mLastReplotTimer.elapsed();
+# else
+  mReplotTime = mLastReplotTimer.nsecsElapsed()*1e-6;
+# endif
+  if (!qFuzzyIsNull(mReplotTimeAverage))
+    mReplotTimeAverage = mReplotTimeAverage*0.9 + mReplotTime*0.1;
+  else
+    mReplotTimeAverage = mReplotTime;
+  
+  emit afterReplot();
+  if (mReplotPending)
+  {
+    mReplotPending = false;
+    replot(rpQueuedReplot);
+  }
+}
+
 /*!
   Rescales the axes such that all plottables (like graphs) in the plot are fully visible.
   
@@ -15523,6 +15803,7 @@ void QCustomPlot::resizeEvent(QResizeEvent *event)
 */
 void QCustomPlot::mouseDoubleClickEvent(QMouseEvent *event)
 {
+  waitForRender();
   emit mouseDoubleClick(event);
   mMouseHasMoved = false;
   mMousePressPos = event->pos();
@@ -15575,6 +15856,7 @@ void QCustomPlot::mouseDoubleClickEvent(QMouseEvent *event)
 */
 void QCustomPlot::mousePressEvent(QMouseEvent *event)
 {
+  waitForRender();
   emit mousePress(event);
   // save some state to tell in releaseEvent whether it was a click:
   mMouseHasMoved = false;
@@ -15625,6 +15907,7 @@ void QCustomPlot::mousePressEvent(QMouseEvent *event)
 */
 void QCustomPlot::mouseMoveEvent(QMouseEvent *event)
 {
+  waitForRender();
   emit mouseMove(event);
   
   if (!mMouseHasMoved && (mMousePressPos-event->pos()).manhattanLength() > 3)
@@ -15654,6 +15937,7 @@ void QCustomPlot::mouseMoveEvent(QMouseEvent *event)
 */
 void QCustomPlot::mouseReleaseEvent(QMouseEvent *event)
 {
+  waitForRender();
   emit mouseRelease(event);
   
   if (!mMouseHasMoved) // mouse hasn't moved (much) between press and release, so handle as click
@@ -15708,6 +15992,7 @@ void QCustomPlot::mouseReleaseEvent(QMouseEvent *event)
 */
 void QCustomPlot::wheelEvent(QWheelEvent *event)
 {
+  waitForRender();
   emit mouseWheel(event);
   
 #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
@@ -15894,7 +16179,9 @@ QCPAbstractPaintBuffer *QCustomPlot::createPaintBuffer()
     qDebug() << Q_FUNC_INFO << "OpenGL enabled even though no support for it compiled in, this shouldn't have happened. Falling back to pixmap paint buffer.";
     return new QCPPaintBufferPixmap(viewport().size(), mBufferDevicePixelRatio);
 #endif
-  } else
+  } else if (mAsyncRendering)
+    return new QCPPaintBufferImage(viewport().size(), mBufferDevicePixelRatio);
+  else
     return new QCPPaintBufferPixmap(viewport().size(), mBufferDevicePixelRatio);
 }
 
@@ -16415,6 +16702,7 @@ bool QCustomPlot::saveRastered(const QString &fileName, int width, int height, d
 */
 QPixmap QCustomPlot::toPixmap(int width, int height, double scale)
 {
+  waitForRender();
   // this method is somewhat similar to toPainter. Change something here, and a change in toPainter might be necessary, too.
   int newWidth, newHeight;
   if (width == 0 || height == 0)
@@ -16471,6 +16759,7 @@ QPixmap QCustomPlot::toPixmap(int width, int height, double scale)
 */
 void QCustomPlot::toPainter(QCPPainter *painter, int width, int height)
 {
+  waitForRender();
   // this method is somewhat similar to toPixmap. Change something here, and a change in toPixmap might be necessary, too.
   int newWidth, newHeight;
   if (width == 0 || height == 0)
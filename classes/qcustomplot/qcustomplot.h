@@ -99,6 +99,16 @@
 #if QT_VERSION >= QT_VERSION_CHECK(4, 8, 0)
 #  include <QtCore/QElapsedTimer>
 #endif
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QRunnable>
+#include <QtCore/QThreadPool>
+#include <QtGui/QImage>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+#  include <QtGui/QGuiApplication>
+#  include <QtGui/QScreen>
+#  include <QtGui/QWindow>
+#endif
 # if QT_VERSION >= QT_VERSION_CHECK(5, 2, 0)
 #  include <QtCore/QTimeZone>
 #endif
@@ -592,6 +602,7 @@ public:
   virtual void donePainting() {}
   virtual void draw(QCPPainter *painter) const = 0;
   virtual void clear(const QColor &color) = 0;
+  virtual void swapBuffers() {}
   
 protected:
   // property members:
@@ -626,6 +637,27 @@ protected:
 };
 
 
+class QCP_LIB_DECL QCPPaintBufferImage : public QCPAbstractPaintBuffer
+{
+public:
+  explicit QCPPaintBufferImage(const QSize &size, double devicePixelRatio);
+  virtual ~QCPPaintBufferImage() Q_DECL_OVERRIDE;
+  
+  // reimplemented virtual methods:
+  virtual QCPPainter *startPainting() Q_DECL_OVERRIDE;
+  virtual void draw(QCPPainter *painter) const Q_DECL_OVERRIDE;
+  void clear(const QColor &color) Q_DECL_OVERRIDE;
+  virtual void swapBuffers() Q_DECL_OVERRIDE;
+  
+protected:
+  // non-property members:
+  QImage mFront, mBack;
+  
+  // reimplemented virtual methods:
+  virtual void reallocateBuffer() Q_DECL_OVERRIDE;
+};
+
+
 #ifdef QCP_OPENGL_PBUFFER
 class QCP_LIB_DECL QCPPaintBufferGlPbuffer : public QCPAbstractPaintBuffer
 {
@@ -3846,6 +3878,8 @@ public:
   QCP::SelectionRectMode selectionRectMode() const { return mSelectionRectMode; }
   QCPSelectionRect *selectionRect() const { return mSelectionRect; }
   bool openGl() const { return mOpenGl; }
+  double maxReplotRate() const { return mMaxReplotRate; }
+  bool asyncRendering() const { return mAsyncRendering; }
   
   // setters:
   void setViewport(const QRect &rect);
@@ -3870,8 +3904,11 @@ public:
   void setSelectionRectMode(QCP::SelectionRectMode mode);
   void setSelectionRect(QCPSelectionRect *selectionRect);
   void setOpenGl(bool enabled, int multisampling=16);
+  void setMaxReplotRate(double hz);
+  void setAsyncRendering(bool enabled);
   
   // non-property methods:
+  void waitForRender();
   // plottable interface:
   QCPAbstractPlottable *plottable(int index);
   QCPAbstractPlottable *plottable();
@@ -4002,6 +4039,18 @@ protected:
   bool mReplotting;
   bool mReplotQueued;
   double mReplotTime, mReplotTimeAverage;
+  double mMaxReplotRate;
+# if QT_VERSION < QT_VERSION_CHECK(4, 8, 0)
+  QTime mLastReplotTimer;
+# else
+  QElapsedTimer mLastReplotTimer;
+# endif
+  bool mAsyncRendering;
+  bool mRenderInFlight, mReplotPending;
+  QCustomPlot::RefreshPriority mRenderRefreshPriority;
+  bool mRenderDone; // written by the render thread, guarded by mRenderMutex
+  QMutex mRenderMutex;
+  QWaitCondition mRenderDoneCondition;
   int mOpenGlMultisamples;
   QCP::AntialiasedElements mOpenGlAntialiasedElementsBackup;
   bool mOpenGlCacheLabelsBackup;
@@ -4044,6 +4093,10 @@ protected:
   bool hasInvalidatedPaintBuffers();
   bool setupOpenGl();
   void freeOpenGl();
+  double effectiveReplotRate() const;
+  void scheduleQueuedReplot();
+  void renderBufferedLayers(const QList<QCPLayer*> &layers);
+  Q_SLOT void finishAsyncReplot();
   
   friend class QCPLegend;
   friend class QCPAxis;
@@ -4052,6 +4105,7 @@ protected:
   friend class QCPAbstractPlottable;
   friend class QCPGraph;
   friend class QCPAbstractItem;
+  friend class QCPAsyncRenderTask;
 };
 Q_DECLARE_METATYPE(QCustomPlot::LayerInsertMode)
 Q_DECLARE_METATYPE(QCustomPlot::RefreshPriority)
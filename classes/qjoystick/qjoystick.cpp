@@ -27,19 +27,39 @@ QJoyStick::QJoyStick(QString device, int32_t axes, QObject *parent) : QThread(pa
     info.version = 0x000800;
     
     data_sz = sizeof(js_event);
+    fd = -1;
+    stopRequested = false;
+    if (pipe(wakeFd) < 0)
+        wakeFd[0] = wakeFd[1] = -1;
+    else
+    {
+        fcntl(wakeFd[0], F_SETFL, O_NONBLOCK);
+        fcntl(wakeFd[1], F_SETFL, O_NONBLOCK);
+    }
+    qRegisterMetaType< QVector<int> >("QVector<int>");
+    resizeState();
 }
 
 
 QJoyStick::~QJoyStick()
 {
-  close(fd);
+  stop();
+  wait();
+  if (fd >= 0)
+    close(fd);
+  if (wakeFd[0] >= 0)
+  {
+    close(wakeFd[0]);
+    close(wakeFd[1]);
+  }
 }
 
 bool QJoyStick::openQJoy()
 {
 	qWarning( "[qjoystick]: Connecting to device: %s", deviceName.toLatin1().data() );
 
-	if ((fd = open(deviceName.toLatin1().data() , O_RDONLY))<0)
+	// Non blocking: run() waits in poll() and then drains every pending event
+	if ((fd = open(deviceName.toLatin1().data() , O_RDONLY | O_NONBLOCK))<0)
 	{
 		qWarning( "[qjoystick]: Failed opening device." );
 		return false;
@@ -51,29 +71,134 @@ bool QJoyStick::openQJoy()
 	ioctl(fd, JSIOCGBUTTONS, &(info.buttons));
 	ioctl(fd, JSIOCGNAME(JOYSTICK_VERSION_NAME_LENGTH), info.name);
 
+	resizeState();
 
 	qWarning("[qjoystick]: Device opened: name [%s], version [%8X], axes [%2d], buttons [%2d]", info.name, info.version, info.axes, info.buttons );
 	return true;
 }
 
+void QJoyStick::resizeState()
+{
+	QMutexLocker locker(&stateMutex);
+	axesState.fill(0, info.axes);
+	buttonsState.fill(0, info.buttons);
+}
+
+void QJoyStick::getState( QVector<int> &axes, QVector<int> &buttons )
+{
+	QMutexLocker locker(&stateMutex);
+	axes = axesState;
+	buttons = buttonsState;
+}
+
 bool QJoyStick::cmpJoyEv( js_event src, js_event dst )
 {
     return (src.value == dst.value) && (src.type == dst.type) && (src.number == dst.number);
 }
 
+void QJoyStick::start( Priority priority )
+{
+	stopRequested = false;
+	QThread::start(priority);
+}
+
+// Blocks until there are events (or stop() is called), reads all of them and publishes the new state once
 void QJoyStick::run( )
 {
-	for (;;)
+	QVector<int> axes, buttons;
+	getState(axes, buttons);
+	QVector<bool> axisChanged(axes.size());
+
+	struct pollfd fds[2];
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakeFd[0];
+	fds[1].events = POLLIN;
+
+	while (not stopRequested)
 	{
-		if (read(fd, &data, data_sz) == data_sz)
+		if (poll(fds, wakeFd[0] >= 0 ? 2 : 1, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			qWarning( "[qjoystick]: poll failed: %s", strerror(errno) );
+			break;
+		}
+		if (fds[1].revents)
+		{
+			char b[16];
+			while (read(wakeFd[0], b, sizeof(b)) > 0);
+			continue;
+		}
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+		{
+			qWarning( "[qjoystick]: Device %s lost.", deviceName.toLatin1().data() );
+			break;
+		}
+
+		axisChanged.fill(false);
+		bool changed = false, lost = false;
+		for (;;)
+		{
+			const ssize_t r = read(fd, data, sizeof(data));
+			if (r <= 0)
+			{
+				lost = (r == 0) or (errno != EAGAIN and errno != EINTR);
+				break;
+			}
+			for (int i = 0; i < r / data_sz; i++)
+			{
+				const js_event &ev = data[i];
+				const int type = ev.type & ~JS_EVENT_INIT;
+				if (type == JS_EVENT_AXIS and ev.number < axes.size())
+				{
+					// consecutive moves of an axis are coalesced: only the last value of the batch is published
+					if (axes[ev.number] != ev.value)
+					{
+						axes[ev.number] = ev.value;
+						axisChanged[ev.number] = true;
+						changed = true;
+					}
+				}
+				else if (type == JS_EVENT_BUTTON and ev.number < buttons.size())
+				{
+					// every button transition is kept
+					buttons[ev.number] = ev.value;
+					changed = true;
+					emit (inputEvent(ev.value, ev.type, ev.number));
+				}
+			}
+			if (r < (ssize_t)sizeof(data))
+				break;
+		}
+
+		if (changed)
+		{
+			{
+				QMutexLocker locker(&stateMutex);
+				axesState = axes;
+				buttonsState = buttons;
+			}
+			for (int a = 0; a < axes.size(); a++)
+				if (axisChanged[a])
+					emit (inputEvent(axes[a], JS_EVENT_AXIS, a));
+			emit (stateChanged(axes, buttons));
+		}
+		if (lost)
 		{
-			emit (inputEvent(data.value, data.type, data.number));
+			qWarning( "[qjoystick]: Device %s lost.", deviceName.toLatin1().data() );
+			break;
 		}
-		usleep(1);
 	}
 }
 
 void QJoyStick::stop()
 {
+    stopRequested = true;
+    if (wakeFd[1] >= 0)
+    {
+        const char b = 0;
+        if (write(wakeFd[1], &b, 1) < 0) {}
+    }
     quit();
 }
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <poll.h>
 #include <linux/joystick.h>
 #include <linux/input.h>
 #include <QIODevice>
@@ -22,6 +23,8 @@
 #include <QThread>
 #include <QtCore>
 
+#include <atomic>
+
 /**
   * @author Ricardo Royo Anton
   */
@@ -30,6 +33,7 @@
 #define DEFAULT_DEVICE "/dev/input/js0"
 
 #define JOYSTICK_VERSION_NAME_LENGTH 128
+#define JOYSTICK_EVENT_BATCH 64
 
 
 class QJoyStick : public QThread
@@ -53,21 +57,36 @@ public:
 	static bool cmpJoyEv( js_event src, js_event dst );
 
 	std::string getDeviceName() { return deviceName.toStdString(); }
+
+	// Last state of the axes and buttons, updated once per batch of events
+	void getState( QVector<int> &axes, QVector<int> &buttons );
+	// Clears a previous stop() and starts the thread; a stop() called before run() begins is not lost
+	void start( Priority priority = InheritPriority );
 private:
 	QString deviceName;
 	int fd;
+	int wakeFd[2];          // stop() writes to wakeFd[1] to unblock run()
 	qjs_info_t info;
-	js_event data;
+	js_event data[JOYSTICK_EVENT_BATCH];
 	int data_sz;
 
 	int srate;
 
+	QMutex stateMutex;
+	QVector<int> axesState, buttonsState;
+	std::atomic<bool> stopRequested;
+
+	void resizeState();
+
 public slots:
 	void run();
 	void stop();
 
 signals:
+	// Emitted for every button event and, once per batch, for each axis that changed (with its last value)
 	void inputEvent( int value, int type, int number );
+	// Emitted once per batch of events with the whole state
+	void stateChanged( QVector<int> axes, QVector<int> buttons );
 };
 
 #endif
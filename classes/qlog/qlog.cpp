@@ -18,18 +18,25 @@
  */
 #include "qlog.h"
 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
 
 qLog* qLog::logger = NULL;
 
 
-qLog::qLog()
+qLog::qLog() : queueHead(&queueStub), queueTail(&queueStub), asyncStop(false), asyncEnabled(false), asyncProducers(0), asyncInterval(50)
 {
 	log = "local"; 
+	queueStub.next = NULL;
 }
 
 
 qLog::~qLog()
 {
+	setAsync(false);
+	flush();                // the records queued with no logging thread
 }
 
 qLog* qLog::getInstance()
@@ -72,7 +79,10 @@ void qLog::setProxy(std::string endpoint, RoboCompLogger::LoggerPrx _prx)
 {
 	log = QString(endpoint.c_str());
 	if (endpoint == "logger" or endpoint == "both") //sender active
+	{
 		prx = _prx;
+		batchPrx = RoboCompLogger::LoggerPrx::uncheckedCast(_prx->ice_batchOneway());
+	}
 }
 #endif
 
@@ -82,6 +92,21 @@ void qLog::send(std::string _file, int line, std::string func, std::string strng
 //	printf("send: %s %s\n", log.toStdString().c_str(), strng.c_str());
 	if (log == "none")
 		return;
+	else if (asyncCall())
+	{
+		Record *r = new Record;
+		r->ownedFile = _file;
+		r->ownedFunc = func;
+		r->ownedType = _type;
+		r->file = r->ownedFile.c_str();
+		r->func = r->ownedFunc.c_str();
+		r->type = r->ownedType.c_str();
+		r->line = line;
+		r->message = strng;
+		r->time = std::chrono::system_clock::now();
+		push(r);
+		asyncProducers--;
+	}
 	else
 	{
 		//prepare message
@@ -120,4 +145,225 @@ void qLog::send(std::string file, int line,std::string func, const char* strng,s
       send(file, line, func, std::string(strng), type);
 }
 
+void qLog::send(const char* _file, int line, const char* func, const std::string &strng, const char* _type)
+{
+	if (log == "none")
+		return;
+	if (not asyncCall())
+	{
+		send(std::string(_file), line, std::string(func), strng, std::string(_type));
+		return;
+	}
+	Record *r = new Record;
+	r->file = _file;
+	r->func = func;
+	r->type = _type;
+	r->line = line;
+	r->message = strng;
+	r->time = std::chrono::system_clock::now();
+	push(r);
+	asyncProducers--;
+}
+
+void qLog::send(const char* file, int line, const char* func, const char* strng, const char* type)
+{
+	send(file, line, func, std::string(strng), type);
+}
+
+void qLog::send(const char* file, int line, const char* func, const QString &strng, const char* type)
+{
+	send(file, line, func, strng.toStdString(), type);
+}
+
+
+/// Asynchronous mode
+
+// True if the record goes to the queue: asyncProducers is then held until it has been pushed
+bool qLog::asyncCall()
+{
+	if (not asyncEnabled)
+		return false;
+	asyncProducers++;
+	if (asyncEnabled)
+		return true;
+	asyncProducers--;
+	return false;
+}
+
+void qLog::setAsync(bool enable, int intervalMs)
+{
+	if (not enable and asyncThread.joinable())
+	{
+		// cleared before taking asyncMutex: no more records are queued, so the drain that holds it comes to an end
+		asyncEnabled = false;
+		{
+			std::lock_guard<std::mutex> lock(asyncMutex);
+			asyncStop = true;
+		}
+		asyncWake.notify_one();
+		asyncThread.join();
+		// a send() that saw asyncEnabled before it was cleared may not have pushed its record yet
+		while (asyncProducers > 0)
+			std::this_thread::yield();
+		flush();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(asyncMutex);
+		asyncInterval = std::chrono::milliseconds(intervalMs);
+	}
+	if (enable and not asyncThread.joinable())
+	{
+		asyncStop = false;
+		asyncEnabled = true;
+		asyncThread = std::thread(&qLog::asyncLoop, this);
+	}
+}
 
+// Producers: one exchange, no locks
+void qLog::push(Record *r)
+{
+	r->next.store(NULL, std::memory_order_relaxed);
+	Record *previous = queueHead.exchange(r, std::memory_order_acq_rel);
+	previous->next.store(r, std::memory_order_release);
+}
+
+// Consumer: NULL when empty, or while a producer is between the exchange and the link
+qLog::Record *qLog::pop()
+{
+	Record *tail = queueTail, *next = tail->next.load(std::memory_order_acquire);
+	if (tail == &queueStub)
+	{
+		if (next == NULL)
+			return NULL;
+		queueTail = tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next != NULL)
+	{
+		queueTail = next;
+		return tail;
+	}
+	if (tail != queueHead.load(std::memory_order_acquire))
+		return NULL;
+	push(&queueStub);       // 'tail' is the last one: the stub takes its place
+	next = tail->next.load(std::memory_order_acquire);
+	if (next != NULL)
+	{
+		queueTail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+void qLog::asyncLoop()
+{
+	std::unique_lock<std::mutex> lock(asyncMutex);
+	while (not asyncStop)
+	{
+		asyncWake.wait_for(lock, asyncInterval);
+		drain();
+	}
+}
+
+void qLog::flush()
+{
+	std::lock_guard<std::mutex> lock(asyncMutex);
+	drain();
+}
+
+// Formats every queued record; console output goes in a single write and Ice messages in one batch. asyncMutex held.
+void qLog::drain()
+{
+	consoleBuffer.clear();
+	bool any = false;
+	for (Record *r = pop(); r != NULL; r = pop())
+	{
+		emitRecord(*r);
+		delete r;
+		any = true;
+	}
+	if (not any)
+		return;
+	if (not consoleBuffer.empty())
+	{
+		fwrite(consoleBuffer.data(), 1, consoleBuffer.size(), stdout);
+		fflush(stdout);
+	}
+#if COMPILE_LOGGERCOMP==1
+	if (batchPrx and (log == "logger" or log == "both"))
+	{
+		try
+		{
+			batchPrx->ice_flushBatchRequests();
+		}
+		catch( const Ice::Exception& ex)
+		{
+			std::cout << "Exception::Fail sending to Logger:" << ex << endl;
+		}
+	}
+#endif
+}
+
+const std::string &qLog::baseName(const char *path)
+{
+	std::unordered_map<const char*, std::string>::iterator it = baseNames.find(path);
+	if (it == baseNames.end())
+	{
+		const char *slash = strrchr(path, '/');
+		it = baseNames.insert(std::make_pair(path, std::string(slash ? slash + 1 : path))).first;
+	}
+	return it->second;
+}
+
+void qLog::emitRecord(const Record &r)
+{
+	// owned paths are not call site literals, they can not be interned by address
+	const char *name = r.file;
+	if (r.ownedFile.empty())
+		name = baseName(r.file).c_str();
+	else if (const char *slash = strrchr(r.file, '/'))
+		name = slash + 1;
+
+	const time_t seconds = std::chrono::system_clock::to_time_t(r.time);
+	const int millis = std::chrono::duration_cast<std::chrono::milliseconds>(r.time.time_since_epoch()).count() % 1000;
+	struct tm local;
+	localtime_r(&seconds, &local);
+	char stamp[32];
+	const size_t n = strftime(stamp, sizeof(stamp), "%Y.%m.%d %H:%M:%S", &local);
+	snprintf(stamp + n, sizeof(stamp) - n, ":%03d", millis);
+
+	if (log == "local" or log == "both")
+	{
+		char lineNumber[16];
+		snprintf(lineNumber, sizeof(lineNumber), "%i", r.line);
+		consoleBuffer.append(stamp).append("::").append(r.type).append("::").append(name).append("::").append(lineNumber);
+		consoleBuffer.append("::").append(PROGRAM_NAME).append("::").append(r.func).append("::").append(r.message).append("\n");
+	}
+	if (log == "logger" or log == "both")
+	{
+#if COMPILE_LOGGERCOMP==1
+		if (not batchPrx)
+			return;
+		RoboCompLogger::LogMessage m;
+		m.sender = PROGRAM_NAME;
+		m.method = r.func;
+		m.file = name;
+		m.line = r.line;
+		m.timeStamp = stamp;
+		m.message = r.message;
+		m.type = r.type;
+		m.fullpath = r.file;
+		try
+		{
+			batchPrx->sendMessage(m);     // queued in the batch proxy until drain() flushes it
+		}
+		catch( const Ice::Exception& ex)
+		{
+			std::cout << "Exception::Fail sending to Logger:" << ex << endl;
+		}
+#else
+		consoleBuffer.append("Error component compiled without rclogger support, check CMAKELIST\n");
+#endif
+	}
+}
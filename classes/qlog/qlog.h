@@ -23,6 +23,14 @@
 #include <QtCore>
 #include <iostream>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #if COMPILE_LOGGERCOMP==1
 	#include <Logger.h>
 #endif
@@ -33,10 +41,12 @@
 
 
 #define SetLoggerInstance(x) loggerInstance = x
-#define rDebug2(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),boost::str(boost::format strng ),std::string("Debug"))
-#define rDebug(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Debug"))
-#define rInfo(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Info"))
-#define rError(strng) qLog::getInstance()->send(std::string(__FILE__),__LINE__,std::string(__func__),strng,std::string("Error"))
+// __FILE__, __func__ and the type are passed as pointers to static strings: they identify the call site, and the
+// asynchronous mode keeps only the pointers and formats them (once per call site) in the logging thread
+#define rDebug2(strng) qLog::getInstance()->send(__FILE__,__LINE__,__func__,boost::str(boost::format strng ),"Debug")
+#define rDebug(strng) qLog::getInstance()->send(__FILE__,__LINE__,__func__,strng,"Debug")
+#define rInfo(strng) qLog::getInstance()->send(__FILE__,__LINE__,__func__,strng,"Info")
+#define rError(strng) qLog::getInstance()->send(__FILE__,__LINE__,__func__,strng,"Error")
 
 class qLog
 {
@@ -44,6 +54,7 @@ private:
 #if COMPILE_LOGGERCOMP==1
 	RoboCompLogger::LogMessage mess;
 	RoboCompLogger::LoggerPrx prx;
+	RoboCompLogger::LoggerPrx batchPrx;         // batch oneway view of prx, used by the asynchronous mode
 public:
 	void setProxy(std::string endpoint,RoboCompLogger::LoggerPrx _prx);
 	void sendLogger();
@@ -62,6 +73,37 @@ private:
 	QString log;
 	static qLog *logger;
 	void showConsole();
+
+	// Asynchronous mode: the callers push records to a lock-free MPSC queue (Vyukov) and the logging thread formats
+	// and writes them in batches every 'interval'
+	struct Record
+	{
+		std::atomic<Record*> next;
+		const char *file, *func, *type;         // static strings of the call site
+		int line;
+		std::string ownedFile, ownedFunc, ownedType;   // used by the std::string overloads
+		std::string message;
+		std::chrono::system_clock::time_point time;
+	};
+	std::atomic<Record*> queueHead;             // producers exchange it
+	Record *queueTail;                          // only the logging thread
+	Record queueStub;
+	std::thread asyncThread;
+	std::atomic<bool> asyncStop, asyncEnabled;
+	std::atomic<int> asyncProducers;            // send() calls between the asyncEnabled check and push()
+	std::chrono::milliseconds asyncInterval;
+	std::mutex asyncMutex;                      // serializes the consumers (logging thread and flush())
+	std::condition_variable asyncWake;
+	std::unordered_map<const char*, std::string> baseNames;   // call site file -> file name
+	std::string consoleBuffer;
+
+	bool asyncCall();
+	void push(Record *r);
+	Record *pop();
+	void asyncLoop();
+	void drain();
+	void emitRecord(const Record &r);
+	const std::string &baseName(const char *path);
   public:
 	~qLog();
 	qLog();
@@ -69,6 +111,17 @@ private:
 	void send(std::string file, int line,std::string func, std::string strng,std::string type);
 	void send(std::string file, int line,std::string func, const char* strng,std::string type);
 	void send(std::string file, int line,std::string func, QString strng,std::string type);
+	// call site overloads used by the macros
+	void send(const char* file, int line, const char* func, const std::string &strng, const char* type);
+	void send(const char* file, int line, const char* func, const char* strng, const char* type);
+	void send(const char* file, int line, const char* func, const QString &strng, const char* type);
+
+	// In asynchronous mode send() only queues the message. Every intervalMs the logging thread formats the queued
+	// messages, prints them with one write and sends them to the logger through a batch oneway proxy, flushed once.
+	void setAsync(bool enable, int intervalMs = 50);
+	bool isAsync() const { return asyncEnabled; }
+	// Writes the queued messages now
+	void flush();
 };
 
 #endif
@@ -1,4 +1,11 @@
 //https://gist.github.com/cbsmith/5538174
+#ifndef RANDOM_SELECTOR_H
+#define RANDOM_SELECTOR_H
+
+#include <iterator>
+#include <random>
+
+#include <random/rng.h>
 
 // use example
 //
@@ -6,11 +13,11 @@
 // selector(source_container);
 
 
-template <typename RandomGenerator = std::default_random_engine>
+template <typename RandomGenerator = RCRng>
 struct RandomSelector
 {
-    //On most platforms, you probably want to use std::random_device("/dev/urandom")()
-    RandomSelector(RandomGenerator g = RandomGenerator(std::random_device()()))
+    //By default the selector takes a new stream from the generators of RCRandom, so it is repeatable after RCRandom::seed()
+    RandomSelector(RandomGenerator g = RandomGenerator(RCRandom::local()()))
             : gen(g) {}
 
     template <typename Iter>
@@ -35,3 +42,4 @@ struct RandomSelector
 private:
     RandomGenerator gen;
 };
+#endif
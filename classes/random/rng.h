@@ -0,0 +1,187 @@
+// Random number generation shared by the particle filters and the selectors.
+//
+// RCRng is xoshiro256++ (Blackman and Vigna): 256 bits of state, a few cycles per number and a jump() that splits its
+// period in 2^128 non-overlapping streams. It is a UniformRandomBitGenerator, so the <random> distributions take it.
+//
+// Every thread gets its own generator from RCRandom::local(), so there is no shared state nor locking. The generators
+// come from a global seed: the n-th stream is the seed state jumped n times. Parallel code that has to be repeatable
+// whatever the scheduling asks for a numbered stream instead (one per chunk or per OpenMP thread number). The last
+// stream given is cached, so asking for the streams in increasing order costs one jump each.
+//
+// use example
+//
+//   RCRandom::seed(1234);                                   // replay: same seed, same numbers
+//   auto &g = RCRandom::local();                            // this thread's generator
+//   float u = RCRandom::uniform(g);                         // [0, 1)
+//   std::normal_distribution<float> n(0, 1); n(g);          // works with <random>
+//   RCRandom::normal(g, noise.data(), noise.size(), 0.f, 20.f);   // batch
+//   RCRng chunk = RCRandom::stream(c);                      // deterministic stream 'c'
+
+#ifndef RC_RNG_H
+#define RC_RNG_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+
+class RCRng
+{
+public:
+	using result_type = uint64_t;
+
+	explicit RCRng(uint64_t seed = 0x853c49e6748fea9bull)
+	{
+		this->seed(seed);
+	}
+
+	// the state is filled with splitmix64 of the seed, as recommended by the authors
+	void seed(uint64_t seed)
+	{
+		for (auto &w : s)
+		{
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			w = z ^ (z >> 31);
+		}
+	}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+	inline result_type operator()()
+	{
+		const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	// equivalent to 2^128 calls: the generators obtained by repeated jumps give non-overlapping sequences
+	void jump()
+	{
+		static constexpr uint64_t J[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+		uint64_t t[4] = {0, 0, 0, 0};
+		for (auto j : J)
+			for (int b = 0; b < 64; b++)
+			{
+				if (j & (uint64_t(1) << b))
+					for (int i = 0; i < 4; i++)
+						t[i] ^= s[i];
+				(*this)();
+			}
+		for (int i = 0; i < 4; i++)
+			s[i] = t[i];
+	}
+
+private:
+	uint64_t s[4];
+	static inline uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+class RCRandom
+{
+public:
+	// Seeds the generators: the ones created from now on (local() of new threads and stream()) depend only on it
+	static void seed(uint64_t seed)
+	{
+		globalSeed().store(seed, std::memory_order_relaxed);
+		RCRng &g = local();
+		g = stream(0);        // the calling thread takes the first stream
+		nextStream() = 1;
+	}
+
+	// Generator 'n' of the current seed. It starts from the cached stream if that one is not after 'n', the jumps are
+	// done out of the lock.
+	static RCRng stream(uint64_t n)
+	{
+		const uint64_t seed = globalSeed().load(std::memory_order_relaxed);
+		StreamCache &cache = streamCache();
+		RCRng g(seed);
+		uint64_t at = 0;
+		{
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			if (cache.valid and cache.seed == seed and cache.n <= n)
+			{
+				g = cache.g;
+				at = cache.n;
+			}
+		}
+		for (; at < n; ++at)
+			g.jump();
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		cache.valid = true;
+		cache.seed = seed;
+		cache.n = n;
+		cache.g = g;
+		return g;
+	}
+
+	// Generator of the calling thread, created on first use with the next stream
+	static RCRng &local()
+	{
+		thread_local RCRng g = stream(nextStream()++);
+		return g;
+	}
+
+	// uniform in [0, 1) from the upper bits
+	template < typename G >
+	static inline double uniform(G &g) { return (g() >> 11) * 0x1.0p-53; }
+	template < typename G >
+	static inline float uniformf(G &g) { return (g() >> 40) * 0x1.0p-24f; }
+
+	// batches of uniform numbers in [a, b) and of normal numbers (Box-Muller, two per uniform pair)
+	template < typename G, typename Real >
+	static void uniform(G &g, Real *out, std::size_t n, Real a = 0, Real b = 1)
+	{
+		for (std::size_t i = 0; i < n; ++i)
+			out[i] = a + (b - a) * Real(uniform(g));
+	}
+	template < typename G, typename Real >
+	static void normal(G &g, Real *out, std::size_t n, Real mean = 0, Real stddev = 1)
+	{
+		for (std::size_t i = 0; i < n; i += 2)
+		{
+			const double r = std::sqrt(-2. * std::log(1. - uniform(g))), a = 2. * M_PI * uniform(g);
+			out[i] = mean + stddev * Real(r * std::cos(a));
+			if (i + 1 < n)
+				out[i + 1] = mean + stddev * Real(r * std::sin(a));
+		}
+	}
+
+private:
+	static std::atomic<uint64_t> &globalSeed()
+	{
+		static std::atomic<uint64_t> s{0x853c49e6748fea9bull};
+		return s;
+	}
+	// last generator returned by stream(), tagged with its seed and number
+	struct StreamCache
+	{
+		std::mutex mutex;
+		bool valid = false;
+		uint64_t seed = 0, n = 0;
+		RCRng g;
+	};
+	static StreamCache &streamCache()
+	{
+		static StreamCache c;
+		return c;
+	}
+	static std::atomic<uint64_t> &nextStream()
+	{
+		static std::atomic<uint64_t> n{0};
+		return n;
+	}
+};
+
+#endif
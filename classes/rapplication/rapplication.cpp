@@ -18,11 +18,13 @@
  */
 #include "rapplication.h"
 
+#include <algorithm>
+
 namespace RoboComp
 {
 	bool Application::configGetString( const std::string name, std::string &value,  const std::string default_value, QStringList *list)
 	{
-		value = communicator()->getProperties()->getProperty( name );
+		value = getProperty( name );
 		if ( value.length() == 0)
 		{
 			std::cout << name << " property does not exist. Using default value." << std::endl;
@@ -42,16 +44,14 @@ namespace RoboComp
 
 	bool Application::configGetInt( const std::string name, int &value, const int default_value, QList< int > *list )
 	{
-		string tmp;
-	
-		tmp = communicator()->getProperties()->getProperty( name );
-		if ( tmp.length() == 0)
+		const Property *p = findProperty( name );
+		if ( p == NULL )
 		{
 			std::cout << name << " property does not exist. Using default value." << std::endl;
 			value = default_value;
 			return false;
 		}
-		value = std::atoi( tmp.c_str() );
+		value = p->i;
 		if(list != NULL)
 		{
 			if (list->contains(value) == false)
@@ -65,8 +65,8 @@ namespace RoboComp
 
 	bool Application::configGetBool (const std::string name, bool &value, const int default_value)
 	{
-		string tmp;
-		tmp = communicator()->getProperties()->getProperty( name );
+		const Property *p = findProperty( name );
+		const string tmp = p != NULL ? p->text : "";
 		if ( tmp.length() == 0 )
 		{
 			if (default_value != -1)
@@ -81,11 +81,11 @@ namespace RoboComp
 				qFatal("Error\n");
 			}
 		}
-		if(tmp == "true" or tmp == "True" or tmp == "yes" or tmp == "Yes" or tmp == "1")
+		if (p->b == 1)
 		{
 			value = true;
 		} 
-		else if (tmp == "false" or tmp == "False" or tmp == "no" or tmp == "No" or tmp == "0")
+		else if (p->b == 0)
 		{
 			value = false;
 		}
@@ -99,16 +99,14 @@ namespace RoboComp
 
 	bool Application::configGetFloat( const std::string name, float &value, const float default_value, QList< int > *list )
 	{
-		QString tmp;
-	
-		tmp = QString::fromStdString(communicator()->getProperties()->getProperty( name ));
-		if ( tmp.length() == 0)
+		const Property *p = findProperty( name );
+		if ( p == NULL )
 		{
 			std::cout << name << " property does not exist. Using default value." << std::endl;
 			value = default_value;
 			return false;
 		}
-		value = tmp.toFloat();
+		value = p->f;
 		if(list != NULL)
 		{
 			if (list->contains(value) == false)
@@ -122,7 +120,7 @@ namespace RoboComp
 	std::string Application::getProxyString(const std::string name)
 	{
 		std::string proxy;
-		proxy = communicator()->getProperties()->getProperty( name );
+		proxy = getProperty( name );
 		cout << "[" << __FILE__ << "]: Loading [" << proxy << "] proxy at '" << name << "'..." << endl;
 		//rInfo("Application::Loading "+QString::fromStdString(proxy)+" at "+QString::fromStdString(name));
 		if( proxy.empty() )
@@ -133,5 +131,79 @@ namespace RoboComp
 		else
 		  return proxy;
 	}
-}
 
+	const Application::Property *Application::findProperty(const std::string &name)
+	{
+		std::call_once(propertiesLoaded, [this]() { reloadProperties(); });
+		auto it = properties.find(name);
+		if (it == properties.end() or it->second.text.empty())
+			return NULL;
+		return &it->second;
+	}
+
+	void Application::reloadProperties()
+	{
+		properties.clear();
+		const Ice::PropertyDict all = communicator()->getProperties()->getPropertiesForPrefix("");
+		for (const auto &kv : all)
+		{
+			Property p;
+			p.text = kv.second;
+			p.i = std::atoi(p.text.c_str());
+			p.f = QString::fromStdString(p.text).toFloat();
+			const std::string &t = p.text;
+			if (t == "true" or t == "True" or t == "yes" or t == "Yes" or t == "1")
+				p.b = 1;
+			else if (t == "false" or t == "False" or t == "no" or t == "No" or t == "0")
+				p.b = 0;
+			else
+				p.b = -1;
+			properties.emplace(kv.first, std::move(p));
+		}
+	}
+
+	std::string Application::getProperty(const std::string &name, const std::string &default_value)
+	{
+		const Property *p = findProperty(name);
+		return p != NULL ? p->text : default_value;
+	}
+
+	int Application::getPropertyInt(const std::string &name, int default_value)
+	{
+		const Property *p = findProperty(name);
+		return p != NULL ? p->i : default_value;
+	}
+
+	float Application::getPropertyFloat(const std::string &name, float default_value)
+	{
+		const Property *p = findProperty(name);
+		return p != NULL ? p->f : default_value;
+	}
+
+	bool Application::getPropertyBool(const std::string &name, bool default_value)
+	{
+		const Property *p = findProperty(name);
+		return (p != NULL and p->b != -1) ? p->b == 1 : default_value;
+	}
+
+	bool Application::hasProperty(const std::string &name)
+	{
+		return findProperty(name) != NULL;
+	}
+
+	int Application::connectProxies()
+	{
+		std::vector<std::function<bool()>> pending;
+		pending.swap(pendingProxies);
+		if (pending.empty())
+			return 0;
+
+		std::vector<char> ok(pending.size(), 0);
+		{
+			// one worker per proxy: the resolutions block on the network, not on the CPU
+			ThreadPool pool(ThreadPool::Config{.num_threads = static_cast<uint32_t>(std::min<std::size_t>(pending.size(), 64)), .name = "rc-proxies"});
+			pool.spawn_bulk(pending.size(), [&](std::size_t i) { ok[i] = pending[i](); }).wait();
+		}
+		return std::count(ok.begin(), ok.end(), 0);
+	}
+}
@@ -20,6 +20,12 @@
 #include <Ice/Application.h>
 #include <IceUtil/IceUtil.h>
 #include <QtCore>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <threadpool/threadpool.h>
 
 using namespace std;
 
@@ -41,6 +47,72 @@ namespace RoboComp
 		bool configGetBool (const std::string name, bool &value, const int default_value  = -1 );
 		bool configGetFloat( const std::string name, float &value, const float default_value = 0, QList< int > *list = NULL);
 		std::string getProxyString(const std::string name);
+
+		// Typed access to the properties, parsed once from the communicator on first use. No console output
+		std::string getProperty(const std::string &name, const std::string &default_value = "");
+		int getPropertyInt(const std::string &name, int default_value = 0);
+		float getPropertyFloat(const std::string &name, float default_value = 0);
+		bool getPropertyBool(const std::string &name, bool default_value = false);
+		bool hasProperty(const std::string &name);
+		// Parses the properties again, e.g. after changing them at run time. Not safe while other threads read them
+		void reloadProperties();
+
+		// Proxies are registered with addProxy() and resolved together by connectProxies(), each one in a
+		// thread of a ThreadPool, so startup waits for the slowest peer instead of the sum of their timeouts.
+		// Checked: the peer is contacted (ice_isA) with an invocation timeout of timeout_ms.
+		// Lazy: nothing is contacted, the connection is made by the first call through the proxy.
+		// A checked proxy whose peer is down is still assigned, and then also connects on first use.
+		enum class ProxyMode { Checked, Lazy };
+		template <typename Prx>
+		void addProxy(const std::string &name, Prx &proxy, int timeout_ms = 2000, ProxyMode mode = ProxyMode::Checked);
+		int connectProxies();   // returns the number of proxies that could not be verified
+
+	private:
+		struct Property
+		{
+			std::string text;
+			int i;
+			float f;
+			int b;              // 1 true, 0 false, -1 not a boolean
+		};
+		std::unordered_map<std::string, Property> properties;
+		std::once_flag propertiesLoaded;
+		const Property *findProperty(const std::string &name);
+
+		std::vector<std::function<bool()>> pendingProxies;
+		std::mutex proxyOutputMutex;
 	};
 
+	template <typename Prx>
+	void Application::addProxy(const std::string &name, Prx &proxy, int timeout_ms, ProxyMode mode)
+	{
+		const std::string endpoint = getProxyString(name);
+		pendingProxies.push_back([this, name, endpoint, &proxy, timeout_ms, mode]()
+		{
+			if (endpoint.empty())
+				return false;
+			try
+			{
+				Ice::ObjectPrx base = communicator()->stringToProxy(endpoint);
+				proxy = Prx::uncheckedCast(base);
+				if (mode == ProxyMode::Lazy)
+					return true;
+				// the invocation timeout is not part of the connection: the connection opened here is the proxy's one
+				if (not Prx::checkedCast(base->ice_invocationTimeout(timeout_ms)))
+				{
+					std::lock_guard<std::mutex> lock(proxyOutputMutex);
+					cout << "[" << __FILE__ << "]: " << name << " (" << endpoint << ") is not of the expected type" << endl;
+					return false;
+				}
+				return true;
+			}
+			catch (const Ice::Exception &ex)
+			{
+				std::lock_guard<std::mutex> lock(proxyOutputMutex);
+				cout << "[" << __FILE__ << "]: " << name << " (" << endpoint << ") not available: " << ex << ". It will connect on first use" << endl;
+				return false;
+			}
+		});
+	}
+
 }
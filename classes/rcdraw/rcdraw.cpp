@@ -17,9 +17,46 @@
  *    along with RoboComp.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 
 #include "rcdraw.h"
 
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+typedef void (APIENTRY *VertexAttribDivisorFunc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY *DrawArraysInstancedFunc)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+
+static const int CircleSegments = 32;
+static const int CircleFirst = 0;                     // first vertex of the circle template
+static const int SquareFirst = CircleSegments + 2;    // first vertex of the square template
+static const int VertexFloats = 6;                    // x, y, r, g, b, a
+static const int InstanceFloats = 10;                 // cx, cy, sx, sy, cos, sin, r, g, b, a
+
+// Unit shapes are scaled, rotated and translated per instance
+static const char *shapeVertexShader =
+	"#version 120\n"
+	"attribute vec2 vertex;\n"
+	"attribute vec4 placement;\n"
+	"attribute vec2 rotation;\n"
+	"attribute vec4 color;\n"
+	"varying vec4 fcolor;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 p = vertex * placement.zw;\n"
+	"	p = vec2(p.x*rotation.x - p.y*rotation.y, p.x*rotation.y + p.y*rotation.x) + placement.xy;\n"
+	"	gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+	"	fcolor = color;\n"
+	"}\n";
+static const char *shapeFragmentShader =
+	"#version 120\n"
+	"varying vec4 fcolor;\n"
+	"void main()\n"
+	"{\n"
+	"	gl_FragColor = fcolor;\n"
+	"}\n";
+
 RCDraw::RCDraw( int _width, int _height, uchar *img, QWidget *parent) : QGLWidget(parent), width(_width), height(_height)
 {
 	resize(width, height);
@@ -114,6 +151,13 @@ RCDraw::RCDraw(const QRect &win_, QWidget *parent) : QGLWidget(parent)
 
 RCDraw::~RCDraw()
 {
+	if (batchesReady)
+	{
+		makeCurrent();
+		qDeleteAll(batches);
+		shapeTemplates.destroy();
+		delete shapeProgram;
+	}
 }
 
 bool RCDraw::autoResize(bool ignoreAspectRatio)
@@ -167,6 +211,11 @@ void RCDraw::init( )
 	qimg->setColorTable ( ctable );
 	translating = false;
 	effWin = win;
+	batchedRendering = false;
+	batchesReady = false;
+	instancing = false;
+	shapeProgram = NULL;
+	vertexAttribDivisor = drawArraysInstanced = NULL;
 	QGLFormat f = format();
 	if (f.sampleBuffers())
 	{
@@ -213,6 +262,12 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		drawAxis(Qt::blue, 2);
 	}
 
+	if ( batchedRendering )
+	{
+		packBatches(painter);
+		drawBatches(painter, BLines, BLines);
+	}
+
 	//Draw lines
 	while ( !lineQueue.isEmpty() )
 	{
@@ -236,6 +291,9 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		painter.drawLine ( g.line );
 	}
 
+	if ( batchedRendering )
+		drawBatches(painter, BCircleFill, BSquareOutline);
+
 	//Draw ellipses
 	while ( !ellipseQueue.isEmpty() )
 	{
@@ -292,6 +350,8 @@ void RCDraw::paintEvent ( QPaintEvent * )
 		painter.setPen(pen);
 	}
 
+	if ( batchedRendering )
+		drawBatches(painter, BLinesOnTop, BLinesOnTop);
 
 	while ( !lineOnTopQueue.isEmpty() )
 	{
@@ -340,6 +400,279 @@ void RCDraw::paintEvent ( QPaintEvent * )
 }
 
 
+///Batched rendering
+
+void RCDraw::initBatches()
+{
+	batchesReady = true;
+
+	QVector<GLfloat> t;
+	t << 0 << 0;
+	for (int i=0; i<=CircleSegments; i++)
+		t << cos(2.*M_PI*i/CircleSegments) << sin(2.*M_PI*i/CircleSegments);
+	t << 0 << 0 << -1 << -1 << 1 << -1 << 1 << 1 << -1 << 1 << -1 << -1;
+	shapeTemplates = QGLBuffer(QGLBuffer::VertexBuffer);
+	shapeTemplates.create();
+	shapeTemplates.bind();
+	shapeTemplates.allocate(t.constData(), t.size()*sizeof(GLfloat));
+	shapeTemplates.release();
+
+	const QGLContext *ctx = context();
+	vertexAttribDivisor = (void *)ctx->getProcAddress("glVertexAttribDivisor");
+	if (vertexAttribDivisor == NULL)
+		vertexAttribDivisor = (void *)ctx->getProcAddress("glVertexAttribDivisorARB");
+	drawArraysInstanced = (void *)ctx->getProcAddress("glDrawArraysInstanced");
+	if (drawArraysInstanced == NULL)
+		drawArraysInstanced = (void *)ctx->getProcAddress("glDrawArraysInstancedARB");
+	if (vertexAttribDivisor != NULL and drawArraysInstanced != NULL and QGLShaderProgram::hasOpenGLShaderPrograms(ctx))
+	{
+		shapeProgram = new QGLShaderProgram(ctx);
+		instancing = shapeProgram->addShaderFromSourceCode(QGLShader::Vertex, shapeVertexShader) and
+		             shapeProgram->addShaderFromSourceCode(QGLShader::Fragment, shapeFragmentShader) and
+		             shapeProgram->link();
+	}
+	if (not instancing)
+		std::cout << "RCDraw: instanced drawing not available, shapes are expanded on the CPU" << std::endl;
+}
+
+RCDraw::TBatch *RCDraw::batch(BatchType type, float lineWidth)
+{
+	const int key = (type << 16) | qBound(0, qRound(lineWidth*4.f), 0xFFFF);
+	QMap<int, TBatch *>::iterator it = batches.find(key);
+	if (it != batches.end())
+		return it.value();
+	TBatch *b = new TBatch;
+	b->vbo = QGLBuffer(QGLBuffer::VertexBuffer);
+	b->vbo.setUsagePattern(QGLBuffer::DynamicDraw);
+	b->lineWidth = lineWidth;
+	batches.insert(key, b);
+	return b;
+}
+
+// Pixels covered by a pen of the given width in window coordinates, 0 being a cosmetic pen
+float RCDraw::pixelWidth(float penWidth) const
+{
+	const float scale = effWin.width() != 0 ? fabs(QWidget::width()/effWin.width()) : 1.f;
+	return std::max(1.f, penWidth*scale);
+}
+
+// Moves the line, ellipse and square queues into the batches, with the same transformations as the immediate mode
+void RCDraw::packBatches(QPainter &painter)
+{
+	if (not batchesReady)
+	{
+		painter.beginNativePainting();
+		initBatches();
+		painter.endNativePainting();
+	}
+	foreach (TBatch *b, batches)
+		b->data.resize(0);
+
+	for (int i=0; i<lineQueue.size(); i++)
+	{
+		TLine l = lineQueue[i];
+		if (invertedVerticalAxis) l.line = QLineF(l.line.x1()-visibleCenter(0), -l.line.y1()+visibleCenter(1), l.line.x2()-visibleCenter(0), -l.line.y2()+visibleCenter(1));
+		else l.line.translate(-visibleCenter(0), -visibleCenter(1));
+		addLine(batch(BLines, pixelWidth(l.width)), l.line, l.color);
+	}
+	lineQueue.clear();
+
+	const float ellipseWidth = pixelWidth(1);
+	for (int i=0; i<ellipseQueue.size(); i++)
+	{
+		TEllipse e = ellipseQueue[i];
+		if (invertedVerticalAxis) e.center.setY(-(e.center.y()-visibleCenter(1)));
+		else e.center = QPointF(e.center.x()-visibleCenter(0), e.center.y()-visibleCenter(1));
+		const float ang = fabs(e.ang) > 0.1 ? e.ang : 0;
+		if (e.fill)
+			addShape(true, true, e.center, e.rx, e.ry, ang, e.color, 0);
+		addShape(true, false, e.center, e.rx, e.ry, ang, e.color, ellipseWidth);
+	}
+	ellipseQueue.clear();
+
+	for (int i=0; i<squareQueue.size(); i++)
+	{
+		TRect r = squareQueue[i];
+		if (invertedVerticalAxis) r.rect = QRect(r.rect.x()-visibleCenter(0), -r.rect.y()+visibleCenter(1)-r.rect.height(), r.rect.width(), r.rect.height());
+		else r.rect.translate(-visibleCenter(0),-visibleCenter(1));
+		const float ang = fabs(r.ang) > 0.01 ? r.ang : 0;
+		if (r.fill)
+			addShape(false, true, r.rect.center(), r.rect.width()/2., r.rect.height()/2., ang, r.color, 0);
+		addShape(false, false, r.rect.center(), r.rect.width()/2., r.rect.height()/2., ang, r.color, pixelWidth((int)r.width));
+	}
+	squareQueue.clear();
+
+	for (int i=0; i<lineOnTopQueue.size(); i++)
+	{
+		TLine l = lineOnTopQueue[i];
+		l.line.translate(-visibleCenter(0), -visibleCenter(1));
+		addLine(batch(BLinesOnTop, pixelWidth(l.width)), l.line, l.color);
+	}
+	lineOnTopQueue.clear();
+}
+
+void RCDraw::addLine(TBatch *b, const QLineF &line, const QColor &c)
+{
+	const GLfloat v[2*VertexFloats] = { (GLfloat)line.x1(), (GLfloat)line.y1(), (GLfloat)c.redF(), (GLfloat)c.greenF(), (GLfloat)c.blueF(), (GLfloat)c.alphaF(),
+	                                    (GLfloat)line.x2(), (GLfloat)line.y2(), (GLfloat)c.redF(), (GLfloat)c.greenF(), (GLfloat)c.blueF(), (GLfloat)c.alphaF() };
+	const int n = b->data.size();
+	b->data.resize(n + 2*VertexFloats);
+	memcpy(b->data.data()+n, v, sizeof(v));
+}
+
+void RCDraw::addShape(bool circle, bool fill, const QPointF &center, float sx, float sy, float degrees, const QColor &c, float lineWidth)
+{
+	TBatch *b = batch(circle ? (fill ? BCircleFill : BCircleOutline) : (fill ? BSquareFill : BSquareOutline), lineWidth);
+	const float rads = degrees*M_PI/180.;
+	const float cs = cos(rads), sn = sin(rads);
+	if (instancing)
+	{
+		b->data << center.x() << center.y() << sx << sy << cs << sn << c.redF() << c.greenF() << c.blueF() << c.alphaF();
+		return;
+	}
+
+	// no instancing: transform the unit shape here
+	static float unitCircle[CircleSegments][2];
+	static bool unitCircleReady = false;
+	if (not unitCircleReady)
+	{
+		for (int i=0; i<CircleSegments; i++)
+		{
+			unitCircle[i][0] = cos(2.*M_PI*i/CircleSegments);
+			unitCircle[i][1] = sin(2.*M_PI*i/CircleSegments);
+		}
+		unitCircleReady = true;
+	}
+	static const float unitSquare[4][2] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+	const float (*unit)[2] = circle ? unitCircle : unitSquare;
+	const int n = circle ? CircleSegments : 4;
+
+	QPointF ring[CircleSegments];
+	for (int i=0; i<n; i++)
+	{
+		const float x = unit[i][0]*sx, y = unit[i][1]*sy;
+		ring[i] = QPointF(x*cs - y*sn + center.x(), x*sn + y*cs + center.y());
+	}
+	for (int i=0; i<n; i++)
+	{
+		const QPointF &p = ring[i], &q = ring[(i+1)%n];
+		if (fill)
+		{
+			b->data << center.x() << center.y() << c.redF() << c.greenF() << c.blueF() << c.alphaF();
+			b->data << p.x() << p.y() << c.redF() << c.greenF() << c.blueF() << c.alphaF();
+			b->data << q.x() << q.y() << c.redF() << c.greenF() << c.blueF() << c.alphaF();
+		}
+		else
+			addLine(b, QLineF(p, q), c);
+	}
+}
+
+// Draws the non-empty batches of types [first, last], uploading only those that changed since the last frame
+void RCDraw::drawBatches(QPainter &painter, BatchType first, BatchType last)
+{
+	QMap<int, TBatch *>::const_iterator it = batches.lowerBound(first << 16);
+	const QMap<int, TBatch *>::const_iterator end = batches.lowerBound((last+1) << 16);
+	bool empty = true;
+	for (QMap<int, TBatch *>::const_iterator i = it; i != end and empty; ++i)
+		empty = i.value()->data.isEmpty();
+	if (empty)
+		return;
+
+	painter.beginNativePainting();
+	glViewport(0, 0, QWidget::width(), QWidget::height());
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	const QRect w = effWin.toRect();
+	glOrtho(w.left(), w.left()+w.width(), w.top()+w.height(), w.top(), -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	for (; it != end; ++it)
+	{
+		TBatch *b = it.value();
+		const int type = it.key() >> 16;
+		if (b->data.isEmpty())
+			continue;
+
+		if (not b->vbo.isCreated())
+			b->vbo.create();
+		b->vbo.bind();
+		const int bytes = b->data.size()*sizeof(GLfloat);
+		if (b->data.size() != b->uploaded.size())
+		{
+			b->vbo.allocate(b->data.constData(), bytes);
+			b->uploaded.resize(b->data.size());
+			memcpy(b->uploaded.data(), b->data.constData(), bytes);
+		}
+		else if (memcmp(b->uploaded.constData(), b->data.constData(), bytes) != 0)
+		{
+			b->vbo.write(0, b->data.constData(), bytes);
+			memcpy(b->uploaded.data(), b->data.constData(), bytes);
+		}
+
+		const bool fill = type == BCircleFill or type == BSquareFill;
+		if (not fill)
+			glLineWidth(b->lineWidth);
+		if (type == BLines or type == BLinesOnTop or not instancing)
+		{
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glEnableClientState(GL_COLOR_ARRAY);
+			glVertexPointer(2, GL_FLOAT, VertexFloats*sizeof(GLfloat), 0);
+			glColorPointer(4, GL_FLOAT, VertexFloats*sizeof(GLfloat), (const GLvoid *)(2*sizeof(GLfloat)));
+			glDrawArrays(fill ? GL_TRIANGLES : GL_LINES, 0, b->data.size()/VertexFloats);
+			glDisableClientState(GL_COLOR_ARRAY);
+			glDisableClientState(GL_VERTEX_ARRAY);
+		}
+		else
+		{
+			static const char *names[3] = { "placement", "rotation", "color" };
+			static const int offsets[3] = { 0, 4, 6 }, sizes[3] = { 4, 2, 4 };
+			const bool circle = type == BCircleFill or type == BCircleOutline;
+			const int base = circle ? CircleFirst : SquareFirst;
+			const int segments = circle ? CircleSegments : 4;
+
+			shapeProgram->bind();
+			shapeTemplates.bind();
+			shapeProgram->enableAttributeArray("vertex");
+			shapeProgram->setAttributeBuffer("vertex", GL_FLOAT, 0, 2);
+			b->vbo.bind();
+			for (int k=0; k<3; k++)
+			{
+				const int location = shapeProgram->attributeLocation(names[k]);
+				shapeProgram->enableAttributeArray(location);
+				shapeProgram->setAttributeBuffer(location, GL_FLOAT, offsets[k]*sizeof(GLfloat), sizes[k], InstanceFloats*sizeof(GLfloat));
+				((VertexAttribDivisorFunc)vertexAttribDivisor)(location, 1);
+			}
+			const int instances = b->data.size()/InstanceFloats;
+			if (fill)
+				((DrawArraysInstancedFunc)drawArraysInstanced)(GL_TRIANGLE_FAN, base, segments+2, instances);
+			else
+				((DrawArraysInstancedFunc)drawArraysInstanced)(GL_LINE_LOOP, base+1, segments, instances);
+			for (int k=0; k<3; k++)
+			{
+				const int location = shapeProgram->attributeLocation(names[k]);
+				((VertexAttribDivisorFunc)vertexAttribDivisor)(location, 0);
+				shapeProgram->disableAttributeArray(location);
+			}
+			shapeProgram->disableAttributeArray("vertex");
+			shapeProgram->release();
+		}
+		b->vbo.release();
+	}
+
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	painter.endNativePainting();
+}
+
+
 void RCDraw::drawSquare ( const QRect &rect, const QColor & col, bool fill, int id, float rot, float width)
 {
 	TRect r;
@@ -501,6 +834,9 @@ void RCDraw::drawEllipse ( const QRectF & rect, const QColor &col, bool fill, in
 {
 	TEllipse e;
 	e.rect = rect;
+	e.center = rect.center();
+	e.rx = rect.width()/2.;
+	e.ry = rect.height()/2.;
 	e.color= col;
 	e.id = id;
 	e.fill = fill;
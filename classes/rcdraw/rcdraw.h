@@ -24,6 +24,8 @@
 
 #include <qmat/QMatAll>
 #include <QGLWidget>
+#include <QGLBuffer>
+#include <QGLShaderProgram>
 
 
 /**
@@ -31,6 +33,12 @@
 
   The constructor will automatically call show() method.
 
+  With setBatchedRendering(true) lines, squares and ellipses are not drawn one by one with QPainter:
+  paintEvent packs them into vertex buffers grouped by primitive and line width (one draw call each),
+  uploads a buffer only when its contents differ from the previous frame and draws squares and
+  ellipses as instances of a unit shape when the GL implementation supports instancing. Text and
+  gradients are still painted with QPainter.
+
 */
 class RCDraw : public QGLWidget
 {
@@ -86,6 +94,8 @@ public:
 	void removeImage() { if (qimg != NULL) delete qimg; qimg = NULL; }
 
 	void setZoomMultiplier (float mul) { zoomMul = mul; }
+	void setBatchedRendering(bool batched) { batchedRendering = batched; }
+	bool isBatchedRendering() const { return batchedRendering; }
 
 protected:
 	float imageScale;
@@ -159,6 +169,31 @@ protected:
 
 	QVec visibleCenter;
 
+	//Batched rendering
+	enum BatchType { BLines=0, BCircleFill, BCircleOutline, BSquareFill, BSquareOutline, BLinesOnTop, BTypes };
+	struct TBatch
+	{
+		QVector<GLfloat> data;       // packed in this frame
+		QVector<GLfloat> uploaded;   // current contents of vbo
+		QGLBuffer vbo;
+		float lineWidth;             // pixels
+	};
+	bool batchedRendering;
+	bool batchesReady;
+	bool instancing;
+	QMap<int, TBatch *> batches;     // key: (type << 16) | line width in quarters of pixel
+	QGLBuffer shapeTemplates;        // unit circle and unit square (center + closed ring)
+	QGLShaderProgram *shapeProgram;
+	void *vertexAttribDivisor, *drawArraysInstanced;   // resolved from the context in initBatches()
+
+	void initBatches();
+	TBatch *batch(BatchType type, float lineWidth);
+	float pixelWidth(float penWidth) const;
+	void packBatches(QPainter &painter);
+	void addLine(TBatch *b, const QLineF &line, const QColor &c);
+	void addShape(bool circle, bool fill, const QPointF &center, float sx, float sy, float degrees, const QColor &c, float lineWidth);
+	void drawBatches(QPainter &painter, BatchType first, BatchType last);
+
 signals:
 	void iniMouseCoor(QPoint p);
 	void endMouseCoor(QPoint p);
@@ -20,69 +20,215 @@
 #define SerializableMatrix_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#ifdef SERIALIZABLEMATRIX_USE_LZ4
+#include <lz4.h>
+#endif
+
 
+/**
+ * File format (version 1), little or big endian as written by the host:
+ *   header (64 bytes): magic "RCSMAT", version, endianness marker, element type and size, width, height, depth,
+ *                      payload alignment and offset, compression, chunk size, stored bytes and payload checksum
+ *   payload at an offset multiple of the alignment: the elements, or with compression the compressed size of every
+ *   chunk followed by the chunks (LZ4, built with SERIALIZABLEMATRIX_USE_LZ4)
+ *
+ * Uncompressed files can be memory mapped with mapFile(): the matrix reads the pages of the file, shared with the
+ * other processes mapping it, and the writes are private to this process. Files written by the old save() (width,
+ * height and depth followed by the elements) are still read by load().
+ */
 template <typename T>
 class SerializableMatrix
 {
 public:
+	enum class Compression : uint32_t { None = 0, LZ4 = 1 };
 
+	// Reads the whole matrix into memory, checking the payload checksum
 	bool load(std::string path)
 	{
-		FILE *fd = fopen(path.c_str(), "r");
-		if (fd != NULL) {
-			unsigned int rows, columns, depth;
-			fread(&rows, 1, sizeof(unsigned int), fd);
-			fread(&columns, 1, sizeof(unsigned int), fd);
-			fread(&depth, 1, sizeof(unsigned int), fd);
-			resize(rows, columns, depth);
-			fread(&data[0], rows*columns*depth, sizeof(T), fd);
-			fclose(fd);
-			return true;
+		FILE *fd = fopen(path.c_str(), "rb");
+		if (fd == NULL)
+			return fail("Can't open %s for reading\n", path);
+		FileHeader header;
+		const bool versioned = fread(&header, sizeof(header), 1, fd) == 1 and memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0;
+		bool ok = false;
+		if (not versioned)
+		{
+			unsigned int dims[3];   // legacy file: height, width, depth and the elements
+			ok = fseek(fd, 0, SEEK_SET) == 0 and fread(dims, sizeof(unsigned int), 3, fd) == 3;
+			if (ok)
+			{
+				resize(dims[1], dims[0], dims[2]);
+				ok = fread(getDataPointer(), sizeof(T), count(), fd) == count();
+			}
+		}
+		else if (checkHeader(header, path))
+		{
+			resize(header.width, header.height, header.depth);
+			std::vector<char> stored(header.storedBytes);
+			ok = fseek(fd, header.payloadOffset, SEEK_SET) == 0 and fread(stored.data(), 1, stored.size(), fd) == stored.size();
+			if (ok and header.compression == uint32_t(Compression::None))
+			{
+				if (not stored.empty())   // an empty matrix has no payload, the pointers can be null
+					memcpy(getDataPointer(), stored.data(), stored.size());
+			}
+			else if (ok)
+				ok = decompress(header, stored, path);
+			if (ok and checksum(getDataPointer(), count() * sizeof(T)) != header.checksum)
+			{
+				fclose(fd);
+				return fail("Checksum error in %s\n", path);
+			}
 		}
 		else
 		{
-			printf ("Can't open %s for reading\n", path.c_str());
-			fflush(stdout);
-			exit(-3);
+			fclose(fd);
 			return false;
 		}
+		fclose(fd);
+		if (not ok)
+			return fail("Can't read %s\n", path);
+		return true;
 	}
 
-	void save(std::string path)
+	// Maps an uncompressed versioned file instead of reading it. The checksum is only verified on request, since it
+	// touches every page. The payload offset has to be aligned for T, the elements are used in place.
+	bool mapFile(std::string path, bool verify=false)
 	{
-		FILE *fd = fopen(path.c_str(), "w");
-		if (fd != NULL)
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return fail("Can't open %s for reading\n", path);
+		struct stat st;
+		FileHeader header;
+		const bool ok = fstat(fd, &st) == 0 and pread(fd, &header, sizeof(header), 0) == sizeof(header) and
+		                memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0;
+		if (not ok or not checkHeader(header, path) or header.compression != uint32_t(Compression::None) or
+		    uint64_t(header.payloadOffset) + header.storedBytes > uint64_t(st.st_size) or header.payloadOffset % alignof(T) != 0)
 		{
-			fwrite(&height,  1,                  sizeof(unsigned int), fd);
-			fwrite(&width,   1,                  sizeof(unsigned int), fd);
-			fwrite(&depth,   1,                  sizeof(unsigned int), fd);
-			fwrite(&data[0], height*width*depth, sizeof(T),            fd);
-			fclose(fd);
+			close(fd);
+			return fail("Can't map %s (not an uncompressed matrix file)\n", path);
 		}
-		else
+		void *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED)
+			return fail("Can't map %s\n", path);
+		unmap();
+		data.clear();
+		data.shrink_to_fit();
+		mapping = m;
+		mappingBytes = st.st_size;
+		width = header.width;
+		height = header.height;
+		depth = header.depth;
+		base = reinterpret_cast<T *>(static_cast<char *>(m) + header.payloadOffset);
+		if (verify and checksum(base, count() * sizeof(T)) != header.checksum)
+		{
+			resize(0, 0, 0);
+			return fail("Checksum error in %s\n", path);
+		}
+		return true;
+	}
+
+	// Saves in the versioned format. 'alignment' (a power of two) places the payload for mapFile(), 'chunkSize' is
+	// the number of bytes compressed independently.
+	bool save(std::string path, Compression compression=Compression::None, unsigned int alignment=64, unsigned int chunkSize=1<<20)
+	{
+		if (alignment < alignof(T) or (alignment & (alignment - 1)) != 0 or chunkSize == 0)
+			return fail("Invalid alignment or chunk size saving %s\n", path);
+		FileHeader header;
+		memcpy(header.magic, MAGIC, sizeof(MAGIC));
+		header.dtype = dtype();
+		header.elementSize = sizeof(T);
+		header.width = width;
+		header.height = height;
+		header.depth = depth;
+		header.alignment = alignment;
+		header.payloadOffset = (sizeof(FileHeader) + alignment - 1) / alignment * alignment;
+		header.compression = uint32_t(compression);
+		header.chunkSize = chunkSize;
+		header.checksum = checksum(getDataPointer(), count() * sizeof(T));
+
+		std::vector<char> stored;
+		const char *payload = reinterpret_cast<const char *>(getDataPointer());
+		header.storedBytes = count() * sizeof(T);
+		if (compression != Compression::None)
 		{
-			printf ("Can't open %s for writting\n", path.c_str());
-			fflush(stdout);
-			exit(-1);
+			if (not compress(payload, header.storedBytes, chunkSize, stored))
+				return fail("Compression not available saving %s\n", path);
+			payload = stored.data();
+			header.storedBytes = stored.size();
 		}
+
+		FILE *fd = fopen(path.c_str(), "wb");
+		if (fd == NULL)
+			return fail("Can't open %s for writting\n", path);
+		std::vector<char> padding(header.payloadOffset - sizeof(header), 0);
+		bool ok = fwrite(&header, sizeof(header), 1, fd) == 1 and
+		          (padding.empty() or fwrite(padding.data(), 1, padding.size(), fd) == padding.size()) and
+		          (header.storedBytes == 0 or fwrite(payload, 1, header.storedBytes, fd) == header.storedBytes);
+		ok = fclose(fd) == 0 and ok;
+		if (not ok)
+			return fail("Can't write %s\n", path);
+		return true;
 	}
 
 	SerializableMatrix()
 	{
 		width = height = depth = 0;
 		data.resize(1);
+		base = data.data();
+	}
+
+	SerializableMatrix(const SerializableMatrix &other)
+	{
+		*this = other;
+	}
+
+	SerializableMatrix &operator=(const SerializableMatrix &other)
+	{
+		if (this != &other)
+		{
+			unmap();
+			width = other.width;
+			height = other.height;
+			depth = other.depth;
+			data.assign(other.base, other.base + other.count());
+			base = data.data();
+		}
+		return *this;
 	}
 
+	~SerializableMatrix()
+	{
+		unmap();
+	}
+
+	// A mapped matrix is first copied into memory
 	void resize(int newWidth, int newHeight=1, int newDepth=1)
 	{
+		detach();
 		width = newWidth;
 		height = newHeight;
 		depth = newDepth;
 		data.resize(width*height*depth);
+		base = data.data();
+	}
+
+	inline bool isMapped() const
+	{
+		return mapping != NULL;
 	}
 
 	inline void memset0()
@@ -90,8 +236,10 @@ public:
 		memset(getDataPointer(), 0, sizeof(T)*width*height*depth);
 	}
 
+	// A mapped matrix is first copied into memory
 	inline std::vector<T> *getVector()
 	{
+		detach();
 		return &data;
 	}
 
@@ -112,68 +260,68 @@ public:
 
 	inline unsigned int getSize()
 	{
-		if (width*height*depth != data.size()) exit(-934);
+		if (width*height*depth != count()) exit(-934);
 		return width*height*depth;
 	}
 
 	inline T *getDataPointer()
 	{
-		if (data.size() > 0)
-			return &data[0];
+		if (count() > 0)
+			return base;
 		return NULL;
 	}
 
 	inline T get1D(unsigned int x)
 	{
-		if (data.size() > x) return data[x];
+		if (count() > x) return base[x];
 		else throw std::string("SerializableMatrix::get1D() out of bounds.");
 	}
 
 	inline T get2D(unsigned int x, unsigned int y)
 	{
-		if (data.size() > x + y*width) return data[x + y*width];
+		if (count() > x + y*width) return base[x + y*width];
 		else throw std::string("SerializableMatrix::get2D() out of bounds.");
 	}
 
 	inline T get3D(unsigned int x, unsigned int y, unsigned int z)
 	{
-		if (data.size() > x + y*width + z*height*width) return data[x + y*width + z*height*width];
+		if (count() > x + y*width + z*height*width) return base[x + y*width + z*height*width];
 		else throw std::string("SerializableMatrix::get3D() out of bounds.");
 	}
 
 	inline void set1D(unsigned int x, T val)
 	{
-		if (data.size() > x) data[x] = val;
+		if (count() > x) base[x] = val;
 		else throw std::string("SerializableMatrix::set1D() out of bounds.");
 	}
 
 	inline void set2D(unsigned int x, unsigned int y, T val)
 	{
-		if (data.size() > x + y*width) data[x + y*width] = val;
+		if (count() > x + y*width) base[x + y*width] = val;
 		else throw std::string("SerializableMatrix::set2D() out of bounds.");
 	}
 
 	inline void set3D(unsigned int x, unsigned int y, unsigned int z, T val)
 	{
-		if (data.size() > x + y*width + z*height*width) data[x + y*width + z*height*width] = val;
+		if (count() > x + y*width + z*height*width) base[x + y*width + z*height*width] = val;
 		else throw std::string("SerializableMatrix::set2D() out of bounds.");
 	}
 
 	inline void inc1D(unsigned int x)
 	{
-		if (data.size() > x) data[x] = data[x] + 1;
+		if (count() > x) base[x] = base[x] + 1;
 		else throw std::string("SerializableMatrix::inc1D() out of bounds.");
 	}
 
 	inline void inc2D(unsigned int x, unsigned int y)
 	{
-		if (data.size() > x + y*width) data[x + y*width] = data[x + y*width] + 1;
+		if (count() > x + y*width) base[x + y*width] = base[x + y*width] + 1;
 		else throw std::string("SerializableMatrix::inc2D() out of bounds.");
 	}
 
 	inline void inc3D(unsigned int x, unsigned int y, unsigned int z)
 	{
-		if (data.size() > x + y*width + z*height*width) data[x + y*width + z*height*width] = data[x + y*width + z*height*width] + 1;
+		if (count() > x + y*width + z*height*width) base[x + y*width + z*height*width] = base[x + y*width + z*height*width] + 1;
 		else throw std::string("SerializableMatrix::inc3D() out of bounds.");
 	}
 
@@ -206,10 +354,159 @@ public:
 // 	}
 
 private:
+	static constexpr char MAGIC[6] = {'R', 'C', 'S', 'M', 'A', 'T'};
+	static constexpr uint32_t VERSION = 1, ENDIAN = 0x01020304;
+
+	struct FileHeader
+	{
+		char magic[6];
+		uint16_t version = VERSION;
+		uint32_t endian = ENDIAN;
+		uint32_t dtype, elementSize;
+		uint32_t width, height, depth;
+		uint32_t alignment, payloadOffset;
+		uint32_t compression, chunkSize;
+		uint64_t storedBytes;
+		uint64_t checksum;
+	};
+	static_assert(sizeof(FileHeader) == 64, "SerializableMatrix header must be 64 bytes");
+
+	// element type tag: 1-4 signed integers of 1, 2, 4 and 8 bytes, 5-8 unsigned, 9 float, 10 double, 0 other
+	static constexpr uint32_t dtype()
+	{
+		if (std::is_floating_point<T>::value)
+			return sizeof(T) == 4 ? 9 : sizeof(T) == 8 ? 10 : 0;
+		if (std::is_integral<T>::value)
+		{
+			const uint32_t size = sizeof(T) == 1 ? 1 : sizeof(T) == 2 ? 2 : sizeof(T) == 4 ? 3 : 4;
+			return std::is_signed<T>::value ? size : size + 4;
+		}
+		return 0;
+	}
+
+	bool checkHeader(const FileHeader &header, const std::string &path) const
+	{
+		if (header.endian != ENDIAN)
+			return fail("%s was written with a different endianness\n", path);
+		if (header.version != VERSION)
+			return fail("%s has an unknown version\n", path);
+		if (header.dtype != dtype() or header.elementSize != sizeof(T))
+			return fail("%s holds a different element type\n", path);
+		if (header.compression == uint32_t(Compression::None) and header.storedBytes != uint64_t(header.width) * header.height * header.depth * sizeof(T))
+			return fail("%s has a wrong payload size\n", path);
+		return true;
+	}
+
+	// 64 bit hash of the payload, four independent lanes of 8 bytes
+	static uint64_t checksum(const void *p, uint64_t bytes)
+	{
+		const unsigned char *b = static_cast<const unsigned char *>(p);
+		const uint64_t prime = 0x100000001b3ull;
+		uint64_t h[4] = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull, 0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full};
+		uint64_t i = 0;
+		for (; i + 32 <= bytes; i += 32)
+			for (int l = 0; l < 4; l++)
+			{
+				uint64_t w;
+				memcpy(&w, b + i + 8 * l, 8);
+				h[l] = (h[l] ^ w) * prime;
+			}
+		for (; i < bytes; i++)
+			h[0] = (h[0] ^ b[i]) * prime;
+		uint64_t r = bytes;
+		for (int l = 0; l < 4; l++)
+			r = (r ^ h[l] ^ (h[l] >> 29)) * prime;
+		return r;
+	}
+
+	// chunked payload: the compressed size of every chunk (uint32) followed by the chunks
+	static bool compress(const char *raw, uint64_t bytes, uint32_t chunkSize, std::vector<char> &stored)
+	{
+#ifdef SERIALIZABLEMATRIX_USE_LZ4
+		const uint64_t chunks = (bytes + chunkSize - 1) / chunkSize;
+		stored.resize(chunks * sizeof(uint32_t));
+		for (uint64_t c = 0; c < chunks; c++)
+		{
+			const int in = std::min<uint64_t>(chunkSize, bytes - c * chunkSize);
+			const size_t at = stored.size();
+			stored.resize(at + LZ4_compressBound(in));
+			const int out = LZ4_compress_default(raw + c * chunkSize, stored.data() + at, in, LZ4_compressBound(in));
+			if (out <= 0)
+				return false;
+			stored.resize(at + out);
+			const uint32_t size = out;
+			memcpy(stored.data() + c * sizeof(uint32_t), &size, sizeof(size));
+		}
+		return true;
+#else
+		(void)raw; (void)bytes; (void)chunkSize; (void)stored;
+		return false;
+#endif
+	}
+
+	bool decompress(const FileHeader &header, const std::vector<char> &stored, const std::string &path)
+	{
+#ifdef SERIALIZABLEMATRIX_USE_LZ4
+		if (header.compression != uint32_t(Compression::LZ4) or header.chunkSize == 0)
+			return fail("%s uses an unknown compression\n", path);
+		const uint64_t bytes = count() * sizeof(T), chunks = (bytes + header.chunkSize - 1) / header.chunkSize;
+		char *raw = reinterpret_cast<char *>(getDataPointer());
+		uint64_t at = chunks * sizeof(uint32_t);
+		if (at > stored.size())
+			return false;
+		for (uint64_t c = 0; c < chunks; c++)
+		{
+			uint32_t size;
+			memcpy(&size, stored.data() + c * sizeof(uint32_t), sizeof(size));
+			const int out = std::min<uint64_t>(header.chunkSize, bytes - c * header.chunkSize);
+			if (at + size > stored.size() or LZ4_decompress_safe(stored.data() + at, raw + c * header.chunkSize, size, out) != out)
+				return false;
+			at += size;
+		}
+		return true;
+#else
+		(void)header; (void)stored;
+		return fail("%s is compressed and LZ4 support was not built\n", path);
+#endif
+	}
+
+	static bool fail(const char *format, const std::string &path)
+	{
+		printf(format, path.c_str());
+		fflush(stdout);
+		return false;
+	}
+
+	inline uint64_t count() const
+	{
+		return isMapped() ? uint64_t(width) * height * depth : data.size();
+	}
+
+	// copies the mapped elements into memory and releases the mapping
+	void detach()
+	{
+		if (not isMapped())
+			return;
+		data.assign(base, base + count());
+		base = data.data();
+		unmap();
+	}
+
+	void unmap()
+	{
+		if (mapping != NULL)
+			munmap(mapping, mappingBytes);
+		mapping = NULL;
+		mappingBytes = 0;
+	}
+
 	unsigned int width;
 	unsigned int height;
 	unsigned int depth;
 	std::vector<T> data;
+	T *base = NULL;               // the elements: data, or the mapped payload
+	void *mapping = NULL;
+	size_t mappingBytes = 0;
 };
 
 #endif
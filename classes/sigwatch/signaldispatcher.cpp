@@ -0,0 +1,164 @@
+/*
+ * Unix signal dispatcher without Qt.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "signaldispatcher.h"
+
+/*!
+ * Process wide dispatcher, signal dispositions are shared by all the threads.
+ */
+SignalDispatcher &SignalDispatcher::instance()
+{
+    static SignalDispatcher dispatcher;
+    return dispatcher;
+}
+
+SignalDispatcher::SignalDispatcher()
+{
+    if (::pipe2(pipe_fds, O_CLOEXEC))
+        throw std::runtime_error(std::string("SignalDispatcher: pipe: ") + ::strerror(errno));
+    // the handler must never block, a full pipe only drops repeated notifications
+    ::fcntl(pipe_fds[1], F_SETFL, ::fcntl(pipe_fds[1], F_GETFL) | O_NONBLOCK);
+    thread = std::thread(&SignalDispatcher::loop, this);
+}
+
+SignalDispatcher::~SignalDispatcher()
+{
+    for (int s = 1; s <= MAX_SIGNAL; s++)
+        if (installed & (uint64_t(1) << (s - 1)))
+            ::sigaction(s, &previous[s], nullptr);
+    const int quit = 0;
+    ssize_t n = ::write(pipe_fds[1], &quit, sizeof(quit));
+    (void)n;
+    if (thread.joinable())
+        thread.join();
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+}
+
+/*!
+ * Registers a \a handler for \a signal, installing the signal handler the first time the signal is used.
+ */
+int SignalDispatcher::connect(int signal, Handler handler)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    install(signal);
+    handlers.emplace(signal, std::make_pair(next_id, std::move(handler)));
+    return next_id++;
+}
+
+void SignalDispatcher::disconnect(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = handlers.begin(); it != handlers.end(); ++it)
+        if (it->second.first == id)
+        {
+            handlers.erase(it);
+            return;
+        }
+}
+
+void SignalDispatcher::watch_for_stop(std::initializer_list<int> signals)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int s : signals)
+    {
+        install(s);
+        stop_signals.fetch_or(uint64_t(1) << (s - 1), std::memory_order_relaxed);
+    }
+}
+
+void SignalDispatcher::request_stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stop_flag.store(true, std::memory_order_relaxed);
+    }
+    stop_cv.notify_all();
+}
+
+bool SignalDispatcher::wait_for_stop(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(stop_mutex);
+    if (timeout == std::chrono::milliseconds::max())
+    {
+        stop_cv.wait(lock, [] { return stop_requested(); });
+        return true;
+    }
+    return stop_cv.wait_for(lock, timeout, [] { return stop_requested(); });
+}
+
+/*!
+ * Called with the mutex held.
+ */
+void SignalDispatcher::install(int signal)
+{
+    if (signal < 1 or signal > MAX_SIGNAL)
+        throw std::invalid_argument("SignalDispatcher: invalid signal " + std::to_string(signal));
+    const uint64_t bit = uint64_t(1) << (signal - 1);
+    if (installed & bit)
+        return;
+    struct sigaction sigact;
+    ::memset(&sigact, 0, sizeof(sigact));
+    sigact.sa_handler = SignalDispatcher::signal_handler;
+    ::sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = SA_RESTART;
+    if (::sigaction(signal, &sigact, &previous[signal]))
+        throw std::runtime_error(std::string("SignalDispatcher: sigaction: ") + ::strerror(errno));
+    installed |= bit;
+}
+
+/*!
+ * Async signal context: sets the stop flag if the signal requests it and wakes the dispatcher thread.
+ */
+void SignalDispatcher::signal_handler(int signal)
+{
+    const int saved = errno;
+    if (stop_signals.load(std::memory_order_relaxed) & (uint64_t(1) << (signal - 1)))
+        stop_flag.store(true, std::memory_order_relaxed);
+    ssize_t n = ::write(pipe_fds[1], &signal, sizeof(signal));
+    (void)n;
+    errno = saved;
+}
+
+void SignalDispatcher::loop()
+{
+    pthread_setname_np(pthread_self(), "rc-signals");
+    std::vector<Handler> pending;
+    for (;;)
+    {
+        int signal;
+        const ssize_t n = ::read(pipe_fds[0], &signal, sizeof(signal));
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n != sizeof(signal) or signal == 0)
+            return;
+        // wake the threads blocked in wait_for_stop(), the handler could not
+        if (stop_requested())
+        {
+            { std::lock_guard<std::mutex> lock(stop_mutex); }
+            stop_cv.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto [first, last] = handlers.equal_range(signal);
+            for (auto it = first; it != last; ++it)
+                pending.push_back(it->second.second);
+        }
+        // outside the lock, a handler may connect or disconnect
+        for (auto &h : pending)
+        {
+            try { h(signal); }
+            catch (const std::exception &e) { std::cerr << "SignalDispatcher: handler for signal " << signal << " threw: " << e.what() << std::endl; }
+        }
+        pending.clear();
+    }
+}
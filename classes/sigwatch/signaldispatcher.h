@@ -0,0 +1,88 @@
+/*
+ * Unix signal dispatcher without Qt.
+ *
+ * UnixSignalWatcher delivers signals through the Qt event loop, so they wait while the main thread is busy.
+ * SignalDispatcher runs the callbacks on its own thread, and the signals chosen with watch_for_stop() also
+ * raise a process wide "graceful stop" flag from inside the signal handler itself, so a worker sees it on its
+ * next poll whatever the other threads are doing.
+ *
+ * Example:
+ *      SignalDispatcher::instance().watch_for_stop();          // SIGINT and SIGTERM
+ *      SignalDispatcher::instance().connect(SIGHUP, [](int) { reload_config(); });
+ *
+ *      // in a ThreadPool task, a DoubleBuffer/BufferSync consumer or any loop:
+ *      while (not SignalDispatcher::stop_requested())
+ *      {
+ *          auto data = buffer.get(std::chrono::milliseconds(50)); // bounded waits bound the shutdown latency
+ *          ...
+ *      }
+ *
+ *      // main thread:
+ *      SignalDispatcher::wait_for_stop();
+ */
+
+#ifndef SIGNALDISPATCHER_H
+#define SIGNALDISPATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+
+class SignalDispatcher
+{
+public:
+    using Handler = std::function<void(int)>;
+
+    static SignalDispatcher &instance();
+
+    // Runs handler on the dispatcher thread each time signal arrives. Returns an id for disconnect().
+    int connect(int signal, Handler handler);
+    void disconnect(int id);
+
+    // The signals raise the stop flag as soon as they arrive. Connected handlers still run for them.
+    void watch_for_stop(std::initializer_list<int> signals = {SIGINT, SIGTERM});
+
+    // One relaxed atomic load, cheap enough for every iteration of a worker loop.
+    static bool stop_requested() noexcept { return stop_flag.load(std::memory_order_relaxed); }
+    static void request_stop();
+    static void reset_stop() noexcept { stop_flag.store(false, std::memory_order_relaxed); }
+    // Blocks until a stop is requested. Returns false on timeout.
+    static bool wait_for_stop(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+private:
+    SignalDispatcher();
+    ~SignalDispatcher();
+    SignalDispatcher(const SignalDispatcher &) = delete;
+    SignalDispatcher &operator=(const SignalDispatcher &) = delete;
+
+    static constexpr int MAX_SIGNAL = 64;
+
+    static void signal_handler(int signal);
+    void install(int signal);
+    void loop();
+
+    // used from the signal handler: lock free atomics and the pipe only
+    static inline std::atomic<bool> stop_flag{false};
+    static inline std::atomic<uint64_t> stop_signals{0};
+    static inline int pipe_fds[2] = {-1, -1};
+    static_assert(std::atomic<bool>::is_always_lock_free and std::atomic<uint64_t>::is_always_lock_free);
+
+    static inline std::mutex stop_mutex;
+    static inline std::condition_variable stop_cv;
+
+    std::mutex mutex;
+    std::multimap<int, std::pair<int, Handler>> handlers;     // signal -> (id, handler)
+    struct sigaction previous[MAX_SIGNAL + 1];
+    uint64_t installed = 0;
+    int next_id = 0;
+    std::thread thread;
+};
+
+#endif // SIGNALDISPATCHER_H
@@ -36,6 +36,9 @@ class UnixSignalWatcherPrivate;
  *
  * To watch for a given signal, e.g. \c SIGINT, call \c watchForSignal(SIGINT)
  * and \c connect() your handler to unixSignal().
+ *
+ * Signals are delivered through the Qt event loop. When they must be handled
+ * while the main thread is busy, use SignalDispatcher (signaldispatcher.h).
  */
 
 class UnixSignalWatcher : public QObject
@@ -1,63 +1,157 @@
 #include <string>
+#include <algorithm>
 #include "simplifyPath.h"
+#include <threadpool/threadpool.h>
 
 using std::vector;
-//Given an array of points, "findMaximumDistance" calculates the GPS point which have largest distance from the line formed by first and last points in RDP algorithm. Returns the index of the point in the array and the distance.
+//Given a range of an array of points, "findMaximumDistance" calculates the GPS point which have largest distance from the line formed by first and last points in RDP algorithm. Returns the index of the point in the array and the distance.
+//The points are compared by their cross product with the line, so the norm of the line is computed once. If first and last are the same point (closed loop), the distance to that point is used.
 
-const std::pair<int, double> simplifyPath::findMaximumDistance(const vector<Point> &Points) const
+const std::pair<std::size_t, double> simplifyPath::findMaximumDistance(const Point *points, std::size_t first, std::size_t last, ThreadPool *pool, std::size_t grain) const
 {
-	Point firstpoint = Points[0];
-	Point lastpoint = Points[Points.size() - 1];
-	int index = 0;  //index to be returned
-	double Mdist = -1; //the Maximum distance to be returned
-
-	//distance calculation
-	Point p = lastpoint - firstpoint;
-	for (uint i = 1; i < Points.size() - 1; i++)
-	{ //traverse through second point to second last point
-		Point pp = Points[i] - firstpoint;
-		double Dist = fabs(pp * p) / p.Norm(); //formula for point-to-line distance
-		if (Dist > Mdist)
+	const Point firstpoint = points[first];
+	const Point p = points[last] - firstpoint;
+	const double norm = p.Norm();
+	using Best = std::pair<double, std::size_t>;   //(cross product or squared distance, index)
+	auto measure = [&](std::size_t i) -> Best
+	{
+		const Point pp = points[i] - firstpoint;
+		return {norm > 0 ? fabs(pp * p) : pp.x * pp.x + pp.y * pp.y, i};
+	};
+	auto largest = [](Best a, Best b) { return b.first > a.first ? b : a; };   //the first one on ties
+
+	Best best{-1, first};
+	if (pool and last - first > grain)
+		best = pool->parallel_reduce(first + 1, last, grain, best, measure, largest);
+	else
+		for (std::size_t i = first + 1; i < last; i++)   //traverse through second point to second last point
+			best = largest(best, measure(i));
+	return std::make_pair(best.second, norm > 0 ? best.first / norm : sqrt(best.first));
+}
+
+//Marks the points kept in [first, last]. The ranges are processed from a stack; when both halves of a split are large and there is a pool, they are simplified in parallel.
+void simplifyPath::simplifyRange(const Point *points, std::size_t first, std::size_t last, double epsilon, unsigned char *keep, ThreadPool *pool, std::size_t grain) const
+{
+	std::vector<std::pair<std::size_t, std::size_t>> ranges{{first, last}};
+	while (not ranges.empty())
+	{
+		const auto [f, l] = ranges.back();
+		ranges.pop_back();
+		if (l - f < 2)
+			continue;
+		const auto [index, distance] = findMaximumDistance(points, f, l, pool, grain);
+		if (not (distance >= epsilon))   //all points between are to be removed
+			continue;
+		keep[index] = 1;
+		if (pool and index - f > grain and l - index > grain)
 		{
-			Mdist = Dist;
-			index = i;
+			const std::pair<std::size_t, std::size_t> halves[2] = {{f, index}, {index, l}};
+			pool->parallel_for(0, 2, 1, [&](std::size_t h)
+			{
+				simplifyRange(points, halves[h].first, halves[h].second, epsilon, keep, pool, grain);
+			});
+		}
+		else
+		{
+			ranges.emplace_back(index, l);
+			ranges.emplace_back(f, index);
 		}
 	}
-	return std::make_pair(index, Mdist);
 }
 
-
-vector<Point> simplifyPath::simplifyWithRDP(vector<Point> &Points, double epsilon) const
+void simplifyPath::simplifyWithRDP(const Point *points, std::size_t n, double epsilon, std::vector<unsigned char> &keep, ThreadPool *pool, std::size_t grain) const
 {
-	if (Points.size() < 3)
+	keep.assign(n, 0);
+	if (n < 3)
 	{  //base case 1
-		return Points;
+		keep.assign(n, 1);
+		return;
 	}
-	std::pair<int, double> maxDistance = findMaximumDistance(Points);
-	if (maxDistance.second >= epsilon)
+	keep[0] = keep[n - 1] = 1;
+	simplifyRange(points, 0, n - 1, epsilon, keep.data(), pool, std::max<std::size_t>(grain, 2));
+}
+
+void simplifyPath::simplifyWithRDP(const vector<Point> &points, double epsilon, vector<Point> &out, ThreadPool *pool) const
+{
+	thread_local vector<unsigned char> keep;
+	simplifyWithRDP(points.data(), points.size(), epsilon, keep, pool);
+	out.clear();
+	for (std::size_t i = 0; i < points.size(); i++)
+		if (keep[i])
+			out.push_back(points[i]);
+}
+
+vector<Point> simplifyPath::simplifyWithRDP(vector<Point> &Points, double epsilon) const
+{
+	vector<Point> rs;
+	simplifyWithRDP(Points, epsilon, rs);
+	return rs;
+}
+
+//The areas are kept in a min-heap with the version of each point, so the entries left by a neighbour update are skipped when they come out. The removed points are unlinked from a doubly linked list of indices.
+//An area smaller than the one of the point just removed takes that value, so the points go out in increasing order of effective area.
+void simplifyPath::simplifyWithVW(const Point *points, std::size_t n, double minArea, std::vector<unsigned char> &keep, std::size_t minPoints) const
+{
+	keep.assign(n, 1);
+	if (n < 3)
+		return;
+	struct Entry
+	{
+		double area;
+		uint32_t index;
+		uint32_t version;
+		bool operator<(const Entry &o) const { return area > o.area or (area == o.area and index > o.index); }
+	};
+	vector<std::size_t> prev(n), next(n);
+	vector<uint32_t> version(n, 0);
+	vector<Entry> heap;
+	heap.reserve(n);
+	auto area = [&](std::size_t i) { return fabs((points[i] - points[prev[i]]) * (points[next[i]] - points[prev[i]])) / 2.; };
+	for (std::size_t i = 0; i < n; i++)
 	{
-		int index = maxDistance.first;
-		vector<Point>::iterator it = Points.begin();
-		vector<Point> path1(Points.begin(), it + index + 1); //new path l1 from 0 to index
-		vector<Point> path2(it + index, Points.end()); // new path l2 from index to last
-
-		vector<Point> r1 = simplifyWithRDP(path1, epsilon);
-		vector<Point> r2 = simplifyWithRDP(path2, epsilon);
-
-		//Concat simplified path1 and path2 together
-		vector<Point> rs(r1);
-		rs.pop_back();
-		rs.insert(rs.end(), r2.begin(), r2.end());
-		return rs;
+		prev[i] = i > 0 ? i - 1 : 0;
+		next[i] = i + 1 < n ? i + 1 : n - 1;
 	}
-	else
-	{ //base case 2, all points between are to be removed.
-		vector<Point> r(1, Points[0]);
-		r.push_back(Points[Points.size() - 1]);
-		return r;
+	for (std::size_t i = 1; i + 1 < n; i++)
+		heap.push_back({area(i), uint32_t(i), 0});
+	std::make_heap(heap.begin(), heap.end());
+
+	std::size_t remaining = n;
+	while (not heap.empty() and remaining > std::max<std::size_t>(minPoints, 2))
+	{
+		std::pop_heap(heap.begin(), heap.end());
+		const Entry e = heap.back();
+		heap.pop_back();
+		if (e.version != version[e.index])
+			continue;
+		if (e.area >= minArea)
+			break;
+		keep[e.index] = 0;
+		remaining--;
+		const std::size_t p = prev[e.index], q = next[e.index];
+		next[p] = q;
+		prev[q] = p;
+		for (std::size_t j : {p, q})
+			if (j != 0 and j != n - 1)
+			{
+				heap.push_back({std::max(area(j), e.area), uint32_t(j), ++version[j]});
+				std::push_heap(heap.begin(), heap.end());
+			}
 	}
 }
 
+vector<Point> simplifyPath::simplifyWithVW(const vector<Point> &points, double minArea, std::size_t minPoints) const
+{
+	vector<unsigned char> keep;
+	simplifyWithVW(points.data(), points.size(), minArea, keep, minPoints);
+	vector<Point> r;
+	for (std::size_t i = 0; i < points.size(); i++)
+		if (keep[i])
+			r.push_back(points[i]);
+	return r;
+}
+
+
 
 
 
@@ -14,6 +14,9 @@
 #include <cstdlib>
 #include <vector>
 #include <cmath>
+#include <utility>
+
+class ThreadPool;
 
 //"Point" struct stand for each GPS coordinates(x,y). Methods related are used only for simplification of calculation in implementation.
 
@@ -47,15 +50,23 @@ typedef struct Point
 
 class simplifyPath
 {
-	//"findMaximumDistance" used as part of implementation for RDP algorithm.
+	//"findMaximumDistance" used as part of implementation for RDP algorithm. It searches the points strictly between first and last.
 	private:
-		const std::pair<int, double> findMaximumDistance(const std::vector<Point> &Points) const;
+		const std::pair<std::size_t, double> findMaximumDistance(const Point *points, std::size_t first, std::size_t last, ThreadPool *pool, std::size_t grain) const;
+		void simplifyRange(const Point *points, std::size_t first, std::size_t last, double epsilon, unsigned char *keep, ThreadPool *pool, std::size_t grain) const;
 
 	//"simplifyWithRDP" returns the simplified path with a Point vector. The function takes in the paths to be simplified and a customerized thresholds for the simplication.
 	public:
 		std::vector<Point> simplifyWithRDP(std::vector<Point> &Points, double epsilon) const;
-};
 
-#endif 
+	//Iterative RDP over index ranges, without copying the points: keep[i] is set to 1 for the points that stay. With a pool, the ranges of more than "grain" points are split among its workers.
+		void simplifyWithRDP(const Point *points, std::size_t n, double epsilon, std::vector<unsigned char> &keep, ThreadPool *pool = nullptr, std::size_t grain = 4096) const;
+	//Same, writing the simplified path into "out", whose memory is reused between calls.
+		void simplifyWithRDP(const std::vector<Point> &points, double epsilon, std::vector<Point> &out, ThreadPool *pool = nullptr) const;
 
+	//Visvalingam-Whyatt: removes the point that forms the smallest triangle with its neighbours until every remaining one forms a triangle of at least "minArea", or only "minPoints" are left.
+		void simplifyWithVW(const Point *points, std::size_t n, double minArea, std::vector<unsigned char> &keep, std::size_t minPoints = 2) const;
+		std::vector<Point> simplifyWithVW(const std::vector<Point> &points, double minArea, std::size_t minPoints = 2) const;
+};
 
+#endif 
@@ -1,6 +1,122 @@
 #include "graphwidget.h"
 
 #include <QCheckBox>
+#include <QVarLengthArray>
+
+// Barnes-Hut quadtree: the repulsion of a far away cell is that of its whole mass at its center of mass
+class RepulsionTree
+{
+public:
+	RepulsionTree(const QVector<QPointF> &points);
+	QPointF force(int i, qreal theta) const;
+private:
+	struct Cell
+	{
+		qreal x, y, half;   // center and half side
+		qreal mass, mx, my; // number of points and sum of their coordinates
+		int child[4];
+		int point;          // single point of a leaf, -1 otherwise
+	};
+	enum { MaxDepth = 20 };
+	const QVector<QPointF> &points;
+	QVector<Cell> cells;
+	int child(int c, int q);
+	void insert(int i);
+};
+
+RepulsionTree::RepulsionTree(const QVector<QPointF> &pts) : points(pts)
+{
+	if (points.isEmpty())
+		return;
+	QRectF bounds(points[0], QSizeF(0, 0));
+	foreach (const QPointF &p, points)
+		bounds |= QRectF(p, QSizeF(0, 0));
+	Cell root = { bounds.center().x(), bounds.center().y(), qMax(bounds.width(), bounds.height())/2. + 1., 0, 0, 0, {-1, -1, -1, -1}, -1 };
+	cells.reserve(2 * points.size());
+	cells.append(root);
+	for (int i=0; i<points.size(); i++)
+		insert(i);
+}
+
+int RepulsionTree::child(int c, int q)
+{
+	if (cells[c].child[q] < 0)
+	{
+		const qreal h = cells[c].half / 2.;
+		Cell n = { cells[c].x + ((q & 1) ? h : -h), cells[c].y + ((q & 2) ? h : -h), h, 0, 0, 0, {-1, -1, -1, -1}, -1 };
+		cells.append(n);
+		cells[c].child[q] = cells.size() - 1;
+	}
+	return cells[c].child[q];
+}
+
+void RepulsionTree::insert(int i)
+{
+	const QPointF &p = points[i];
+	int c = 0;
+	for (int depth = 0; ; depth++)
+	{
+		if (cells[c].mass == 0)
+		{
+			cells[c].point = i;
+			cells[c].mass = 1;
+			cells[c].mx = p.x();
+			cells[c].my = p.y();
+			return;
+		}
+		if (cells[c].point >= 0 and depth < MaxDepth)
+		{
+			// split the leaf, moving its point one level down
+			const int j = cells[c].point;
+			cells[c].point = -1;
+			const int q = (points[j].x() >= cells[c].x) + 2*(points[j].y() >= cells[c].y);
+			const int n = child(c, q);
+			cells[n].point = j;
+			cells[n].mass = 1;
+			cells[n].mx = points[j].x();
+			cells[n].my = points[j].y();
+		}
+		cells[c].mass += 1;
+		cells[c].mx += p.x();
+		cells[c].my += p.y();
+		if (cells[c].point >= 0)
+			return;   // coincident points at MaxDepth share the leaf
+		c = child(c, (p.x() >= cells[c].x) + 2*(p.y() >= cells[c].y));
+	}
+}
+
+// Same law as Node::calculateForces(): 300 * d / |d|^2 for every other node
+QPointF RepulsionTree::force(int i, qreal theta) const
+{
+	QPointF f(0, 0);
+	if (cells.isEmpty())
+		return f;
+	const QPointF &p = points[i];
+	QVarLengthArray<int, 64> stack;
+	stack.append(0);
+	while (not stack.isEmpty())
+	{
+		const Cell &cell = cells[stack.last()];
+		stack.removeLast();
+		if (cell.mass == 0 or (cell.point == i and cell.mass == 1))
+			continue;
+		const qreal dx = p.x() - cell.mx / cell.mass;
+		const qreal dy = p.y() - cell.my / cell.mass;
+		const qreal l = dx*dx + dy*dy;
+		if (cell.point >= 0 or 4.*cell.half*cell.half < theta*theta*l)
+		{
+			if (l > 0)
+				f += QPointF(dx, dy) * (300. * cell.mass / l);
+		}
+		else
+		{
+			for (int q=0; q<4; q++)
+				if (cell.child[q] >= 0)
+					stack.append(cell.child[q]);
+		}
+	}
+	return f;
+}
 
 
 GraphWidget::GraphWidget(QWidget *parent,QMenu *menu):QGraphicsView(parent)
@@ -19,6 +135,8 @@ GraphWidget::GraphWidget(QWidget *parent,QMenu *menu):QGraphicsView(parent)
 
 	setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
 	timerId = 0;
+	energyThreshold = 0.25;
+	theta = 0.7;
 	scene = new QGraphicsScene(this);
 	scene->setItemIndexMethod(QGraphicsScene::NoIndex);
 
@@ -87,6 +205,12 @@ void GraphWidget::itemMoved()
 		timerId = startTimer(1000 / 25);
 }
 
+// Nodes or edges were added or removed: run the layout again until it settles
+void GraphWidget::layoutChanged()
+{
+	itemMoved();
+}
+
 void GraphWidget::keyPressEvent(QKeyEvent *event)
 {
      switch (event->key()) {
@@ -114,6 +238,7 @@ void GraphWidget::keyPressEvent(QKeyEvent *event)
              if (qgraphicsitem_cast<Node *>(item))
                  item->setPos(qrand() % width(), qrand() % height());
          }
+         layoutChanged();
          break;
      default:
          QGraphicsView::keyPressEvent(event);
@@ -125,9 +250,12 @@ void GraphWidget::timerEvent(QTimerEvent *event)
 	Q_UNUSED(event);
 
 	QList<Node *> nodes;
-	foreach (QGraphicsItem *item, scene->items()) {
-		if (Node *node = qgraphicsitem_cast<Node *>(item))
+	QVector<QPointF> positions;
+	foreach (Node *node, nodes_map) {
+		if (node->scene() == scene) {
 			nodes << node;
+			positions << node->scenePos();
+		}
 	}
 
 	static bool ddd = false;
@@ -139,10 +267,16 @@ void GraphWidget::timerEvent(QTimerEvent *event)
 		ddd = true;
 	}
 	
+	qreal energy = 0;
 	if (not c->isChecked())
-	foreach (Node *node, nodes)
-		node->calculateForces();
-		
+	{
+		// theta 0 never approximates a cell, which is the exact O(N^2) sum
+		const RepulsionTree tree(positions);
+		for (int i=0; i<nodes.size(); i++)
+			energy += nodes[i]->calculateForces(tree.force(i, theta));
+	}
+	else
+		energy = energyThreshold * nodes.size();
 
 	bool itemsMoved = false;
 	foreach (Node *node, nodes) {
@@ -150,7 +284,7 @@ void GraphWidget::timerEvent(QTimerEvent *event)
 			itemsMoved = true;
 	}
 
-	if (!itemsMoved) {
+	if (!itemsMoved or energy < energyThreshold * nodes.size()) {
 		killTimer(timerId);
 		timerId = 0;
 	}
@@ -310,6 +444,7 @@ Node* GraphWidget::addNode(QString id,int key,NodeType type)
 	scene->addItem(node);
 	connect(node,SIGNAL(selectedNode(int)),this,SLOT(selected_Node(int)));
 	connect(node,SIGNAL(removeNode(int)),this,SLOT(remove_Node_key(int)));
+	layoutChanged();
 	return node;
 }
 Node* GraphWidget::addNode(QString id,int key,int parentKey,NodeType type)
@@ -326,6 +461,7 @@ Node* GraphWidget::addNode(QString id,int key,int parentKey,NodeType type)
 		connect(node,SIGNAL(selectedNode(int)),this,SLOT(selected_Node(int)));
 		connect(node,SIGNAL(removeNode(int)),this,SLOT(remove_Node_key(int)));
 		nodes_map[parentKey]->hasChild = true;
+		layoutChanged();
 	}
 	else
 		qDebug()<<"add node: no parent";
@@ -339,6 +475,7 @@ void GraphWidget::removeNode(Node *n)
 	{
 		parent->updateSize();
 	}
+	layoutChanged();
 }
 
 bool GraphWidget::containsNode(int key)
@@ -363,6 +500,7 @@ Edge* GraphWidget::addEdge(int source,int target,EdgeType t)
 
 			edges_map[key] = edge;
 			connect(edge,SIGNAL(removeEdge(QString)),this,SLOT(remove_Edge_key(QString)));
+			layoutChanged();
 		}
 	}
 	return edge;
@@ -25,6 +25,9 @@ public:
 	~GraphWidget();
 	
 	void itemMoved();
+	void layoutChanged();
+	void setLayoutEnergyThreshold(qreal energy) { energyThreshold = energy; }
+	void setBarnesHutTheta(qreal t) { theta = t; }
 
 //	void checkNewItems();
 	void clear();
@@ -67,6 +70,8 @@ protected:
 	void resizeEvent ( QResizeEvent * event );
 private:
 	int timerId;
+	qreal energyThreshold;   // mean squared displacement per tick under which the layout stops
+	qreal theta;             // Barnes-Hut opening criterion, 0 for exact O(N^2) repulsion
 	QGraphicsScene *scene;
 	QMap<int,Node *> nodes_map;
 	QMap<QString,Edge*> edges_map;
@@ -86,30 +86,40 @@ void Node::computeChildArea(float &areaC)
 	}
 }
 
+// Exact O(N) repulsion from every node in the scene, see GraphWidget::timerEvent for the approximated one
 void Node::calculateForces(){
-	if (!scene() || scene()->mouseGrabberItem() == this) {
-        newPos = pos();
-        return;
-    }
-
     // Sum up all forces pushing this item away
     qreal xvel = 0;
     qreal yvel = 0;
-    const QList<QGraphicsItem *> items = scene()->items();
-    for (QGraphicsItem *item : items) {
-        Node *node = qgraphicsitem_cast<Node *>(item);
-        if (!node)
-            continue;
-
-        QPointF vec = mapToItem(node, 0, 0);
-        qreal dx = vec.x();
-        qreal dy = vec.y();
-        double l = 0.5 * (dx * dx + dy * dy);
-        if (l > 0) {
-            xvel += (dx * 150.0) / l;
-            yvel += (dy * 150.0) / l;
+    if (scene()) {
+        const QList<QGraphicsItem *> items = scene()->items();
+        for (QGraphicsItem *item : items) {
+            Node *node = qgraphicsitem_cast<Node *>(item);
+            if (!node)
+                continue;
+
+            QPointF vec = mapToItem(node, 0, 0);
+            qreal dx = vec.x();
+            qreal dy = vec.y();
+            double l = 0.5 * (dx * dx + dy * dy);
+            if (l > 0) {
+                xvel += (dx * 150.0) / l;
+                yvel += (dy * 150.0) / l;
+            }
         }
     }
+    calculateForces(QPointF(xvel, yvel));
+}
+
+// Adds the edge attraction to the given repulsion and returns the squared displacement of the node
+qreal Node::calculateForces(const QPointF &repulsion){
+	if (!scene() || scene()->mouseGrabberItem() == this) {
+        newPos = pos();
+        return 0;
+    }
+
+    qreal xvel = repulsion.x();
+    qreal yvel = repulsion.y();
     // Now subtract all forces pulling items together
     double weight = (edgeList.size() + 1) * 10;
     for (const Edge *edge : qAsConst(edgeList)) {
@@ -128,7 +138,8 @@ void Node::calculateForces(){
     newPos = pos() + QPointF(xvel, yvel);
     newPos.setX(qMin(qMax(newPos.x(), sceneRect.left() + 10), sceneRect.right() - 10));
     newPos.setY(qMin(qMax(newPos.y(), sceneRect.top() + 10), sceneRect.bottom() - 10));
-
+    const QPointF moved = newPos - pos();
+    return moved.x() * moved.x() + moved.y() * moved.y();
 }
 
 bool Node::advance()
@@ -155,8 +166,11 @@ void Node::setActive(bool _active)
 {
 	if(_active)
 		time.restart();
+	// repaint only on changes and while the deactivation fades out
+	const bool changed = _active != active;
 	active = _active;
-	update();
+	if (changed or (not active and time.elapsed() <= ACTIVE_TIME + 100))
+		update();
 }
 void Node::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
 {
@@ -231,7 +245,9 @@ QVariant Node::itemChange(GraphicsItemChange change, const QVariant &value)
 	case ItemPositionHasChanged:
 		foreach (Edge *edge, edgeList)
 			edge->adjust();
-		graph->itemMoved();
+		// the layout restarts on structural changes (GraphWidget::layoutChanged) and on drags, not on its own steps
+		if (scene() and scene()->mouseGrabberItem() == this)
+			graph->itemMoved();
 		break;
 	default:
 		break;
@@ -242,12 +258,15 @@ QVariant Node::itemChange(GraphicsItemChange change, const QVariant &value)
 
 void Node::updateSize(bool first)
 {
-	prepareGeometryChange();
-
 	float maxDist, maxRad;
 	float childArea;
-	if (size == 0 or first)
+	if (first)
+		size = 0;
+	if (size == 0)
+	{
+		prepareGeometryChange();
 		size = 50;
+	}
 	computeMaxDistRad(maxDist, maxRad);
 	computeChildArea(childArea);
 //printf("updateSize %s: %f %f %d\n", id.toStdString().c_str(), maxDist, maxRad, size);
@@ -256,11 +275,13 @@ void Node::updateSize(bool first)
 	{
 		if ((maxDist+maxRad > size and size < 500) or childArea/area > 0.5)
 		{
+			prepareGeometryChange();
 			size += 2;
 			newPos = newPos + QPointF(1, 1);
 		}
 		else if (maxDist+maxRad+ 10 < size and size > 50)
 		{
+			prepareGeometryChange();
 			size -= 2;
 			newPos = newPos - QPointF(1,1);
 		}
@@ -373,6 +394,7 @@ void Node::show()
 	updateSize();
 	this->setPos(qrand() % size, qrand() % size);
 	this->fill = true;
+	graph->layoutChanged();
 	foreach(Edge *edge,edgeList)
 	{
 		if(edge->sourceNode()->isVisible() or edge->destNode()->isVisible())
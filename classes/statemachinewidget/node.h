@@ -59,6 +59,7 @@ public:
 			/*****/
 
 	void calculateForces();
+	qreal calculateForces(const QPointF &repulsion);
 	bool advance();
 
 	QRectF boundingRect() const;
@@ -0,0 +1,473 @@
+//
+// Binary record and replay of the streams that go through BufferSync and DoubleBuffer.
+//
+// StreamRecorder taps the puts of the buffers (see BufferSync::set_tap and DoubleBuffer::set_tap) and appends every
+// value to a memory-mapped log, with the time of the put and the BufferSync timestamp. StreamReplayer reads the log
+// back and puts the values again with the original timing, faster or as fast as possible, so the mapping, planning
+// and particle filter pipelines fed by those buffers can be run and profiled offline with the data of a real session.
+//
+//      record:
+//          BufferSync<InOut<std::vector<float>, std::vector<float>>, InOut<Pose, Pose>> buffer;
+//          StreamRecorder recorder("session.rcs");
+//          recorder.attach<0>(buffer, 0);          // stream ids are chosen by the user, unique in the log
+//          recorder.attach<1>(buffer, 1);
+//          recorder.attach(laser_buffer, 2);       // a DoubleBuffer
+//      replay:
+//          StreamReplayer replay("session.rcs");
+//          replay.to<0>(buffer, 0);
+//          replay.to<1>(buffer, 1);
+//          replay.to(laser_buffer, 2);
+//          replay.on<Pose>(3, [](Pose &&p, size_t timestamp) { ... });      // or any other sink
+//          auto stats = replay.run(2.0);           // 2x faster than recorded, 0: as fast as possible
+//
+// Values are serialized with StreamCodec<T>. Trivially copyable types, std::string, std::vector, std::array and
+// std::pair are supported; other types (e.g. the Ice structures) need a specialization that writes their members:
+//
+//      template <> struct StreamCodec<RoboCompLidar3D::TData>
+//      {
+//          static void encode(const RoboCompLidar3D::TData &d, StreamBytes &out)
+//          {
+//              StreamCodec<decltype(d.points)>::encode(d.points, out);
+//              StreamCodec<decltype(d.timestamp)>::encode(d.timestamp, out);
+//          }
+//          static RoboCompLidar3D::TData decode(StreamCursor &in)
+//          {
+//              RoboCompLidar3D::TData d;
+//              d.points = StreamCodec<decltype(d.points)>::decode(in);
+//              d.timestamp = StreamCodec<decltype(d.timestamp)>::decode(in);
+//              return d;
+//          }
+//      };
+//
+// File layout (native endianness): a 32 bytes header ("RCSTREAM", version, creation time) followed by records of a
+// 32 bytes header (marker, stream, time, timestamp, size) and the payload padded to 8 bytes. The log is append-only
+// and the marker of a record is written after its payload, so a log cut by a crash is read up to its last complete
+// record.
+//
+
+#ifndef STREAMLOG_H
+#define STREAMLOG_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using StreamBytes = std::vector<std::uint8_t>;
+
+// Read position in a payload
+struct StreamCursor
+{
+    const std::uint8_t *p, *end;
+
+    void read(void *dst, std::size_t n)
+    {
+        if (std::size_t(end - p) < n)
+            throw std::runtime_error("StreamCursor: truncated payload");
+        std::memcpy(dst, p, n);
+        p += n;
+    }
+};
+
+template <typename T, typename = void>
+struct StreamCodec
+{
+    static_assert(std::is_trivially_copyable_v<T>, "StreamCodec: specialize StreamCodec<T> for this type");
+    static void encode(const T &v, StreamBytes &out)
+    {
+        const auto *b = reinterpret_cast<const std::uint8_t *>(&v);
+        out.insert(out.end(), b, b + sizeof(T));
+    }
+    static T decode(StreamCursor &in)
+    {
+        T v;
+        in.read(&v, sizeof(T));
+        return v;
+    }
+};
+
+// Containers are written as a 64 bits count and the elements, in one copy when they are trivially copyable
+template <typename C>
+struct StreamSequenceCodec
+{
+    using V = typename C::value_type;
+    static void encode(const C &c, StreamBytes &out)
+    {
+        StreamCodec<std::uint64_t>::encode(c.size(), out);
+        if constexpr (std::is_trivially_copyable_v<V>)
+        {
+            const auto *b = reinterpret_cast<const std::uint8_t *>(c.data());
+            out.insert(out.end(), b, b + c.size() * sizeof(V));
+        }
+        else
+            for (const auto &v : c)
+                StreamCodec<V>::encode(v, out);
+    }
+    static C decode(StreamCursor &in)
+    {
+        const auto n = StreamCodec<std::uint64_t>::decode(in);
+        C c;
+        if constexpr (std::is_trivially_copyable_v<V>)
+        {
+            if (std::size_t(in.end - in.p) / sizeof(V) < n)
+                throw std::runtime_error("StreamCursor: truncated payload");
+            c.resize(n);
+            in.read(c.data(), n * sizeof(V));
+        }
+        else
+        {
+            c.reserve(n);
+            for (std::uint64_t i = 0; i < n; i++)
+                c.push_back(StreamCodec<V>::decode(in));
+        }
+        return c;
+    }
+};
+
+template <typename T, typename A>
+struct StreamCodec<std::vector<T, A>> : StreamSequenceCodec<std::vector<T, A>> {};
+template <>
+struct StreamCodec<std::string> : StreamSequenceCodec<std::string> {};
+
+template <typename T, std::size_t N>
+struct StreamCodec<std::array<T, N>, std::enable_if_t<!std::is_trivially_copyable_v<std::array<T, N>>>>
+{
+    static void encode(const std::array<T, N> &a, StreamBytes &out) { for (const auto &v : a) StreamCodec<T>::encode(v, out); }
+    static std::array<T, N> decode(StreamCursor &in)
+    {
+        std::array<T, N> a;
+        for (auto &v : a)
+            v = StreamCodec<T>::decode(in);
+        return a;
+    }
+};
+
+template <typename A, typename B>
+struct StreamCodec<std::pair<A, B>, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<A, B>>>>
+{
+    static void encode(const std::pair<A, B> &v, StreamBytes &out) { StreamCodec<A>::encode(v.first, out); StreamCodec<B>::encode(v.second, out); }
+    static std::pair<A, B> decode(StreamCursor &in)
+    {
+        A a = StreamCodec<A>::decode(in);
+        return {std::move(a), StreamCodec<B>::decode(in)};
+    }
+};
+
+namespace streamlog
+{
+struct FileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::int64_t created_ns;        // system clock
+    std::int64_t reserved2;
+};
+struct RecordHeader
+{
+    std::uint32_t marker;
+    std::uint32_t stream;
+    std::uint64_t time_ns;          // since the recorder was created (steady clock)
+    std::uint64_t timestamp;        // of BufferSync::put, 0 for DoubleBuffer
+    std::uint64_t size;             // of the payload, without padding
+};
+static_assert(sizeof(FileHeader) == 32 && sizeof(RecordHeader) == 32);
+inline constexpr char file_magic[8] = {'R', 'C', 'S', 'T', 'R', 'E', 'A', 'M'};
+inline constexpr std::uint32_t version = 1;
+inline constexpr std::uint32_t record_marker = 0x44524352;     // "RCRD"
+inline constexpr std::size_t padded(std::size_t n) { return (n + 7) & ~std::size_t(7); }
+
+inline std::runtime_error error(const std::string &what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+}
+
+/**
+ * Appends the values put in the attached buffers to a log file. The file grows in chunks of 'chunk' bytes that are
+ * mapped in memory, so recording a value is serializing it and one memcpy under a lock; it is truncated to its
+ * length when the recorder is destroyed. The recorder must outlive the puts of the attached buffers (or detach them
+ * with set_tap({})).
+ */
+class StreamRecorder
+{
+public:
+    explicit StreamRecorder(const std::string &path, std::size_t chunk = std::size_t(64) << 20)
+        : chunk(streamlog::padded(std::max<std::size_t>(chunk, 4096))), start(std::chrono::steady_clock::now())
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw streamlog::error("StreamRecorder: can not open " + path);
+        try { grow(sizeof(streamlog::FileHeader)); }
+        catch (...) { ::close(fd); throw; }
+        streamlog::FileHeader header{};
+        std::memcpy(header.magic, streamlog::file_magic, sizeof(header.magic));
+        header.version = streamlog::version;
+        header.created_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        std::memcpy(map, &header, sizeof(header));
+        length = sizeof(header);
+    }
+    ~StreamRecorder()
+    {
+        std::lock_guard lock(mutex);
+        if (map)
+        {
+            ::msync(map, length, MS_SYNC);
+            ::munmap(map, capacity);
+        }
+        if (::ftruncate(fd, length) != 0) {}
+        ::close(fd);
+    }
+    StreamRecorder(const StreamRecorder &) = delete;
+    StreamRecorder &operator=(const StreamRecorder &) = delete;
+
+    // Taps put<idx> of a BufferSync
+    template <std::size_t idx, typename Buffer>
+    void attach(Buffer &buffer, std::uint32_t stream)
+    {
+        using I = typename Buffer::template input_t<idx>;
+        buffer.template set_tap<idx>([this, stream](const I &v, std::size_t timestamp) { record(stream, v, timestamp); });
+    }
+    // Taps the puts of a DoubleBuffer
+    template <typename Buffer>
+    void attach(Buffer &buffer, std::uint32_t stream)
+    {
+        using I = typename Buffer::input_type;
+        buffer.set_tap([this, stream](const I &v) { record(stream, v, 0); });
+    }
+
+    template <typename T>
+    void record(std::uint32_t stream, const T &value, std::size_t timestamp)
+    {
+        thread_local StreamBytes scratch;
+        scratch.clear();
+        StreamCodec<std::remove_cvref_t<T>>::encode(value, scratch);
+        write(stream, timestamp, scratch.data(), scratch.size());
+    }
+
+    void write(std::uint32_t stream, std::size_t timestamp, const void *data, std::size_t size)
+    {
+        const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard lock(mutex);
+        const std::size_t total = sizeof(streamlog::RecordHeader) + streamlog::padded(size);
+        if (length + total > capacity)
+            grow(length + total);
+        auto *at = static_cast<std::uint8_t *>(map) + length;
+        streamlog::RecordHeader header{0, stream, std::uint64_t(now), timestamp, size};
+        std::memcpy(at, &header, sizeof(header));
+        std::memcpy(at + sizeof(header), data, size);
+        // the marker last, a record without it ends the log
+        std::atomic_ref<std::uint32_t>(reinterpret_cast<streamlog::RecordHeader *>(at)->marker).store(streamlog::record_marker, std::memory_order_release);
+        length += total;
+        count++;
+    }
+
+    std::size_t records() const { std::lock_guard lock(mutex); return count; }
+    std::size_t bytes() const { std::lock_guard lock(mutex); return length; }
+
+private:
+    // called with the mutex held (or from the constructor)
+    void grow(std::size_t needed)
+    {
+        std::size_t next = capacity;
+        while (next < needed)
+            next += chunk;
+        if (::ftruncate(fd, next) != 0)
+            throw streamlog::error("StreamRecorder: ftruncate");
+        void *m = map ? ::mremap(map, capacity, next, MREMAP_MAYMOVE) : ::mmap(nullptr, next, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED)
+            throw streamlog::error("StreamRecorder: mmap");
+        map = m;
+        capacity = next;
+    }
+
+    const std::size_t chunk;
+    const std::chrono::steady_clock::time_point start;
+    mutable std::mutex mutex;
+    int fd = -1;
+    void *map = nullptr;
+    std::size_t capacity = 0, length = 0, count = 0;
+};
+
+/**
+ * Read-only view of a log: the file is mapped and its records indexed, the payloads are not copied.
+ */
+class StreamLog
+{
+public:
+    struct Record
+    {
+        std::uint32_t stream;
+        std::uint64_t time_ns, timestamp;
+        const std::uint8_t *data;
+        std::size_t size;
+
+        template <typename T>
+        T decode() const
+        {
+            StreamCursor in{data, data + size};
+            return StreamCodec<T>::decode(in);
+        }
+    };
+
+    explicit StreamLog(const std::string &path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw streamlog::error("StreamLog: can not open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(streamlog::FileHeader))
+        {
+            ::close(fd);
+            throw std::runtime_error("StreamLog: " + path + " is not a stream log");
+        }
+        size = st.st_size;
+        map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            throw streamlog::error("StreamLog: mmap " + path);
+        const auto *base = static_cast<const std::uint8_t *>(map);
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, streamlog::file_magic, sizeof(header.magic)) != 0 || header.version != streamlog::version)
+        {
+            ::munmap(map, size);
+            throw std::runtime_error("StreamLog: " + path + " is not a stream log of version " + std::to_string(streamlog::version));
+        }
+        std::size_t at = sizeof(header);
+        while (at + sizeof(streamlog::RecordHeader) <= size)
+        {
+            streamlog::RecordHeader r;
+            std::memcpy(&r, base + at, sizeof(r));
+            if (r.marker != streamlog::record_marker || r.size > size - at - sizeof(r))
+                break;
+            index.push_back({r.stream, r.time_ns, r.timestamp, base + at + sizeof(r), std::size_t(r.size)});
+            at += sizeof(r) + streamlog::padded(r.size);
+        }
+    }
+    ~StreamLog() { ::munmap(map, size); }
+    StreamLog(const StreamLog &) = delete;
+    StreamLog &operator=(const StreamLog &) = delete;
+
+    const std::vector<Record> &records() const { return index; }
+    std::chrono::nanoseconds duration() const
+    {
+        return std::chrono::nanoseconds(index.empty() ? 0 : index.back().time_ns - index.front().time_ns);
+    }
+    // records per stream
+    std::map<std::uint32_t, std::size_t> streams() const
+    {
+        std::map<std::uint32_t, std::size_t> s;
+        for (const auto &r : index)
+            s[r.stream]++;
+        return s;
+    }
+    std::chrono::system_clock::time_point created() const
+    {
+        return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.created_ns)));
+    }
+
+private:
+    void *map = nullptr;
+    std::size_t size = 0;
+    streamlog::FileHeader header;
+    std::vector<Record> index;
+};
+
+/**
+ * Puts the records of a log into the sinks registered for their streams, in the recorded order. The streams
+ * without a sink are skipped.
+ */
+class StreamReplayer
+{
+public:
+    struct Stats
+    {
+        std::size_t records = 0;                        // delivered to a sink
+        std::chrono::nanoseconds elapsed{0};
+        std::chrono::nanoseconds max_lag{0};            // behind the scheduled time, at speed > 0
+        double records_per_second() const { return elapsed.count() > 0 ? records * 1e9 / elapsed.count() : 0; }
+    };
+
+    explicit StreamReplayer(const std::string &path) : log(path) {}
+
+    const StreamLog &stream_log() const { return log; }
+
+    template <typename T>
+    void on(std::uint32_t stream, std::function<void(T &&, std::size_t)> sink)
+    {
+        sinks[stream] = [sink = std::move(sink)](const StreamLog::Record &r) { sink(r.decode<T>(), r.timestamp); };
+    }
+    // Puts the stream into put<idx> of a BufferSync, with the recorded timestamps
+    template <std::size_t idx, typename Buffer>
+    void to(Buffer &buffer, std::uint32_t stream)
+    {
+        using I = typename Buffer::template input_t<idx>;
+        on<I>(stream, [&buffer](I &&v, std::size_t timestamp) { buffer.template put<idx>(std::move(v), timestamp); });
+    }
+    // Puts the stream into a DoubleBuffer
+    template <typename Buffer>
+    void to(Buffer &buffer, std::uint32_t stream)
+    {
+        using I = typename Buffer::input_type;
+        on<I>(stream, [&buffer](I &&v, std::size_t) { buffer.put(std::move(v)); });
+    }
+
+    // speed: 1 replays with the recorded timing, 2 twice as fast, 0 (or less) as fast as possible.
+    // stop() ends it from another thread.
+    Stats run(double speed = 1.0)
+    {
+        using clock = std::chrono::steady_clock;
+        stopped.store(false);
+        Stats stats;
+        const auto &records = log.records();
+        const auto start = clock::now();
+        const std::uint64_t first = records.empty() ? 0 : records.front().time_ns;
+        for (const auto &r : records)
+        {
+            if (stopped.load(std::memory_order_relaxed))
+                break;
+            auto sink = sinks.find(r.stream);
+            if (sink == sinks.end())
+                continue;
+            if (speed > 0)
+            {
+                const auto due = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::nano>((r.time_ns - first) / speed));
+                const auto now = clock::now();
+                if (now < due)
+                    std::this_thread::sleep_until(due);
+                else
+                    stats.max_lag = std::max(stats.max_lag, std::chrono::duration_cast<std::chrono::nanoseconds>(now - due));
+            }
+            sink->second(r);
+            stats.records++;
+        }
+        stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        return stats;
+    }
+    void stop() { stopped.store(true); }
+
+private:
+    StreamLog log;
+    std::unordered_map<std::uint32_t, std::function<void(const StreamLog::Record &)>> sinks;
+    std::atomic_bool stopped{false};
+};
+
+#endif // STREAMLOG_H
@@ -0,0 +1,449 @@
+//
+// Coroutines and continuations on ThreadPool.
+// rc::Task<T> is the result of a computation that completes later: a coroutine returning it, a function spawned with
+// rc::spawn, a then() continuation or a when_all/when_any join. Nothing parks a thread while it waits: the code that
+// consumes the result is attached to the task and runs on the thread that completes it, so a stage of a pipeline
+// occupies a worker only while it computes.
+//
+// A coroutine returning Task<T> starts running on the calling thread, up to its first co_await; co_await
+// pool.schedule() continues it on a worker. Awaiting a task, or a then() without a pool, resumes on the thread that
+// completed the task. A task is consumed once: awaited, chained, joined or waited with get(). get() blocks the caller
+// and is meant for the edges of a pipeline (main, a component's compute loop). Exceptions travel along the chain and
+// are rethrown by co_await and get(); a then() function is not called when its input failed.
+//
+//Example 1: a coroutine.
+//   rc::Task<Points> transform(ThreadPool &tp, Scan scan)
+//   {
+//       co_await tp.schedule();                     //from here on, on a worker
+//       co_return to_world(scan);
+//   }
+//
+//Example 2: continuations. The second then() runs on a worker with low priority.
+//   auto done = rc::spawn(tp, [this]() { return read_laser(); })
+//                   .then([this](Scan s) { return transform(s); })
+//                   .then(tp, [this](Points p) { grid.update_map(p); }, ThreadPool::Priority::Low);
+//
+//Example 3: joins. when_all gives every result, in order; when_any the index and result of the first to complete.
+//   auto [laser, camera] = co_await rc::when_all(read_laser(tp), read_camera(tp));
+//   auto [which, path] = rc::when_any(std::move(planners)).get();
+//
+
+#ifndef THREADPOOL_TASK_H
+#define THREADPOOL_TASK_H
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <threadpool/threadpool.h>
+
+namespace rc
+{
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+//void results are kept, and given by the joins, as std::monostate
+template <typename T>
+using task_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+template <typename T>
+struct is_task : std::false_type {};
+template <typename T>
+struct is_task<Task<T>> : std::true_type {};
+
+template <typename T>
+struct unwrap_task { using type = T; };
+template <typename T>
+struct unwrap_task<Task<T>> { using type = T; };
+
+//Result of a task and the code to run once it is there. The continuation is stored before the status leaves
+//'pending', so the thread that completes the task sees it; if the task completed first, the caller runs it instead.
+template <typename T>
+class task_state
+{
+public:
+    template <typename... Args>
+    void store(Args &&... args) { value.emplace(std::forward<Args>(args)...); }
+    void store_error(std::exception_ptr e) { error = std::move(e); }
+
+    void complete()
+    {
+        if (status.exchange(done, std::memory_order_acq_rel) == attached)
+        {
+            task_wrapper c = std::move(continuation);
+            status.notify_all();
+            c();
+        }
+        else
+            status.notify_all();
+    }
+
+    //false, and 'c' untouched, if the task has already completed
+    bool attach(task_wrapper &c)
+    {
+        continuation = std::move(c);
+        int expected = pending;
+        if (status.compare_exchange_strong(expected, attached, std::memory_order_acq_rel, std::memory_order_acquire))
+            return true;
+        c = std::move(continuation);
+        return false;
+    }
+    void on_complete(task_wrapper &&c)
+    {
+        if (!attach(c))
+            c();
+    }
+
+    bool ready() const { return status.load(std::memory_order_acquire) == done; }
+    void wait() const
+    {
+        for (auto s = status.load(std::memory_order_acquire); s != done; s = status.load(std::memory_order_acquire))
+            status.wait(s, std::memory_order_acquire);
+    }
+
+    T take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*value);
+    }
+    task_value_t<T> take_value()
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            take();
+            return {};
+        }
+        else
+            return take();
+    }
+
+private:
+    enum : int { pending, attached, done };
+    std::atomic<int> status{pending};
+    task_wrapper continuation;
+    std::optional<task_value_t<T>> value;
+    std::exception_ptr error;
+};
+
+template <typename T>
+std::shared_ptr<task_state<T>> make_state()
+{
+    return std::allocate_shared<task_state<T>>(pooled_allocator<task_state<T>>{});
+}
+
+//Stores the result of f(), or the exception it throws, and completes the task. A Task returned by f is unwrapped:
+//'s' completes with it.
+template <typename T, typename F>
+void fulfil(const std::shared_ptr<task_state<T>> &s, F &&f) noexcept
+{
+    using R = std::invoke_result_t<F &>;
+    try
+    {
+        if constexpr (is_task<R>::value)
+        {
+            auto inner = f().release();
+            inner->on_complete(task_wrapper([inner, s]() {
+                fulfil(s, [&inner]() { return inner->take(); });
+            }));
+            return;
+        }
+        else if constexpr (std::is_void_v<R>)
+        {
+            f();
+            s->store();
+        }
+        else
+            s->store(f());
+    }
+    catch (...)
+    {
+        s->store_error(std::current_exception());
+    }
+    s->complete();
+}
+
+template <typename F, typename T>
+struct then_result { using type = std::invoke_result_t<F &, T>; };
+template <typename F>
+struct then_result<F, void> { using type = std::invoke_result_t<F &>; };
+
+//Value type of the task returned by then(): the result of F, unwrapped if it is a Task
+template <typename F, typename T, typename R = typename then_result<F, T>::type>
+using then_value_t = typename unwrap_task<R>::type;
+
+template <typename T>
+struct promise_value
+{
+    std::shared_ptr<task_state<T>> state = make_state<T>();
+
+    template <typename U>
+    void return_value(U &&v) { state->store(std::forward<U>(v)); }
+};
+template <>
+struct promise_value<void>
+{
+    std::shared_ptr<task_state<void>> state = make_state<void>();
+
+    void return_void() { state->store(); }
+};
+}
+
+template <typename T>
+class [[nodiscard]] Task
+{
+public:
+    using value_type = T;
+
+    //The coroutine starts at once and its frame is released when it ends, the result stays in the shared state.
+    //Frames come from the same block_pool as the shared states of the waitable tasks.
+    struct promise_type : detail::promise_value<T>
+    {
+        Task get_return_object() { return Task(this->state); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept
+        {
+            struct final_awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    auto state = std::move(h.promise().state);
+                    h.destroy();
+                    state->complete();
+                }
+                void await_resume() const noexcept {}
+            };
+            return final_awaiter{};
+        }
+        void unhandled_exception() { this->state->store_error(std::current_exception()); }
+
+        static void *operator new(std::size_t bytes) { return block_pool::allocate(bytes); }
+        static void operator delete(void *p, std::size_t bytes) { block_pool::deallocate(p, bytes); }
+    };
+
+    Task() = default;
+    explicit Task(std::shared_ptr<detail::task_state<T>> state) : state(std::move(state)) {}
+
+    bool valid() const { return state != nullptr; }
+    bool is_ready() const { return state->ready(); }
+
+    //Blocks until the task completes. Meant for the edges of a pipeline, never inside a task of a busy pool.
+    void wait() const { state->wait(); }
+    T get()
+    {
+        auto s = release();
+        s->wait();
+        return s->take();
+    }
+
+    auto operator co_await()
+    {
+        struct awaiter
+        {
+            std::shared_ptr<detail::task_state<T>> state;
+
+            bool await_ready() const { return state->ready(); }
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+                task_wrapper resume([h]() { h.resume(); });
+                return state->attach(resume);
+            }
+            T await_resume() { return state->take(); }
+        };
+        return awaiter{release()};
+    }
+
+    //fn(result), or fn() for Task<void>, on the thread that completes this task. The returned task completes with
+    //the result of fn, or with the result of the task fn returns.
+    template <typename Function>
+    auto then(Function &&fn) -> Task<detail::then_value_t<std::decay_t<Function>, T>>
+    {
+        using R = detail::then_value_t<std::decay_t<Function>, T>;
+        auto next = detail::make_state<R>();
+        auto src = release();
+        src->on_complete(task_wrapper([src, next, f = std::forward<Function>(fn)]() mutable {
+            detail::fulfil(next, [&]() -> decltype(auto) {
+                if constexpr (std::is_void_v<T>)
+                {
+                    src->take();
+                    return f();
+                }
+                else
+                    return f(src->take());
+            });
+        }));
+        return Task<R>(std::move(next));
+    }
+
+    //Same, with fn queued on 'pool' when this task completes
+    template <typename Function>
+    auto then(ThreadPool &pool, Function &&fn, ThreadPool::Priority priority = ThreadPool::Priority::Normal)
+        -> Task<detail::then_value_t<std::decay_t<Function>, T>>
+    {
+        return then([&pool, priority, f = std::forward<Function>(fn)](auto &&... v) mutable {
+            auto next = detail::make_state<detail::then_value_t<std::decay_t<Function>, T>>();
+            pool.spawn_task(ThreadPool::TaskOptions{priority},
+                    [next, f = std::move(f), args = std::make_tuple(std::move(v)...)]() mutable {
+                        detail::fulfil(next, [&]() -> decltype(auto) { return std::apply(f, std::move(args)); });
+                    });
+            return Task<detail::then_value_t<std::decay_t<Function>, T>>(std::move(next));
+        });
+    }
+
+    std::shared_ptr<detail::task_state<T>> release() { return std::move(state); }
+
+private:
+    std::shared_ptr<detail::task_state<T>> state;
+};
+
+//Runs fn() on a worker of 'pool' and gives its result as a task
+template <typename Function>
+auto spawn(ThreadPool &pool, Function &&fn, ThreadPool::Priority priority = ThreadPool::Priority::Normal)
+    -> Task<detail::then_value_t<std::decay_t<Function>, void>>
+{
+    auto next = detail::make_state<detail::then_value_t<std::decay_t<Function>, void>>();
+    pool.spawn_task(ThreadPool::TaskOptions{priority}, [next, f = std::forward<Function>(fn)]() mutable {
+        detail::fulfil(next, f);
+    });
+    return Task<detail::then_value_t<std::decay_t<Function>, void>>(std::move(next));
+}
+
+//Completes when every task has completed, with their results in order (nothing for Task<void>). If some failed, with
+//the exception of the first of them in order.
+template <typename T>
+auto when_all(std::vector<Task<T>> tasks) -> Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>>
+{
+    using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+    struct join
+    {
+        std::atomic<std::size_t> remaining;
+        std::vector<std::shared_ptr<detail::task_state<T>>> sources;
+        std::shared_ptr<detail::task_state<R>> next = detail::make_state<R>();
+
+        void finish()
+        {
+            detail::fulfil(next, [this]() {
+                if constexpr (std::is_void_v<T>)
+                    for (auto &s : sources)
+                        s->take();
+                else
+                {
+                    std::vector<T> results;
+                    results.reserve(sources.size());
+                    for (auto &s : sources)
+                        results.push_back(s->take());
+                    return results;
+                }
+            });
+            sources.clear();
+        }
+    };
+
+    auto j = std::make_shared<join>();
+    j->remaining.store(tasks.size());
+    for (auto &t : tasks)
+        j->sources.push_back(t.release());
+    auto result = Task<R>(j->next);
+    if (tasks.empty())
+        j->finish();
+    //a copy of 'sources': the last continuation clears it, there may still be tasks to attach to
+    for (auto sources = j->sources; auto &s : sources)
+        s->on_complete(task_wrapper([j]() {
+            if (j->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                j->finish();
+        }));
+    return result;
+}
+
+//Same for tasks of different types, the results come in a tuple (std::monostate for Task<void>)
+template <typename... Ts>
+    requires (sizeof...(Ts) > 0)
+auto when_all(Task<Ts>... tasks) -> Task<std::tuple<detail::task_value_t<Ts>...>>
+{
+    using R = std::tuple<detail::task_value_t<Ts>...>;
+    struct join
+    {
+        std::atomic<std::size_t> remaining{sizeof...(Ts)};
+        std::tuple<std::shared_ptr<detail::task_state<Ts>>...> sources;
+        std::shared_ptr<detail::task_state<R>> next = detail::make_state<R>();
+
+        void finish()
+        {
+            detail::fulfil(next, [this]() {
+                return std::apply([](auto &... s) { return R{s->take_value()...}; }, sources);
+            });
+            sources = {};
+        }
+    };
+
+    auto j = std::make_shared<join>();
+    j->sources = std::make_tuple(tasks.release()...);
+    auto result = Task<R>(j->next);
+    std::apply([&j](auto... s) {
+        (s->on_complete(task_wrapper([j]() {
+            if (j->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                j->finish();
+        })), ...);
+    }, j->sources);
+    return result;
+}
+
+//Completes with the first task to complete: its index and result (only the index for Task<void>), or its exception.
+//The other tasks keep running, their results are discarded.
+template <typename T>
+auto when_any(std::vector<Task<T>> tasks)
+    -> Task<std::conditional_t<std::is_void_v<T>, std::size_t, std::pair<std::size_t, T>>>
+{
+    using R = std::conditional_t<std::is_void_v<T>, std::size_t, std::pair<std::size_t, T>>;
+    if (tasks.empty())
+        throw std::invalid_argument("when_any: no tasks");
+
+    struct join
+    {
+        std::atomic<bool> finished{false};
+        std::shared_ptr<detail::task_state<R>> next = detail::make_state<R>();
+    };
+
+    auto j = std::make_shared<join>();
+    auto result = Task<R>(j->next);
+    for (std::size_t i = 0; i < tasks.size(); i++)
+    {
+        auto s = tasks[i].release();
+        s->on_complete(task_wrapper([j, s, i]() {
+            if (j->finished.exchange(true, std::memory_order_acq_rel))
+                return;
+            detail::fulfil(j->next, [&]() -> R {
+                if constexpr (std::is_void_v<T>)
+                {
+                    s->take();
+                    return i;
+                }
+                else
+                    return R(i, s->take());
+            });
+        }));
+    }
+    return result;
+}
+
+//Blocks until the task completes and returns its result
+template <typename T>
+T sync_wait(Task<T> task)
+{
+    return task.get();
+}
+}
+
+#endif // THREADPOOL_TASK_H
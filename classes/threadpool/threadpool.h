@@ -78,64 +78,531 @@
 //   tp.spawn_task(DSRGraph::join_delta_node_att, this, ...);
 //and in a lambda:
 //   tp.spawn_task([this]() { ... });
+//
+//Example 6: work-stealing scheduling. Each worker owns a deque where the tasks it spawns are pushed and popped
+//without locking. Idle workers take batches from the shared queue or steal from a random worker.
+//   ThreadPool tp(16, ThreadPool::Scheduling::WorkStealing);
+//   tp.spawn_task([]() { ... }); //Same interface as the default mode.
+//
+//Example 7: batches. spawn_bulk queues n tasks under one lock and returns a single future for all of them.
+//parallel_for and parallel_reduce split a range in chunks and block until it has been processed.
+//   auto f = tp.spawn_bulk(particles.size(), [&](std::size_t i) { particles[i].computeWeight(); });
+//   f.wait();
+//   tp.parallel_for(0, cells.size(), 256, [&](std::size_t i) { cells[i].cost = 1; });
+//   auto total = tp.parallel_reduce(0, v.size(), 0, 0.0, [&](std::size_t i) { return v[i]; }, std::plus<>());
+//
+//Example 8: priorities and deadlines. High priority tasks are taken before any queued normal or low priority one.
+//A task that has not started before its deadline is dropped and counted in dropped_tasks().
+//   tp.spawn_task({ThreadPool::Priority::Low}, [m = std::move(map)]() { save(m); });
+//   tp.spawn_task({ThreadPool::Priority::High, std::chrono::steady_clock::now() + 10ms}, [this]() { convert_laser(); });
+//
+//Example 9: worker configuration. Names, CPU pinning, NUMA node and SCHED_FIFO priority.
+//   ThreadPool tp(ThreadPool::Config{.num_threads = 4, .name = "laser", .numa_node = 0, .realtime_priority = 50});
+//
+//Example 10: metrics. Enqueue/execution counters, wait and run time histograms, worker utilization and queue depth.
+//   ThreadPool tp(ThreadPool::Config{.num_threads = 4, .metrics = true});
+//   auto m = tp.metrics();
+//   std::cout << m.to_prometheus("laser");
+//
+//Example 11: coroutines and continuations (task.h). co_await pool.schedule() moves the coroutine to a worker, and
+//rc::Task<T> is awaited, chained with then() or joined with when_all/when_any without blocking any thread.
+//   rc::Task<Points> transform(ThreadPool &tp, Scan s) { co_await tp.schedule(); co_return to_world(s); }
+//   auto plan = transform(tp, scan).then(tp, [&](Points p) { grid.update(p); return planner.plan(); });
+//   auto [a, b] = rc::when_all(read_laser(tp), read_camera(tp)).get();
 
 
 #ifndef SIMPLE_THREADPOOL
 #define SIMPLE_THREADPOOL
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 
 template<typename ... T>
 concept only_rvalues  = (std::negation< std::bool_constant<std::is_lvalue_reference<T&&>::value> >::value  && ...);
 
 
-//Base Virtual Object to store any kind of callable objects and its arguments.
-class function_wrapper_base
+//Type-erased, move-only callable with inline storage. Callables up to 'inline_size' bytes (a lambda with a few
+//captures, a function pointer and its arguments, a std::promise...) are constructed inside the wrapper, so queuing
+//a task does not allocate. Bigger callables fall back to the heap.
+class task_wrapper
+{
+public:
+    static constexpr std::size_t inline_size = 96;
+
+    task_wrapper() = default;
+
+    template <typename Callable>
+        requires (!std::is_same_v<std::decay_t<Callable>, task_wrapper>)
+    explicit task_wrapper(Callable &&c)
+    {
+        using C = std::decay_t<Callable>;
+        if constexpr (fits_inline<C>)
+        {
+            new (storage) C(std::forward<Callable>(c));
+            ops = &inline_ops<C>;
+        }
+        else
+        {
+            *reinterpret_cast<C **>(storage) = new C(std::forward<Callable>(c));
+            ops = &heap_ops<C>;
+        }
+    }
+
+    task_wrapper(const task_wrapper &) = delete;
+    task_wrapper &operator=(const task_wrapper &) = delete;
+    task_wrapper(task_wrapper &&other) noexcept { move_from(other); }
+    task_wrapper &operator=(task_wrapper &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    ~task_wrapper() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+    explicit operator bool() const { return ops != nullptr; }
+
+    //Time the task was queued, only set when the pool collects metrics.
+    void set_queue_time(std::chrono::steady_clock::time_point t) { queued_at = t; }
+    std::chrono::steady_clock::time_point queue_time() const { return queued_at; }
+
+private:
+    struct operations
+    {
+        void (*invoke)(void *);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *);
+    };
+
+    template <typename C>
+    static constexpr bool fits_inline = sizeof(C) <= inline_size && alignof(C) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<C>;
+
+    template <typename C>
+    static constexpr operations inline_ops = {
+            [](void *s) { (*static_cast<C *>(s))(); },
+            [](void *d, void *s) { new (d) C(std::move(*static_cast<C *>(s))); static_cast<C *>(s)->~C(); },
+            [](void *s) { static_cast<C *>(s)->~C(); }};
+
+    template <typename C>
+    static constexpr operations heap_ops = {
+            [](void *s) { (**static_cast<C **>(s))(); },
+            [](void *d, void *s) { *static_cast<C **>(d) = *static_cast<C **>(s); },
+            [](void *s) { delete *static_cast<C **>(s); }};
+
+    void move_from(task_wrapper &other)
+    {
+        if (other.ops != nullptr)
+        {
+            other.ops->move(storage, other.storage);
+            ops = other.ops;
+            other.ops = nullptr;
+        }
+        queued_at = other.queued_at;
+    }
+
+    void reset()
+    {
+        if (ops != nullptr)
+        {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) std::byte storage[inline_size];
+    const operations *ops = nullptr;
+    std::chrono::steady_clock::time_point queued_at{};
+};
+
+//FIFO of tasks over a ring buffer that only grows, so the steady state does no allocations
+//(std::queue over std::deque allocates and frees a block every few tasks).
+class task_queue
 {
 public:
-    virtual ~function_wrapper_base(){};
-    virtual void operator()() {};
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    task_wrapper &front() { return ring[head]; }
+
+    void emplace(task_wrapper &&task)
+    {
+        if (count == ring.size())
+            grow();
+        ring[(head + count) & (ring.size() - 1)] = std::move(task);
+        count++;
+    }
+
+    void pop()
+    {
+        ring[head] = task_wrapper{};
+        head = (head + 1) & (ring.size() - 1);
+        count--;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<task_wrapper> bigger(std::max<std::size_t>(64, ring.size() * 2));
+        for (std::size_t i = 0; i < count; i++)
+            bigger[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+        ring = std::move(bigger);
+        head = 0;
+    }
+
+    std::vector<task_wrapper> ring;
+    std::size_t head = 0;
+    std::size_t count = 0;
 };
 
-//Specialization
-template <typename Function, typename... Arguments>
-class function_wrapper : public function_wrapper_base
+//Shared queue with one FIFO lane per priority (0 is the highest). front() and pop() work on the highest
+//priority lane that has tasks.
+class priority_task_queue
 {
 public:
-    function_wrapper(Function &&fn, std::tuple<Arguments...> args) : f(std::forward<Function>(fn)),
-                                                                     args(std::move(args)){};
+    static constexpr std::size_t num_lanes = 3;
 
-    void operator()() override
+    bool empty() const { return size() == 0; }
+    std::size_t size() const
+    {
+        std::size_t n = 0;
+        for (auto &l : lanes)
+            n += l.size();
+        return n;
+    }
+    std::size_t size(std::size_t lane) const { return lanes[lane].size(); }
+    std::size_t front_lane() const
     {
-        std::apply(f, std::move(args));
+        for (std::size_t i = 0; i < num_lanes; i++)
+            if (!lanes[i].empty())
+                return i;
+        return num_lanes;
     }
 
+    task_wrapper &front() { return lanes[front_lane()].front(); }
+    void emplace(task_wrapper &&task, std::size_t lane) { lanes[lane].emplace(std::move(task)); }
+    void pop() { lanes[front_lane()].pop(); }
+
 private:
-    Function f;
-    std::tuple<Arguments...> args;
+    std::array<task_queue, num_lanes> lanes;
+};
+
+//Free lists of fixed-size blocks shared by every pooled_allocator. Released blocks are kept for later requests
+//of the same size class, so a steady flow of waitable tasks does not reach the system allocator.
+//The lists are never destroyed because shared states can be released by static objects at exit.
+class block_pool
+{
+public:
+    static void *allocate(std::size_t bytes)
+    {
+        auto c = size_class(bytes);
+        if (c >= num_classes)
+            return ::operator new(bytes);
+
+        auto &list = lists()[c];
+        {
+            std::lock_guard<std::mutex> lock(list.mutex);
+            if (list.head != nullptr)
+            {
+                auto b = list.head;
+                list.head = b->next;
+                list.count--;
+                return b;
+            }
+        }
+        return ::operator new((c + 1) * granularity);
+    }
+
+    static void deallocate(void *p, std::size_t bytes)
+    {
+        auto c = size_class(bytes);
+        if (c < num_classes)
+        {
+            auto &list = lists()[c];
+            std::lock_guard<std::mutex> lock(list.mutex);
+            if (list.count < max_blocks)
+            {
+                list.head = new (p) block{list.head};
+                list.count++;
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+private:
+    struct block { block *next; };
+    struct free_list
+    {
+        std::mutex mutex;
+        block *head = nullptr;
+        std::size_t count = 0;
+    };
+
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t num_classes = 8;
+    static constexpr std::size_t max_blocks = 4096;
+
+    static std::size_t size_class(std::size_t bytes) { return (std::max<std::size_t>(bytes, 1) - 1) / granularity; }
+    static std::array<free_list, num_classes> &lists()
+    {
+        static auto *l = new std::array<free_list, num_classes>();
+        return *l;
+    }
+};
+
+//Allocator for the shared state of the promises created by spawn_task_waitable.
+template <typename T>
+struct pooled_allocator
+{
+    using value_type = T;
+
+    pooled_allocator() = default;
+    template <typename U>
+    pooled_allocator(const pooled_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return std::allocator<T>().allocate(n);
+        else
+            return static_cast<T *>(block_pool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            std::allocator<T>().deallocate(p, n);
+        else
+            block_pool::deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const pooled_allocator<U> &) const noexcept { return true; }
+};
+
+//Fixed capacity Chase-Lev deque used by the work-stealing mode. The owner pushes and pops at the bottom
+//without locking and any other thread can steal from the top. Every slot carries a flag so the owner never
+//reuses a slot that a thief has claimed but not yet moved out.
+template <typename T, std::size_t Capacity = 256>
+class work_stealing_deque
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    //Only the owner can push. Returns false (and leaves value untouched) when the deque is full.
+    bool push(T &&value)
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        if (b - t >= static_cast<int64_t>(Capacity))
+            return false;
+
+        auto &slot = slots[b & mask];
+        if (slot.full.load(std::memory_order_acquire))
+            return false;
+
+        slot.value = std::move(value);
+        slot.full.store(true, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    //Only the owner can pop. Takes the most recently pushed element.
+    std::optional<T> pop()
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_seq_cst);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_seq_cst);
+            return std::nullopt;
+        }
+        if (t == b)
+        {
+            //Last element, race against thieves.
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_seq_cst);
+            if (!won)
+                return std::nullopt;
+        }
+        return take(slots[b & mask]);
+    }
+
+    //Any thread can steal. Takes the oldest element.
+    std::optional<T> steal()
+    {
+        auto t = top.load(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b)
+            return std::nullopt;
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return std::nullopt;
+        return take(slots[t & mask]);
+    }
+
+    bool empty() const
+    {
+        return bottom.load(std::memory_order_acquire) <= top.load(std::memory_order_acquire);
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+    struct slot_t
+    {
+        std::atomic_bool full = false;
+        T value{};
+    };
+
+    std::optional<T> take(slot_t &slot)
+    {
+        std::optional<T> value{std::move(slot.value)};
+        slot.full.store(false, std::memory_order_release);
+        return value;
+    }
+
+    static constexpr int64_t mask = Capacity - 1;
+    alignas(64) std::atomic<int64_t> top = 0;
+    alignas(64) std::atomic<int64_t> bottom = 0;
+    std::array<slot_t, Capacity> slots;
 };
 
 class ThreadPool
 {
 public:
 
+    //SharedQueue: every task goes through one queue protected by a mutex (default).
+    //WorkStealing: per-worker lock-free deques with randomized stealing. Tasks spawned from outside the pool are
+    //still submitted to the shared queue, but workers move them to their deques in batches.
+    enum class Scheduling { SharedQueue, WorkStealing };
+
+    //Queued tasks are taken by priority and in FIFO order within the same priority. An optional deadline drops the
+    //task if no worker has started it in time; dropped waitable tasks leave their future with a broken_promise error.
+    enum class Priority { High = 0, Normal = 1, Low = 2 };
+    struct TaskOptions
+    {
+        Priority priority = Priority::Normal;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    };
+
     //The threadpool can't be copied.
     ThreadPool(const ThreadPool &tp) = delete;
     ThreadPool(ThreadPool &tp) = delete;
     ThreadPool &operator=(const ThreadPool &tp) = delete;
 
-    ThreadPool(uint32_t num_threads = 0) : done(false)
+    //Worker thread setup. CPU, NUMA and real-time settings are applied by each worker when it starts; if one
+    //of them fails (unknown CPU, missing permissions...) a warning is printed and the worker runs anyway.
+    struct Config
     {
-        uint32_t nt = (num_threads == 0) ? std::thread::hardware_concurrency() : num_threads;
+        uint32_t num_threads = 0;                       //0: one worker per hardware thread.
+        Scheduling scheduling = Scheduling::SharedQueue;
+        std::string name{};                             //If set, workers are named "<name>-<index>" (15 chars max).
+        std::vector<std::vector<int>> cpu_sets{};       //Worker i is pinned to cpu_sets[i % cpu_sets.size()].
+        int numa_node = -1;                             //Pin the workers to the CPUs of this node if cpu_sets is empty.
+        int realtime_priority = 0;                      //> 0: SCHED_FIFO with this priority (needs CAP_SYS_NICE).
+        bool metrics = false;                           //Collect the counters returned by metrics().
+    };
+
+    //Snapshot of the pool counters. Histogram bucket k counts the tasks that took less than 2^k microseconds
+    //(and at least 2^(k-1)); the last bucket also holds everything slower.
+    struct Metrics
+    {
+        static constexpr std::size_t histogram_buckets = 24;
+        using histogram_t = std::array<uint64_t, histogram_buckets>;
+
+        uint64_t enqueued = 0;
+        uint64_t executed = 0;
+        uint64_t dropped = 0;
+        std::size_t queue_depth = 0;
+        std::size_t peak_queue_depth = 0;
+        histogram_t wait_us{};                          //From queued to started.
+        histogram_t run_us{};                           //Execution time.
+        double wait_sum_s = 0;
+        double run_sum_s = 0;
+        std::vector<double> worker_utilization;         //Busy time / time since the pool was created.
+
+        //Prometheus text exposition format, with the pool name as label.
+        std::string to_prometheus(const std::string &pool, const std::string &prefix = "robocomp_threadpool") const
+        {
+            std::ostringstream out;
+            auto label = "{pool=\"" + pool + "\"";
+            auto counter = [&](const std::string &name, const std::string &type, auto value) {
+                out << "# TYPE " << prefix << "_" << name << " " << type << "\n"
+                    << prefix << "_" << name << label << "} " << value << "\n";
+            };
+            auto histogram = [&](const std::string &name, const histogram_t &h, double sum) {
+                out << "# TYPE " << prefix << "_" << name << " histogram\n";
+                uint64_t cumulative = 0;
+                for (std::size_t k = 0; k < histogram_buckets; k++)
+                {
+                    cumulative += h[k];
+                    out << prefix << "_" << name << "_bucket" << label << ",le=\"";
+                    if (k + 1 < histogram_buckets)
+                        out << static_cast<double>(uint64_t{1} << k) * 1e-6;
+                    else
+                        out << "+Inf";
+                    out << "\"} " << cumulative << "\n";
+                }
+                out << prefix << "_" << name << "_sum" << label << "} " << sum << "\n"
+                    << prefix << "_" << name << "_count" << label << "} " << cumulative << "\n";
+            };
+
+            counter("enqueued_total", "counter", enqueued);
+            counter("executed_total", "counter", executed);
+            counter("dropped_total", "counter", dropped);
+            counter("queue_depth", "gauge", queue_depth);
+            counter("peak_queue_depth", "gauge", peak_queue_depth);
+            histogram("wait_seconds", wait_us, wait_sum_s);
+            histogram("run_seconds", run_us, run_sum_s);
+            out << "# TYPE " << prefix << "_worker_utilization gauge\n";
+            for (std::size_t i = 0; i < worker_utilization.size(); i++)
+                out << prefix << "_worker_utilization" << label << ",worker=\"" << i << "\"} " << worker_utilization[i] << "\n";
+            return out.str();
+        }
+    };
+
+    ThreadPool(uint32_t num_threads = 0, Scheduling scheduling = Scheduling::SharedQueue)
+        : ThreadPool(Config{.num_threads = num_threads, .scheduling = scheduling}) {}
+
+    explicit ThreadPool(const Config &config) : done(false), scheduling(config.scheduling), config(config)
+    {
+        uint32_t nt = (config.num_threads == 0) ? std::thread::hardware_concurrency() : config.num_threads;
+        if (config.metrics)
+            stats = std::make_unique<statistics>(nt);
+        if (scheduling == Scheduling::WorkStealing)
+        {
+            for (std::size_t i = 0; i < nt; i++)
+                local_tasks.emplace_back(std::make_unique<local_queue_t>());
+        }
         for (std::size_t i = 0; i < nt; i++)
         {
             threads.emplace_back(std::thread(&ThreadPool::thread_loop, this, i));
@@ -146,11 +613,13 @@ public:
     {
 
         std::unique_lock<std::mutex> lock(tp_mutex);
-        std::queue<std::unique_ptr<function_wrapper_base>> tmp;
+        priority_task_queue tmp;
         std::swap(tasks, tmp);
+        shared_tasks = 0;
+        shared_high_tasks = 0;
+        done = true;
         lock.unlock();
 
-        done = true;
         cv.notify_all();
 
         for (auto &th : threads)
@@ -160,51 +629,460 @@ public:
         }
     }
 
-    uint32_t remaining_tasks() {
-        return tasks.size();
+    uint32_t remaining_tasks() const {
+        return static_cast<uint32_t>(queue_depth());
+    }
+
+    //Counters collected when the pool is created with Config::metrics. Every value is read atomically, but the
+    //snapshot as a whole is not taken at a single instant.
+    Metrics metrics() const
+    {
+        Metrics m;
+        m.dropped = dropped.load();
+        m.queue_depth = queue_depth();
+        if (!stats)
+            return m;
+
+        m.enqueued = stats->enqueued.load(std::memory_order_relaxed);
+        m.executed = stats->executed.load(std::memory_order_relaxed);
+        m.peak_queue_depth = stats->peak_depth.load(std::memory_order_relaxed);
+        for (std::size_t k = 0; k < Metrics::histogram_buckets; k++)
+        {
+            m.wait_us[k] = stats->wait_us[k].load(std::memory_order_relaxed);
+            m.run_us[k] = stats->run_us[k].load(std::memory_order_relaxed);
+        }
+        m.wait_sum_s = stats->wait_ns.load(std::memory_order_relaxed) * 1e-9;
+        m.run_sum_s = stats->run_ns.load(std::memory_order_relaxed) * 1e-9;
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - stats->start).count();
+        for (auto &b : stats->busy_ns)
+            m.worker_utilization.push_back(elapsed > 0 ? b.load(std::memory_order_relaxed) / elapsed : 0.0);
+        return m;
     }
 
     template <typename Function, typename... Arguments>
     void spawn_task(Function &&fn, Arguments &&... args)
         requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
     {
-        std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
-        task_queue_lock.lock();
-        auto tmp_ptr = std::unique_ptr<function_wrapper_base>(new function_wrapper<Function, Arguments...>(std::forward<Function>(fn), std::forward_as_tuple(std::move(args)...)));
-        tasks.emplace(std::move(tmp_ptr));
-        task_queue_lock.unlock();
-        cv.notify_one();
+        spawn_task(TaskOptions{}, std::forward<Function>(fn), std::move(args)...);
+    }
+
+    template <typename Function, typename... Arguments>
+    void spawn_task(const TaskOptions &options, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        enqueue(make_task(options,
+                [f = std::forward<Function>(fn), args_ = std::tuple<std::decay_t<Arguments>...>(std::move(args)...)]() mutable {
+                    std::apply(f, std::move(args_));
+                }), options.priority);
     }
 
     template <typename Function, typename... Arguments>
     auto spawn_task_waitable(Function &&fn, Arguments &&... args)
         requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
     {
-        std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
+        return spawn_task_waitable(TaskOptions{}, std::forward<Function>(fn), std::move(args)...);
+    }
 
-        auto task = std::packaged_task<std::invoke_result_t<Function, Arguments...>()>(
-                [fn_ = std::forward<Function>(fn), args_ = std::forward_as_tuple(args...)]() mutable -> auto {
-                    return std::apply(std::move(fn_), std::move(args_));
-                }
-        );
+    template <typename Function, typename... Arguments>
+    auto spawn_task_waitable(const TaskOptions &options, Function &&fn, Arguments &&... args)
+        requires (only_rvalues<Arguments&& ...> && std::is_invocable<Function &&, Arguments &&...>::value)
+    {
+        using R = std::invoke_result_t<Function, Arguments...>;
 
-        auto future = task.get_future();
+        //The promise shared state comes from block_pool instead of the heap.
+        std::promise<R> promise(std::allocator_arg, pooled_allocator<R>{});
+        auto future = promise.get_future();
 
-        task_queue_lock.lock();
-        auto tmp_ptr = std::unique_ptr<function_wrapper_base>(
-                new function_wrapper<std::packaged_task<std::invoke_result_t<Function, Arguments...>()>>(
-                        std::move(task), std::tuple<>{}));
-        tasks.emplace(std::move(tmp_ptr));
-        task_queue_lock.unlock();
-        cv.notify_one();
+        enqueue(make_task(options,
+                [p = std::move(promise), f = std::forward<Function>(fn), args_ = std::tuple<std::decay_t<Arguments>...>(std::move(args)...)]() mutable {
+                    try
+                    {
+                        if constexpr (std::is_void_v<R>)
+                        {
+                            std::apply(f, std::move(args_));
+                            p.set_value();
+                        }
+                        else
+                            p.set_value(std::apply(f, std::move(args_)));
+                    }
+                    catch (...)
+                    {
+                        p.set_exception(std::current_exception());
+                    }
+                }), options.priority);
+
+        return future;
+    }
+
+    //Number of tasks dropped because their deadline expired before they started.
+    uint64_t dropped_tasks() const { return dropped.load(); }
+
+    //Runs fn(i) for every i in [0, n) as n tasks queued under a single lock. The returned future is ready when
+    //all of them have finished and carries the first exception thrown, if any.
+    template <typename Function>
+    std::future<void> spawn_bulk(std::size_t n, Function &&fn)
+        requires std::is_invocable_v<std::decay_t<Function> &, std::size_t>
+    {
+        struct bulk_state
+        {
+            bulk_state(Function &&fn, std::size_t n) : fn(std::forward<Function>(fn)), remaining(n) {}
+            std::decay_t<Function> fn;
+            std::atomic<std::size_t> remaining;
+            std::atomic_bool failed = false;
+            std::exception_ptr error;
+            std::promise<void> promise{std::allocator_arg, pooled_allocator<void>{}};
+        };
+
+        auto state = std::allocate_shared<bulk_state>(pooled_allocator<bulk_state>{}, std::forward<Function>(fn), n);
+        auto future = state->promise.get_future();
+        if (n == 0)
+        {
+            state->promise.set_value();
+            return future;
+        }
 
+        enqueue_bulk(n, [&state](std::size_t i) {
+            return task_wrapper([state, i]() {
+                try
+                {
+                    if (!state->failed.load())
+                        state->fn(i);
+                }
+                catch (...)
+                {
+                    if (!state->failed.exchange(true))
+                        state->error = std::current_exception();
+                }
+                if (state->remaining.fetch_sub(1) == 1)
+                {
+                    if (state->error)
+                        state->promise.set_exception(state->error);
+                    else
+                        state->promise.set_value();
+                }
+            });
+        });
         return future;
     }
 
+    //Splits [begin, end) in chunks of 'grain' indices (0 picks a size from the number of workers) and runs them on the
+    //pool. fn is called either as fn(i) for every index or as fn(chunk_begin, chunk_end) once per chunk.
+    //The calling thread runs chunks too and returns when all of them are done, so it is safe to call it from a task
+    //running in this same pool. The first exception thrown by fn is rethrown here.
+    template <typename Function>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Function &&fn)
+        requires (std::is_invocable_v<Function &, std::size_t> || std::is_invocable_v<Function &, std::size_t, std::size_t>)
+    {
+        run_chunks(begin, end, grain, [&fn](std::size_t b, std::size_t e, std::size_t) {
+            if constexpr (std::is_invocable_v<Function &, std::size_t, std::size_t>)
+                fn(b, e);
+            else
+                for (auto i = b; i < e; i++)
+                    fn(i);
+        });
+    }
+
+    //Map-reduce over [begin, end). Every chunk folds map(i) into a value that starts at 'identity' and the partial
+    //results are combined in chunk order on the calling thread, so the result does not depend on the scheduling.
+    template <typename T, typename Map, typename Reduce>
+    T parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, T identity, Map &&map, Reduce &&reduce)
+        requires (std::is_invocable_v<Map &, std::size_t> &&
+                  std::is_invocable_r_v<T, Reduce &, T, std::invoke_result_t<Map &, std::size_t>> &&
+                  std::is_invocable_r_v<T, Reduce &, T, T>)
+    {
+        if (end <= begin)
+            return identity;
+
+        grain = chunk_grain(begin, end, grain);
+        std::vector<std::optional<T>> partials((end - begin + grain - 1) / grain);
+        run_chunks(begin, end, grain, [&](std::size_t b, std::size_t e, std::size_t chunk) {
+            T local = identity;
+            for (auto i = b; i < e; i++)
+                local = reduce(std::move(local), map(i));
+            partials[chunk] = std::move(local);
+        });
+
+        T result = std::move(identity);
+        for (auto &p : partials)
+            result = reduce(std::move(result), std::move(*p));
+        return result;
+    }
+
+    //Awaitable that resumes the awaiting coroutine on a worker of this pool: 'co_await pool.schedule();' ends the
+    //part of the coroutine that runs on the current thread. There is no deadline, a resumption is never dropped.
+    //The pool must outlive the coroutines scheduled on it. See task.h for the coroutine type and its combinators.
+    struct ScheduleAwaiter
+    {
+        ThreadPool &pool;
+        Priority priority;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { pool.enqueue(task_wrapper([h]() { h.resume(); }), priority); }
+        void await_resume() const noexcept {}
+    };
+    ScheduleAwaiter schedule(Priority priority = Priority::Normal)
+    {
+        return ScheduleAwaiter{*this, priority};
+    }
+
 private:
+    using local_queue_t = work_stealing_deque<task_wrapper>;
+
+    std::size_t chunk_grain(std::size_t begin, std::size_t end, std::size_t grain) const
+    {
+        if (grain > 0)
+            return grain;
+        //About four chunks per worker (and the caller) to balance uneven chunks.
+        return std::max<std::size_t>(1, (end - begin) / (4 * (threads.size() + 1)));
+    }
+
+    //Shared by parallel_for and parallel_reduce. Helper tasks and the calling thread claim chunks from an atomic
+    //counter; helpers that start after every chunk has been claimed return without touching chunk_fn.
+    template <typename ChunkFn>
+    void run_chunks(std::size_t begin, std::size_t end, std::size_t grain, ChunkFn &&chunk_fn)
+    {
+        if (end <= begin)
+            return;
+
+        struct chunk_state
+        {
+            std::size_t begin, end, grain, chunks;
+            std::remove_reference_t<ChunkFn> *fn;
+            std::atomic<std::size_t> next = 0;
+            std::atomic<std::size_t> finished = 0;
+            std::atomic_bool failed = false;
+            std::exception_ptr error;
+
+            void work()
+            {
+                for (auto c = next.fetch_add(1); c < chunks; c = next.fetch_add(1))
+                {
+                    auto b = begin + c * grain;
+                    try
+                    {
+                        if (!failed.load())
+                            (*fn)(b, std::min(end, b + grain), c);
+                    }
+                    catch (...)
+                    {
+                        if (!failed.exchange(true))
+                            error = std::current_exception();
+                    }
+                    if (finished.fetch_add(1) + 1 == chunks)
+                        finished.notify_all();
+                }
+            }
+        };
+
+        grain = chunk_grain(begin, end, grain);
+        auto state = std::allocate_shared<chunk_state>(pooled_allocator<chunk_state>{});
+        state->begin = begin;
+        state->end = end;
+        state->grain = grain;
+        state->chunks = (end - begin + grain - 1) / grain;
+        state->fn = &chunk_fn;
+
+        auto helpers = std::min<std::size_t>(state->chunks - 1, threads.size());
+        enqueue_bulk(helpers, [&state](std::size_t) { return task_wrapper([state]() { state->work(); }); });
+
+        state->work();
+        for (auto f = state->finished.load(); f != state->chunks; f = state->finished.load())
+            state->finished.wait(f);
+
+        if (state->error)
+            std::rethrow_exception(state->error);
+    }
+
+    template <typename Callable>
+    task_wrapper make_task(const TaskOptions &options, Callable &&c)
+    {
+        if (options.deadline == std::chrono::steady_clock::time_point::max())
+            return task_wrapper(std::forward<Callable>(c));
+
+        return task_wrapper([this, c = std::forward<Callable>(c), deadline = options.deadline]() mutable {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                dropped.fetch_add(1);
+                return;
+            }
+            c();
+        });
+    }
+
+    void enqueue(task_wrapper &&task, Priority priority = Priority::Normal)
+    {
+        enqueue_bulk(1, [&task](std::size_t) { return std::move(task); }, priority);
+    }
+
+    //Queues make_task(0) ... make_task(n - 1) taking the queue lock at most once.
+    template <typename MakeTask>
+    void enqueue_bulk(std::size_t n, MakeTask &&make_task, Priority priority = Priority::Normal)
+    {
+        if (n == 0)
+            return;
+
+        auto queued_at = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+        auto next_task = [&](std::size_t k) {
+            task_wrapper t = make_task(k);
+            t.set_queue_time(queued_at);
+            return t;
+        };
+
+        std::size_t i = 0;
+        task_wrapper overflow;
+        if (scheduling == Scheduling::WorkStealing)
+        {
+            pending.fetch_add(n);
+            if (stats)
+                stats->on_enqueue(n, queue_depth());
+            //Tasks spawned from one of our own workers go to its deque without taking the lock.
+            //Other priorities always go through the shared queue.
+            if (current_pool == this && priority == Priority::Normal)
+            {
+                auto &local = *local_tasks[current_worker];
+                for (; i < n; i++)
+                {
+                    task_wrapper t = next_task(i);
+                    if (!local.push(std::move(t)))
+                    {
+                        overflow = std::move(t);
+                        break;
+                    }
+                }
+                if (i > 0)
+                    wake_idle_workers(i > 1);
+                if (i == n)
+                    return;
+            }
+        }
+
+        auto lane = static_cast<std::size_t>(priority);
+        std::unique_lock<std::mutex> task_queue_lock(tp_mutex);
+        std::size_t queued = 0;
+        if (overflow)
+        {
+            tasks.emplace(std::move(overflow), lane);
+            queued++;
+            i++;
+        }
+        for (; i < n; i++, queued++)
+            tasks.emplace(next_task(i), lane);
+        shared_tasks.fetch_add(queued);
+        shared_high_tasks.store(tasks.size(0));
+        task_queue_lock.unlock();
+        if (stats && scheduling == Scheduling::SharedQueue)
+            stats->on_enqueue(n, queue_depth());
+
+        if (queued > 1)
+            cv.notify_all();
+        else
+            cv.notify_one();
+    }
+
+    void wake_idle_workers(bool all = false)
+    {
+        //Idle workers check 'pending' while holding tp_mutex, so taking it here avoids a lost wake-up.
+        if (idle_workers.load() > 0)
+        {
+            { std::lock_guard<std::mutex> lock(tp_mutex); }
+            if (all)
+                cv.notify_all();
+            else
+                cv.notify_one();
+        }
+    }
+
+    void configure_worker(uint32_t i)
+    {
+#ifdef __linux__
+        if (!config.name.empty())
+        {
+            auto name = (config.name + "-" + std::to_string(i)).substr(0, 15);
+            pthread_setname_np(pthread_self(), name.c_str());
+        }
+
+        std::vector<int> cpus;
+        if (!config.cpu_sets.empty())
+            cpus = config.cpu_sets[i % config.cpu_sets.size()];
+        else if (config.numa_node >= 0)
+            cpus = numa_node_cpus(config.numa_node);
+        if (!cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (auto c : cpus)
+                if (c >= 0 && c < CPU_SETSIZE)
+                    CPU_SET(c, &set);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+                std::cerr << "ThreadPool: could not set the affinity of worker " << i << std::endl;
+        }
+
+        if (config.realtime_priority > 0)
+        {
+            sched_param param{};
+            param.sched_priority = config.realtime_priority;
+            if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+                std::cerr << "ThreadPool: could not set SCHED_FIFO priority " << config.realtime_priority
+                          << " for worker " << i << std::endl;
+        }
+#endif
+    }
+
+    //Parses /sys/devices/system/node/node<N>/cpulist ("0-7,16-23").
+    static std::vector<int> numa_node_cpus(int node)
+    {
+        std::vector<int> cpus;
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string range;
+        while (std::getline(file, range, ','))
+        {
+            int first = 0, last = 0;
+            char dash = 0;
+            std::istringstream ss(range);
+            if (!(ss >> first))
+                continue;
+            if (!(ss >> dash >> last) || dash != '-')
+                last = first;
+            for (int c = first; c <= last; c++)
+                cpus.push_back(c);
+        }
+        if (cpus.empty())
+            std::cerr << "ThreadPool: NUMA node " << node << " not found" << std::endl;
+        return cpus;
+    }
+
+    std::size_t queue_depth() const
+    {
+        if (scheduling == Scheduling::WorkStealing)
+            return static_cast<std::size_t>(std::max<int64_t>(pending.load(), 0));
+        return shared_tasks.load();
+    }
+
+    void run_task(task_wrapper &t)
+    {
+        if (!stats)
+        {
+            t();
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        t();
+        auto end = std::chrono::steady_clock::now();
+        stats->on_run(current_worker, start - t.queue_time(), end - start);
+    }
 
     void thread_loop(int i)
     {
+        current_pool = this;
+        current_worker = i;
+        configure_worker(i);
+        if (scheduling == Scheduling::WorkStealing)
+        {
+            work_stealing_loop(i);
+            return;
+        }
+
         [[maybe_unused]] static thread_local uint32_t thread_index = i;
         std::unique_lock<std::mutex> task_queue_lock(tp_mutex, std::defer_lock);
         while (!done)
@@ -220,24 +1098,162 @@ private:
                 break;
             }
 
-            std::unique_ptr<function_wrapper_base> t = std::move(tasks.front());
+            task_wrapper t = std::move(tasks.front());
             tasks.pop();
+            shared_tasks.fetch_sub(1);
             task_queue_lock.unlock();
 
-            if (t != nullptr)
+            if (t)
             {
-                (*t)();
+                run_task(t);
             }
 
         }
     }
 
+    void work_stealing_loop(uint32_t i)
+    {
+        auto &local = *local_tasks[i];
+        uint64_t seed = 0x9E3779B97F4A7C15ull * (i + 1);
+
+        while (!done)
+        {
+            task_wrapper t;
+            //High priority tasks wait in the shared queue, check it before the local deque.
+            if (shared_high_tasks.load() > 0)
+                t = take_from_shared_queue(local);
+            if (!t)
+            {
+                if (auto local_task = local.pop())
+                    t = std::move(*local_task);
+                else if (!(t = take_from_shared_queue(local)))
+                    t = steal(i, seed);
+            }
+
+            if (t)
+            {
+                pending.fetch_sub(1);
+                run_task(t);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> task_queue_lock(tp_mutex);
+            idle_workers.fetch_add(1);
+            cv.wait(task_queue_lock, [&]() -> bool { return pending.load() > 0 || done; });
+            idle_workers.fetch_sub(1);
+        }
+    }
+
+    //Takes one task from the shared queue and moves a fair share of the rest to the local deque,
+    //so the mutex is taken once per batch instead of once per task.
+    task_wrapper take_from_shared_queue(local_queue_t &local)
+    {
+        if (shared_tasks.load() == 0)
+            return {};
+
+        std::unique_lock<std::mutex> task_queue_lock(tp_mutex);
+        if (tasks.empty())
+            return {};
+
+        auto t = std::move(tasks.front());
+        tasks.pop();
+        //Only normal priority tasks are moved in batches, the rest must keep their order in the shared queue.
+        auto normal = static_cast<std::size_t>(Priority::Normal);
+        std::size_t batch = std::min(tasks.size(normal) / threads.size(), local_queue_t::capacity() / 2);
+        std::size_t moved = 0;
+        while (moved < batch && tasks.front_lane() == normal && local.push(std::move(tasks.front())))
+        {
+            tasks.pop();
+            moved++;
+        }
+        shared_tasks.fetch_sub(moved + 1);
+        shared_high_tasks.store(tasks.size(0));
+        task_queue_lock.unlock();
+
+        if (moved > 0)
+            wake_idle_workers(moved > 1);
+        return t;
+    }
+
+    task_wrapper steal(uint32_t self, uint64_t &seed)
+    {
+        //xorshift64, only used to pick the first victim.
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        auto n = local_tasks.size();
+        auto start = seed % n;
+        for (std::size_t k = 0; k < n; k++)
+        {
+            auto victim = (start + k) % n;
+            if (victim == self)
+                continue;
+            if (auto t = local_tasks[victim]->steal())
+                return std::move(*t);
+        }
+        return {};
+    }
+
     std::vector<std::thread> threads;
-    std::queue<std::unique_ptr<function_wrapper_base>> tasks;
+    priority_task_queue tasks;
     static thread_local uint32_t thread_index;
     std::condition_variable cv;
     std::atomic_bool done = false;
     mutable std::mutex tp_mutex;
+
+    //Metrics, relaxed atomics updated by the workers (only allocated when Config::metrics is set).
+    struct statistics
+    {
+        explicit statistics(std::size_t workers) : busy_ns(workers) {}
+
+        static std::size_t bucket(std::chrono::steady_clock::duration d)
+        {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+            return std::min<std::size_t>(us <= 0 ? 0 : std::bit_width(static_cast<uint64_t>(us)),
+                                         Metrics::histogram_buckets - 1);
+        }
+
+        void on_enqueue(std::size_t n, std::size_t depth)
+        {
+            enqueued.fetch_add(n, std::memory_order_relaxed);
+            auto peak = peak_depth.load(std::memory_order_relaxed);
+            while (depth > peak && !peak_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed));
+        }
+
+        void on_run(uint32_t worker, std::chrono::steady_clock::duration wait, std::chrono::steady_clock::duration run)
+        {
+            auto run_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(run).count();
+            executed.fetch_add(1, std::memory_order_relaxed);
+            wait_us[bucket(wait)].fetch_add(1, std::memory_order_relaxed);
+            run_us[bucket(run)].fetch_add(1, std::memory_order_relaxed);
+            wait_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count(), std::memory_order_relaxed);
+            this->run_ns.fetch_add(run_ns, std::memory_order_relaxed);
+            busy_ns[worker].fetch_add(run_ns, std::memory_order_relaxed);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::atomic<uint64_t> enqueued = 0;
+        std::atomic<uint64_t> executed = 0;
+        std::atomic<std::size_t> peak_depth = 0;
+        std::array<std::atomic<uint64_t>, Metrics::histogram_buckets> wait_us{};
+        std::array<std::atomic<uint64_t>, Metrics::histogram_buckets> run_us{};
+        std::atomic<uint64_t> wait_ns = 0;
+        std::atomic<uint64_t> run_ns = 0;
+        std::vector<std::atomic<uint64_t>> busy_ns;
+    };
+
+    //Work-stealing mode
+    Scheduling scheduling;
+    Config config;
+    std::unique_ptr<statistics> stats;
+    std::vector<std::unique_ptr<local_queue_t>> local_tasks;
+    std::atomic<int64_t> pending = 0;           //Tasks queued anywhere and not yet started.
+    std::atomic<std::size_t> shared_tasks = 0;  //Mirror of tasks.size() readable without the lock.
+    std::atomic<std::size_t> shared_high_tasks = 0;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<uint32_t> idle_workers = 0;
+    inline static thread_local ThreadPool *current_pool = nullptr;
+    inline static thread_local uint32_t current_worker = 0;
 };
 
 
@@ -0,0 +1,409 @@
+// Use:
+/*
+	void SpecificWorker::compute()
+	{
+		RC_PROFILE_ZONE("compute");
+		{
+			RC_PROFILE_ZONE("read laser");        // nested zone
+			...
+		}
+	}
+
+	rc::Profiler::instance().startAggregation(1000, [](const auto &stats){ rc::Profiler::print(stats); });
+	rc::Profiler::instance().enableTrace();
+	...
+	rc::Profiler::instance().writeChromeTrace("trace.json");   // chrome://tracing or ui.perfetto.dev
+*/
+// Every thread records the zones it closes in its own ring buffer, without locks: only the thread writes it and the
+// aggregation reads it. collect() (called periodically by startAggregation() or by hand) drains the rings into per-zone
+// statistics (count, mean, min, max, p50, p99 from a log-linear histogram) and, if tracing is enabled, into the events
+// of the trace. A zone whose ring is full is dropped and counted in dropped().
+
+#ifndef ROBOCOMP_PROFILER_H
+#define ROBOCOMP_PROFILER_H
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RC_PROFILE_CONCAT2(a, b) a##b
+#define RC_PROFILE_CONCAT(a, b) RC_PROFILE_CONCAT2(a, b)
+#define RC_PROFILE_ZONE(name) \
+    static const rc::ProfileZone RC_PROFILE_CONCAT(rcProfileZone, __LINE__)(name, __FILE__, __LINE__); \
+    rc::ProfileScope RC_PROFILE_CONCAT(rcProfileScope, __LINE__)(RC_PROFILE_CONCAT(rcProfileZone, __LINE__))
+#define RC_PROFILE_FUNCTION() RC_PROFILE_ZONE(__func__)
+
+namespace rc
+{
+    class Profiler
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        struct Event
+        {
+            uint32_t zone;
+            uint32_t depth;
+            int64_t start;      // ns since the start of the profiler
+            int64_t duration;   // ns
+        };
+
+        // Log-linear histogram of durations: 16 sub-buckets per power of two of nanoseconds, error under 1/16
+        struct Histogram
+        {
+            static constexpr int SUB = 16, BUCKETS = 64 * SUB;
+            std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS, 0);
+
+            static int bucket(int64_t ns)
+            {
+                const uint64_t v = ns < 1 ? 1 : uint64_t(ns);
+                const int e = 63 - __builtin_clzll(v);
+                if (e < 4)
+                    return int(v);
+                return (e - 3) * SUB + int((v >> (e - 4)) & (SUB - 1));
+            }
+            static int64_t lowerBound(int b)
+            {
+                if (b < SUB)
+                    return b;
+                const int e = b / SUB + 3;
+                return (int64_t(1) << e) + (int64_t(b % SUB) << (e - 4));
+            }
+            void add(int64_t ns) { counts[bucket(ns)]++; }
+            int64_t percentile(double p, uint64_t total) const
+            {
+                const uint64_t rank = std::max<uint64_t>(1, uint64_t(p * total + 0.5));
+                uint64_t seen = 0;
+                for (int b = 0; b < BUCKETS; b++)
+                    if ((seen += counts[b]) >= rank)
+                        return (lowerBound(b) + lowerBound(b + 1)) / 2;
+                return 0;
+            }
+        };
+
+        struct ZoneStats
+        {
+            std::string name, file;
+            int line = 0;
+            uint64_t count = 0;
+            int64_t total = 0, min = 0, max = 0, p50 = 0, p99 = 0;     // ns
+            double mean() const { return count ? double(total) / count : 0.; }
+        };
+
+        static Profiler &instance()
+        {
+            static Profiler p;
+            return p;
+        }
+
+        ~Profiler()
+        {
+            stopAggregation();
+        }
+
+        // a zone gets its id the first time its line is run
+        uint32_t registerZone(const char *name, const char *file, int line)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            zones.push_back(Zone{name, file, line, Histogram(), 0, 0, 0, 0});
+            return uint32_t(zones.size() - 1);
+        }
+
+        inline bool enabled() const { return on.load(std::memory_order_relaxed); }
+        void setEnabled(bool enable) { on = enable; }
+        // keeps the events for writeChromeTrace(), at most maxEvents
+        void enableTrace(size_t maxEvents = 1 << 20)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            traceLimit = maxEvents;
+            tracing = true;
+        }
+        void disableTrace() { std::lock_guard<std::mutex> lock(mutex); tracing = false; }
+        // size of the ring of the threads that record for the first time from now on (power of two)
+        void setBufferSize(size_t events) { size_t c = 1; while (c < events) c <<= 1; bufferSize = c; }
+        void setThreadName(const std::string &name)
+        {
+            ThreadLog &log = local();
+            std::lock_guard<std::mutex> lock(mutex);
+            log.name = name;
+        }
+        uint64_t dropped() const { return droppedEvents.load(std::memory_order_relaxed); }
+
+        // recording thread: lock-free unless it is the first event of the thread
+        inline void record(uint32_t zone, uint32_t depth, clock::time_point start, clock::time_point end)
+        {
+            ThreadLog &log = local();
+            const uint64_t head = log.head.load(std::memory_order_relaxed);
+            if (head - log.tail.load(std::memory_order_acquire) >= log.events.size())
+            {
+                droppedEvents.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            log.events[head & (log.events.size() - 1)] = Event{zone, depth, (start - origin).count(), (end - start).count()};
+            log.head.store(head + 1, std::memory_order_release);
+        }
+        inline uint32_t &depth() { thread_local uint32_t d = 0; return d; }
+
+        // Moves the recorded events of every thread to the statistics and to the trace
+        void collect()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = logs.begin(); it != logs.end(); )
+            {
+                ThreadLog &log = **it;
+                const uint64_t head = log.head.load(std::memory_order_acquire);
+                uint64_t tail = log.tail.load(std::memory_order_relaxed);
+                for (; tail != head; tail++)
+                {
+                    const Event &e = log.events[tail & (log.events.size() - 1)];
+                    Zone &z = zones[e.zone];
+                    z.histogram.add(e.duration);
+                    if (z.count == 0 or e.duration < z.min) z.min = e.duration;
+                    if (z.count == 0 or e.duration > z.max) z.max = e.duration;
+                    z.count++;
+                    z.total += e.duration;
+                    if (tracing and trace.size() < traceLimit)
+                        trace.push_back(TraceEvent{e, log.tid});
+                }
+                log.tail.store(tail, std::memory_order_release);
+                if (log.finished.load(std::memory_order_acquire) and log.head.load(std::memory_order_acquire) == tail)
+                {
+                    threadNames.emplace_back(log.tid, log.name);
+                    it = logs.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+
+        // Statistics of the zones since the last reset, collect() first
+        std::vector<ZoneStats> stats(bool reset = false)
+        {
+            collect();
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<ZoneStats> result;
+            for (auto &z : zones)
+            {
+                if (z.count == 0)
+                    continue;
+                ZoneStats s;
+                s.name = z.name;
+                s.file = z.file;
+                s.line = z.line;
+                s.count = z.count;
+                s.total = z.total;
+                s.min = z.min;
+                s.max = z.max;
+                s.p50 = std::clamp(z.histogram.percentile(0.5, z.count), z.min, z.max);
+                s.p99 = std::clamp(z.histogram.percentile(0.99, z.count), z.min, z.max);
+                result.push_back(s);
+                if (reset)
+                    z = Zone{z.name, z.file, z.line, Histogram(), 0, 0, 0, 0};
+            }
+            return result;
+        }
+
+        static void print(const std::vector<ZoneStats> &stats, std::ostream &out = std::cout)
+        {
+            out << std::left << std::setw(32) << "zone" << std::right << std::setw(10) << "count" << std::setw(12) << "mean(us)"
+                << std::setw(12) << "p50(us)" << std::setw(12) << "p99(us)" << std::setw(12) << "max(us)" << std::endl;
+            for (const auto &s : stats)
+                out << std::left << std::setw(32) << s.name << std::right << std::setw(10) << s.count << std::fixed << std::setprecision(1)
+                    << std::setw(12) << s.mean() / 1000. << std::setw(12) << s.p50 / 1000. << std::setw(12) << s.p99 / 1000.
+                    << std::setw(12) << s.max / 1000. << std::endl;
+        }
+
+        // Runs stats(true) every periodMs in a thread and gives the result to 'callback'
+        void startAggregation(unsigned int periodMs, std::function<void(const std::vector<ZoneStats> &)> callback)
+        {
+            stopAggregation();
+            aggregationStop = false;
+            aggregation = std::thread([this, periodMs, callback]
+            {
+                std::unique_lock<std::mutex> lock(aggregationMutex);
+                while (not aggregationWake.wait_for(lock, std::chrono::milliseconds(periodMs), [this]{ return aggregationStop; }))
+                {
+                    lock.unlock();
+                    const auto s = stats(true);
+                    if (callback)
+                        callback(s);
+                    lock.lock();
+                }
+            });
+        }
+        void stopAggregation()
+        {
+            if (not aggregation.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(aggregationMutex);
+                aggregationStop = true;
+            }
+            aggregationWake.notify_all();
+            aggregation.join();
+        }
+
+        // Chrome trace event format (complete events), readable by chrome://tracing and Perfetto
+        bool writeChromeTrace(const std::string &path)
+        {
+            collect();
+            std::lock_guard<std::mutex> lock(mutex);
+            std::ofstream out(path);
+            if (not out)
+                return false;
+            const int pid = getpid();
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            bool first = true;
+            auto names = threadNames;
+            for (const auto &l : logs)
+                names.emplace_back(l->tid, l->name);
+            for (const auto &n : names)
+            {
+                if (n.second.empty())
+                    continue;
+                out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << n.first
+                    << ",\"args\":{\"name\":\"" << escape(n.second) << "\"}}";
+                first = false;
+            }
+            out << std::fixed << std::setprecision(3);
+            for (const auto &t : trace)
+            {
+                const Zone &z = zones[t.event.zone];
+                out << (first ? "" : ",\n") << "{\"name\":\"" << escape(z.name) << "\",\"cat\":\"rc\",\"ph\":\"X\",\"ts\":"
+                    << t.event.start / 1000. << ",\"dur\":" << t.event.duration / 1000. << ",\"pid\":" << pid << ",\"tid\":" << t.tid
+                    << ",\"args\":{\"depth\":" << t.event.depth << "}}";
+                first = false;
+            }
+            out << "\n]}\n";
+            trace.clear();
+            return bool(out);
+        }
+
+    private:
+        struct Zone
+        {
+            std::string name, file;
+            int line;
+            Histogram histogram;
+            uint64_t count;
+            int64_t total, min, max;
+        };
+        struct ThreadLog
+        {
+            std::vector<Event> events;
+            std::atomic<uint64_t> head{0}, tail{0};
+            std::atomic<bool> finished{false};
+            long tid;
+            std::string name;
+        };
+        // marks the log of a thread as finished when the thread ends; collect() frees it once drained
+        struct ThreadOwner
+        {
+            std::shared_ptr<ThreadLog> log;
+            ~ThreadOwner() { if (log) log->finished.store(true, std::memory_order_release); }
+        };
+        struct TraceEvent
+        {
+            Event event;
+            long tid;
+        };
+
+        Profiler() : origin(clock::now()) {}
+
+        ThreadLog &local()
+        {
+            thread_local ThreadOwner owner;
+            if (not owner.log)
+            {
+                owner.log = std::make_shared<ThreadLog>();
+                owner.log->events.resize(bufferSize);
+                owner.log->tid = syscall(SYS_gettid);
+                std::lock_guard<std::mutex> lock(mutex);
+                logs.push_back(owner.log);
+            }
+            return *owner.log;
+        }
+
+        static std::string escape(const std::string &s)
+        {
+            std::string r;
+            for (char c : s)
+            {
+                if (c == '"' or c == '\\')
+                    r += '\\';
+                if (uint8_t(c) >= 0x20)
+                    r += c;
+            }
+            return r;
+        }
+
+        const clock::time_point origin;
+        std::atomic<bool> on{true};
+        std::atomic<uint64_t> droppedEvents{0};
+        size_t bufferSize = 1 << 14;
+        std::mutex mutex;               // zones, logs, trace
+        std::vector<Zone> zones;
+        std::vector<std::shared_ptr<ThreadLog>> logs;
+        std::vector<std::pair<long, std::string>> threadNames;
+        bool tracing = false;
+        size_t traceLimit = 0;
+        std::vector<TraceEvent> trace;
+
+        std::thread aggregation;
+        std::mutex aggregationMutex;
+        std::condition_variable aggregationWake;
+        bool aggregationStop = false;
+    };
+
+    // Static object of a call site (see RC_PROFILE_ZONE)
+    struct ProfileZone
+    {
+        uint32_t id;
+        ProfileZone(const char *name, const char *file, int line) : id(Profiler::instance().registerZone(name, file, line)) {}
+    };
+
+    // RAII zone: records the time between its construction and its destruction
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(const ProfileZone &zone) : zone(zone.id), active(Profiler::instance().enabled())
+        {
+            if (active)
+            {
+                depth = Profiler::instance().depth()++;
+                start = Profiler::clock::now();
+            }
+        }
+        ~ProfileScope()
+        {
+            if (active)
+            {
+                const auto end = Profiler::clock::now();
+                Profiler &p = Profiler::instance();
+                p.depth()--;
+                p.record(zone, depth, start, end);
+            }
+        }
+        ProfileScope(const ProfileScope &) = delete;
+        ProfileScope &operator=(const ProfileScope &) = delete;
+    private:
+        uint32_t zone, depth = 0;
+        bool active;
+        Profiler::clock::time_point start;
+    };
+}
+#endif
@@ -0,0 +1,21 @@
+# GPU backend of Grid (classes/grid2d/grid_device.cpp, see Grid::set_device_backend).
+# Include it after the SOURCES of a component that uses grid2d/grid.cpp:
+#   INCLUDE ( $ENV{ROBOCOMP}/cmake/modules/grid2d_cuda.cmake )
+# With a CUDA compiler grid_device.cpp is built by nvcc, otherwise as C++ and the backend reports no GPU.
+SET(GRID2D_CUDA_FOUND 0)
+SET(GRID_DEVICE_SOURCE $ENV{ROBOCOMP}/classes/grid2d/grid_device.cpp)
+
+INCLUDE(CheckLanguage)
+CHECK_LANGUAGE(CUDA)
+IF( CMAKE_CUDA_COMPILER )
+  ENABLE_LANGUAGE(CUDA)
+  FIND_PACKAGE(CUDAToolkit REQUIRED)
+  SET(CMAKE_CUDA_STANDARD 20)
+  SET_SOURCE_FILES_PROPERTIES( ${GRID_DEVICE_SOURCE} PROPERTIES LANGUAGE CUDA )
+  SET( LIBS ${LIBS} CUDA::cudart )
+  MESSAGE(STATUS "Grid GPU backend: CUDA ${CUDAToolkit_VERSION}")
+  SET(GRID2D_CUDA_FOUND 1)
+ELSE( CMAKE_CUDA_COMPILER )
+  MESSAGE(STATUS "CUDA compiler not found, the Grid GPU backend is not available")
+ENDIF( CMAKE_CUDA_COMPILER )
+SET( SOURCES ${SOURCES} ${GRID_DEVICE_SOURCE} )